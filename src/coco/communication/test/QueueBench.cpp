@@ -0,0 +1,150 @@
+/**
+ * \file QueueBench.cpp
+ *
+ * \brief Compares throughput and latency of ConcurrentQueue and RingQueue.
+ *
+ * For every thread count half of the threads produce and half consume (one of each for a single thread). Every element carries the time
+ * it was pushed, consumers sort the time it spent in the queue into log2 nanosecond buckets.
+ *
+ * Usage: QueueBench [items per producer] [max threads]
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include "coco/communication/ConcurrentQueue.h"
+#include "coco/communication/RingQueue.h"
+
+#define BENCH_BUCKETS 40
+#define BENCH_STOP 0
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static inline int bucket(uint64_t ns)
+{
+    int b=0;
+    while (ns>0 && b<BENCH_BUCKETS-1)
+    {
+        ns >>= 1;
+        b++;
+    }
+    return b;
+}
+
+template<typename Queue>
+struct bench_arg
+{
+    Queue       *queue;
+    long        items;
+    uint64_t    hist[BENCH_BUCKETS];
+};
+
+template<typename Queue>
+void *bench_producer(void *ptr)
+{
+    struct bench_arg<Queue> *p_arg = (struct bench_arg<Queue> *) ptr;
+    for (long i=0; i<p_arg->items; i++)
+    {
+        p_arg->queue->push(now_ns());
+    }
+    return NULL;
+}
+
+template<typename Queue>
+void *bench_consumer(void *ptr)
+{
+    struct bench_arg<Queue> *p_arg = (struct bench_arg<Queue> *) ptr;
+    uint64_t ts;
+    while (1)
+    {
+        p_arg->queue->wait_and_pop(ts);
+        if (ts==BENCH_STOP) break;
+        p_arg->hist[bucket(now_ns()-ts)]++;
+    }
+    return NULL;
+}
+
+static uint64_t percentile(uint64_t *hist, uint64_t total, double pct)
+{
+    uint64_t target = (uint64_t)(total*pct/100.0);
+    uint64_t sum = 0;
+    for (int b=0; b<BENCH_BUCKETS; b++)
+    {
+        sum += hist[b];
+        if (sum>target) return ((uint64_t)1<<b)-1;
+    }
+    return ((uint64_t)1<<(BENCH_BUCKETS-1));
+}
+
+template<typename Queue>
+void run(const char *name, int threads, long items)
+{
+    int producers = (threads>1) ? threads/2 : 1;
+    int consumers = (threads>1) ? threads-producers : 1;
+    Queue *p_queue = new Queue();
+    pthread_t *ptids = new pthread_t[producers];
+    pthread_t *ctids = new pthread_t[consumers];
+    struct bench_arg<Queue> *pargs = new struct bench_arg<Queue>[producers];
+    struct bench_arg<Queue> *cargs = new struct bench_arg<Queue>[consumers];
+    uint64_t start = now_ns();
+    for (int i=0; i<consumers; i++)
+    {
+        cargs[i].queue = p_queue;
+        memset(cargs[i].hist, 0, sizeof(cargs[i].hist));
+        pthread_create(&ctids[i], NULL, bench_consumer<Queue>, &cargs[i]);
+    }
+    for (int i=0; i<producers; i++)
+    {
+        pargs[i].queue = p_queue;
+        pargs[i].items = items;
+        pthread_create(&ptids[i], NULL, bench_producer<Queue>, &pargs[i]);
+    }
+    for (int i=0; i<producers; i++)
+    {
+        pthread_join(ptids[i], NULL);
+    }
+    for (int i=0; i<consumers; i++)
+    {
+        p_queue->push(BENCH_STOP);
+    }
+    uint64_t hist[BENCH_BUCKETS];
+    memset(hist, 0, sizeof(hist));
+    for (int i=0; i<consumers; i++)
+    {
+        pthread_join(ctids[i], NULL);
+        for (int b=0; b<BENCH_BUCKETS; b++)
+        {
+            hist[b] += cargs[i].hist[b];
+        }
+    }
+    uint64_t elapsed = now_ns()-start;
+    uint64_t total = producers*items;
+    printf("%-16s %3d %3d/%-3d %10.0f %10llu %10llu %10llu\n", name, threads, producers, consumers,
+            total/(elapsed/1e9), (unsigned long long)percentile(hist,total,50),
+            (unsigned long long)percentile(hist,total,99), (unsigned long long)percentile(hist,total,99.9));
+    delete p_queue;
+    delete[] ptids;
+    delete[] ctids;
+    delete[] pargs;
+    delete[] cargs;
+}
+
+int main(int argc, char **argv)
+{
+    long items = (argc>1) ? atol(argv[1]) : 200000;
+    int maxthreads = (argc>2) ? atoi(argv[2]) : 64;
+    printf("%-16s %3s %7s %10s %10s %10s %10s\n", "queue", "thr", "prod/con", "ops/s", "p50[ns]", "p99[ns]", "p99.9[ns]");
+    for (int threads=1; threads<=maxthreads; threads*=2)
+    {
+        run<ConcurrentQueue<uint64_t> >("ConcurrentQueue", threads, items);
+        run<RingQueue<uint64_t> >("RingQueue", threads, items);
+    }
+    return 0;
+}
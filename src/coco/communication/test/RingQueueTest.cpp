@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+#include "coco/communication/RingQueue.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+#define RQ_TEST_ITEMS 200000
+
+struct ringtest_arg
+{
+    RingQueue<int>  *queue;
+    int             id;
+    int             count;
+    long            sum;
+};
+
+void *ringtest_producer(void *ptr)
+{
+    struct ringtest_arg *p_arg = (struct ringtest_arg *) ptr;
+    for (int i=1; i<=p_arg->count; i++)
+    {
+        p_arg->queue->push(i);
+    }
+    return NULL;
+}
+
+void *ringtest_consumer(void *ptr)
+{
+    struct ringtest_arg *p_arg = (struct ringtest_arg *) ptr;
+    int x;
+    for (int i=0; i<p_arg->count; i++)
+    {
+        p_arg->queue->wait_and_pop(x);
+        p_arg->sum += x;
+    }
+    return NULL;
+}
+
+void *ringtest_delayed_push(void *ptr)
+{
+    RingQueue<int> *p_queue = (RingQueue<int>*) ptr;
+    usleep(100000);
+    p_queue->push(7);
+    return NULL;
+}
+
+TEST(RingQueueTest, fifo)
+{
+    RingQueue<int> queue(8);
+    int x;
+    ASSERT_TRUE(queue.empty());
+    ASSERT_FALSE(queue.try_pop(x));
+    for (int i=0; i<8; i++)
+    {
+        queue.push(i);
+    }
+    ASSERT_FALSE(queue.empty());
+    for (int i=0; i<8; i++)
+    {
+        ASSERT_TRUE(queue.try_pop(x));
+        ASSERT_EQ(i, x);
+    }
+    ASSERT_TRUE(queue.empty());
+    ASSERT_FALSE(queue.try_wait_and_pop(x, 1));
+}
+
+TEST(RingQueueTest, blocking_pop)
+{
+    RingQueue<int> queue;
+    pthread_t thread;
+    int x = 0;
+    pthread_create(&thread, NULL, ringtest_delayed_push, (void*) &queue);
+    queue.wait_and_pop(x);
+    pthread_join(thread, NULL);
+    ASSERT_EQ(7, x);
+}
+
+TEST(RingQueueTest, full_ring_blocks_producers)
+{
+    // more items than cells, producers have to wait for the consumers
+    RingQueue<int> queue(64);
+    const int threads = 4;
+    pthread_t producers[threads], consumers[threads];
+    struct ringtest_arg pargs[threads], cargs[threads];
+    for (int i=0; i<threads; i++)
+    {
+        pargs[i].queue = &queue;
+        pargs[i].count = RQ_TEST_ITEMS;
+        cargs[i].queue = &queue;
+        cargs[i].count = RQ_TEST_ITEMS;
+        cargs[i].sum = 0;
+        pthread_create(&producers[i], NULL, ringtest_producer, &pargs[i]);
+        pthread_create(&consumers[i], NULL, ringtest_consumer, &cargs[i]);
+    }
+    long sum = 0;
+    for (int i=0; i<threads; i++)
+    {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+        sum += cargs[i].sum;
+    }
+    long expected = (long)threads*RQ_TEST_ITEMS*(RQ_TEST_ITEMS+1)/2;
+    ASSERT_EQ(expected, sum);
+    ASSERT_TRUE(queue.empty());
+}
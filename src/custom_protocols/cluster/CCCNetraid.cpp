@@ -7,7 +7,7 @@
 
 #include "custom_protocols/cluster/CCCNetraid.h"
 
-static ConcurrentQueue<void*>  *p_queue = new ConcurrentQueue<void*>();
+static RingQueue<void*>  *p_queue = new RingQueue<void*>();
 
 void* cccworker_threads(void *obj)
 {
@@ -299,6 +299,53 @@ int CCCNetraid::handle_CCC_pingpong(struct CCC_cl_pingpong *p_msg)
     return 0;
 }
 
+/**
+ * @brief unpacks a batch into single messages, allocated like the messages
+ * received by the tcp server, and dispatches them one by one.
+ */
+int CCCNetraid::handle_CCC_batch(struct CCC_batch *p_msg)
+{
+    int rc=0;
+    log->debug_log("messages:%u, length:%llu",p_msg->count,p_msg->head.customhead.datalength);
+    char *p_iter = (char *) p_msg->head.customhead.datablock;
+    size_t left = p_msg->head.customhead.datalength;
+    for (uint32_t i=0; i<p_msg->count; i++)
+    {
+        if (left<sizeof(CCC_message))
+        {
+            log->error_log("batch truncated at message %u of %u",i,p_msg->count);
+            rc=-1;
+            break;
+        }
+        CCC_message *p_sub = new CCC_message;
+        memcpy(p_sub, p_iter, sizeof(CCC_message));
+        p_iter += sizeof(CCC_message);
+        left -= sizeof(CCC_message);
+        struct custom_protocol_reqhead_t *p_custom = (struct custom_protocol_reqhead_t *) p_sub;
+        if (left<p_custom->datalength)
+        {
+            log->error_log("batch truncated at message %u of %u",i,p_msg->count);
+            delete p_sub;
+            rc=-1;
+            break;
+        }
+        p_custom->ip = NULL;
+        p_custom->datablock = malloc(p_custom->datalength);
+        memcpy(p_custom->datablock, p_iter, p_custom->datalength);
+        p_iter += p_custom->datalength;
+        left -= p_custom->datalength;
+        if (handle_Message(p_sub))
+        {
+            rc=-1;
+        }
+    }
+    free(p_msg->head.customhead.datablock);
+    free(p_msg->head.customhead.ip);
+    delete (CCC_message *) p_msg;
+    log->debug_log("rc:%d",rc);
+    return rc;
+}
+
 int CCCNetraid::handle_Message(CCC_message *p_msg)
 {
     int rc=-1;
@@ -348,6 +395,11 @@ int CCCNetraid::handle_Message(CCC_message *p_msg)
             rc = this->handle_CCC_pingpong((struct CCC_cl_pingpong *)p_msg);
             break;
         }
+        case (MT_CCC_batch):
+        {
+            rc = this->handle_CCC_batch((struct CCC_batch *)p_msg);
+            break;
+        }
         default:
         {
             log->debug_log("Unknown message type:%u.",p_head->customhead.msg_type);
@@ -8,7 +8,21 @@
 #include "custom_protocols/cluster/CCCNetraid_client.h"
 
 
-static ConcurrentQueue<void*>  *p_queue = new ConcurrentQueue<void*>();
+static RingQueue<void*>  *p_queue = new RingQueue<void*>();
+
+static inline uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+void* cccflusher(void *data)
+{
+    CCCNetraid_client *p_cl = (CCCNetraid_client*)data;
+    p_cl->flush_batches();
+    return NULL;
+}
 
 /**
  * @Todo change sleep time
@@ -90,6 +104,12 @@ CCCNetraid_client::CCCNetraid_client(Logger *p_log, ServerManager *p_sm, serveri
     dosync = dsync;
     seqnum_mutex = PTHREAD_MUTEX_INITIALIZER;
     sequence_num = 1;
+    batch_window = CCC_BATCH_DEFAULT_WINDOW;
+    batch_size = CCC_BATCH_DEFAULT_SIZE;
+    msgs_sent = 0;
+    frames_sent = 0;
+    pthread_mutex_init(&batch_mutex, NULL);
+    pthread_cond_init(&batch_cond, NULL);
     //p_netmsg = new ConcurrentQueue<CCC_message*>;
     if (p_sm==NULL)
     {        
@@ -125,6 +145,12 @@ int CCCNetraid_client::run()
             log->error_log("thread creation failed.");
         }
     }
+    pthread_t flusher_thread;
+    rc = pthread_create(&flusher_thread, NULL, cccflusher, this);
+    if (rc)
+    {
+        log->error_log("thread creation failed.");
+    }
     return rc;
 }
 
@@ -155,39 +181,67 @@ void CCCNetraid_client::pushQueue(CCC_message *p_msg)
 
 
 
+/**
+ * @brief adds the message to the batch of its receiver. The batch is sent
+ * once it is full, otherwise by the flusher thread when its window expired.
+ * Without a window every message is sent on its own.
+ */
 int CCCNetraid_client::perform(CCC_message *p_msg)
 {
-    int rc=-1;
-    //stringstream ss("");
+    int rc=0;
     struct CCCHead *p_head = (struct CCCHead*) p_msg;
     p_head->customhead.protocol_id = ccc_id;
     p_head->customhead.sequence_number = getSequenceNumber();
-    if (p_head->customhead.msg_type==MT_CCC_committed)
+    // the objects of a committed message were flushed and closed by the
+    // group commit of the data server before the message was queued
+    log->debug_log("msg_type=%u for %u",p_head->customhead.msg_type,p_head->receiver);
+    pthread_mutex_lock(&batch_mutex);
+    if (batch_window==0)
     {
-        struct CCC_committed *p_m = (struct CCC_committed *) p_msg;
-        std::map<StripeId,struct dataobject_collection*>::iterator it = p_m->partop->datamap->begin();
-        for (it;it!=p_m->partop->datamap->end(); it++)
-        {
-            while (!it->second->fhvalid) usleep(100);
-            if(dosync)
-            {
-                fsync(it->second->filehandle);
-                log->debug_log("flushed...");
-            }
-            close(it->second->filehandle);
-            log->debug_log("File closed:inum:%llu",p_m->ophead.inum);
-        }
+        pthread_mutex_unlock(&batch_mutex);
+        return send_single(p_msg);
     }
-    log->debug_log("msg_type=%u for %u",p_head->customhead.msg_type,p_head->receiver);
+    struct ccc_batch *p_batch;
+    std::map<serverid_t, struct ccc_batch*>::iterator it = batches.find(p_head->receiver);
+    if (it==batches.end())
+    {
+        p_batch = new struct ccc_batch;
+        p_batch->bytes = 0;
+        p_batch->deadline = now_us()+batch_window;
+        batches.insert(std::pair<serverid_t, struct ccc_batch*>(p_head->receiver, p_batch));
+        pthread_cond_signal(&batch_cond);
+    }
+    else
+    {
+        p_batch = it->second;
+    }
+    p_batch->msgs.push_back(p_msg);
+    p_batch->bytes += sizeof(CCC_message);
+    if (p_head->customhead.datablock!=NULL)
+    {
+        p_batch->bytes += p_head->customhead.datalength;
+    }
+    if (p_batch->msgs.size()>=batch_size || p_batch->bytes>=CCC_BATCH_MAX_BYTES)
+    {
+        batches.erase(p_head->receiver);
+        pthread_mutex_unlock(&batch_mutex);
+        rc = send_batch(p_head->receiver, p_batch);
+    }
+    else
+    {
+        pthread_mutex_unlock(&batch_mutex);
+    }
+    return rc;
+}
+
+int CCCNetraid_client::send_single(CCC_message *p_msg)
+{
+    int rc=-1;
+    struct CCCHead *p_head = (struct CCCHead*) p_msg;
     rc = p_asyn->send(p_msg, p_head->receiver);
     log->debug_log("send returned %u",rc);
-    
-/*    ipaddress_t  addr;
-    uint8_t proc = 1;
-    p_ds_manager->get_server_address(&server, &addr);
-    boost::asio::ip::tcp::socket *p_sock = p_ds_manager->get_socket_entry(&server, &proc, &proc);
-    log->debug_log("server:%u=%s",server,addr);
-    log->debug_log(ss.str().c_str());*/
+    __sync_fetch_and_add(&msgs_sent, 1);
+    __sync_fetch_and_add(&frames_sent, 1);
     if (rc==0)
     {
         if (p_head->customhead.datablock!=NULL)
@@ -200,6 +254,145 @@ int CCCNetraid_client::perform(CCC_message *p_msg)
     return rc;
 }
 
+/**
+ * @brief sends all messages of the batch in one CCC_batch frame. The heads
+ * and payloads are gathered from the queued messages without copying.
+ */
+int CCCNetraid_client::send_batch(serverid_t receiver, struct ccc_batch *p_batch)
+{
+    int rc=-1;
+    if (p_batch->msgs.size()==1)
+    {
+        rc = send_single(p_batch->msgs.front());
+        delete p_batch;
+        return rc;
+    }
+    CCC_message *p_frame = new CCC_message;
+    memset(p_frame, 0, sizeof(CCC_message));
+    struct CCC_batch *p_bhead = (struct CCC_batch *) p_frame;
+    p_bhead->head.customhead.protocol_id = ccc_id;
+    p_bhead->head.customhead.msg_type = MT_CCC_batch;
+    p_bhead->head.customhead.sequence_number = getSequenceNumber();
+    p_bhead->head.customhead.creation_time = time(0);
+    p_bhead->head.receiver = receiver;
+    p_bhead->count = p_batch->msgs.size();
+    std::vector<boost::asio::const_buffer> payload;
+    std::vector<CCC_message*>::iterator it = p_batch->msgs.begin();
+    for (it; it!=p_batch->msgs.end(); it++)
+    {
+        struct custom_protocol_reqhead_t *p_custom = (struct custom_protocol_reqhead_t *) *it;
+        if (p_custom->datablock==NULL)
+        {
+            p_custom->datalength = 0;
+        }
+        payload.push_back(boost::asio::buffer(*it, sizeof(CCC_message)));
+        if (p_custom->datalength>0)
+        {
+            payload.push_back(boost::asio::buffer(p_custom->datablock, p_custom->datalength));
+        }
+    }
+    rc = p_asyn->send(p_frame, receiver, payload);
+    log->debug_log("sent %u messages to %u:rc=%d",p_bhead->count,receiver,rc);
+    __sync_fetch_and_add(&msgs_sent, p_bhead->count);
+    __sync_fetch_and_add(&frames_sent, 1);
+    if (rc==0)
+    {
+        for (it=p_batch->msgs.begin(); it!=p_batch->msgs.end(); it++)
+        {
+            struct custom_protocol_reqhead_t *p_custom = (struct custom_protocol_reqhead_t *) *it;
+            if (p_custom->datablock!=NULL)
+            {
+                free(p_custom->datablock);
+            }
+            delete *it;
+        }
+    }
+    delete p_frame;
+    delete p_batch;
+    return rc;
+}
+
+/**
+ * @brief flusher loop, sends every batch whose window expired
+ */
+void CCCNetraid_client::flush_batches()
+{
+    std::vector<std::pair<serverid_t, struct ccc_batch*> > due;
+    pthread_mutex_lock(&batch_mutex);
+    while (true)
+    {
+        uint64_t now = now_us();
+        uint64_t next = 0;
+        std::map<serverid_t, struct ccc_batch*>::iterator it = batches.begin();
+        while (it!=batches.end())
+        {
+            if (it->second->deadline<=now)
+            {
+                due.push_back(*it);
+                batches.erase(it++);
+            }
+            else
+            {
+                if (next==0 || it->second->deadline<next) next = it->second->deadline;
+                it++;
+            }
+        }
+        if (!due.empty())
+        {
+            pthread_mutex_unlock(&batch_mutex);
+            std::vector<std::pair<serverid_t, struct ccc_batch*> >::iterator itd = due.begin();
+            for (itd; itd!=due.end(); itd++)
+            {
+                send_batch(itd->first, itd->second);
+            }
+            due.clear();
+            pthread_mutex_lock(&batch_mutex);
+        }
+        else if (next==0)
+        {
+            pthread_cond_wait(&batch_cond, &batch_mutex);
+        }
+        else
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            uint64_t ns = ts.tv_nsec + (next-now)*1000;
+            ts.tv_sec += ns/1000000000;
+            ts.tv_nsec = ns%1000000000;
+            pthread_cond_timedwait(&batch_cond, &batch_mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&batch_mutex);
+}
+
+/**
+ * @brief a window of 0 sends every message on its own
+ */
+void CCCNetraid_client::set_batching(uint32_t window_us, uint32_t maxmsgs)
+{
+    pthread_mutex_lock(&batch_mutex);
+    batch_window = window_us;
+    batch_size = (maxmsgs>0) ? maxmsgs : 1;
+    pthread_mutex_unlock(&batch_mutex);
+    log->debug_log("window:%uus, messages:%u",window_us,batch_size);
+}
+
+/**
+ * @brief number of connections to each data server
+ */
+void CCCNetraid_client::set_connections(uint32_t conns)
+{
+    p_asyn->set_connections(conns);
+}
+
+void CCCNetraid_client::report()
+{
+    uint64_t msgs = msgs_sent;
+    uint64_t frames = frames_sent;
+    log->debug_log("ccc messages:%llu, frames:%llu, messages per frame:%.2f",
+            msgs, frames, (frames>0) ? (double)msgs/frames : 0.0);
+}
+
 
 int  CCCNetraid_client::handle_CCC_cl_smallwrite(struct dstask_ccc_send_received *p_task)
 {
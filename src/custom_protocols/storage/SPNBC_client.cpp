@@ -8,7 +8,7 @@
 #include "custom_protocols/storage/SPNBC_client.h"
 
 
-static ConcurrentQueue<SPNBC_head*>  *p_queue = new ConcurrentQueue<SPNBC_head*>();
+static RingQueue<SPNBC_head*>  *p_queue = new RingQueue<SPNBC_head*>();
 
 /**
  * @Todo change sleep time
@@ -10,7 +10,7 @@
 /**
  * @brief 
  */
-static ConcurrentQueue<void*>  *p_queue = new ConcurrentQueue<void*>();
+static RingQueue<void*>  *p_queue = new RingQueue<void*>();
 
 void* worker_threads(void *obj)
 {
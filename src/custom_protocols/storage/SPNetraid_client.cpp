@@ -9,8 +9,35 @@
 
 static bool killthreads;
 
-static ConcurrentQueue<void*>  *p_queue = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_bch = new ConcurrentQueue<void*>();
+static RingQueue<void*>  *p_queue = new RingQueue<void*>();
+static RingQueue<void*>  *p_queue_bch = new RingQueue<void*>();
+
+/* metadata and checksum framing the data of a read response */
+static const size_t read_response_framing = sizeof(struct dataobject_metadata)+sizeof(uint32_t);
+
+/**
+ * @brief receives a read response straight into a data_object, the data
+ * lands in an aligned buffer. The datablock of the head is the object.
+ */
+static int scatter_read_response(void *p, std::vector<boost::asio::mutable_buffer> *p_bufs)
+{
+    SPNBC_head *p_head = (SPNBC_head *) p;
+    if (p_head->customhead.msg_type!=read_response || p_head->customhead.datalength<read_response_framing)
+    {
+        return -1;
+    }
+    struct data_object *p_do = new struct data_object;
+    size_t length = p_head->customhead.datalength-read_response_framing;
+    if (posix_memalign(&p_do->data, SPN_PAYLOAD_ALIGN, (length>0) ? length : 1))
+    {
+        p_do->data = malloc(length);
+    }
+    p_bufs->push_back(boost::asio::buffer(&p_do->metadata, sizeof(p_do->metadata)));
+    p_bufs->push_back(boost::asio::buffer(p_do->data, length));
+    p_bufs->push_back(boost::asio::buffer(&p_do->checksum, sizeof(p_do->checksum)));
+    p_head->customhead.datablock = p_do;
+    return 0;
+}
 
 /**
  * @Todo change sleep time
@@ -172,12 +199,34 @@ void* networkerBCH(void *data)
 }
 
 
+/**
+ * @brief finishes asynchronous stripe writes once their result arrived
+ */
+void* writecompleter(void *data)
+{
+    SPNetraid_client *p_cl = (SPNetraid_client*)data;
+    p_cl->complete_writes();
+    pthread_exit(0);
+}
+
+
 SPNetraid_client::SPNetraid_client(Logger *p_log) {
     log = p_log;
     seqnum_mutex = PTHREAD_MUTEX_INITIALIZER;
     killthreads = false;
     sequence_num = 1;
-    p_netmsg = new ConcurrentQueue<struct spn_task*>();
+    window_perfile = SPN_WINDOW_FILE;
+    window_perserver = SPN_WINDOW_SERVER;
+    read_degraded_timeout = SPN_READ_DEGRADED_TIMEOUT;
+    read_hedge_pct = 0;
+    memset(&read_hist[0], 0, sizeof(read_hist));
+    reads_done = 0;
+    reads_degraded = 0;
+    pthread_mutex_init(&window_mutex, NULL);
+    pthread_cond_init(&window_cond, NULL);
+    pthread_cond_init(&complete_cond, NULL);
+    pthread_cond_init(&sent_cond, NULL);
+    p_netmsg = new RingQueue<struct spn_task*>();
     p_ds_manager = new ServerManager(log, SPN_ASIO_BASEPORT);
     p_opman = new OpManager(log,&pushQueue,0,NULL,NULL);
     p_asyn = new AsynClient<SPN_message>(log,p_ds_manager);
@@ -188,7 +237,7 @@ SPNetraid_client::SPNetraid_client(Logger *p_log) {
     io_service = new boost::asio::io_service();
     uint16_t port = SPN_ASIO_CLIENT_BACKCHANNEL;
     log->debug_log("port:%u",port);
-    p_bch = new asyn_tcp_server<SPNBC_head> (*io_service , port, &pushQueueBCH,log);
+    p_bch = new asyn_tcp_server<SPNBC_head> (*io_service , port, &pushQueueBCH,log,&scatter_read_response);
 
     log->debug_log("Components created");
     this->pingpongflag=false;
@@ -203,6 +252,10 @@ SPNetraid_client::~SPNetraid_client()
 {
     log->debug_log("Shutting down");
     killthreads=true;
+    pthread_mutex_lock(&window_mutex);
+    pthread_cond_broadcast(&complete_cond);
+    pthread_cond_broadcast(&window_cond);
+    pthread_mutex_unlock(&window_mutex);
     delete p_ds_manager;
     delete p_asyn;
     delete p_raid4;    
@@ -221,6 +274,10 @@ SPNetraid_client::~SPNetraid_client()
     //io_service->stop();
     delete io_service;
     delete p_netmsg;
+    pthread_cond_destroy(&sent_cond);
+    pthread_cond_destroy(&complete_cond);
+    pthread_cond_destroy(&window_cond);
+    pthread_mutex_destroy(&window_mutex);
     log->debug_log("done");
 }
 
@@ -268,6 +325,13 @@ int SPNetraid_client::run()
         }
         thread_vec.push_back(worker_thread);
     }
+    pthread_t completer_thread;
+    rc = pthread_create(&completer_thread, NULL, writecompleter, this);
+    if (rc)
+    {
+        log->error_log("thread creation failed.");
+    }
+    thread_vec.push_back(completer_thread);
     log->debug_log("done:rc=%d",rc);
     return rc;
 }
@@ -327,17 +391,17 @@ int SPNetraid_client::perform_operation(struct operation_composite *p_op)
         {
             case operation_client_s_write:
             {
-                rc = perform_stripewrite((struct operation_client_write*) it->second);
+                rc = perform_stripewrite((struct operation_client_write*) it->second, &p_op->sending);
                 break;
             }
             case operation_client_su_write:
             {
-                rc = perform_stripeunitwrite((struct operation_client_write*) it->second);
+                rc = perform_stripeunitwrite((struct operation_client_write*) it->second, &p_op->sending);
                 break;
             }
             case operation_client_su_write_direct:
             {
-                rc = perform_Direct_write((struct operation_client_write*) it->second);
+                rc = perform_Direct_write((struct operation_client_write*) it->second, &p_op->sending);
                 break;
             }
         }/*
@@ -378,6 +442,8 @@ int SPNetraid_client::perform_operation(struct dstask_spn_send_read  *p_t)
     struct spn_task *p_task = new struct spn_task;
     struct SPN_Read_req *req = new struct SPN_Read_req;
     p_task->p_msg = (SPN_message*)req;
+    p_task->p_sending = NULL;
+    p_task->pooled = false;
     memcpy(&p_task->p_msg->read_request.head.ophead, &p_t->dshead.ophead, sizeof(struct OPHead));
     p_task->p_msg->read_request.head.customhead.creation_time = time(0);
     p_task->p_msg->read_request.head.customhead.msg_type = SP_Read_req;
@@ -409,6 +475,18 @@ int SPNetraid_client::perform_network_send(struct spn_task *p_task)
     //log->debug_log("val msg pointer:%p.",p_task->p_msg);
     rc = p_asyn->send(p_task->p_msg, p_task->receiver);
     log->debug_log("send returned %u.",rc);
+    if (p_task->p_sending!=NULL)
+    {
+        // the payload belongs to the writer, it may return once this is 0
+        p_head->customhead.datablock = NULL;
+        if (__sync_sub_and_fetch(p_task->p_sending, 1)==0)
+        {
+            pthread_mutex_lock(&window_mutex);
+            pthread_cond_broadcast(&complete_cond);
+            pthread_cond_broadcast(&sent_cond);
+            pthread_mutex_unlock(&window_mutex);
+        }
+    }
 /*    ipaddress_t  addr;
     uint8_t proc = 1;
     p_ds_manager->get_server_address(&server, &addr);
@@ -420,7 +498,11 @@ int SPNetraid_client::perform_network_send(struct spn_task *p_task)
         log->debug_log("csid:%u, seq:%u",p_task->p_msg->read_request.head.ophead.cco_id.csid,p_task->p_msg->read_request.head.ophead.cco_id.sequencenum);
         if (p_task->p_msg!=NULL)
         {
-            if (p_head->customhead.datablock!=NULL)
+            if (p_task->pooled)
+            {
+                slab_payload_free(p_head->customhead.datablock, p_head->customhead.datalength);
+            }
+            else if (p_head->customhead.datablock!=NULL)
             {
                 free(p_head->customhead.datablock);
             }
@@ -443,21 +525,30 @@ int SPNetraid_client::perform_operationBCH(SPNBC_head* p_head)
             log->debug_log("received result msg:result=%u.",result);
             rc = p_opman->client_result(p_head->inum, p_head->ccoid, result);
             delete p_head;
+            pthread_mutex_lock(&window_mutex);
+            if (!inflight.empty())
+            {
+                pthread_cond_signal(&complete_cond);
+            }
+            pthread_mutex_unlock(&window_mutex);
             break;
         }
         case (read_response):
         {
             log->debug_log("received read response msg.:length:%u",p_head->customhead.datalength);
-            struct data_object *p_do = new struct data_object;
-            p_do->data = malloc(p_head->customhead.datalength);
-            if (p_head->customhead.datalength>0)
+            struct data_object *p_do;
+            if (p_head->customhead.datalength>=read_response_framing)
             {                
-                memcpy(&p_do->metadata,(char*)p_head->customhead.datablock, sizeof(p_do->metadata));
-                memcpy( p_do->data,    (char*)p_head->customhead.datablock+sizeof(p_do->metadata), p_do->metadata.datalength);
-                memcpy(&p_do->checksum,(char*)p_head->customhead.datablock+sizeof(p_do->metadata)+p_do->metadata.datalength, sizeof(p_do->checksum));
+                // received in place by scatter_read_response
+                p_do = (struct data_object *) p_head->customhead.datablock;
                 log->debug_log("receivede checksum.:%u",p_do->checksum);
             }           
-            free(p_head->customhead.datablock);
+            else
+            {
+                p_do = new struct data_object;
+                p_do->data = malloc(p_head->customhead.datalength);
+                free(p_head->customhead.datablock);
+            }
             rc = p_opman->client_handle_read_response(p_do, p_head->inum, p_head->stripeid, p_head->stripeunitid, p_head->ccoid);
             delete p_head;
             break;            
@@ -497,6 +588,7 @@ int SPNetraid_client::handle_write_lock(ClientSessionId csid, struct EInode *p_e
     
     struct operation_composite *op = new struct operation_composite;
     op->ops = new std::map<uint32_t,operation*>();
+    op->sending = 0;
     
     op->ophead.cco_id.csid = csid;
     op->ophead.cco_id.sequencenum = 0;// this->getSequenceNumber();    
@@ -560,6 +652,7 @@ int SPNetraid_client::handle_write_lock(ClientSessionId csid, struct EInode *p_e
         log->debug_log("spnclient.Error occured...");
     }
     
+    wait_sent(op);
     p_opman->cleanup(op);
     double timetaken = difftime(time(0),starttime);
     log->debug_log("end, rc=%d, time:%f",rc,timetaken);
@@ -574,6 +667,7 @@ int SPNetraid_client::handle_write(ClientSessionId csid, struct EInode *p_einode
     
     struct operation_composite *op = new struct operation_composite;
     op->ops = new std::map<uint32_t,operation*>();
+    op->sending = 0;
     
     op->ophead.cco_id.csid = csid;
     op->ophead.cco_id.sequencenum = 0;// this->getSequenceNumber();    
@@ -638,12 +732,302 @@ int SPNetraid_client::handle_write(ClientSessionId csid, struct EInode *p_einode
         log->debug_log("spnclient.Error occured...");
     }
     
+    wait_sent(op);
     p_opman->cleanup(op);
     double timetaken = difftime(time(0),starttime);
     log->debug_log("end, rc=%d, time:%f",rc,timetaken);
     return rc;
 }
 
+/**
+ * @brief blocks until the network threads no longer read the payload of op,
+ * perform_network_send signals once its last message is sent.
+ */
+void SPNetraid_client::wait_sent(struct operation_composite *op)
+{
+    pthread_mutex_lock(&window_mutex);
+    while (__sync_fetch_and_add(&op->sending, 0)>0)
+    {
+        pthread_cond_wait(&sent_cond, &window_mutex);
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+/**
+ * @brief issues a write without waiting for its result. The write is split
+ * at stripe boundaries and every stripe is sent as its own composite
+ * operation. Blocks while the file or one of the data servers of the next
+ * stripe has a full window of outstanding stripe writes.
+ * @param cb if set, it is called by the completion thread (or by the caller
+ * if all stripes are already done) and the handle is released afterwards
+ * @param pp_handle receives the handle to pass to wait_write if cb is NULL
+ * @return 0 if all stripes were issued, -1 if neither cb nor pp_handle is
+ * given as nobody would release the handle
+ */
+int SPNetraid_client::handle_write_async(ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data,
+                                         spn_write_cb cb, void *arg, struct spn_write_handle **pp_handle)
+{
+    log->debug_log("inum:%llu,csid:%u,offset:%llu,length:%llu",p_einode->inode.inode_number,csid,offset,length);
+    if (cb==NULL && pp_handle==NULL)
+    {
+        log->error_log("neither callback nor handle");
+        return -1;
+    }
+    int rc=0;
+    filelayout_raid *p_fl = (filelayout_raid *) &p_einode->inode.layout_info[0];
+    size_t stripesize = get_stripe_size(p_fl);
+    struct spn_write_handle *p_handle = new struct spn_write_handle;
+    p_handle->rc = 0;
+    p_handle->done = false;
+    p_handle->pending = 1;  // held until all stripes are issued
+    p_handle->cb = cb;
+    p_handle->arg = arg;
+    pthread_mutex_init(&p_handle->mutex, NULL);
+    pthread_cond_init(&p_handle->cond, NULL);
+    if (pp_handle!=NULL)
+    {
+        *pp_handle = (cb==NULL) ? p_handle : NULL;
+    }
+    
+    size_t pos = offset;
+    char *data_iter = (char*) data;
+    while (pos<offset+length && !killthreads)
+    {
+        size_t chunk = stripesize - pos%stripesize;
+        if (chunk > offset+length-pos) chunk = offset+length-pos;
+        
+        struct spn_inflight *p_in = new struct spn_inflight;
+        struct operation_composite *op = new struct operation_composite;
+        op->ops = new std::map<uint32_t,operation*>();
+        op->sending = 0;
+        op->ophead.cco_id.csid = csid;
+        op->ophead.cco_id.sequencenum = 0;
+        op->ophead.inum = p_einode->inode.inode_number;
+        op->ophead.offset = pos;
+        op->ophead.length = chunk;
+        op->ophead.status = opstatus_init;
+        op->ophead.subtype=0;
+        op->ophead.type = operation_client_composite_write_type;
+        memcpy(&op->ophead.filelayout, &p_einode->inode.layout_info[0], 256);
+        p_in->op = op;
+        p_in->handle = p_handle;
+        
+        StripeId sid = pos/stripesize;
+        StripeUnitId first = (pos%stripesize)/p_fl->raid4.stripeunitsize;
+        StripeUnitId last = ((pos+chunk-1)%stripesize)/p_fl->raid4.stripeunitsize;
+        for (StripeUnitId u=first; u<=last; u++)
+        {
+            p_in->servers.push_back(get_server_id(p_fl, sid, u));
+        }
+        p_in->servers.push_back(get_coordinator(p_fl, pos));
+        window_acquire(op->ophead.inum, &p_in->servers);
+        
+        pthread_mutex_lock(&p_handle->mutex);
+        p_handle->pending++;
+        pthread_mutex_unlock(&p_handle->mutex);
+        int rcs = p_opman->client_insert(op, data_iter);
+        if (!rcs)
+        {
+            perform_operation(op);
+        }
+        else
+        {
+            log->debug_log("opmanager reported error.");
+            op->ophead.status=opstatus_failure;
+            rc=-1;
+        }
+        p_in->starttime = time(0);
+        pthread_mutex_lock(&window_mutex);
+        inflight.push_back(p_in);
+        pthread_cond_signal(&complete_cond);
+        pthread_mutex_unlock(&window_mutex);
+        
+        pos += chunk;
+        data_iter += chunk;
+    }
+    finish_write(p_handle, rc);
+    log->debug_log("issued:rc=%d",rc);
+    return rc;
+}
+
+/**
+ * @brief blocks until the asynchronous write finished and releases the handle
+ * @return 0 if every stripe was written successfully
+ */
+int SPNetraid_client::wait_write(struct spn_write_handle *p_handle)
+{
+    pthread_mutex_lock(&p_handle->mutex);
+    while (!p_handle->done)
+    {
+        pthread_cond_wait(&p_handle->cond, &p_handle->mutex);
+    }
+    int rc = p_handle->rc;
+    pthread_mutex_unlock(&p_handle->mutex);
+    pthread_cond_destroy(&p_handle->cond);
+    pthread_mutex_destroy(&p_handle->mutex);
+    delete p_handle;
+    return rc;
+}
+
+void SPNetraid_client::finish_write(struct spn_write_handle *p_handle, int rc)
+{
+    pthread_mutex_lock(&p_handle->mutex);
+    if (rc) p_handle->rc = rc;
+    p_handle->pending--;
+    bool last = (p_handle->pending==0);
+    if (last)
+    {
+        p_handle->done = true;
+        pthread_cond_broadcast(&p_handle->cond);
+    }
+    pthread_mutex_unlock(&p_handle->mutex);
+    if (last && p_handle->cb!=NULL)
+    {
+        p_handle->cb(p_handle, p_handle->arg);
+        pthread_cond_destroy(&p_handle->cond);
+        pthread_mutex_destroy(&p_handle->mutex);
+        delete p_handle;
+    }
+}
+
+/**
+ * @brief a value of 0 disables the respective limit
+ */
+void SPNetraid_client::set_write_window(uint32_t perfile, uint32_t perserver)
+{
+    pthread_mutex_lock(&window_mutex);
+    window_perfile = perfile;
+    window_perserver = perserver;
+    pthread_cond_broadcast(&window_cond);
+    pthread_mutex_unlock(&window_mutex);
+    log->debug_log("window per file:%u, per server:%u",perfile,perserver);
+}
+
+uint32_t SPNetraid_client::get_inflight()
+{
+    pthread_mutex_lock(&window_mutex);
+    uint32_t n = inflight.size();
+    pthread_mutex_unlock(&window_mutex);
+    return n;
+}
+
+/**
+ * @brief takes one slot of the file and of every listed server, waits until
+ * all of them are free so a stripe never holds part of its slots.
+ */
+void SPNetraid_client::window_acquire(InodeNumber inum, std::vector<serverid_t> *p_servers)
+{
+    pthread_mutex_lock(&window_mutex);
+    while (!killthreads)
+    {
+        bool full = (window_perfile>0 && window_file[inum]>=window_perfile);
+        std::vector<serverid_t>::iterator it = p_servers->begin();
+        for (it; it!=p_servers->end() && !full; it++)
+        {
+            full = (window_perserver>0 && window_server[*it]>=window_perserver);
+        }
+        if (!full) break;
+        pthread_cond_wait(&window_cond, &window_mutex);
+    }
+    window_file[inum]++;
+    std::vector<serverid_t>::iterator it = p_servers->begin();
+    for (it; it!=p_servers->end(); it++)
+    {
+        window_server[*it]++;
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+/**
+ * @brief returns the slots taken by window_acquire, window_mutex must be held
+ */
+void SPNetraid_client::window_release(InodeNumber inum, std::vector<serverid_t> *p_servers)
+{
+    std::map<InodeNumber,uint32_t>::iterator itf = window_file.find(inum);
+    if (itf!=window_file.end() && --itf->second==0)
+    {
+        window_file.erase(itf);
+    }
+    std::vector<serverid_t>::iterator it = p_servers->begin();
+    for (it; it!=p_servers->end(); it++)
+    {
+        std::map<serverid_t,uint32_t>::iterator its = window_server.find(*it);
+        if (its!=window_server.end() && --its->second==0)
+        {
+            window_server.erase(its);
+        }
+    }
+}
+
+/**
+ * @brief completion loop. A stripe write is finished once its result is
+ * known and the network threads no longer read the callers buffer.
+ */
+void SPNetraid_client::complete_writes()
+{
+    std::vector<struct spn_inflight*> finished;
+    pthread_mutex_lock(&window_mutex);
+    while (!killthreads)
+    {
+        time_t oldest = 0;  // start of the oldest stripe without result
+        std::list<struct spn_inflight*>::iterator it = inflight.begin();
+        while (it!=inflight.end())
+        {
+            struct spn_inflight *p_in = *it;
+            opstatus status = p_in->op->ophead.status;
+            bool final = (status==opstatus_success || status==opstatus_failure);
+            if (!final && difftime(time(0),p_in->starttime)>SPN_OPERATION_TIMEOUT)
+            {
+                log->debug_log("Operation failed:TIMEOUT:inum:%llu,offset:%llu",p_in->op->ophead.inum,p_in->op->ophead.offset);
+                p_in->op->ophead.status = opstatus_failure;
+                final = true;
+            }
+            if (final && p_in->op->sending==0)
+            {
+                window_release(p_in->op->ophead.inum, &p_in->servers);
+                finished.push_back(p_in);
+                inflight.erase(it++);
+            }
+            else
+            {
+                if (!final && (oldest==0 || p_in->starttime<oldest))
+                {
+                    oldest = p_in->starttime;
+                }
+                it++;
+            }
+        }
+        // results and sent payloads are signalled, only timeouts are not
+        if (finished.empty() && oldest==0)
+        {
+            pthread_cond_wait(&complete_cond, &window_mutex);
+            continue;
+        }
+        if (finished.empty())
+        {
+            struct timespec ts;
+            ts.tv_sec = oldest+SPN_OPERATION_TIMEOUT+1;
+            ts.tv_nsec = 0;
+            pthread_cond_timedwait(&complete_cond, &window_mutex, &ts);
+            continue;
+        }
+        pthread_cond_broadcast(&window_cond);
+        pthread_mutex_unlock(&window_mutex);
+        std::vector<struct spn_inflight*>::iterator itf = finished.begin();
+        for (itf; itf!=finished.end(); itf++)
+        {
+            struct spn_inflight *p_in = *itf;
+            int rc = (p_in->op->ophead.status==opstatus_success) ? 0 : -1;
+            p_opman->cleanup(p_in->op);
+            finish_write(p_in->handle, rc);
+            delete p_in;
+        }
+        finished.clear();
+        pthread_mutex_lock(&window_mutex);
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
 int SPNetraid_client::register_ds_address(serverid_t id, char *ip)
 {
     return p_ds_manager->register_server(id,ip);
@@ -662,11 +1046,73 @@ int SPNetraid_client::getDeviceLayouts(std::vector<serverid_t> *ds)
     return rc;
 }
 
+static inline uint64_t read_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static inline int read_hist_bucket(uint64_t us)
+{
+    int b=0;
+    while (us>0 && b<SPN_READ_HIST_BUCKETS-1)
+    {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/**
+ * @brief configures when a read stops waiting for a unit and rebuilds it
+ * from parity. 
+ * @param timeout_ms fixed timeout, 0 disables it
+ * @param hedgepct rebuild once the read is slower than this percentile of
+ * the previous reads, 0 disables hedging
+ */
+void SPNetraid_client::set_degraded_read(uint32_t timeout_ms, double hedgepct)
+{
+    read_degraded_timeout = timeout_ms;
+    read_hedge_pct = (hedgepct>0 && hedgepct<100) ? hedgepct : 0;
+    log->debug_log("degraded timeout:%u ms, hedge percentile:%f",read_degraded_timeout,read_hedge_pct);
+}
+
+/**
+ * @brief number of connections to each data server
+ */
+void SPNetraid_client::set_connections(uint32_t conns)
+{
+    p_asyn->set_connections(conns);
+}
+
+/**
+ * @brief upper bound of the histogram bucket holding the given percentile
+ * of the completed read latencies in microseconds, 0 without samples.
+ */
+uint64_t SPNetraid_client::read_percentile(double pct)
+{
+    uint64_t total = reads_done;
+    if (total==0) return 0;
+    uint64_t target = (uint64_t)(total*pct/100.0);
+    uint64_t sum = 0;
+    for (int b=0; b<SPN_READ_HIST_BUCKETS; b++)
+    {
+        sum += read_hist[b];
+        if (sum>target || sum>=total)
+        {
+            return (b==0) ? 0 : ((uint64_t)1<<b)-1;
+        }
+    }
+    return ((uint64_t)1<<(SPN_READ_HIST_BUCKETS-1))-1;
+}
+
 int SPNetraid_client::handle_read(ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void **data)
 {
     log->debug_log("inum:%llu,csid:%u,offset:%llu,length:%llu",p_einode->inode.inode_number,csid,offset,length);
     int rc = -1;
     time_t  starttime = time(0);
+    uint64_t startus = read_now_us();
     struct operation_client_read *op = new struct operation_client_read;
     op->ophead.status = opstatus_init;
     op->ophead.cco_id.csid = csid;
@@ -679,6 +1125,15 @@ int SPNetraid_client::handle_read(ClientSessionId csid, struct EInode *p_einode,
     op->groups = NULL;    
     op->resultdata = data;
     rc = p_opman->client_insert_read(op,p_einode);
+    
+    // deadline after which missing units are rebuilt from parity
+    uint64_t degraded_us = (uint64_t)read_degraded_timeout*1000;
+    if (read_hedge_pct>0 && reads_done>=SPN_HEDGE_MIN_SAMPLES)
+    {
+        uint64_t hedge_us = read_percentile(read_hedge_pct);
+        if (hedge_us>0 && (degraded_us==0 || hedge_us<degraded_us)) degraded_us = hedge_us;
+    }
+    bool degraded = (degraded_us==0);
     bool _continue=true;
     try
     {
@@ -689,6 +1144,9 @@ int SPNetraid_client::handle_read(ClientSessionId csid, struct EInode *p_einode,
                 case (opstatus_success):
                 {
                     log->debug_log("Operation successful");
+                    uint64_t took = read_now_us()-startus;
+                    __sync_fetch_and_add(&read_hist[read_hist_bucket(took)], 1);
+                    __sync_fetch_and_add(&reads_done, 1);
                     _continue=false;
                     break;
                 }
@@ -708,6 +1166,15 @@ int SPNetraid_client::handle_read(ClientSessionId csid, struct EInode *p_einode,
                     }
                     else
                     {
+                        if (!degraded && read_now_us()-startus>degraded_us)
+                        {
+                            degraded = true;
+                            if (p_opman->client_read_degraded(op)>0)
+                            {
+                                __sync_fetch_and_add(&reads_degraded, 1);
+                                log->debug_log("read inum:%llu,offset:%llu degraded after %llu us",p_einode->inode.inode_number,offset,degraded_us);
+                            }
+                        }
                         usleep(THREADING_TIMEOUT_USLEEP);
                     }
 
@@ -725,7 +1192,7 @@ int SPNetraid_client::handle_read(ClientSessionId csid, struct EInode *p_einode,
     return rc;
 }
 
-int SPNetraid_client::perform_stripewrite(struct operation_client_write *p_op)
+int SPNetraid_client::perform_stripewrite(struct operation_client_write *p_op, uint32_t *p_sending)
 {
     int rc=-1;
     log->debug_log("inum:%llu",p_op->ophead.inum);
@@ -746,12 +1213,21 @@ int SPNetraid_client::perform_stripewrite(struct operation_client_write *p_op)
     
     parityreq->head.customhead.datalength = p_fl->raid4.stripeunitsize;
     parityreq->head.participants = p_op->participants;
-    parityreq->head.customhead.datablock = malloc(parityreq->head.customhead.datalength);
+    parityreq->head.customhead.datablock = slab_payload_alloc(parityreq->head.customhead.datalength);
     memset(parityreq->head.customhead.datablock,0,parityreq->head.customhead.datalength);
     //log->debug_log("text:%s",(char*)req->head.customhead.datablock);
+    // full sized units are folded into the parity block in one pass below,
+    // their tasks are held back until the parity is computed.
+    void *units[PARITY_MAX_INPUTS];
+    struct spn_task *unittasks[PARITY_MAX_INPUTS];
+    int unitcnt=0;
+    units[unitcnt] = parityreq->head.customhead.datablock;
+    unittasks[unitcnt++] = paritytask;
     paritytask->receiver = get_coordinator((filelayout_raid*)&parityreq->head.ophead.filelayout[0],p_op->ophead.offset);
     //log->debug_log("send to id:%u, size:%u, text:%s",paritytask->receiver, parityreq->head.customhead.datalength,(char*)parityreq->head.customhead.datablock);
     paritytask->p_msg = (SPN_message*)parityreq;
+    paritytask->p_sending = NULL;
+    paritytask->pooled = true;
     //log->debug_log("pointer:%p",paritytask->p_msg);    
     
     std::map<StripeUnitId,struct StripeUnit*>::iterator it = p_op->group->sumap->begin();
@@ -773,21 +1249,36 @@ int SPNetraid_client::perform_stripewrite(struct operation_client_write *p_op)
         req->head.customhead.datalength = it->second->opsize;
         req->head.participants = p_op->participants;
         req->head.customhead.ip = NULL;
-        req->head.customhead.datablock = malloc(it->second->opsize);
-        memcpy(req->head.customhead.datablock, it->second->newdata,req->head.customhead.datalength);
-        calc_parity(req->head.customhead.datablock,parityreq->head.customhead.datablock,parityreq->head.customhead.datablock,parityreq->head.customhead.datalength);
+        req->head.customhead.datablock = it->second->newdata;
         //log->debug_log("text:%s",(char*)req->head.customhead.datablock);
         task->receiver= get_server_id((filelayout_raid*)&req->head.ophead.filelayout[0],req->stripeid, it->first);
         //log->debug_log("send to id:%u, size:%u, text:%s",task->receiver, req->head.customhead.datalength,(char*)req->head.customhead.datablock);
         task->p_msg = (SPN_message*)req;
+        task->p_sending = p_sending;
+        task->pooled = false;
+        __sync_fetch_and_add(p_sending, 1);
         log->debug_log("pointer:%p",task->p_msg);
-        p_netmsg->push(task);
+        if (req->head.customhead.datalength==parityreq->head.customhead.datalength && unitcnt<PARITY_MAX_INPUTS)
+        {
+            units[unitcnt] = req->head.customhead.datablock;
+            unittasks[unitcnt++] = task;
+        }
+        else
+        {
+            calc_parity(req->head.customhead.datablock,parityreq->head.customhead.datablock,parityreq->head.customhead.datablock,std::min(req->head.customhead.datalength,parityreq->head.customhead.datalength));
+            p_netmsg->push(task);
+        }
+    }
+    calc_parity_n(&units[0], unitcnt, parityreq->head.customhead.datablock, parityreq->head.customhead.datalength);
+    for (int i=1; i<unitcnt; i++)
+    {
+        p_netmsg->push(unittasks[i]);
     }
     p_netmsg->push(paritytask);
     return rc;
 }
 
-int SPNetraid_client::perform_stripeunitwrite(struct operation_client_write *p_op)
+int SPNetraid_client::perform_stripeunitwrite(struct operation_client_write *p_op, uint32_t *p_sending)
 {
     int rc=0;
     log->debug_log("inum:%llu",p_op->ophead.inum);
@@ -809,19 +1300,21 @@ int SPNetraid_client::perform_stripeunitwrite(struct operation_client_write *p_o
         req->head.customhead.datalength = it->second->opsize;
         req->head.participants = p_op->participants;
         req->head.customhead.ip = NULL;
-        req->head.customhead.datablock = malloc(it->second->opsize);
-        memcpy(req->head.customhead.datablock, it->second->newdata,req->head.customhead.datalength);
+        req->head.customhead.datablock = it->second->newdata;
         //log->debug_log("text:%s",(char*)req->head.customhead.datablock);
         task->receiver= get_server_id((filelayout_raid*)&req->head.ophead.filelayout[0],req->stripeid, it->first);
         //log->debug_log("send to id:%u, size:%u, offset:%llu, text:%s",task->receiver, req->head.customhead.datalength,req->head.ophead.offset,(char*)req->head.customhead.datablock);
         task->p_msg = (SPN_message*)req;
+        task->p_sending = p_sending;
+        task->pooled = false;
+        __sync_fetch_and_add(p_sending, 1);
         //log->debug_log("pointer:%p",task->p_msg);
         p_netmsg->push(task);
     }
     return rc;
 }
 
-int SPNetraid_client::perform_Direct_write(struct operation_client_write *p_op)
+int SPNetraid_client::perform_Direct_write(struct operation_client_write *p_op, uint32_t *p_sending)
 {
     int rc=-1;
     log->debug_log("inum:%llu",p_op->ophead.inum);
@@ -841,12 +1334,14 @@ int SPNetraid_client::perform_Direct_write(struct operation_client_write *p_op)
     
     parityreq->head.customhead.datalength = p_fl->raid4.stripeunitsize;
     parityreq->head.participants = p_op->participants;
-    parityreq->head.customhead.datablock = malloc(parityreq->head.customhead.datalength);
+    parityreq->head.customhead.datablock = slab_payload_alloc(parityreq->head.customhead.datalength);
     memset(parityreq->head.customhead.datablock,0,parityreq->head.customhead.datalength);
     //log->debug_log("text:%s",(char*)req->head.customhead.datablock);
     paritytask->receiver = get_coordinator((filelayout_raid*)&parityreq->head.ophead.filelayout[0],p_op->ophead.offset);
     //log->debug_log("send to id:%u, size:%u, text:%s",paritytask->receiver, parityreq->head.customhead.datalength,(char*)parityreq->head.customhead.datablock);
     paritytask->p_msg = (SPN_message*)parityreq;
+    paritytask->p_sending = NULL;
+    paritytask->pooled = true;
     //log->debug_log("pointer:%p",paritytask->p_msg);    
     p_netmsg->push(paritytask);
     std::map<StripeUnitId,struct StripeUnit*>::iterator it = p_op->group->sumap->begin();
@@ -868,13 +1363,15 @@ int SPNetraid_client::perform_Direct_write(struct operation_client_write *p_op)
         req->head.customhead.datalength = it->second->opsize;
         req->head.participants = p_op->participants;
         req->head.customhead.ip = NULL;
-        req->head.customhead.datablock = malloc(it->second->opsize);
-        memcpy(req->head.customhead.datablock, it->second->newdata,req->head.customhead.datalength);
+        req->head.customhead.datablock = it->second->newdata;
         //calc_parity(req->head.customhead.datablock,parityreq->head.customhead.datablock,parityreq->head.customhead.datablock,parityreq->head.customhead.datalength);
         //log->debug_log("text:%s",(char*)req->head.customhead.datablock);
         task->receiver= get_server_id((filelayout_raid*)&req->head.ophead.filelayout[0],req->stripeid, it->first);
         //log->debug_log("send to id:%u, size:%u, text:%s",task->receiver, req->head.customhead.datalength,(char*)req->head.customhead.datablock);
         task->p_msg = (SPN_message*)req;
+        task->p_sending = p_sending;
+        task->pooled = false;
+        __sync_fetch_and_add(p_sending, 1);
         log->debug_log("pointer:%p",task->p_msg);
         p_netmsg->push(task);
     }
@@ -891,6 +1388,8 @@ int SPNetraid_client::handle_pingpong(ClientSessionId csid)
     req->a=0;
     req->b=1;
     p_task->p_msg = (SPN_message*)req;
+    p_task->p_sending = NULL;
+    p_task->pooled = false;
     
     p_task->p_msg->read_request.head.customhead.creation_time = time(0);
     p_task->p_msg->read_request.head.customhead.msg_type = SP_Pingpong_req;
@@ -0,0 +1,318 @@
+/**
+ * \file RingQueue.h
+ *
+ * \author Markus Maesker
+ *
+ * \brief Bounded lock-free multi producer / multi consumer queue with the interface of ConcurrentQueue.
+ *
+ * Elements are stored in a power of two sized ring of cells. Every cell carries a sequence number which tells producers and consumers
+ * whether the cell is free for the current lap, so both sides only contend on one compare and swap of their position counter. Threads only
+ * block if the ring is empty (consumers) or full (producers). Blocking uses an event count on a futex, the fast path never enters the
+ * kernel unless a thread is actually parked.
+ */
+#ifndef RINGQUEUE_H_
+#define RINGQUEUE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctime>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/**
+ * Default number of cells, rounded up to a power of two.
+ */
+#define RINGQUEUE_DEFAULT_CAPACITY 16384
+
+/**
+ * Number of failed attempts before a thread parks on the event count.
+ */
+#define RINGQUEUE_SPIN 64
+
+template<typename Data>
+/**
+ * Implements a bounded generic FIFO queue which can be used by any number of producer and consumer threads. Data must be copy assignable.
+ */
+class RingQueue
+{
+private:
+    struct cell
+    {
+        size_t  sequence;
+        Data    data;
+    };
+
+    /**
+     * Futex word which is incremented on every notification and the number of threads parked on it.
+     */
+    struct eventcount
+    {
+        uint32_t seq;
+        uint32_t waiters;
+    };
+
+    cell *buffer;
+    size_t mask;
+    /* producer and consumer positions on separate cache lines */
+    char pad0[64];
+    size_t enqueue_pos;
+    char pad1[64];
+    size_t dequeue_pos;
+    char pad2[64];
+    struct eventcount notempty;
+    struct eventcount notfull;
+    /**
+     * Saves the point in time when the last pop was done, 0 if no pop was done yet.
+     */
+    time_t last_pop;
+
+    static void futex_wait(uint32_t *addr, uint32_t val)
+    {
+        syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+    }
+
+    static void futex_wake(uint32_t *addr, int n)
+    {
+        syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+
+    /**
+     * Wakes one parked thread. The full barrier orders the preceding cell update before the waiters check, which pairs with the barrier
+     * in park.
+     */
+    static void notify(struct eventcount *p_ec)
+    {
+        __sync_synchronize();
+        if (__atomic_load_n(&p_ec->waiters, __ATOMIC_RELAXED)>0)
+        {
+            __sync_fetch_and_add(&p_ec->seq, 1);
+            futex_wake(&p_ec->seq, 1);
+        }
+    }
+
+    bool try_push(Data const& data)
+    {
+        size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        cell *p_cell;
+        while (1)
+        {
+            p_cell = &buffer[pos & mask];
+            size_t seq = __atomic_load_n(&p_cell->sequence, __ATOMIC_ACQUIRE);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif==0)
+            {
+                if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            }
+            else if (dif<0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+            }
+        }
+        p_cell->data = data;
+        __atomic_store_n(&p_cell->sequence, pos+1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    bool dequeue(Data& popped_value)
+    {
+        size_t pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        cell *p_cell;
+        while (1)
+        {
+            p_cell = &buffer[pos & mask];
+            size_t seq = __atomic_load_n(&p_cell->sequence, __ATOMIC_ACQUIRE);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos+1);
+            if (dif==0)
+            {
+                if (__atomic_compare_exchange_n(&dequeue_pos, &pos, pos+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    break;
+                }
+            }
+            else if (dif<0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+            }
+        }
+        popped_value = p_cell->data;
+        __atomic_store_n(&p_cell->sequence, pos+mask+1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+public:
+    /*!\brief Constructor of "RingQueue"
+     *
+     * \param capacity maximum number of queued elements, rounded up to the next power of two
+     */
+    RingQueue(size_t capacity = RINGQUEUE_DEFAULT_CAPACITY)
+    {
+        size_t size = 2;
+        while (size<capacity)
+        {
+            size <<= 1;
+        }
+        buffer = new cell[size];
+        mask = size-1;
+        for (size_t i=0; i<size; i++)
+        {
+            buffer[i].sequence = i;
+        }
+        enqueue_pos = 0;
+        dequeue_pos = 0;
+        notempty.seq = 0;
+        notempty.waiters = 0;
+        notfull.seq = 0;
+        notfull.waiters = 0;
+        last_pop = 0;
+    }
+
+    /**
+     *\brief Destructor of "RingQueue"
+     */
+    ~RingQueue()
+    {
+        delete[] buffer;
+    }
+
+    /*!\brief Pushes one element into the queue
+     *
+     * Blocks while the queue is full and wakes a consumer parked on the empty queue.
+     */
+    void push(Data const& data)
+    {
+        int spin = 0;
+        while (!try_push(data))
+        {
+            if (spin++<RINGQUEUE_SPIN)
+            {
+                sched_yield();
+                continue;
+            }
+            uint32_t key = __atomic_load_n(&notfull.seq, __ATOMIC_ACQUIRE);
+            __sync_fetch_and_add(&notfull.waiters, 1);
+            if (try_push(data))
+            {
+                __sync_fetch_and_sub(&notfull.waiters, 1);
+                break;
+            }
+            futex_wait(&notfull.seq, key);
+            __sync_fetch_and_sub(&notfull.waiters, 1);
+        }
+        notify(&notempty);
+    }
+
+    /*!\brief Checks wether the queue is empty or not
+     *
+     *\return true if the queue does not contain any elements and false otherwise
+     */
+    bool empty() const
+    {
+        size_t pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+        size_t seq = __atomic_load_n(&buffer[pos & mask].sequence, __ATOMIC_ACQUIRE);
+        return (intptr_t)seq - (intptr_t)(pos+1) < 0;
+    }
+
+    /*!\brief Tries to pop an element without blocking
+     *
+     * \param popped_value output parameter which will contain the popped element if method is successful
+     * \return false if the queue is empty
+     */
+    bool try_pop(Data& popped_value)
+    {
+        if (!dequeue(popped_value))
+        {
+            return false;
+        }
+        last_pop = time(NULL);
+        notify(&notfull);
+        return true;
+    }
+
+    /*!\brief Pop an element with blocking until an element is available
+     *
+     * \param popped_value output parameter which will contain the popped element
+     */
+    void wait_and_pop(Data& popped_value)
+    {
+        int spin = 0;
+        while (!try_pop(popped_value))
+        {
+            if (spin++<RINGQUEUE_SPIN)
+            {
+                sched_yield();
+                continue;
+            }
+            uint32_t key = __atomic_load_n(&notempty.seq, __ATOMIC_ACQUIRE);
+            __sync_fetch_and_add(&notempty.waiters, 1);
+            if (try_pop(popped_value))
+            {
+                __sync_fetch_and_sub(&notempty.waiters, 1);
+                return;
+            }
+            futex_wait(&notempty.seq, key);
+            __sync_fetch_and_sub(&notempty.waiters, 1);
+        }
+    }
+
+    /*!\brief Tries to pop an element, blocks until the timeout exceeds.
+     *
+     * \param popped_value output parameter which will contain the popped element
+     * \param timeout Timeout value in seconds.
+     * \return Returns true if an element was popped; false if the timeout exceeds.
+     */
+    bool try_wait_and_pop(Data& popped_value, int timeout)
+    {
+        time_t deadline = time(NULL)+timeout;
+        while (!try_pop(popped_value))
+        {
+            time_t now = time(NULL);
+            if (now>=deadline)
+            {
+                return false;
+            }
+            uint32_t key = __atomic_load_n(&notempty.seq, __ATOMIC_ACQUIRE);
+            __sync_fetch_and_add(&notempty.waiters, 1);
+            if (try_pop(popped_value))
+            {
+                __sync_fetch_and_sub(&notempty.waiters, 1);
+                return true;
+            }
+            struct timespec ts;
+            ts.tv_sec = deadline-now;
+            ts.tv_nsec = 0;
+            syscall(SYS_futex, &notempty.seq, FUTEX_WAIT_PRIVATE, key, &ts, NULL, 0);
+            __sync_fetch_and_sub(&notempty.waiters, 1);
+        }
+        return true;
+    }
+
+    /**
+     *\brief Returns the elapsed time in seconds since the last pop
+     *
+     *\return 0 if no pop has been done yet otherwise the elapsed time in seconds since the last pop
+     */
+    double get_elapsed_time_after_last_pop()
+    {
+        if (last_pop==0)
+        {
+            return 0.0;
+        }
+        return difftime(time(NULL), last_pop);
+    }
+};
+
+#endif //#ifndef RINGQUEUE_H_
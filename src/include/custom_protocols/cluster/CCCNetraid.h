@@ -15,6 +15,7 @@
 #include "custom_protocols/global_protocol_data.h"
 //#include "server/DataServer/DataServer.h"
 #include "coco/communication/ConcurrentQueue.h"
+#include "coco/communication/RingQueue.h"
 #include "components/raidlibs/Libraid5.h"
 #include "components/OperationManager/OpManager.h"
 #include "components/network/asyn_tcp_server.h"
@@ -45,6 +46,7 @@ public:
     int         handle_CCC_result(struct CCC_result *p_msg);
     int         handle_CCC_stripewrite_cancommit(struct CCC_cl_stripewrite_cancommit *p_msg);
     int         handle_CCC_pingpong(struct CCC_cl_pingpong *p_msg);
+    int         handle_CCC_batch(struct CCC_batch *p_msg);
 
     static void pushQueue(void *p);   
     
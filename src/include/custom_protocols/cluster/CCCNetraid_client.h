@@ -11,6 +11,8 @@
 #include "stdint.h"
 #include <pthread.h>
 #include <string>
+#include <map>
+#include <vector>
 #include <zmq.h>
 #include <zmq.hpp>
 
@@ -22,8 +24,23 @@
 #include "components/raidlibs/Libraid4.h"
 #include "components/network/ServerManager.h"
 #include "coco/communication/ConcurrentQueue.h"
+#include "coco/communication/RingQueue.h"
 #include "logging/Logger.h"
 
+/* microseconds a message waits for more messages to the same server */
+#define CCC_BATCH_DEFAULT_WINDOW 100
+/* messages and payload bytes after which a batch is sent at once */
+#define CCC_BATCH_DEFAULT_SIZE 32
+#define CCC_BATCH_MAX_BYTES (256*1024)
+
+/**
+ * @brief messages collected for one destination server
+ */
+struct ccc_batch {
+    std::vector<CCC_message*>   msgs;
+    size_t                      bytes;
+    uint64_t                    deadline;   // monotonic microseconds
+};
 
 class CCCNetraid_client {
 public:
@@ -45,6 +62,11 @@ public:
     int handle_CCC_stripewrite_cancommit(struct dstask_ccc_stripewrite_cancommit *p_task);
     
     int  handle_CCC_cl_pingping(struct dstask_pingpong *p_task);
+    
+    void set_batching(uint32_t window_us, uint32_t maxmsgs);
+    void flush_batches();
+    void set_connections(uint32_t conns);
+    void report();
 private:
     //ConcurrentQueue<CCC_message*> *p_netmsg;    
     ServerManager *p_ds_manager;
@@ -59,6 +81,18 @@ private:
     pthread_mutex_t seqnum_mutex;
     uint32_t getSequenceNumber();
     int run();
+    
+    /* pending batches by receiver, guarded by batch_mutex */
+    std::map<serverid_t, struct ccc_batch*> batches;
+    uint32_t batch_window;
+    uint32_t batch_size;
+    pthread_mutex_t batch_mutex;
+    pthread_cond_t batch_cond;
+    uint64_t msgs_sent;
+    uint64_t frames_sent;
+    
+    int send_single(CCC_message *p_msg);
+    int send_batch(serverid_t receiver, struct ccc_batch *p_batch);
 };
 
 #endif	/* CCCNETRAID_CLIENT_H */
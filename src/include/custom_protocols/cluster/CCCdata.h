@@ -76,11 +76,21 @@ struct CCC_committed {
         struct operation_participant       *partop;
 };
 
+/*
+ * Several messages to the same server in one frame. The payload holds count
+ * messages, each a CCC_message head followed by its datalength bytes.
+ */
+struct CCC_batch {
+        struct CCCHead          head;
+        uint32_t                count;
+};
+
 
 union CCC_message {
     struct CCC_cl_smallwrite    cl_smallwrite;
     struct CCC_prepare          send_prepare;
     struct CCC_docommit         send_docommit;
+    struct CCC_batch            batch;
 };
 
 void print_CCCHead(struct CCCHead *p_head, std::stringstream& ss);
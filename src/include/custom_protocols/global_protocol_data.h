@@ -150,6 +150,7 @@ const uint8_t MT_CCC_committed          = 250;
 const uint8_t MT_CCC_result             = 249;
 const uint8_t MT_CCC_stripewrite_cancommit      = 248;
 const uint8_t MT_CCC_pingpong           = 247;
+const uint8_t MT_CCC_batch              = 246;
 //const uint8_t MT_CCC_stripeunitwrite   = 247;
 //const uint8_t ipaddress_array_size = 32; 
 
@@ -24,6 +24,7 @@
 #include "components/raidlibs/Libraid5.h"
 #include "components/network/ServerManager.h"
 #include "coco/communication/ConcurrentQueue.h"
+#include "coco/communication/RingQueue.h"
 #include "logging/Logger.h"
 #include "components/network/asyn_tcp_server.h"
 
@@ -15,6 +15,7 @@
 #include "custom_protocols/global_protocol_data.h"
 #include "server/DataServer/DataServer.h"
 #include "coco/communication/ConcurrentQueue.h"
+#include "coco/communication/RingQueue.h"
 #include "components/raidlibs/Libraid5.h"
 #include "components/network/asyn_tcp_server.h"
 
@@ -11,6 +11,8 @@
 #include "stdint.h"
 #include <pthread.h>
 #include <string>
+#include <list>
+#include <map>
 #include <zmq.h>
 #include <zmq.hpp>
 #include <time.h>
@@ -23,9 +25,11 @@
 #include "components/raidlibs/Libraid4.h"
 #include "components/network/ServerManager.h"
 #include "coco/communication/ConcurrentQueue.h"
+#include "coco/communication/RingQueue.h"
 #include "logging/Logger.h"
 #include "components/network/asyn_tcp_server.h"
 #include "tools/parity.h"
+#include "tools/slab_pool.h"
 
 #define DO_TESTMODE
 #ifdef DO_TESTMODE
@@ -34,6 +38,47 @@
   #define SPN_OPERATION_TIMEOUT 2
 #endif
 
+/* alignment of received stripe unit payloads */
+#define SPN_PAYLOAD_ALIGN 4096
+
+/* default number of stripe writes in flight per file and per data server */
+#define SPN_WINDOW_FILE 16
+#define SPN_WINDOW_SERVER 8
+
+/* a read waiting this long (ms) rebuilds its missing unit from parity, 0 disables */
+#define SPN_READ_DEGRADED_TIMEOUT 1000
+/* log2 buckets of the read latency histogram, in microseconds */
+#define SPN_READ_HIST_BUCKETS 24
+/* completed reads needed before hedging trusts the percentile */
+#define SPN_HEDGE_MIN_SAMPLES 64
+
+struct spn_write_handle;
+typedef void (*spn_write_cb)(struct spn_write_handle *p_handle, void *arg);
+
+/**
+ * @brief completion handle of an asynchronous write. The write is split at
+ * stripe boundaries and completes once every stripe write finished.
+ */
+struct spn_write_handle {
+    int                 rc;         // 0 or -1 if any stripe failed
+    bool                done;
+    uint32_t            pending;    // stripe writes not finished yet
+    spn_write_cb        cb;         // called by the completion thread if set
+    void                *arg;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+};
+
+/**
+ * @brief one stripe write in flight and the window slots it holds.
+ */
+struct spn_inflight {
+    struct operation_composite  *op;
+    struct spn_write_handle     *handle;
+    std::vector<serverid_t>     servers;
+    time_t                      starttime;
+};
+
 class SPNetraid_client {
 public:
     SPNetraid_client(Logger *p_log);
@@ -51,7 +96,16 @@ public:
     int getDeviceLayouts(std::vector<serverid_t> *ds);
     int handle_write(ClientSessionId csid,struct EInode *p_einode, size_t offset, size_t length, void *data);
     int handle_write_lock(ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data);
+    int handle_write_async(ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data,
+                           spn_write_cb cb, void *arg, struct spn_write_handle **pp_handle);
+    int wait_write(struct spn_write_handle *p_handle);
+    void set_write_window(uint32_t perfile, uint32_t perserver);
+    uint32_t get_inflight();
+    void complete_writes();
     int handle_read(ClientSessionId csid,struct EInode *p_einode, size_t offset, size_t length, void **data);
+    void set_degraded_read(uint32_t timeout_ms, double hedgepct);
+    uint64_t read_percentile(double pct);
+    void set_connections(uint32_t conns);
     int handle_pingpong(ClientSessionId csid);
     
     bool                popqueue(void **p_res);
@@ -62,7 +116,7 @@ public:
     
 private:
     //SocketManager<struct ds_socket_t> *sm;
-    ConcurrentQueue<struct spn_task*> *p_netmsg;
+    RingQueue<struct spn_task*> *p_netmsg;
     OpManager *p_opman;
     //Libraid5 *p_raid;
     Libraid4 *p_raid4;
@@ -74,6 +128,24 @@ private:
     
     uint32_t ds_count;
     uint32_t sequence_num;
+    
+    /* asynchronous writes, guarded by window_mutex */
+    std::list<struct spn_inflight*> inflight;
+    std::map<InodeNumber,uint32_t> window_file;
+    std::map<serverid_t,uint32_t> window_server;
+    uint32_t window_perfile;
+    uint32_t window_perserver;
+    pthread_mutex_t window_mutex;
+    pthread_cond_t window_cond;     // slots released
+    pthread_cond_t complete_cond;   // results received
+    pthread_cond_t sent_cond;       // all payloads of a write sent
+    
+    /* degraded and hedged reads, the histogram is updated atomically */
+    uint32_t read_degraded_timeout;     // ms
+    double read_hedge_pct;              // 0 disables hedging
+    uint64_t read_hist[SPN_READ_HIST_BUCKETS];
+    uint64_t reads_done;
+    uint64_t reads_degraded;
     bool pingpongflag;
     
     Logger *log;
@@ -85,9 +157,13 @@ private:
     pthread_mutex_t seqnum_mutex;
     //uint32_t getSequenceNumber();
     int run();
-    int perform_stripewrite(struct operation_client_write *p_op);
-    int perform_stripeunitwrite(struct operation_client_write *p_op);
-    int perform_Direct_write(struct operation_client_write *p_op);
+    int perform_stripewrite(struct operation_client_write *p_op, uint32_t *p_sending);
+    int perform_stripeunitwrite(struct operation_client_write *p_op, uint32_t *p_sending);
+    int perform_Direct_write(struct operation_client_write *p_op, uint32_t *p_sending);
+    void window_acquire(InodeNumber inum, std::vector<serverid_t> *p_servers);
+    void window_release(InodeNumber inum, std::vector<serverid_t> *p_servers);
+    void finish_write(struct spn_write_handle *p_handle, int rc);
+    void wait_sent(struct operation_composite *op);
 };
 
 #endif	/* SPNETRAID_CLIENT_H */
@@ -101,6 +101,8 @@ union SPN_message {
 struct spn_task {
     union SPN_message   *p_msg;
     serverid_t          receiver;
+    uint32_t            *p_sending; // datablock borrowed from the caller
+    bool                pooled;     // datablock from slab_payload_alloc
 };
 
 void print_SPHead(struct SPHead *p_head, stringstream& ss);
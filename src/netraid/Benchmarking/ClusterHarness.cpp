@@ -0,0 +1,327 @@
+/*
+ * File:   ClusterHarness.cpp
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fstream>
+#include <sstream>
+
+#include "global_types.h"
+#include "custom_protocols/global_protocol_data.h"
+#include "tools/sys_tools.h"
+#include "Benchmarking/ClusterHarness.h"
+
+/* the running harness, stopped at exit or on a signal */
+static ClusterHarness *active_harness = NULL;
+
+static void cluster_harness_atexit()
+{
+    if (active_harness!=NULL)
+    {
+        active_harness->stop();
+    }
+}
+
+/**
+ * @brief stops the harness, then takes the default action. stop only
+ * kills, waits and renames, the harness log is not used.
+ */
+static void cluster_harness_signal(int sig)
+{
+    cluster_harness_atexit();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+ClusterHarness::ClusterHarness(Logger *p_log, std::string dir, std::string dsbin, std::string mdsbin)
+{
+    log = p_log;
+    this->dir = dir;
+    this->dsbin = dsbin;
+    this->mdsbin = mdsbin;
+    mds_pid = -1;
+}
+
+ClusterHarness::~ClusterHarness()
+{
+    stop();
+}
+
+uint32_t ClusterHarness::get_dataservers()
+{
+    return ds_pids.size();
+}
+
+/**
+ * @brief copies a config template, replaces the values of the given keys
+ * and removes the keys starting with drop_prefix. The current target is
+ * kept as .bak and restored by stop().
+ */
+int ClusterHarness::write_config(std::string src, std::string target,
+        std::map<std::string,std::string>& values, std::vector<std::string>& append, std::string drop_prefix)
+{
+    std::ifstream in(src.c_str());
+    if (!in.is_open())
+    {
+        log->error_log("config template %s not found",src.c_str());
+        return -1;
+    }
+    std::string bak = target+".bak";
+    if (access(bak.c_str(), F_OK)==0)
+    {
+        // left by a harness that did not stop, it holds the previous config
+        backups.push_back(target);
+    }
+    else if (access(target.c_str(), F_OK)==0)
+    {
+        if (rename(target.c_str(), bak.c_str()))
+        {
+            log->error_log("%s not saved:%s",target.c_str(),strerror(errno));
+            return -1;
+        }
+        backups.push_back(target);
+    }
+    else
+    {
+        generated.push_back(target);
+    }
+    std::stringstream ss("");
+    std::string line;
+    while (std::getline(in, line))
+    {
+        size_t pos = line.find('=');
+        std::string key = (pos==std::string::npos) ? std::string("") : line.substr(0,pos);
+        std::map<std::string,std::string>::iterator it = values.find(key);
+        if (it!=values.end())
+        {
+            ss << key << "=" << it->second << "\n";
+            values.erase(it);
+        }
+        else if (drop_prefix.empty() || key.compare(0, drop_prefix.size(), drop_prefix) ||
+                key.size()==drop_prefix.size() || !isdigit(key[drop_prefix.size()]))
+        {
+            ss << line << "\n";
+        }
+    }
+    std::map<std::string,std::string>::iterator it = values.begin();
+    for (it; it!=values.end(); it++)
+    {
+        ss << it->first << "=" << it->second << "\n";
+    }
+    std::vector<std::string>::iterator it2 = append.begin();
+    for (it2; it2!=append.end(); it2++)
+    {
+        ss << *it2 << "\n";
+    }
+    std::ofstream out(target.c_str());
+    out << ss.str();
+    out.close();
+    if (out.fail())
+    {
+        log->error_log("%s not written",target.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief starts bin with one argument, stdin from /dev/null, stdout and
+ * stderr to out
+ */
+pid_t ClusterHarness::spawn(std::string bin, std::string arg, std::string out)
+{
+    pid_t pid = fork();
+    if (pid==0)
+    {
+        int in = open("/dev/null", O_RDONLY);
+        int fd = open(out.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if (in>=0) dup2(in, STDIN_FILENO);
+        if (fd>=0)
+        {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+        }
+        if (arg.empty())
+        {
+            execl(bin.c_str(), bin.c_str(), (char*) NULL);
+        }
+        else
+        {
+            execl(bin.c_str(), bin.c_str(), arg.c_str(), (char*) NULL);
+        }
+        fprintf(stderr, "exec %s failed:%s\n", bin.c_str(), strerror(errno));
+        _exit(127);
+    }
+    if (pid<0)
+    {
+        log->error_log("fork failed:%s",strerror(errno));
+    }
+    return pid;
+}
+
+/**
+ * @brief waits until the process accepts connections on the local port
+ */
+int ClusterHarness::wait_listen(pid_t pid, uint16_t port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    for (int i=0; i<CLUSTER_HARNESS_START_TIMEOUT*10; i++)
+    {
+        int status;
+        if (waitpid(pid, &status, WNOHANG)==pid)
+        {
+            log->error_log("process %d exited before listening on %u",pid,port);
+            return -1;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int rc = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+        close(fd);
+        if (rc==0) return 0;
+        usleep(100000);
+    }
+    log->error_log("nothing listens on %u",port);
+    return -1;
+}
+
+/**
+ * @brief generates the configs and starts the data servers, then the
+ * metadata server. Returns once all of them accept connections.
+ */
+int ClusterHarness::start(uint32_t dataservers)
+{
+    if (!ds_pids.empty() || mds_pid>0) return -1;
+    if (active_harness!=NULL && active_harness!=this)
+    {
+        log->error_log("another harness is running");
+        return -1;
+    }
+    static bool registered=false;
+    if (!registered)
+    {
+        // workers exit on errors, the servers and configs must not outlive them
+        atexit(&cluster_harness_atexit);
+        signal(SIGINT, &cluster_harness_signal);
+        signal(SIGTERM, &cluster_harness_signal);
+        signal(SIGHUP, &cluster_harness_signal);
+        registered = true;
+    }
+    active_harness = this;
+    xsystools_fs_mkdir(dir);
+    xsystools_fs_mkdir(dir+"/storage");
+    xsystools_fs_mkdir("/etc/r2d2");
+
+    std::map<std::string,std::string> dsvalues;
+    std::vector<std::string> none;
+    dsvalues["storage"] = dir+"/storage";
+    dsvalues["mds"] = "127.0.0.1";
+    int rc = write_config(std::string(CLUSTER_HARNESS_CONF_DIR)+"/main_ds.conf",
+            std::string(DS_CONFIG_FILE), dsvalues, none, std::string(""));
+    if (rc)
+    {
+        stop();
+        return rc;
+    }
+
+    // the data servers are started here, the ssh launch of the mds is a no-op
+    std::map<std::string,std::string> mdsvalues;
+    std::vector<std::string> dslines;
+    mdsvalues["ds.bin"] = "true";
+    for (uint32_t i=0; i<dataservers; i++)
+    {
+        std::stringstream ss("");
+        ss << "ds" << i << "=127.0.0.1";
+        dslines.push_back(ss.str());
+    }
+    rc = write_config(std::string(CLUSTER_HARNESS_CONF_DIR)+"/mds.conf",
+            std::string(MDS_CONFIG_FILE), mdsvalues, dslines, std::string("ds"));
+    if (rc)
+    {
+        stop();
+        return rc;
+    }
+
+    for (uint32_t i=0; i<dataservers; i++)
+    {
+        std::stringstream id("");
+        id << i;
+        pid_t pid = spawn(dsbin, id.str(), dir+"/ds"+id.str()+".out");
+        if (pid<0)
+        {
+            stop();
+            return -1;
+        }
+        ds_pids.push_back(pid);
+    }
+    for (uint32_t i=0; i<dataservers; i++)
+    {
+        if (wait_listen(ds_pids[i], SPN_ASIO_BASEPORT+i))
+        {
+            stop();
+            return -1;
+        }
+    }
+    mds_pid = spawn(mdsbin, std::string(""), dir+"/mds.out");
+    if (mds_pid<0 || wait_listen(mds_pid, DEF_MDS_PORT))
+    {
+        stop();
+        return -1;
+    }
+    log->debug_log("%u data servers and the mds are up",dataservers);
+    return 0;
+}
+
+/**
+ * @brief terminates the processes, restores the previous configs and
+ * removes the generated ones
+ */
+int ClusterHarness::stop()
+{
+    if (mds_pid>0)
+    {
+        kill(mds_pid, SIGTERM);
+        waitpid(mds_pid, NULL, 0);
+        mds_pid = -1;
+    }
+    std::vector<pid_t>::iterator it = ds_pids.begin();
+    for (it; it!=ds_pids.end(); it++)
+    {
+        kill(*it, SIGTERM);
+    }
+    for (it=ds_pids.begin(); it!=ds_pids.end(); it++)
+    {
+        waitpid(*it, NULL, 0);
+    }
+    ds_pids.clear();
+    std::vector<std::string>::iterator it2 = backups.begin();
+    for (it2; it2!=backups.end(); it2++)
+    {
+        std::string bak = *it2+".bak";
+        rename(bak.c_str(), it2->c_str());
+    }
+    backups.clear();
+    for (it2=generated.begin(); it2!=generated.end(); it2++)
+    {
+        unlink(it2->c_str());
+    }
+    generated.clear();
+    if (active_harness==this)
+    {
+        active_harness = NULL;
+    }
+    return 0;
+}
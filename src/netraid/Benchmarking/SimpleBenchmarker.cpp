@@ -1,8 +1,12 @@
 
 #include <iosfwd>
 #include <sstream>
+#include <set>
+#include <algorithm>
+#include <math.h>
 
 #include "Benchmarking/SimpleBenchmarker.h"
+#include "Benchmarking/ClusterHarness.h"
 
 void *diskwrite(void *data);
 
@@ -516,6 +520,167 @@ void *write_only(void *data)
 }
 
 
+/**
+ * @brief writes the stripe of the thread as single stripe units. Every unit
+ * write reads the old unit and parity, the baseline of the full stripe path.
+ */
+void *write_units(void *data)
+{
+    struct thread_data *tdata = (struct thread_data*)data;
+    Client *p_cl = tdata->p_cl;
+    int rc=0;
+    uint32_t operation_iter=0;
+    struct filelayout_raid4 *flr4 = (struct filelayout_raid4 *) &tdata->einode->inode.layout_info[0];
+    size_t unitsize = flr4->stripeunitsize;
+    size_t opsize = tdata->end-tdata->start;
+
+    struct timertimes  start_latencytime;
+    double latency;
+    double diff;
+    tdata->starttime = timer_start();
+    double latency_av = 0.0;
+    double latency_min = 100.0;
+    double latency_max = 0.0;
+    for (int i=0; i<tdata->iterations;i++)
+    {
+        start_latencytime=timer_start();
+        for (size_t off=0; off<opsize; off+=unitsize)
+        {
+            rc = p_cl->handle_write(tdata->einode,tdata->start+off,unitsize,(char*)tdata->data+off);
+            if (rc) 
+            {
+                printf("ERROR write operation.\n");
+                exit(1);   
+            }
+        }
+        latency = timer_end(start_latencytime);
+        if (latency<latency_min) latency_min=latency;
+        if (latency>latency_max) latency_max=latency;
+        latency_av += latency;
+        
+        operation_iter++;
+        if (operation_iter%INTERVAL == 0)
+        {
+            diff = timer_end(tdata->starttime);   
+            struct resultdata *resdata = new struct resultdata;
+            resdata->opspersec = (operation_iter*1.0)/(diff);
+            resdata->latency_av = latency_av/INTERVAL;
+            resdata->latency_max=latency_max;
+            resdata->latency_min=latency_min;
+            printf("Ops:%u, Average Ops/sec:%f, latency_av:%f.\n",operation_iter,resdata->opspersec, resdata->latency_av);
+            tdata->results->insert(std::pair<uint32_t,struct resultdata*>(operation_iter,resdata));   
+            latency_av = 0.0;
+            latency_min = 100.0;
+            latency_max = 0.0;
+        }                
+    }
+    tdata->success=1;
+}
+
+/* completions of the asynchronous writes of one benchmark thread */
+struct pipeline_state
+{
+    struct thread_data  *tdata;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;
+    uint32_t            completed;
+    int                 failed;
+    double              latency_av;
+    double              latency_min;
+    double              latency_max;
+};
+
+struct pipeline_op
+{
+    struct pipeline_state   *state;
+    struct timertimes       start;
+};
+
+static void pipeline_done(struct spn_write_handle *p_handle, void *arg)
+{
+    struct pipeline_op *p_op = (struct pipeline_op *) arg;
+    struct pipeline_state *p_state = p_op->state;
+    double latency = timer_end(p_op->start);
+    pthread_mutex_lock(&p_state->mutex);
+    if (p_handle->rc) p_state->failed++;
+    if (latency<p_state->latency_min) p_state->latency_min=latency;
+    if (latency>p_state->latency_max) p_state->latency_max=latency;
+    p_state->latency_av += latency;
+    p_state->completed++;
+    if (p_state->completed%INTERVAL == 0)
+    {
+        double diff = timer_end(p_state->tdata->starttime);
+        struct resultdata *resdata = new struct resultdata;
+        resdata->opspersec = (p_state->completed*1.0)/(diff);
+        resdata->latency_av = p_state->latency_av/INTERVAL;
+        resdata->latency_max=p_state->latency_max;
+        resdata->latency_min=p_state->latency_min;
+        printf("Ops:%u, Average Ops/sec:%f, latency_av:%f.\n",p_state->completed,resdata->opspersec, resdata->latency_av);
+        p_state->tdata->results->insert(std::pair<uint32_t,struct resultdata*>(p_state->completed,resdata));
+        p_state->latency_av = 0.0;
+        p_state->latency_min = 100.0;
+        p_state->latency_max = 0.0;
+    }
+    pthread_cond_signal(&p_state->cond);
+    pthread_mutex_unlock(&p_state->mutex);
+    delete p_op;
+}
+
+/**
+ * @brief like write_only, but issues the writes without waiting for the
+ * previous result. The client write window limits the writes in flight.
+ */
+void *write_pipelined(void *data)
+{
+    struct thread_data *tdata = (struct thread_data*)data;
+    Client *p_cl = tdata->p_cl;
+    int rc=0;
+    tdata->starttime = timer_start();
+    
+    size_t opsize = tdata->end-tdata->start;
+    char *randdata=(char*)malloc(opsize+1);
+    memset(randdata,0,opsize+1);
+    sprintf(randdata,"%s",tdata->data);
+    
+    struct pipeline_state state;
+    state.tdata = tdata;
+    state.completed = 0;
+    state.failed = 0;
+    state.latency_av = 0.0;
+    state.latency_min = 100.0;
+    state.latency_max = 0.0;
+    pthread_mutex_init(&state.mutex, NULL);
+    pthread_cond_init(&state.cond, NULL);
+    for (int i=0; i<tdata->iterations;i++)
+    {
+        struct pipeline_op *p_op = new struct pipeline_op;
+        p_op->state = &state;
+        p_op->start = timer_start();
+        rc = p_cl->handle_write_async(tdata->einode,tdata->start,opsize,randdata,&pipeline_done,p_op,NULL);
+        if (rc)
+        {
+            printf("ERROR write operation.\n");
+            exit(1);
+        }
+    }
+    pthread_mutex_lock(&state.mutex);
+    while (state.completed<tdata->iterations)
+    {
+        pthread_cond_wait(&state.cond, &state.mutex);
+    }
+    pthread_mutex_unlock(&state.mutex);
+    if (state.failed)
+    {
+        printf("ERROR write operation.\n");
+        exit(1);
+    }
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.mutex);
+    tdata->success=1;
+    free(randdata);
+}
+
+
 void *write_locked(void *data)
 {
     struct thread_data *tdata = (struct thread_data*)data;
@@ -682,6 +847,201 @@ void *readonly(void *data)
     //printf("exit\n");
 }
 
+
+/* one thread of the mixed workload, every thread has its own region of
+ * span operations, conflicting operations go to the first one which is
+ * shared by all threads */
+void *mixed_worker(void *data)
+{
+    struct thread_data *tdata = (struct thread_data*)data;
+    struct mix_params *mix = tdata->mix;
+    Client *p_cl = tdata->p_cl;
+    serverid_t mds=0;
+    int rc;
+    size_t opsize = tdata->end-tdata->start;
+    void *dataread = malloc(opsize+1);
+
+    // the region is read before it is written otherwise
+    if (mix->readpct>0)
+    {
+        for (uint32_t i=0; i<mix->span; i++)
+        {
+            p_cl->handle_write(tdata->einode,tdata->start+i*opsize,opsize,tdata->data);
+        }
+    }
+    tdata->starttime = timer_start();
+    for (int i=0; i<tdata->iterations; i++)
+    {
+        size_t offset;
+        if ((uint32_t)(rand_r(&tdata->seed)%100) < mix->conflictpct)
+        {
+            offset = 0;
+        }
+        else if (mix->random)
+        {
+            offset = tdata->start+(rand_r(&tdata->seed)%mix->span)*opsize;
+        }
+        else
+        {
+            offset = tdata->start+(i%mix->span)*opsize;
+        }
+        enum mixop op = mix_read;
+        if ((uint32_t)(rand_r(&tdata->seed)%100) >= mix->readpct)
+        {
+            op = ((uint32_t)(rand_r(&tdata->seed)%100) < mix->lockpct) ? mix_lockedwrite : mix_write;
+        }
+
+        struct timertimes start_latencytime = timer_start();
+        if (op==mix_read)
+        {
+            rc = p_cl->handle_read(tdata->einode,offset,opsize,&dataread);
+        }
+        else if (op==mix_write)
+        {
+            rc = p_cl->handle_write(tdata->einode,offset,opsize,tdata->data);
+        }
+        else
+        {
+            uint64_t lockstart = offset;
+            uint64_t lockend = offset+opsize;
+            rc = p_cl->acquireByteRangeLock(&mds,&tdata->einode->inode.inode_number,&lockstart,&lockend);
+            if (!rc)
+            {
+                rc = p_cl->handle_write_lock(tdata->einode,offset,opsize,tdata->data);
+                p_cl->releaselock(&mds,&tdata->einode->inode.inode_number,&lockstart,&lockend);
+            }
+        }
+        double latency = timer_end(start_latencytime);
+        if (rc)
+        {
+            tdata->errors++;
+            continue;
+        }
+        tdata->hist[op].record((uint64_t)(latency*1000000));
+    }
+    tdata->success=1;
+    free(dataread);
+    return NULL;
+}
+
+#define CCC_TAG_MAGIC       0x43434354
+#define CCC_PRIVATE_SPAN    16      // private stripes per thread
+
+/* written at the start of every stripe unit, tells which write it came from */
+struct ccc_tag
+{
+    uint32_t magic;
+    uint32_t writer;
+    uint32_t seq;
+};
+
+/**
+ * @brief cumulative distribution of a zipf law with exponent s over n ids
+ */
+static void zipf_cdf(uint32_t n, double s, std::vector<double> *cdf)
+{
+    double sum = 0;
+    cdf->clear();
+    for (uint32_t k=1; k<=n; k++)
+    {
+        sum += 1.0/pow(k, s);
+        cdf->push_back(sum);
+    }
+    std::vector<double>::iterator it = cdf->begin();
+    for (it; it!=cdf->end(); it++)
+    {
+        *it /= sum;
+    }
+}
+
+static uint32_t zipf_next(std::vector<double> *cdf, unsigned int *seed)
+{
+    double u = rand_r(seed)/(RAND_MAX+1.0);
+    std::vector<double>::iterator it = std::lower_bound(cdf->begin(), cdf->end(), u);
+    return (it==cdf->end()) ? cdf->size()-1 : it-cdf->begin();
+}
+
+static void ccc_tag_units(void *data, size_t length, size_t susize, uint32_t writer, uint32_t seq)
+{
+    struct ccc_tag tag;
+    tag.magic = CCC_TAG_MAGIC;
+    tag.writer = writer;
+    tag.seq = seq;
+    for (size_t off=0; off+sizeof(tag)<=length; off+=susize)
+    {
+        memcpy((char*)data+off, &tag, sizeof(tag));
+    }
+}
+
+/* one client of the conflict workload, writes full stripes either to the
+ * shared stripes picked by the zipf law or to its private ones. An aborted
+ * write is retried up to ccc->retries times. */
+void *conflict_worker(void *data)
+{
+    struct thread_data *tdata = (struct thread_data*)data;
+    struct conflict_params *ccc = tdata->ccc;
+    Client *p_cl = tdata->p_cl;
+    serverid_t mds=0;
+    size_t stripesize = tdata->end-tdata->start;
+
+    tdata->starttime = timer_start();
+    for (int i=0; i<tdata->iterations; i++)
+    {
+        size_t offset;
+        if ((uint32_t)(rand_r(&tdata->seed)%100) < ccc->overlappct)
+        {
+            uint32_t sid = zipf_next(ccc->cdf, &tdata->seed);
+            offset = sid*stripesize;
+            if (ccc->units>1 && (uint32_t)(rand_r(&tdata->seed)%100) < ccc->partialpct)
+            {
+                // overlaps sid and sid+1 instead of matching one stripe
+                offset += (1+rand_r(&tdata->seed)%(ccc->units-1))*ccc->suSize;
+                __sync_lock_test_and_set(&ccc->partial[sid], 1);
+                __sync_lock_test_and_set(&ccc->partial[sid+1], 1);
+            }
+        }
+        else
+        {
+            offset = tdata->start+(rand_r(&tdata->seed)%CCC_PRIVATE_SPAN)*stripesize;
+        }
+        ccc_tag_units(tdata->data, stripesize, ccc->suSize, tdata->id, i+1);
+
+        struct timertimes start_latencytime = timer_start();
+        int rc = -1;
+        for (uint32_t attempt=0; attempt<=ccc->retries; attempt++)
+        {
+            if (attempt>0) tdata->retries++;
+            if (tdata->lockmode)
+            {
+                uint64_t lockstart = offset;
+                uint64_t lockend = offset+stripesize;
+                rc = p_cl->acquireByteRangeLock(&mds,&tdata->einode->inode.inode_number,&lockstart,&lockend);
+                if (!rc)
+                {
+                    rc = p_cl->handle_write_lock(tdata->einode,offset,stripesize,tdata->data);
+                    p_cl->releaselock(&mds,&tdata->einode->inode.inode_number,&lockstart,&lockend);
+                }
+            }
+            else
+            {
+                rc = p_cl->handle_write(tdata->einode,offset,stripesize,tdata->data);
+            }
+            if (!rc) break;
+            tdata->aborts++;
+        }
+        double latency = timer_end(start_latencytime);
+        if (rc)
+        {
+            tdata->errors++;
+            continue;
+        }
+        tdata->commits++;
+        tdata->hist->record((uint64_t)(latency*1000000));
+    }
+    tdata->success=1;
+    return NULL;
+}
+
 SimpleBenchmarker::SimpleBenchmarker(int iter, int threads, std::string logloc)
 {
     log = new Logger();
@@ -697,6 +1057,22 @@ SimpleBenchmarker::SimpleBenchmarker(int iter, int threads, std::string logloc)
     iterations = iter;
     this->threads = threads;
     this->sync=true;
+    this->rmwcompare=false;
+    this->dataservers=0;
+    mix.readpct=50;
+    mix.lockpct=0;
+    mix.conflictpct=0;
+    mix.opsize=0;
+    mix.random=true;
+    mix.span=16;
+    ccc.stripes=64;
+    ccc.overlappct=50;
+    ccc.partialpct=0;
+    ccc.zipf=0.99;
+    ccc.retries=8;
+    ccc.baseline=true;
+    ccc.cdf=NULL;
+    ccc.partial=NULL;
 }
 
 SimpleBenchmarker::~SimpleBenchmarker()
@@ -752,6 +1128,27 @@ struct thread_data* SimpleBenchmarker::newThreadDataS(struct EInode *einode, Str
     return p1;
 }
 
+struct thread_data* SimpleBenchmarker::newThreadDataMix(struct EInode *einode, int id, size_t opsize)
+{
+    struct thread_data *p1 = new struct thread_data;
+    p1->id = id;
+    p1->einode = einode;
+    // the first operation slot is shared by all threads
+    p1->start = opsize*(1+id*mix.span);
+    p1->end = p1->start+opsize;
+    p1->data = malloc(opsize+1);
+    gen_string(opsize, (char*) p1->data);
+    p1->p_cl = cl;
+    p1->success=0;
+    p1->errors=0;
+    p1->iterations=iterations;
+    p1->results = new std::map<uint32_t, struct resultdata*>();
+    p1->mix = &mix;
+    p1->hist = new LatencyHistogram[MIX_OPS];
+    p1->seed = time(NULL)+id;
+    return p1;
+}
+
 void SimpleBenchmarker::write_result(const char *path, std::stringstream& ss)
 {
     log->debug_log("Writing:%s.",path);
@@ -844,23 +1241,54 @@ int SimpleBenchmarker::eval_StripeUnit()
     return rc;
 }
 
+/**
+ * @brief sequential full stripe writes. With rmwcompare the same stripes are
+ * written again unit by unit, which takes the read-modify-write path, and
+ * the throughput gain of the full stripe path is reported.
+ */
 int SimpleBenchmarker::eval_Stripe()
 {
     log->debug_log("Start");
-    setup();/*
-    std::stringstream name("");    
-    name << "/tmp/SingleStripe_";
-    name << iterations;
-    std:string tt =  get_time();
-    name << "_" << tt.c_str();
-    name << ".log";
-    log->set_log_location(name.str().c_str());*/
+    setup();
+    int rc=0;
+    double fullrate = run_Stripe(stripe);
+    if (fullrate<0) return -1;
+    printf("Full stripe writes: %f MB/sec\n",fullrate);
+    if (rmwcompare)
+    {
+        double rmwrate = run_Stripe(stripermw);
+        if (rmwrate<0) return -1;
+        printf("Read-modify-write unit writes: %f MB/sec\n",rmwrate);
+        if (rmwrate>0)
+        {
+            printf("Full stripe gain: %.2fx\n",fullrate/rmwrate);
+        }
+        std::stringstream ss("");
+        ss << "Fullstripe MB/sec,RMW MB/sec,Gain;\n";
+        ss << fullrate << "," << rmwrate << "," << ((rmwrate>0) ? fullrate/rmwrate : 0) << ";\n";
+        std::stringstream filename("");
+        filename << "/tmp/SiBe_SGAIN_" << iterations << "_"<< threads << "_" << get_time() << ".csv";
+        write_result(filename.str().c_str(),ss);
+    }
+    log->debug_log("Done");
+    return rc;
+}
+
+/**
+ * @brief one thread per stripe of a new file, each writes its stripe
+ * iterations times.
+ * @return MB/sec over all threads, negative on error
+ */
+double SimpleBenchmarker::run_Stripe(enum benchtype bench)
+{
     InodeNumber inum;
     int rc = createRandomFile(&inum);
+    if (rc) return -1;
     
     struct EInode einode;
     rc = cl->p_pnfs_cl->meta_get_file_inode(&root, &inum , &einode);
     log->debug_log("get einode:%d,inum:%llu.\n",rc,inum);
+    if (rc) return -1;
 
     std::vector<struct thread_data*> *vec = new std::vector<struct thread_data*>();
     for (int i=0; i<threads; i++)
@@ -868,20 +1296,62 @@ int SimpleBenchmarker::eval_Stripe()
         vec->push_back(newThreadDataS(&einode,i));
     }    
     log->debug_log("created file... inum:%llu",inum);  
-    rc = perform(vec, &write_only);
-     
-    analyse(vec,stripe,this->threads);
+    struct timertimes start = timer_start();
+    if (bench==stripermw)
+    {
+        rc = perform(vec, &write_units);
+    }
+    else
+    {
+        rc = perform(vec, &write_only);
+    }
+    double diff = timer_end(start);
+    analyse(vec,bench,this->threads);
     
+    filelayout_raid *fl = (filelayout_raid *) &einode.inode.layout_info[0];
+    size_t stripesize = (fl->raid4.groupsize-1)*fl->raid4.stripeunitsize;
+    double rate = (diff>0) ? (1.0*threads*iterations*stripesize)/(1024*1024)/diff : 0;
+    log->debug_log("bench:%u, rate:%f MB/sec",bench,rate);
+
     std::vector<struct thread_data*>::iterator it = vec->begin();
-    /*while (it !=vec->end())
+    for (it; it!=vec->end(); it++)
     {
-        vec->erase(it++);
-    }*/
+        std::map<uint32_t, struct resultdata*>::iterator rit = (*it)->results->begin();
+        for (rit; rit!=(*it)->results->end(); rit++)
+        {
+            delete rit->second;
+        }
+        free((*it)->data);
+        delete (*it)->results;
+        delete *it;
+    }
+    delete vec;
+    return rate;
+}
+
+
+int SimpleBenchmarker::eval_Stripe_pipelined()
+{
+    log->debug_log("Start");
+    setup();
+    InodeNumber inum;
+    int rc = createRandomFile(&inum);
+    
+    struct EInode einode;
+    rc = cl->p_pnfs_cl->meta_get_file_inode(&root, &inum , &einode);
+    log->debug_log("get einode:%d,inum:%llu.\n",rc,inum);
+
+    std::vector<struct thread_data*> *vec = new std::vector<struct thread_data*>();
+    for (int i=0; i<threads; i++)
+    {
+        vec->push_back(newThreadDataS(&einode,i));
+    }    
+    rc = perform(vec, &write_pipelined);
+    analyse(vec,stripepipelined,this->threads);
     log->debug_log("Done");
     return rc;
 }
 
-
 int SimpleBenchmarker::eval_Stripe_lockmode()
 {
     log->debug_log("starting lockmode");
@@ -968,6 +1438,263 @@ int SimpleBenchmarker::eval_ReadSU()
     return rc;
 }
 
+/**
+ * @brief runs the mixed read/write/lock workload with all threads on one
+ * file and writes the latency percentiles per operation as json and csv
+ */
+int SimpleBenchmarker::eval_Mixed()
+{
+    log->debug_log("starting mixed workload");
+    setup();
+    InodeNumber inum;
+    int rc = createRandomFile(&inum);
+    if (rc) return rc;
+    struct EInode einode;
+    rc = cl->p_pnfs_cl->meta_get_file_inode(&root, &inum , &einode);
+    if (rc) return rc;
+    struct filelayout_raid4 *flr4 = (struct filelayout_raid4 *) &einode.inode.layout_info[0];
+    size_t opsize = mix.opsize;
+    if (opsize==0) opsize = (flr4->groupsize-1)*flr4->stripeunitsize;
+    if (mix.span==0) mix.span=1;
+
+    std::vector<struct thread_data*> *vec = new std::vector<struct thread_data*>();
+    for (int i=0; i<threads; i++)
+    {
+        vec->push_back(newThreadDataMix(&einode,i,opsize));
+    }
+    if (mix.readpct>0)
+    {
+        cl->handle_write(&einode,0,opsize,vec->front()->data);
+    }
+    struct timertimes start = timer_start();
+    rc = perform(vec, &mixed_worker);
+    double diff = timer_end(start);
+
+    LatencyHistogram all;
+    LatencyHistogram total[MIX_OPS];
+    int errors=0;
+    std::vector<struct thread_data*>::iterator it = vec->begin();
+    for (it; it!=vec->end(); it++)
+    {
+        for (int op=0; op<MIX_OPS; op++)
+        {
+            total[op].merge((*it)->hist[op]);
+            all.merge((*it)->hist[op]);
+        }
+        errors += (*it)->errors;
+    }
+    double opspersec = all.get_count()/diff;
+    double mbpersec = opspersec*opsize/(1024*1024);
+    const char *names[MIX_OPS] = {"read", "write", "locked_write"};
+
+    std::stringstream json("");
+    json << "{\"benchmark\":\"mix\",\"dataservers\":" << dataservers;
+    json << ",\"threads\":" << threads << ",\"iterations\":" << iterations;
+    json << ",\"size\":" << opsize << ",\"read_pct\":" << mix.readpct;
+    json << ",\"lock_pct\":" << mix.lockpct << ",\"conflict_pct\":" << mix.conflictpct;
+    json << ",\"offsets\":\"" << (mix.random ? "random" : "seq") << "\",\"span\":" << mix.span;
+    json << ",\"seconds\":" << diff << ",\"ops_per_sec\":" << opspersec;
+    json << ",\"mb_per_sec\":" << mbpersec << ",\"errors\":" << errors;
+    json << ",\"latency_us\":{";
+    for (int op=0; op<MIX_OPS; op++)
+    {
+        json << "\"" << names[op] << "\":" << total[op].to_json() << ",";
+    }
+    json << "\"all\":" << all.to_json() << "}}\n";
+
+    std::stringstream csv("");
+    csv << "op;count;ops_per_sec;min_us;mean_us;p50_us;p99_us;p999_us;max_us\n";
+    for (int op=0; op<=MIX_OPS; op++)
+    {
+        LatencyHistogram *h = (op<MIX_OPS) ? &total[op] : &all;
+        csv << ((op<MIX_OPS) ? names[op] : "all") << ";" << h->get_count() << ";";
+        csv << h->get_count()/diff << ";" << h->get_min() << ";" << h->get_mean() << ";";
+        csv << h->percentile(50) << ";" << h->percentile(99) << ";" << h->percentile(99.9) << ";";
+        csv << h->get_max() << "\n";
+    }
+    printf("%s", json.str().c_str());
+
+    std::stringstream filename("");
+    filename << "/tmp/SiBe_MIX_" << iterations << "_" << threads << "_" << get_time();
+    write_result((filename.str()+".json").c_str(), json);
+    write_result((filename.str()+".csv").c_str(), csv);
+
+    for (it=vec->begin(); it!=vec->end(); it++)
+    {
+        free((*it)->data);
+        delete[] (*it)->hist;
+        delete (*it)->results;
+        delete *it;
+    }
+    delete vec;
+    log->debug_log("Done");
+    return (errors>0) ? -1 : rc;
+}
+
+/**
+ * @brief one run of the conflict workload on a new file, appends the
+ * counters of the run to json and csv
+ * @param lockmode every write takes a byte range lock first, the slk way
+ */
+int SimpleBenchmarker::run_Conflict(bool lockmode, unsigned int seed, std::stringstream& json, std::stringstream& csv)
+{
+    InodeNumber inum;
+    int rc = createRandomFile(&inum);
+    if (rc) return rc;
+    struct EInode einode;
+    rc = cl->p_pnfs_cl->meta_get_file_inode(&root, &inum , &einode);
+    if (rc) return rc;
+    struct filelayout_raid4 *flr4 = (struct filelayout_raid4 *) &einode.inode.layout_info[0];
+    ccc.suSize = flr4->stripeunitsize;
+    ccc.units = flr4->groupsize-1;
+    size_t stripesize = ccc.units*ccc.suSize;
+
+    // shifted writes reach into the stripe after the shared ones
+    ccc.partial = new uint32_t[ccc.stripes+1];
+    memset(ccc.partial, 0, sizeof(uint32_t)*(ccc.stripes+1));
+    void *buf = malloc(stripesize+1);
+    gen_string(stripesize, (char*) buf);
+    ccc_tag_units(buf, stripesize, ccc.suSize, UINT32_MAX, 0);
+    for (uint32_t sid=0; sid<=ccc.stripes; sid++)
+    {
+        cl->handle_write(&einode,sid*stripesize,stripesize,buf);
+    }
+
+    std::vector<struct thread_data*> *vec = new std::vector<struct thread_data*>();
+    for (int i=0; i<threads; i++)
+    {
+        struct thread_data *p = new struct thread_data;
+        p->id = i;
+        p->einode = &einode;
+        p->start = stripesize*(ccc.stripes+1+i*CCC_PRIVATE_SPAN);
+        p->end = p->start+stripesize;
+        p->data = malloc(stripesize+1);
+        gen_string(stripesize, (char*) p->data);
+        p->p_cl = cl;
+        p->lockmode = lockmode;
+        p->success = 0;
+        p->errors = 0;
+        p->iterations = iterations;
+        p->results = new std::map<uint32_t, struct resultdata*>();
+        p->ccc = &ccc;
+        p->hist = new LatencyHistogram();
+        p->seed = seed+i;
+        p->commits = 0;
+        p->aborts = 0;
+        p->retries = 0;
+        vec->push_back(p);
+    }
+    struct timertimes start = timer_start();
+    rc = perform(vec, &conflict_worker);
+    double diff = timer_end(start);
+
+    LatencyHistogram hist;
+    uint64_t commits=0, aborts=0, retries=0, failed=0;
+    std::vector<struct thread_data*>::iterator it = vec->begin();
+    for (it; it!=vec->end(); it++)
+    {
+        hist.merge(*(*it)->hist);
+        commits += (*it)->commits;
+        aborts += (*it)->aborts;
+        retries += (*it)->retries;
+        failed += (*it)->errors;
+    }
+
+    // a stripe whose units come from different writes has diverged, only
+    // stripes without shifted writes are expected to be uniform
+    uint32_t checked=0, divergent=0, unreadable=0;
+    size_t maxversions=0;
+    for (uint32_t sid=0; sid<=ccc.stripes; sid++)
+    {
+        if (ccc.partial[sid]) continue;
+        if (cl->handle_read(&einode,sid*stripesize,stripesize,&buf))
+        {
+            unreadable++;
+            continue;
+        }
+        std::set<uint64_t> versions;
+        for (uint32_t u=0; u<ccc.units; u++)
+        {
+            struct ccc_tag tag;
+            memcpy(&tag, (char*)buf+u*ccc.suSize, sizeof(tag));
+            versions.insert((tag.magic==CCC_TAG_MAGIC) ? ((uint64_t)tag.writer<<32)|tag.seq : UINT64_MAX);
+        }
+        checked++;
+        if (versions.size()>1) divergent++;
+        if (versions.size()>maxversions) maxversions=versions.size();
+    }
+
+    const char *mode = lockmode ? "lock" : "ccc";
+    double commitspersec = commits/diff;
+    double mbpersec = commitspersec*stripesize/(1024*1024);
+    double abortrate = (commits+aborts>0) ? (double)aborts/(commits+aborts) : 0;
+    json << "{\"mode\":\"" << mode << "\",\"seconds\":" << diff;
+    json << ",\"commits\":" << commits << ",\"aborts\":" << aborts;
+    json << ",\"retries\":" << retries << ",\"failed\":" << failed;
+    json << ",\"abort_rate\":" << abortrate << ",\"commits_per_sec\":" << commitspersec;
+    json << ",\"mb_per_sec\":" << mbpersec << ",\"checked_stripes\":" << checked;
+    json << ",\"divergent_stripes\":" << divergent << ",\"max_versions_per_stripe\":" << maxversions;
+    json << ",\"unreadable_stripes\":" << unreadable << ",\"latency_us\":" << hist.to_json() << "}";
+    csv << mode << ";" << commits << ";" << aborts << ";" << retries << ";" << failed << ";";
+    csv << commitspersec << ";" << mbpersec << ";" << checked << ";" << divergent << ";" << maxversions << ";";
+    csv << hist.percentile(50) << ";" << hist.percentile(99) << ";" << hist.percentile(99.9) << ";" << hist.get_max() << "\n";
+    printf("%s: commits:%llu aborts:%llu retries:%llu failed:%llu commits/sec:%f divergent:%u/%u\n",
+            mode, commits, aborts, retries, failed, commitspersec, divergent, checked);
+
+    for (it=vec->begin(); it!=vec->end(); it++)
+    {
+        free((*it)->data);
+        delete (*it)->hist;
+        delete (*it)->results;
+        delete *it;
+    }
+    delete vec;
+    delete[] ccc.partial;
+    ccc.partial = NULL;
+    free(buf);
+    return rc;
+}
+
+/**
+ * @brief writes overlapping stripes from all threads with the lock-free
+ * commit protocol, and with byte range locks as baseline, with the same
+ * sequence of stripes
+ */
+int SimpleBenchmarker::eval_Conflict()
+{
+    log->debug_log("starting conflict workload");
+    setup();
+    if (ccc.stripes==0) ccc.stripes=1;
+    ccc.cdf = new std::vector<double>();
+    zipf_cdf(ccc.stripes, ccc.zipf, ccc.cdf);
+    unsigned int seed = time(NULL);
+
+    std::stringstream json("");
+    std::stringstream csv("");
+    json << "{\"benchmark\":\"ccc\",\"dataservers\":" << dataservers;
+    json << ",\"threads\":" << threads << ",\"iterations\":" << iterations;
+    json << ",\"stripes\":" << ccc.stripes << ",\"overlap_pct\":" << ccc.overlappct;
+    json << ",\"partial_pct\":" << ccc.partialpct << ",\"zipf\":" << ccc.zipf;
+    json << ",\"max_retries\":" << ccc.retries << ",\"runs\":[";
+    csv << "mode;commits;aborts;retries;failed;commits_per_sec;mb_per_sec;checked_stripes;divergent_stripes;max_versions;p50_us;p99_us;p999_us;max_us\n";
+    int rc = run_Conflict(false, seed, json, csv);
+    if (ccc.baseline)
+    {
+        json << ",";
+        rc |= run_Conflict(true, seed, json, csv);
+    }
+    json << "]}\n";
+
+    std::stringstream filename("");
+    filename << "/tmp/SiBe_CCC_" << iterations << "_" << threads << "_" << get_time();
+    write_result((filename.str()+".json").c_str(), json);
+    write_result((filename.str()+".csv").c_str(), csv);
+    delete ccc.cdf;
+    ccc.cdf = NULL;
+    log->debug_log("Done");
+    return rc;
+}
+
 
 int SimpleBenchmarker::eval_lock_roundtrip()
 {
@@ -1097,6 +1824,14 @@ int SimpleBenchmarker::analyse(std::vector<struct thread_data*> *vec, enum bench
     {
         optype.append("S_");
     }
+    else if (bench==stripermw)
+    {
+        optype.append("SRMW_");
+    }
+    else if (bench==stripepipelined)
+    {
+        optype.append("SP_");
+    }
     else if (bench==stripeunitlocked)
     {
         optype.append("SLK_");
@@ -1169,7 +1904,7 @@ int SimpleBenchmarker::analyse(std::vector<struct thread_data*> *vec, enum bench
             {
                 rate = opspersec*blocksize/(1024*1024);
             }
-            else if (bench==stripe)
+            else if (bench==stripe || bench==stripermw)
             {
                 rate = opspersec*groupsize*blocksize/(1024*1024);
             }
@@ -1248,37 +1983,151 @@ int SimpleBenchmarker::device_diskio(int threads, size_t bytes, int iterations,
     return 0;
 }
 
+/**
+ * @brief compares the one-file-per-version layout with the segment store.
+ * Every round writes a new version of each stripe like a primary
+ * coordinator does and drops the older ones like the garbage collector.
+ */
+int SimpleBenchmarker::storage_layout(std::string dir)
+{
+    std::stringstream ss("");
+    ss << "layout,op,ops,secs,Ops/sec,MB/sec;\n";
+    const char *names[2] = {"files","segments"};
+    enum storage_layout layouts[2] = {layout_files, layout_segments};
+    size_t unitsize = (size>0) ? size : 64*1024;
+    StripeId stripes = 64;
+    
+    struct OPHead head;
+    memset(&head, 0, sizeof(head));
+    head.inum = 1;
+    struct filelayout_raid4 *p_fl = (struct filelayout_raid4 *) &head.filelayout[0];
+    p_fl->type = raid4;
+    p_fl->groupsize = default_groupsize+1;
+    p_fl->servercount = default_groupsize+1;
+    p_fl->stripeunitsize = unitsize;
+    for (serverid_t i=0; i<p_fl->servercount; i++)
+    {
+        p_fl->serverids[i] = i;
+    }
+    size_t stripesize = (p_fl->groupsize-1)*unitsize;
+    
+    struct data_object obj;
+    memset(&obj.metadata, 0, sizeof(obj.metadata));
+    obj.metadata.datalength = unitsize;
+    obj.data = malloc(unitsize);
+    gen_string(unitsize, (char*) obj.data);
+    struct datacollection_primco dcol;
+    dcol.newobject = &obj;
+    
+    for (int l=0; l<2; l++)
+    {
+        std::stringstream base("");
+        base << dir << "/" << names[l] << "_" << get_time();
+        Filestorage *p_fs = new Filestorage(log, base.str().c_str(), 0, sync, layouts[l], 0);
+        
+        struct timertimes start = timer_start();
+        for (uint32_t v=1; v<=iterations; v++)
+        {
+            for (StripeId sid=0; sid<stripes; sid++)
+            {
+                head.offset = sid*stripesize;
+                obj.metadata.versionvector[default_groupsize] = v;
+                if (p_fs->write_file(&head, &dcol)==0)
+                {
+                    // as done in handle_primcoord_phase_3
+                    if (sync) fsync(dcol.filehandle);
+                    close(dcol.filehandle);
+                }
+            }
+            for (StripeId sid=0; sid<stripes; sid++)
+            {
+                p_fs->remove_lower_than(head.inum, sid, v);
+            }
+            p_fs->compact();
+        }
+        double diff = timer_end(start);
+        double ops = iterations*stripes;
+        ss << names[l] << ",write," << ops << "," << diff << "," << ops/diff << "," << ops*unitsize/(1024*1024)/diff << ";\n";
+        printf("Storage layout:%s, write ops:%.0f, %f ops/sec, %f MB/sec\n",names[l],ops,ops/diff,ops*unitsize/(1024*1024)/diff);
+        
+        start = timer_start();
+        for (StripeId sid=0; sid<stripes; sid++)
+        {
+            struct data_object *p_out = NULL;
+            if (p_fs->read_stripe_object(head.inum, sid, &p_out)==0)
+            {
+                free(p_out->data);
+                delete p_out;
+            }
+        }
+        diff = timer_end(start);
+        ops = stripes;
+        ss << names[l] << ",read," << ops << "," << diff << "," << ops/diff << "," << ops*unitsize/(1024*1024)/diff << ";\n";
+        printf("Storage layout:%s, read ops:%.0f, %f ops/sec\n",names[l],ops,ops/diff);
+        delete p_fs;
+    }
+    free(obj.data);
+    std::stringstream path("");    
+    path << "/tmp/Storagebench_" << iterations << "_" << unitsize << "_" << get_time() << ".csv";
+    write_result(path.str().c_str(),ss);
+    return 0;
+}
+
 int SimpleBenchmarker::parity_calc()
 {
     std::stringstream ss("");
-    ss << "1GB,time,GB/s;\n";
+    ss << "kernel,inputs,run,time,GB/s;\n";
     size_t s = 4*1024*1024;
     int its = 256;
+    // pairwise update as done by the participants and a full stripe fold
+    // as done by the primary coordinator and the stripe writing client.
+    int inputcnt[2] = {2, default_groupsize};
 
-    void *a = malloc(s);
-    void *b = malloc(s);
+    void *in[default_groupsize];
+    for (int j=0; j<default_groupsize; j++)
+    {
+        in[j] = malloc(s);
+        memset(in[j], j+1, s);
+    }
     void *res = malloc(s);
     
     double diff=0.0;
     double result = 0.0;
-    for (int i=1; i<20; i++)
-    {   
-        struct timertimes  start = timer_start();
-        for (int k=0;k<its;k++)
+    for (int k=0; k<parity_kernel_count; k++)
+    {
+        enum parity_kernel kernel = (enum parity_kernel) k;
+        if (!parity_kernel_supported(kernel))
         {
-            calc_parity (a, b, res, s);
+            log->debug_log("kernel %s not supported.",parity_kernel_name(kernel));
+            continue;
+        }
+        for (int n=0; n<2; n++)
+        {
+            double best=0.0;
+            for (int i=1; i<20; i++)
+            {   
+                struct timertimes  start = timer_start();
+                for (int x=0;x<its;x++)
+                {
+                    calc_parity_n_kernel(kernel, &in[0], inputcnt[n], res, s);
+                }
+                diff = timer_end(start);    
+                // bytes read from all inputs
+                result = (its*s*inputcnt[n]*1.0/(1024*1024*1024))/diff;
+                best = max(best,result);
+                ss << parity_kernel_name(kernel) << "," << inputcnt[n] << "," << i << "," << diff << "," << result << ";\n";            
+            }
+            printf("Parity kernel:%s%s, inputs:%d, best:%f GB/sec\n",parity_kernel_name(kernel),(kernel==parity_get_kernel())?"(selected)":"",inputcnt[n],best);
         }
-        diff = timer_end(start);    
-        //printf("Diff:%f\n",diff);
-        result = (its*s*1.0/(1024*1024))/diff;
-        ss << i << "," << diff << "," << result << ";\n";            
     }
     std::stringstream path("");    
     path << "/tmp/Paritybench_" << get_time() << ".csv";
     
     write_result(path.str().c_str(),ss);
-    free(a);
-    free(b);
+    for (int j=0; j<default_groupsize; j++)
+    {
+        free(in[j]);
+    }
     free(res);
     return 0;
 }
@@ -1427,7 +2276,7 @@ int main(int argc, char **argv)
     std::string abspath("../conf/simplebench.conf");
     ConfigurationManager *cm = new ConfigurationManager(argc,argv,abspath);
     cm->register_option("log.loc","logfile location");
-    cm->register_option("benchmark","Benchmark to execute [s,su,slk,dio,cpu,tcp,pp,lrt,rsu] stripe,stripeunit,stripelock,diskio,cpu parity,tcp,pingpong,lockroundtrip,readsu");
+    cm->register_option("benchmark","Benchmark to execute [s,sp,su,slk,dio,cpu,tcp,pp,lrt,rsu,fs,mix,ccc] stripe,stripe pipelined,stripeunit,stripelock,diskio,cpu parity,tcp,pingpong,lockroundtrip,readsu,storage layout,mixed workload,conflicting writes");
     cm->register_option("iterations","Number of iterations");
     cm->register_option("threads", "Number of threads");
     cm->register_option("bytes", "Measure disc device speed, write Kibytes per block, in MB for parity calc");
@@ -1442,12 +2291,46 @@ int main(int argc, char **argv)
     cm->register_option("mds.pw", "Password of the mds user");
     cm->register_option("mds.bin", "Path of the mds binary");
     cm->register_option("setup", "setup mds");
+    cm->register_option("s.compare", "s also writes the stripes unit by unit and reports the full stripe gain. 0/1 [default:0]");
+    cm->register_option("mix.read", "mix: percentage of reads [default:50]");
+    cm->register_option("mix.lock", "mix: percentage of writes under a byte range lock [default:0]");
+    cm->register_option("mix.conflict", "mix: percentage of operations on the stripe shared by all threads [default:0]");
+    cm->register_option("mix.size", "mix: bytes per operation, 0 is one stripe [default:0]");
+    cm->register_option("mix.offsets", "mix: seq or random offsets in the thread region [default:random]");
+    cm->register_option("mix.span", "mix: operations per thread region [default:16]");
+    cm->register_option("ccc.stripes", "ccc: number of stripes shared by all threads [default:64]");
+    cm->register_option("ccc.overlap", "ccc: percentage of writes to the shared stripes [default:50]");
+    cm->register_option("ccc.partial", "ccc: percentage of shared writes that overlap two stripes instead of matching one [default:0]");
+    cm->register_option("ccc.zipf", "ccc: zipf exponent over the shared stripes, 0 is uniform [default:0.99]");
+    cm->register_option("ccc.retries", "ccc: retries of an aborted write [default:8]");
+    cm->register_option("ccc.baseline", "ccc: also run the workload with byte range locks (slk). 0/1 [default:1]");
+    cm->register_option("cluster.ds", "Start this many data servers and the mds locally, 0 uses the running system [default:0]");
+    cm->register_option("cluster.dir", "Storage and output directory of the local system");
+    cm->register_option("cluster.dsbin", "Path of the dataServer binary");
+    cm->register_option("cluster.mdsbin", "Path of the metadataServer binary");
     
     
     cm->parse();
 
     int iterations = atoi(cm->get_value("iterations").c_str());
     int threads    = atoi(cm->get_value("threads").c_str());
+    uint32_t clusterds = atoi(cm->get_value("cluster.ds").c_str());
+    ClusterHarness *harness = NULL;
+    if (clusterds>0)
+    {
+        // the client of the benchmarker connects to the mds right away
+        Logger *hlog = new Logger();
+        hlog->set_log_location(cm->get_value("cluster.dir")+"/harness.log");
+        harness = new ClusterHarness(hlog, cm->get_value("cluster.dir"),
+                cm->get_value("cluster.dsbin"), cm->get_value("cluster.mdsbin"));
+        if (harness->start(clusterds))
+        {
+            printf("Local system not started, see %s\n",cm->get_value("cluster.dir").c_str());
+            delete harness;
+            return 1;
+        }
+        printf("Local system up: %u data servers\n",clusterds);
+    }
     SimpleBenchmarker *sb = new SimpleBenchmarker(iterations,threads,cm->get_value("log.loc"));
     sb->sshtarget = cm->get_value("ssh.target");
     sb->sshuser = cm->get_value("ssh.user");
@@ -1459,7 +2342,21 @@ int main(int argc, char **argv)
     sb->mdsip=cm->get_value("mds.ip");
         
     if (!strcmp(cm->get_value("sync").c_str(),"0")) sb->sync=false;    
+    if (!strcmp(cm->get_value("s.compare").c_str(),"1")) sb->rmwcompare=true;
     sb->size = atol(cm->get_value("bytes").c_str())*1024;
+    sb->dataservers = clusterds;
+    if (!cm->get_value("mix.read").empty()) sb->mix.readpct = atoi(cm->get_value("mix.read").c_str());
+    if (!cm->get_value("mix.lock").empty()) sb->mix.lockpct = atoi(cm->get_value("mix.lock").c_str());
+    if (!cm->get_value("mix.conflict").empty()) sb->mix.conflictpct = atoi(cm->get_value("mix.conflict").c_str());
+    if (!cm->get_value("mix.size").empty()) sb->mix.opsize = atol(cm->get_value("mix.size").c_str());
+    if (!cm->get_value("mix.span").empty()) sb->mix.span = atoi(cm->get_value("mix.span").c_str());
+    if (!strcmp(cm->get_value("mix.offsets").c_str(),"seq")) sb->mix.random=false;
+    if (!cm->get_value("ccc.stripes").empty()) sb->ccc.stripes = atoi(cm->get_value("ccc.stripes").c_str());
+    if (!cm->get_value("ccc.overlap").empty()) sb->ccc.overlappct = atoi(cm->get_value("ccc.overlap").c_str());
+    if (!cm->get_value("ccc.partial").empty()) sb->ccc.partialpct = atoi(cm->get_value("ccc.partial").c_str());
+    if (!cm->get_value("ccc.zipf").empty()) sb->ccc.zipf = atof(cm->get_value("ccc.zipf").c_str());
+    if (!cm->get_value("ccc.retries").empty()) sb->ccc.retries = atoi(cm->get_value("ccc.retries").c_str());
+    if (!strcmp(cm->get_value("ccc.baseline").c_str(),"0")) sb->ccc.baseline=false;
     
     if (!strcmp(cm->get_value("setup").c_str(),"1"))
     {
@@ -1475,6 +2372,10 @@ int main(int argc, char **argv)
     {
         rc = sb->eval_Stripe();
     }
+    else if (!strcmp(cm->get_value("benchmark").c_str(),"sp"))
+    {
+        rc = sb->eval_Stripe_pipelined();
+    }
     else if (!strcmp(cm->get_value("benchmark").c_str(),"slk"))
     {
         rc = sb->eval_Stripe_lockmode();
@@ -1484,6 +2385,10 @@ int main(int argc, char **argv)
         std::string dir = cm->get_value("dir");
         sb->device_diskio(threads,sb->size,iterations, dir, sb->sync);
     }
+    else if (!strcmp(cm->get_value("benchmark").c_str(),"fs"))
+    { 
+        sb->storage_layout(cm->get_value("dir"));
+    }
     else if (!strcmp(cm->get_value("benchmark").c_str(),"cpu"))
     {
         sb->parity_calc();
@@ -1504,6 +2409,14 @@ int main(int argc, char **argv)
     {
         sb->eval_ReadSU();
     }
+    else if (!strcmp(cm->get_value("benchmark").c_str(),"mix"))
+    {
+        rc = sb->eval_Mixed();
+    }
+    else if (!strcmp(cm->get_value("benchmark").c_str(),"ccc"))
+    {
+        rc = sb->eval_Conflict();
+    }
     else if (!strcmp(cm->get_value("benchmark").c_str(),"full"))
     {
         rc = sb->fullbench();
@@ -1516,4 +2429,9 @@ int main(int argc, char **argv)
     printf("Successful\n");
     sb->send_results();    
     printf("Results sent.\n");
+    if (harness!=NULL)
+    {
+        delete sb;
+        delete harness;
+    }
 }
\ No newline at end of file
@@ -22,10 +22,22 @@ ConfigurationManager* init_cm(int argc, char **argv, std::string abspath)
     cm->register_option("loglevel","Specify loglevel");
     cm->register_option("cmdoutput","Activate commandline output");
     cm->register_option("mds","Metadataserver address");
+    cm->register_option("window.file","Asynchronous stripe writes in flight per file, 0 is unlimited");
+    cm->register_option("window.server","Asynchronous stripe writes in flight per data server, 0 is unlimited");
+    cm->register_option("read.degradedtimeout","Milliseconds a read waits before rebuilding a unit from parity, 0 disables");
+    cm->register_option("read.hedgepct","Rebuild reads slower than this latency percentile, 0 disables hedging");
+    cm->register_option("write.buffer","Coalesce small adjacent writes into stripe writes 0/1 [default:0]");
+    cm->register_option("write.buffertimeout","Milliseconds an incomplete stripe is buffered");
+    cm->register_option("net.connections","Connections to each data server");
     cm->parse();
     return cm;
 }
 
+static int client_buffered_write(void *arg, ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data)
+{
+    return ((SPNetraid_client*)arg)->handle_write(csid,p_einode,offset,length,data);
+}
+
 
 Client::Client() 
 {
@@ -45,6 +57,25 @@ Client::Client()
     ds_count  = 0;
     p_pnfs_cl   = new Pnfsdummy_client(log);
     p_spn_cl    = new SPNetraid_client(log);    
+    if (!p_cm->get_value("window.file").empty() && !p_cm->get_value("window.server").empty())
+    {
+        p_spn_cl->set_write_window(atoi(p_cm->get_value("window.file").c_str()), atoi(p_cm->get_value("window.server").c_str()));
+    }
+    if (!p_cm->get_value("read.degradedtimeout").empty() || !p_cm->get_value("read.hedgepct").empty())
+    {
+        std::string timeout = p_cm->get_value("read.degradedtimeout");
+        p_spn_cl->set_degraded_read(timeout.empty() ? SPN_READ_DEGRADED_TIMEOUT : atoi(timeout.c_str()), atof(p_cm->get_value("read.hedgepct").c_str()));
+    }
+    if (!p_cm->get_value("net.connections").empty())
+    {
+        p_spn_cl->set_connections(atoi(p_cm->get_value("net.connections").c_str()));
+    }
+    p_wbuf = NULL;
+    if (atoi(p_cm->get_value("write.buffer").c_str())==1)
+    {
+        std::string timeout = p_cm->get_value("write.buffertimeout");
+        p_wbuf = new WriteBuffer(log, &client_buffered_write, p_spn_cl, timeout.empty() ? WBUF_DEFAULT_TIMEOUT : atoi(timeout.c_str()));
+    }
     p_brlman =    new ByterangeLockManager(log);    
     
     
@@ -55,6 +86,7 @@ Client::Client()
 
 Client::~Client() 
 {
+    delete p_wbuf;
     delete p_spn_cl;
     delete p_pnfs_cl;    
     delete p_brlman; 
@@ -81,6 +113,11 @@ int Client::releaselock(serverid_t *id, InodeNumber *inum, uint64_t *start, uint
 {
     log->debug_log("id:%u,inum:%llu,start:%llu,end:%llu",*id,*inum,*start,*end);
     int ret = -1;
+    if (p_wbuf!=NULL && p_wbuf->flush(*inum,*start,*end))
+    {
+        log->warning_log("flush before release failed.");
+        return ret;
+    }
     if (this->csid != 0)
     {
         ret = p_pnfs_cl->handle_pnfs_send_releaselock(id,&this->csid,inum,start,end);
@@ -111,6 +148,12 @@ int Client::acquireByteRangeLock(serverid_t *id, InodeNumber *inum, uint64_t *st
 {
     log->debug_log("id:%u,inum:%llu,start:%llu,end:%llu",*id,*inum,*start,*end);
     int ret = -1;
+    // writes buffered before the lock must not land inside it
+    if (p_wbuf!=NULL && p_wbuf->flush(*inum,*start,*end))
+    {
+        log->warning_log("flush before lock failed.");
+        return ret;
+    }
     if (this->csid != 0)
     {
         time_t expires;
@@ -201,7 +244,15 @@ int Client::getDataserverAddresses(serverid_t *mds, vector<serverid_t> *dsids)
 int Client::handle_write(struct EInode *p_einode, size_t offset, size_t length, void *data)
 {
     log->debug_log("handle write start: size:%u",length);
-    int rc = p_spn_cl->handle_write(this->csid,p_einode,offset,length,data);
+    int rc;
+    if (p_wbuf!=NULL)
+    {
+        rc = p_wbuf->write(this->csid,p_einode,offset,length,data);
+    }
+    else
+    {
+        rc = p_spn_cl->handle_write(this->csid,p_einode,offset,length,data);
+    }
     log->debug_log("rc=%d",rc);
     return rc;
 }
@@ -209,19 +260,57 @@ int Client::handle_write(struct EInode *p_einode, size_t offset, size_t length,
 int Client::handle_write_lock(struct EInode *p_einode, size_t offset, size_t length, void *data)
 {
     log->debug_log("handle write start: size:%u",length);
-    int rc = p_spn_cl->handle_write_lock(this->csid,p_einode,offset,length,data);
+    int rc = flush_range(p_einode,offset,length);
+    if (rc) return rc;
+    rc = p_spn_cl->handle_write_lock(this->csid,p_einode,offset,length,data);
     log->debug_log("rc=%d",rc);
     return rc;
 }
 
+int Client::handle_write_async(struct EInode *p_einode, size_t offset, size_t length, void *data,
+                               spn_write_cb cb, void *arg, struct spn_write_handle **pp_handle)
+{
+    log->debug_log("handle write async start: size:%u",length);
+    int rc = flush_range(p_einode,offset,length);
+    if (rc) return rc;
+    rc = p_spn_cl->handle_write_async(this->csid,p_einode,offset,length,data,cb,arg,pp_handle);
+    log->debug_log("rc=%d",rc);
+    return rc;
+}
+
+int Client::wait_write(struct spn_write_handle *p_handle)
+{
+    return p_spn_cl->wait_write(p_handle);
+}
+
 int Client::handle_read(struct EInode *p_einode, size_t offset, size_t length, void **data)
 {
     log->debug_log("handle read start");
-    int rc = p_spn_cl->handle_read(this->csid,p_einode,offset,length,data);
+    int rc = flush_range(p_einode,offset,length);
+    if (rc) return rc;
+    rc = p_spn_cl->handle_read(this->csid,p_einode,offset,length,data);
     log->debug_log("rc=%d",rc);
     return rc;
 }
 
+/**
+ * @brief writes the buffered data of the file, the fsync of the client
+ */
+int Client::flush(struct EInode *p_einode)
+{
+    return (p_wbuf!=NULL) ? p_wbuf->flush(p_einode->inode.inode_number) : 0;
+}
+
+/**
+ * @brief writes buffered data overlapping the range before it is read or
+ * written around the buffer
+ */
+int Client::flush_range(struct EInode *p_einode, size_t offset, size_t length)
+{
+    if (p_wbuf==NULL || length==0) return 0;
+    return p_wbuf->flush(p_einode->inode.inode_number, offset, offset+length-1);
+}
+
 int Client::pingpong()
 {
     return p_spn_cl->handle_pingpong(this->csid);
@@ -0,0 +1,287 @@
+/*
+ * File:   WriteBuffer.cpp
+ */
+
+#include "client/WriteBuffer.h"
+
+static inline uint64_t wbuf_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void* wbuf_timeout_thread(void *arg)
+{
+    ((WriteBuffer*)arg)->timeout_run();
+    return NULL;
+}
+
+WriteBuffer::WriteBuffer(Logger *p_log, wbuf_write_fn fn, void *arg, uint32_t timeout_ms)
+{
+    log = p_log;
+    this->fn = fn;
+    this->arg = arg;
+    timeout = timeout_ms;
+    stopflag = false;
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    if (pthread_create(&thread, NULL, wbuf_timeout_thread, this))
+    {
+        log->error_log("thread creation failed.");
+    }
+    log->debug_log("timeout:%u ms",timeout);
+}
+
+WriteBuffer::~WriteBuffer()
+{
+    pthread_mutex_lock(&mutex);
+    stopflag = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    flush_all();
+    std::map<InodeNumber,struct wbuf_file*>::iterator it = files.begin();
+    for (it; it!=files.end(); it++)
+    {
+        free(it->second->data);
+        pthread_mutex_destroy(&it->second->mutex);
+        delete it->second;
+    }
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+struct wbuf_file* WriteBuffer::get_file(InodeNumber inum)
+{
+    struct wbuf_file *p_f;
+    pthread_mutex_lock(&mutex);
+    std::map<InodeNumber,struct wbuf_file*>::iterator it = files.find(inum);
+    if (it==files.end())
+    {
+        p_f = new struct wbuf_file;
+        p_f->start = 0;
+        p_f->length = 0;
+        p_f->stripestart = 0;
+        p_f->stripesize = 0;
+        p_f->data = NULL;
+        p_f->error = 0;
+        pthread_mutex_init(&p_f->mutex, NULL);
+        files[inum] = p_f;
+    }
+    else
+    {
+        p_f = it->second;
+    }
+    pthread_mutex_unlock(&mutex);
+    return p_f;
+}
+
+void WriteBuffer::count(uint64_t *p_counter)
+{
+    __sync_fetch_and_add(p_counter, 1);
+}
+
+/**
+ * @brief writes the buffered run of a file. The file mutex must be held.
+ */
+int WriteBuffer::flush_file(struct wbuf_file *p_f)
+{
+    if (p_f->length==0) return 0;
+    log->debug_log("inum:%llu, start:%llu, length:%llu",p_f->einode.inode.inode_number,p_f->start,p_f->length);
+    count((p_f->length==p_f->stripesize) ? &stats.fullstripes : &stats.partial);
+    int rc = fn(arg, p_f->csid, &p_f->einode, p_f->start, p_f->length, p_f->data+(p_f->start-p_f->stripestart));
+    p_f->length = 0;
+    if (rc)
+    {
+        log->warning_log("write of buffered data failed:%d",rc);
+    }
+    return rc;
+}
+
+int WriteBuffer::take_error(struct wbuf_file *p_f)
+{
+    int rc = p_f->error;
+    p_f->error = 0;
+    return rc;
+}
+
+/**
+ * @brief buffers the write. Parts that complete their stripe are written
+ * before it returns, whole stripes of an empty buffer are written directly.
+ * @return 0, or the error of this write or of an earlier timed out flush
+ */
+int WriteBuffer::write(ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data)
+{
+    log->debug_log("inum:%llu, offset:%llu, length:%llu",p_einode->inode.inode_number,offset,length);
+    count(&stats.writes);
+    struct wbuf_file *p_f = get_file(p_einode->inode.inode_number);
+    pthread_mutex_lock(&p_f->mutex);
+    int rc = take_error(p_f);
+    size_t stripesize = get_stripe_size((filelayout_raid*) &p_einode->inode.layout_info[0]);
+    char *src = (char*) data;
+    while (length>0 && !rc)
+    {
+        size_t stripestart = offset - offset%stripesize;
+        size_t chunk = std::min(length, stripestart+stripesize-offset);
+        if (p_f->length>0)
+        {
+            // only a run touching the buffered one in the same stripe is merged
+            bool adjacent = (stripestart==p_f->stripestart && offset<=p_f->start+p_f->length && offset+chunk>=p_f->start);
+            if (!adjacent || p_f->csid!=csid)
+            {
+                rc = flush_file(p_f);
+                if (rc) break;
+            }
+        }
+        if (p_f->length==0 && chunk==stripesize)
+        {
+            size_t whole = length - length%stripesize;
+            rc = fn(arg, csid, p_einode, offset, whole, src);
+            count(&stats.passthrough);
+            offset += whole;
+            src += whole;
+            length -= whole;
+            continue;
+        }
+        if (p_f->length==0)
+        {
+            if (p_f->data==NULL)
+            {
+                p_f->data = (char*) malloc(stripesize);
+            }
+            memcpy(&p_f->einode, p_einode, sizeof(struct EInode));
+            p_f->csid = csid;
+            p_f->stripesize = stripesize;
+            p_f->stripestart = stripestart;
+            p_f->start = offset;
+            p_f->first_us = wbuf_now_us();
+        }
+        memcpy(p_f->data+(offset-stripestart), src, chunk);
+        size_t end = std::max(p_f->start+p_f->length, offset+chunk);
+        p_f->start = std::min(p_f->start, offset);
+        p_f->length = end-p_f->start;
+        count(&stats.coalesced);
+        offset += chunk;
+        src += chunk;
+        length -= chunk;
+        if (p_f->length==stripesize)
+        {
+            rc = flush_file(p_f);
+        }
+    }
+    pthread_mutex_unlock(&p_f->mutex);
+    log->debug_log("rc:%d",rc);
+    return rc;
+}
+
+/**
+ * @brief writes everything buffered for the file, used by fsync and close
+ */
+int WriteBuffer::flush(InodeNumber inum)
+{
+    return flush(inum, 0, UINT64_MAX);
+}
+
+/**
+ * @brief writes the buffered data of the file if it overlaps the byte
+ * range [start,end]. Called before a byte range lock is acquired or
+ * released and before reads and direct writes of the range.
+ */
+int WriteBuffer::flush(InodeNumber inum, uint64_t start, uint64_t end)
+{
+    int rc=0;
+    pthread_mutex_lock(&mutex);
+    std::map<InodeNumber,struct wbuf_file*>::iterator it = files.find(inum);
+    struct wbuf_file *p_f = (it!=files.end()) ? it->second : NULL;
+    pthread_mutex_unlock(&mutex);
+    if (p_f!=NULL)
+    {
+        pthread_mutex_lock(&p_f->mutex);
+        rc = take_error(p_f);
+        if (p_f->length>0 && p_f->start<=end && p_f->start+p_f->length>start)
+        {
+            int rc2 = flush_file(p_f);
+            if (!rc) rc = rc2;
+        }
+        pthread_mutex_unlock(&p_f->mutex);
+    }
+    log->debug_log("inum:%llu, rc:%d",inum,rc);
+    return rc;
+}
+
+int WriteBuffer::flush_all()
+{
+    int rc=0;
+    std::vector<InodeNumber> inums;
+    pthread_mutex_lock(&mutex);
+    std::map<InodeNumber,struct wbuf_file*>::iterator it = files.begin();
+    for (it; it!=files.end(); it++)
+    {
+        inums.push_back(it->first);
+    }
+    pthread_mutex_unlock(&mutex);
+    std::vector<InodeNumber>::iterator iti = inums.begin();
+    for (iti; iti!=inums.end(); iti++)
+    {
+        int rc2 = flush(*iti);
+        if (!rc) rc = rc2;
+    }
+    return rc;
+}
+
+void WriteBuffer::get_stats(struct wbuf_stats *p_stats)
+{
+    pthread_mutex_lock(&mutex);
+    memcpy(p_stats, &stats, sizeof(stats));
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief writes runs buffered longer than the timeout. Files busy with a
+ * write are checked on the next round.
+ */
+void WriteBuffer::timeout_run()
+{
+    uint64_t interval = std::max(timeout/2, (uint32_t)1);
+    std::vector<struct wbuf_file*> check;
+    pthread_mutex_lock(&mutex);
+    while (!stopflag)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += interval/1000;
+        ts.tv_nsec += (interval%1000)*1000000;
+        if (ts.tv_nsec>=1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&cond, &mutex, &ts);
+        if (stopflag) break;
+        std::map<InodeNumber,struct wbuf_file*>::iterator it = files.begin();
+        for (it; it!=files.end(); it++)
+        {
+            check.push_back(it->second);
+        }
+        pthread_mutex_unlock(&mutex);
+        uint64_t now = wbuf_now_us();
+        std::vector<struct wbuf_file*>::iterator itc = check.begin();
+        for (itc; itc!=check.end(); itc++)
+        {
+            struct wbuf_file *p_f = *itc;
+            if (pthread_mutex_trylock(&p_f->mutex)!=0) continue;
+            if (p_f->length>0 && now-p_f->first_us>=(uint64_t)timeout*1000)
+            {
+                count(&stats.timeouts);
+                int rc = flush_file(p_f);
+                if (rc) p_f->error = rc;
+            }
+            pthread_mutex_unlock(&p_f->mutex);
+        }
+        check.clear();
+        pthread_mutex_lock(&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,166 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "client/WriteBuffer.h"
+
+#define TEST_SU_SIZE    4096
+#define TEST_GROUPSIZE  4       // stripes of three units
+#define TEST_STRIPE     (3*TEST_SU_SIZE)
+
+
+namespace
+{
+
+struct written {
+    InodeNumber inum;
+    size_t      offset;
+    size_t      length;
+};
+
+/* records the writes of the buffer into an image of the file */
+struct target {
+    std::vector<struct written> writes;
+    char        image[4*TEST_STRIPE];
+    int         rc;
+    pthread_mutex_t mutex;
+};
+
+static int record_write(void *arg, ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data)
+{
+    struct target *p_t = (struct target*) arg;
+    pthread_mutex_lock(&p_t->mutex);
+    struct written w;
+    w.inum = p_einode->inode.inode_number;
+    w.offset = offset;
+    w.length = length;
+    p_t->writes.push_back(w);
+    memcpy(p_t->image+offset, data, length);
+    pthread_mutex_unlock(&p_t->mutex);
+    return p_t->rc;
+}
+
+class WriteBufferTest : public ::testing::Test
+{
+public:
+    Logger *log;
+    struct EInode einode;
+    struct target t;
+    char data[4*TEST_STRIPE];
+
+    WriteBufferTest()
+    {
+        log = new Logger();
+        string s = string("/tmp/WriteBufferTest.log");
+	log->set_log_location(s);
+        log->set_console_output(false);
+        memset(&einode, 0, sizeof(einode));
+        einode.inode.inode_number = 11;
+        filelayout_raid *fl = (filelayout_raid *) &einode.inode.layout_info[0];
+        fl->raid4.type = raid4;
+        fl->raid4.groupsize = TEST_GROUPSIZE;
+        fl->raid4.servercount = TEST_GROUPSIZE;
+        fl->raid4.stripeunitsize = TEST_SU_SIZE;
+        for (size_t i=0; i<sizeof(data); i++)
+        {
+            data[i] = (char)(i*7+3);
+        }
+    }
+    ~WriteBufferTest()
+    {
+        delete log;
+    }
+
+protected:
+    void SetUp()
+    {
+        t.writes.clear();
+        memset(t.image, 0, sizeof(t.image));
+        t.rc = 0;
+        pthread_mutex_init(&t.mutex, NULL);
+    }
+
+    void TearDown()
+    {
+        pthread_mutex_destroy(&t.mutex);
+    }
+};
+
+
+TEST_F(WriteBufferTest, appends_become_stripe_writes)
+{
+    WriteBuffer *p_wb = new WriteBuffer(log, &record_write, &t, 10000);
+    // 2 KiB appends over two stripes
+    for (size_t off=0; off<2*TEST_STRIPE; off+=2048)
+    {
+        ASSERT_EQ(p_wb->write(1, &einode, off, 2048, data+off), 0);
+    }
+    ASSERT_EQ(t.writes.size(), 2);
+    ASSERT_EQ(t.writes[0].offset, 0);
+    ASSERT_EQ(t.writes[0].length, TEST_STRIPE);
+    ASSERT_EQ(t.writes[1].offset, TEST_STRIPE);
+    ASSERT_EQ(memcmp(t.image, data, 2*TEST_STRIPE), 0);
+    struct wbuf_stats stats;
+    p_wb->get_stats(&stats);
+    ASSERT_EQ(stats.fullstripes, 2);
+    ASSERT_EQ(stats.partial, 0);
+    delete p_wb;
+}
+
+TEST_F(WriteBufferTest, gap_and_flush)
+{
+    WriteBuffer *p_wb = new WriteBuffer(log, &record_write, &t, 10000);
+    ASSERT_EQ(p_wb->write(1, &einode, 100, 1000, data+100), 0);
+    // overwrites part of the run and extends it
+    ASSERT_EQ(p_wb->write(1, &einode, 600, 1000, data+600), 0);
+    ASSERT_EQ(t.writes.size(), 0);
+    // not adjacent, the first run is written
+    ASSERT_EQ(p_wb->write(1, &einode, 5000, 100, data+5000), 0);
+    ASSERT_EQ(t.writes.size(), 1);
+    ASSERT_EQ(t.writes[0].offset, 100);
+    ASSERT_EQ(t.writes[0].length, 1500);
+    // a range not covering the run leaves it buffered
+    ASSERT_EQ(p_wb->flush(einode.inode.inode_number, 0, 4999), 0);
+    ASSERT_EQ(t.writes.size(), 1);
+    ASSERT_EQ(p_wb->flush(einode.inode.inode_number, 5050, 5050), 0);
+    ASSERT_EQ(t.writes.size(), 2);
+    ASSERT_EQ(memcmp(t.image+100, data+100, 1500), 0);
+    ASSERT_EQ(memcmp(t.image+5000, data+5000, 100), 0);
+    delete p_wb;
+}
+
+TEST_F(WriteBufferTest, aligned_stripes_pass_through)
+{
+    WriteBuffer *p_wb = new WriteBuffer(log, &record_write, &t, 10000);
+    // one stripe and a half, then the rest of the second stripe
+    ASSERT_EQ(p_wb->write(1, &einode, TEST_STRIPE, TEST_STRIPE+TEST_STRIPE/2, data), 0);
+    ASSERT_EQ(t.writes.size(), 1);
+    ASSERT_EQ(t.writes[0].length, TEST_STRIPE);
+    ASSERT_EQ(p_wb->write(1, &einode, 2*TEST_STRIPE+TEST_STRIPE/2, TEST_STRIPE/2, data+TEST_STRIPE+TEST_STRIPE/2), 0);
+    ASSERT_EQ(t.writes.size(), 2);
+    ASSERT_EQ(t.writes[1].offset, 2*TEST_STRIPE);
+    ASSERT_EQ(t.writes[1].length, TEST_STRIPE);
+    ASSERT_EQ(memcmp(t.image+TEST_STRIPE, data, 2*TEST_STRIPE), 0);
+    delete p_wb;
+}
+
+TEST_F(WriteBufferTest, timeout_and_error)
+{
+    WriteBuffer *p_wb = new WriteBuffer(log, &record_write, &t, 20);
+    t.rc = -1;
+    ASSERT_EQ(p_wb->write(1, &einode, 0, 512, data), 0);
+    usleep(200000);
+    pthread_mutex_lock(&t.mutex);
+    ASSERT_EQ(t.writes.size(), 1);
+    pthread_mutex_unlock(&t.mutex);
+    // the failed background write is reported once
+    ASSERT_EQ(p_wb->flush(einode.inode.inode_number), -1);
+    ASSERT_EQ(p_wb->flush(einode.inode.inode_number), 0);
+    struct wbuf_stats stats;
+    p_wb->get_stats(&stats);
+    ASSERT_EQ(stats.timeouts, 1);
+    delete p_wb;
+}
+
+}
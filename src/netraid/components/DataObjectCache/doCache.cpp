@@ -23,14 +23,32 @@ static void print_dataobject(struct data_object *p_obj, stringstream& ss)
     ss << "data...\nchecksum:" << p_obj->checksum;
 }
 
-doCache::doCache(Logger* p_log, Filestorage *p_f ,serverid_t servid)
+doCache::doCache(Logger* p_log, Filestorage *p_f ,serverid_t servid, size_t bytes, uint32_t n)
 {
     p_fileio = p_f;
     log = p_log;        
-    p_cache = new std::map<InodeNumber,struct stripe_cache_entry*>();
-    mutex = PTHREAD_MUTEX_INITIALIZER;
+    shardcnt = (n>0) ? n : DOCACHE_DEFAULT_SHARDS;
+    budget = bytes;
+    shards = new struct cache_shard[shardcnt];
+    for (uint32_t i=0; i<shardcnt; i++)
+    {
+        shards[i].map = new std::map<InodeNumber,struct stripe_cache_entry*>();
+        pthread_mutex_init(&shards[i].mutex, NULL);
+        shards[i].bytes = 0;
+        shards[i].hand = 0;
+        shards[i].hits = 0;
+        shards[i].misses = 0;
+        shards[i].evictions = 0;
+        shards[i].readhits = 0;
+        shards[i].readmisses = 0;
+        shards[i].prefetches = 0;
+    }
+    readahead = DOCACHE_DEFAULT_READAHEAD;
     id = servid;
     p_raid = new Libraid4(log); 
+    pinned = new std::map<struct data_object*,struct object_pin>();
+    pthread_mutex_init(&pin_mutex, NULL);
+    log->debug_log("shards:%u, budget:%llu",shardcnt,budget);
 }
 
 doCache::doCache(const doCache& orig)
@@ -42,26 +60,188 @@ doCache::~doCache()
 {    
 }
 
+uint32_t doCache::get_shard(InodeNumber inum)
+{
+    uint64_t h = (uint64_t)inum * 0x9e3779b97f4a7c15ULL;
+    return (uint32_t)(h >> 32) % shardcnt;
+}
+
+/**
+ * @brief finds or creates the inode entry, shard mutex must be held.
+ */
+std::map<InodeNumber,struct stripe_cache_entry*>::iterator doCache::lookup(struct cache_shard *p_shard, InodeNumber inum)
+{
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_shard->map->find(inum);
+    if (it==p_shard->map->end())
+    {
+        struct stripe_cache_entry *p_ent = create_stripe_cache_entry();
+        it = p_shard->map->insert(it,std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
+        log->debug_log("inserted map for inum:%u",inum);
+    }
+    return it;
+}
+
+/**
+ * @brief keeps the object alive until it is released, the entry holding it
+ * must be locked.
+ */
+void doCache::pin(struct data_object *p_do)
+{
+    if (p_do==NULL) return;
+    pthread_mutex_lock(&pin_mutex);
+    std::map<struct data_object*,struct object_pin>::iterator it = pinned->find(p_do);
+    if (it==pinned->end())
+    {
+        struct object_pin pin;
+        pin.count = 1;
+        pin.retired = false;
+        pinned->insert(std::pair<struct data_object*,struct object_pin>(p_do,pin));
+    }
+    else
+    {
+        it->second.count++;
+    }
+    pthread_mutex_unlock(&pin_mutex);
+}
+
+/**
+ * @brief returns an object handed out by get_entry, read_entry,
+ * read_entry_async or get_unconfirmed. If the cache dropped it meanwhile
+ * the last release frees it.
+ */
+void doCache::release(struct data_object *p_do)
+{
+    if (p_do==NULL) return;
+    bool drop = false;
+    pthread_mutex_lock(&pin_mutex);
+    std::map<struct data_object*,struct object_pin>::iterator it = pinned->find(p_do);
+    if (it!=pinned->end() && --it->second.count==0)
+    {
+        drop = it->second.retired;
+        pinned->erase(it);
+    }
+    pthread_mutex_unlock(&pin_mutex);
+    if (drop)
+    {
+        if (p_do->data!=NULL) free(p_do->data);
+        delete p_do;
+    }
+}
+
+/**
+ * @brief frees an object the cache no longer holds, a pinned object is
+ * freed by its last release instead.
+ */
+void doCache::drop_object(struct data_object *p_do)
+{
+    pthread_mutex_lock(&pin_mutex);
+    std::map<struct data_object*,struct object_pin>::iterator it = pinned->find(p_do);
+    if (it!=pinned->end())
+    {
+        it->second.retired = true;
+        p_do = NULL;
+    }
+    pthread_mutex_unlock(&pin_mutex);
+    if (p_do!=NULL)
+    {
+        if (p_do->data!=NULL) free(p_do->data);
+        delete p_do;
+    }
+}
+
+static size_t object_size(struct data_object *p_do)
+{
+    return sizeof(struct data_object) + p_do->metadata.datalength;
+}
+
+/**
+ * @brief recounts the objects held by the entry and updates the shard
+ * total, the entry lock must be held. current may also be in a version map.
+ */
+void doCache::account(struct cache_shard *p_shard, struct cache_entry *p_entry)
+{
+    size_t bytes = 0;
+    if (p_entry->current!=NULL)
+    {
+        bytes += object_size(p_entry->current);
+    }
+    std::map<uint64_t, struct data_object*>::iterator it = p_entry->unconfirmed->begin();
+    for (it; it!=p_entry->unconfirmed->end(); it++)
+    {
+        if (it->second!=NULL && it->second!=p_entry->current)
+        {
+            bytes += object_size(it->second);
+        }
+    }
+    for (it=p_entry->confirmed->begin(); it!=p_entry->confirmed->end(); it++)
+    {
+        if (it->second!=NULL && it->second!=p_entry->current)
+        {
+            bytes += object_size(it->second);
+        }
+    }
+    if (bytes>p_entry->bytes)
+    {
+        __sync_fetch_and_add(&p_shard->bytes, bytes-p_entry->bytes);
+    }
+    else
+    {
+        __sync_fetch_and_sub(&p_shard->bytes, p_entry->bytes-bytes);
+    }
+    p_entry->bytes = bytes;
+}
+
+void doCache::get_stats(struct cache_stats *p_stats)
+{
+    memset(p_stats, 0, sizeof(struct cache_stats));
+    p_stats->budget = budget;
+    for (uint32_t i=0; i<shardcnt; i++)
+    {
+        pthread_mutex_lock(&shards[i].mutex);
+        p_stats->hits += shards[i].hits;
+        p_stats->misses += shards[i].misses;
+        p_stats->evictions += shards[i].evictions;
+        p_stats->readhits += shards[i].readhits;
+        p_stats->readmisses += shards[i].readmisses;
+        p_stats->prefetches += shards[i].prefetches;
+        p_stats->bytes += shards[i].bytes;
+        p_stats->inodes += shards[i].map->size();
+        pthread_mutex_unlock(&shards[i].mutex);
+    }
+}
+
 /**
  * @param it
  * @return 
  * 
  * Assumption: cache entry lock has been taken by calling instance
  */
-uint64_t doCache::initialize_cache_entry(std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid)
+uint64_t doCache::initialize_cache_entry(struct cache_shard *p_shard, std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid)
 {
     //int rc=-1;
     log->debug_log("initialize for inum:%llu,sid:%u",cacheit->first, sid);
-    struct cache_entry *entry = new struct cache_entry;
-    entry->unconfirmed = new std::map<uint64_t, struct data_object*>();
-    entry->confirmed = new std::map<uint64_t, struct data_object*>();
-    entry->entry_mutex = PTHREAD_MUTEX_INITIALIZER;
-    entry->dirty = false;
-    
-    if (p_fileio->read_stripe_object(cacheit->first, sid, &entry->current)!=0)
+    __sync_fetch_and_add(&p_shard->misses, 1);
+    struct data_object *p_do = NULL;
+    if (p_fileio->read_stripe_object(cacheit->first, sid, &p_do)!=0)
     {
         log->debug_log("No block available, vecsize:%u",sizeof_versionvec);        
-        entry->current=NULL;
+        p_do = NULL;
+    }
+    insert_read_entry(p_shard, cacheit, sid, p_do);
+    return 0;//++entry->versioncnt;
+}
+
+/**
+ * @brief inserts a clean entry for an object read from disk, p_do is NULL
+ * if the stripe has no object. smutex must be held.
+ */
+void doCache::insert_read_entry(struct cache_shard *p_shard, std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid, struct data_object *p_do)
+{
+    struct cache_entry *entry = create_cache_entry(NULL);
+    entry->dirty = false;
+    entry->current = p_do;
+    if (p_do==NULL)
+    {
         //entry->versioncnt = 0; //cacheit->second->versioncounter=0;
         memset(&entry->versionvec[0],0,sizeof_versionvec);
         entry->myvec_entry=NULL;
@@ -71,13 +251,97 @@ uint64_t doCache::initialize_cache_entry(std::map<InodeNumber,struct stripe_cach
         log->debug_log("stripeid entry for %u read and inserted.",sid);
         filelayout_raid *fl = (filelayout_raid *) &entry->current->metadata.filelayout[0];
         StripeUnitId versionindex = p_raid->get_my_stripeunitid(fl,entry->current->metadata.offset,this->id);
-        memcpy(&entry->versionvec, &entry->current->metadata.versionvector, sizeof_versionvec);
         memcpy(&entry->versionvec,&entry->current->metadata.versionvector, sizeof_versionvec);
         entry->myvec_entry=&entry->versionvec[versionindex];
-        //rc=0;
+        account(p_shard, entry);
     }
     cacheit->second->map->insert(std::pair<StripeId,struct cache_entry*>(sid,entry));
-    return 0;//++entry->versioncnt;
+}
+
+/**
+ * @brief inserts an entry with the version vector of the stored object but
+ * without its data, full stripe writes need no old data. The object is read
+ * by load_partial once it is requested. smutex must be held.
+ */
+void doCache::initialize_version_entry(struct cache_shard *p_shard, std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid)
+{
+    log->debug_log("initialize versions for inum:%llu,sid:%u",cacheit->first, sid);
+    __sync_fetch_and_add(&p_shard->misses, 1);
+    struct dataobject_metadata md;
+    struct cache_entry *entry = create_cache_entry(NULL);
+    entry->dirty = false;
+    memset(&entry->versionvec[0],0,sizeof_versionvec);
+    if (p_fileio->read_stripe_metadata(cacheit->first, sid, &md)==0)
+    {
+        filelayout_raid *fl = (filelayout_raid *) &md.filelayout[0];
+        StripeUnitId versionindex = p_raid->get_my_stripeunitid(fl,md.offset,this->id);
+        memcpy(&entry->versionvec[0],&md.versionvector[0], sizeof_versionvec);
+        memcpy(&entry->diskvec[0],&md.versionvector[0], sizeof_versionvec);
+        entry->myvec_entry=&entry->versionvec[versionindex];
+        entry->partial=true;
+    }
+    cacheit->second->map->insert(std::pair<StripeId,struct cache_entry*>(sid,entry));
+}
+
+/**
+ * @brief reads the object of an entry inserted by initialize_version_entry.
+ * The entry stays partial if the read fails. smutex must be held.
+ */
+void doCache::load_partial(struct cache_shard *p_shard, InodeNumber inum, StripeId sid, struct cache_entry *p_entry)
+{
+    if (!p_entry->partial) return;
+    if (p_entry->current!=NULL)
+    {
+        p_entry->partial=false;
+        return;
+    }
+    struct data_object *p_do = NULL;
+    if (p_fileio->read_stripe_object(inum, sid, &p_do)==0)
+    {
+        log->debug_log("loaded partial entry %llu.%u",inum,sid);
+        p_entry->partial=false;
+        p_entry->current = p_do;
+        account(p_shard, p_entry);
+    }
+    else
+    {
+        log->error_log("loading partial entry %llu.%u failed",inum,sid);
+    }
+}
+
+/**
+ * @brief version vindex of the object the entry holds or, for a partial
+ * entry, of the object on disk. 0 if there is none.
+ */
+uint32_t doCache::stored_version(struct cache_entry *p_entry, uint8_t vindex)
+{
+    if (p_entry->current!=NULL)
+    {
+        return p_entry->current->metadata.versionvector[vindex];
+    }
+    return p_entry->partial ? p_entry->diskvec[vindex] : 0;
+}
+
+struct cache_entry* doCache::create_cache_entry(struct data_object *p_in)
+{
+    struct cache_entry *entry = new struct cache_entry;
+    entry->current = p_in;
+    entry->unconfirmed = new std::map<uint64_t, struct data_object*>();
+    entry->confirmed = new std::map<uint64_t, struct data_object*>();
+    entry->entry_mutex = PTHREAD_MUTEX_INITIALIZER;
+    entry->myvec_entry = NULL;
+    entry->dirty = true;
+    entry->referenced = true;
+    entry->bytes = 0;
+    entry->partial = false;
+    if (p_in!=NULL)
+    {
+        memcpy(&entry->versionvec[0], &p_in->metadata.versionvector[0], sizeof_versionvec);
+        filelayout_raid *fl = (filelayout_raid *) &p_in->metadata.filelayout[0];
+        StripeUnitId versionindex = p_raid->get_my_stripeunitid(fl,p_in->metadata.offset,this->id);
+        entry->myvec_entry = &entry->versionvec[versionindex];
+    }
+    return entry;
 }
 
 struct stripe_cache_entry* doCache::create_stripe_cache_entry()
@@ -87,6 +351,8 @@ struct stripe_cache_entry* doCache::create_stripe_cache_entry()
         //p_ent->dirtycnter=0;
         p_ent->dirty=true;
         p_ent->busy=true;
+        p_ent->nextread=0;
+        p_ent->prefetched=0;
         //p_ent->last_modified = time(0);
         p_ent->smutex = PTHREAD_MUTEX_INITIALIZER;
         return p_ent;
@@ -96,20 +362,15 @@ int doCache::reset_version_vector(InodeNumber inum ,StripeId sid, uint8_t vindex
 {
     int rc=0;
     log->debug_log("inum:%llu, sid:%u",inum,sid);
-    pthread_mutex_lock(&mutex);
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it==p_cache->end())
-    {
-        struct stripe_cache_entry *p_ent = create_stripe_cache_entry();
-        it = p_cache->insert(it,std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
-        log->debug_log("inserted map for inum:%u",inum);
-    }
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
     pthread_mutex_lock(&it->second->smutex);
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
     std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
     if (it2 == it->second->map->end())
     {
-        initialize_cache_entry(it, sid);
+        initialize_cache_entry(p_shard, it, sid);
         log->debug_log("initalized...");
         it2 = it->second->map->find( sid);
         it2->second->myvec_entry = &it2->second->versionvec[vindex];
@@ -122,31 +383,42 @@ int doCache::reset_version_vector(InodeNumber inum ,StripeId sid, uint8_t vindex
     return rc;
 }
 
-int doCache::get_next_version_vector(InodeNumber inum, StripeId sid, uint32_t *versionvec, uint8_t vindex)
+/**
+ * @param readdata false if the caller does not need the old object, a miss
+ * then reads only its metadata
+ */
+int doCache::get_next_version_vector(InodeNumber inum, StripeId sid, uint32_t *versionvec, uint8_t vindex, bool readdata)
 {
     log->debug_log("request for %llu.%u, vindex=%u",inum,sid,vindex);
     int rc=0;
-    pthread_mutex_lock(&mutex);
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it==p_cache->end())
-    {
-        struct stripe_cache_entry *p_ent = create_stripe_cache_entry();
-        it = p_cache->insert(it,std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
-        log->debug_log("inserted map for inum:%u",inum);
-    }
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
     pthread_mutex_lock(&it->second->smutex);
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
     log->debug_log("Got stripe mutex");
     it->second->busy=true;
     std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
     if (it2 == it->second->map->end())
     {
-        initialize_cache_entry(it, sid);
+        if (readdata)
+        {
+            initialize_cache_entry(p_shard, it, sid);
+        }
+        else
+        {
+            initialize_version_entry(p_shard, it, sid);
+        }
         log->debug_log("initalized...");
         it2 = it->second->map->find( sid);
         it2->second->myvec_entry = &it2->second->versionvec[vindex];
         //*it2->second->myvec_entry = 0;
     }
+    else
+    {
+        __sync_fetch_and_add(&p_shard->hits, 1);
+    }
+    it2->second->referenced = true;
     log->debug_log("got stripe");
     if (it2->second->myvec_entry==NULL)
     {
@@ -176,30 +448,56 @@ int doCache::get_next_version_vector(InodeNumber inum, StripeId sid, uint32_t *v
     return rc;
 }
 
+/**
+ * @brief the stored version of unit vindex without reading the old object.
+ * @return 0 if an object is stored
+ */
+int doCache::get_stored_version(InodeNumber inum, StripeId sid, uint8_t vindex, uint32_t *version)
+{
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
+    pthread_mutex_lock(&it->second->smutex);
+    pthread_mutex_unlock(&p_shard->mutex);
+    std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
+    if (it2 == it->second->map->end())
+    {
+        initialize_version_entry(p_shard, it, sid);
+        it2 = it->second->map->find(sid);
+    }
+    else
+    {
+        __sync_fetch_and_add(&p_shard->hits, 1);
+    }
+    it2->second->referenced = true;
+    *version = stored_version(it2->second, vindex);
+    pthread_mutex_unlock(&it->second->smutex);
+    log->debug_log("%llu.%u: version:%u",inum,sid,*version);
+    return (*version>0) ? 0 : -1;
+}
+
 int doCache::get_unconfirmed(InodeNumber inum, StripeId sid, struct data_object **p_out)
 {
     log->debug_log("request for %llu.%u",inum,sid);
     int rc=-1;
-    pthread_mutex_lock(&mutex);
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it==p_cache->end())
-    {
-        struct stripe_cache_entry *p_ent =  create_stripe_cache_entry();
-        it = p_cache->insert(it,std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
-        log->debug_log("inserted map for inum:%u",inum);
-    }
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
     pthread_mutex_lock(&it->second->smutex);
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
     std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
     if (it2 == it->second->map->end())
     {
-        initialize_cache_entry(it, sid);
+        initialize_cache_entry(p_shard, it, sid);
         pthread_mutex_unlock(&it->second->smutex);
     }
     else
     {
+        __sync_fetch_and_add(&p_shard->hits, 1);
+        load_partial(p_shard, inum, sid, it2->second);
         pthread_mutex_lock(&it2->second->entry_mutex);
         pthread_mutex_unlock(&it->second->smutex);
+        it2->second->referenced = true;
         log->debug_log("Found stripeid:%u",it2->first);
         std::map<uint64_t, struct data_object*>::reverse_iterator itunconf = it2->second->unconfirmed->rbegin();
         if (itunconf!= it2->second->unconfirmed->rend())
@@ -210,6 +508,7 @@ int doCache::get_unconfirmed(InodeNumber inum, StripeId sid, struct data_object
         {
             *p_out = it2->second->current;
         }
+        pin(*p_out);
         pthread_mutex_unlock(&it2->second->entry_mutex);
         log->debug_log("resturn entry with csid:%u",(*p_out)->metadata.ccoid.csid);
         rc=0;
@@ -223,30 +522,35 @@ int doCache::get_unconfirmed(InodeNumber inum, StripeId sid, struct data_object
     return rc;
 }
  
+/**
+ * @brief the current object of the stripe, read from disk on a miss. It
+ * stays valid until the caller gives it back with release.
+ */
 int doCache::get_entry(InodeNumber inum, StripeId sid, struct data_object **p_out)
 {
     log->debug_log("request for %llu.%u",inum,sid);
     int rc=-1;
-    pthread_mutex_lock(&mutex);
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it==p_cache->end())
-    {
-        struct stripe_cache_entry *p_ent = create_stripe_cache_entry();
-        it = p_cache->insert(it,std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
-        log->debug_log("inserted map for inum:%u",inum);
-    }
-    
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
     pthread_mutex_lock(&it->second->smutex);
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
     
     std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
     if (it2 == it->second->map->end())
     {
-        initialize_cache_entry(it, sid);    
+        initialize_cache_entry(p_shard, it, sid);    
         it2 = it->second->map->find(sid);
     }
+    else
+    {
+        __sync_fetch_and_add(&p_shard->hits, 1);
+    }
+    it2->second->referenced = true;
+    load_partial(p_shard, inum, sid, it2->second);
     log->debug_log("Found stripeid:%u",it2->first);
     *p_out = it2->second->current;    
+    pin(*p_out);
     pthread_mutex_unlock(&it->second->smutex);
     if (*p_out!=NULL)
     {
@@ -265,35 +569,21 @@ int doCache::get_entry(InodeNumber inum, StripeId sid, struct data_object **p_ou
 int doCache::set_entry(InodeNumber inum, StripeId sid, struct data_object *p_in)
 {
     int rc=-1;
-    pthread_mutex_lock(&mutex);
+    uint32_t shard = get_shard(inum);
+    struct cache_shard *p_shard = &shards[shard];
+    pthread_mutex_lock(&p_shard->mutex);
     log->debug_log("Inum:%llu,sid:%u",inum,sid);
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it==p_cache->end())
-    {     
-        struct stripe_cache_entry *p_ent = create_stripe_cache_entry();
-        it = p_cache->insert(it, std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
-        log->debug_log("created map for inum:%llu",inum);        
-    }
-    
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
     pthread_mutex_lock(&it->second->smutex);
     
     log->debug_log("Found cache entry for inum:%llu",inum);
     std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
     if (it2 == it->second->map->end())
     {
-        struct cache_entry *entry = new struct cache_entry;
-        entry->current=p_in;
-        entry->unconfirmed=new std::map<uint64_t, struct data_object*>();
-        entry->confirmed = new std::map<uint64_t, struct data_object*>();
-        //entry->versioncnt=1;
-        entry->dirty=true;
-        filelayout_raid *fl = (filelayout_raid *) &entry->current->metadata.filelayout[0];
-        StripeUnitId versionindex = p_raid->get_my_stripeunitid(fl,entry->current->metadata.offset,this->id);
-        entry->myvec_entry = &entry->versionvec[versionindex];
-        entry->entry_mutex=PTHREAD_MUTEX_INITIALIZER;
+        struct cache_entry *entry = create_cache_entry(p_in);
         it->second->map->insert(std::pair<StripeId,struct cache_entry*>(sid,entry));
         it->second->busy=true;
-        pthread_mutex_unlock(&it->second->smutex);
+        account(p_shard, entry);
         log->debug_log("No stripeid entry for %u. created it.",sid);  
         rc=0;
     }        
@@ -305,13 +595,15 @@ int doCache::set_entry(InodeNumber inum, StripeId sid, struct data_object *p_in)
         if (it2->second->current!=NULL)
         {
             log->debug_log("deleting csid:%u,seq:%u.",it2->second->current->metadata.ccoid.csid,it2->second->current->metadata.ccoid.sequencenum);
-            if (it2->second->current->data!=NULL) free(it2->second->current->data);
-            //delete it2->second->current;
+            drop_object(it2->second->current);
         }
         it2->second->current = p_in;
+        it2->second->partial=false;
         it->second->busy=true;
         it->second->dirty=true;
         it2->second->dirty=true;
+        it2->second->referenced=true;
+        account(p_shard, it2->second);
         rc=0;
         log->debug_log("inserted:seq:%u",it2->second->current->metadata.ccoid.sequencenum);
         pthread_mutex_unlock(&it2->second->entry_mutex);
@@ -319,7 +611,8 @@ int doCache::set_entry(InodeNumber inum, StripeId sid, struct data_object *p_in)
     pthread_mutex_unlock(&it->second->smutex);
     //it->second->last_modified = time(0);
     log->debug_log("rc:%d",rc);
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
+    evict(shard);
     return rc;
 }
 
@@ -328,29 +621,17 @@ int doCache::parityUnconfirmed(InodeNumber inum, StripeId sid, struct data_objec
     int rc=-1;
     uint8_t versionindex = default_groupsize;
     log->debug_log("Inum:%llu,sid:%u,version:%u, seq:%u",inum,sid,p_in->metadata.versionvector[versionindex],p_in->metadata.ccoid.sequencenum);
-    pthread_mutex_lock(&mutex);
-    
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it==p_cache->end())
-    {     
-        struct stripe_cache_entry *p_ent = create_stripe_cache_entry();
-        it = p_cache->insert(it, std::pair<InodeNumber,struct stripe_cache_entry*>(inum,p_ent));
-        log->debug_log("created map for inum:%llu",inum);        
-    }
+    uint32_t shard = get_shard(inum);
+    struct cache_shard *p_shard = &shards[shard];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
     log->debug_log("Found cache entry for inum:%llu",inum);
     pthread_mutex_lock(&it->second->smutex);
     std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
     if (it2 == it->second->map->end())
     {
-        struct cache_entry *entry = new struct cache_entry;
-        entry->current=p_in;
+        struct cache_entry *entry = create_cache_entry(p_in);
         entry->dirty=false;
-        entry->unconfirmed=new std::map<uint64_t, struct data_object*>();
-        entry->confirmed = new std::map<uint64_t, struct data_object*>();
-        entry->entry_mutex=PTHREAD_MUTEX_INITIALIZER;
-        filelayout_raid *fl = (filelayout_raid *) &entry->current->metadata.filelayout[0];
-        StripeUnitId versionindex = p_raid->get_my_stripeunitid(fl,entry->current->metadata.offset,this->id);
-        entry->myvec_entry = &entry->versionvec[versionindex];
         it->second->map->insert(std::pair<StripeId,struct cache_entry*>(sid,entry));
         log->debug_log("No stripeid entry for %u. created it.",sid);  
         rc=0;
@@ -358,12 +639,15 @@ int doCache::parityUnconfirmed(InodeNumber inum, StripeId sid, struct data_objec
     }
     //std::map<uint64_t,struct data_object*>::iterator it3 = it2->second->unconfirmed->find(p_in->metadata.versionvector[versionindex]);
     it2->second->unconfirmed->insert(std::pair<uint64_t,struct data_object*>(p_in->metadata.versionvector[versionindex],p_in));
+    it2->second->referenced=true;
+    account(p_shard, it2->second);
     log->debug_log("stripe id:%u, inserted version:%u",it2->first,p_in->metadata.versionvector[versionindex]);
     rc=0;
 
     pthread_mutex_unlock(&it->second->smutex);
-    pthread_mutex_unlock(&mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
     log->debug_log("rc:%d",rc);
+    evict(shard);
     return rc;
 }
 
@@ -373,14 +657,15 @@ int doCache::parityConfirm(InodeNumber inum, StripeId sid, uint64_t version)
     int rc=-1;
     uint8_t versionindex = default_groupsize;
     log->debug_log("inum:%llu,sid:%u,version:%llu, versionindex:%u",inum,sid,version, versionindex);
-    pthread_mutex_lock(&mutex);
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->find(inum);
-    if (it!=p_cache->end())
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_shard->map->find(inum);
+    if (it!=p_shard->map->end())
     {    
         pthread_mutex_lock(&it->second->smutex);
         log->debug_log("find entry sid:%u",sid);
         std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
-        pthread_mutex_unlock(&mutex);
+        pthread_mutex_unlock(&p_shard->mutex);
         if (it2 != it->second->map->end())
         { 
             pthread_mutex_lock(&it2->second->entry_mutex);
@@ -390,17 +675,17 @@ int doCache::parityConfirm(InodeNumber inum, StripeId sid, uint64_t version)
             log->debug_log("acquire mutex...");
             if (it3 != it2->second->unconfirmed->end())
             {
-                uint64_t current_version = (it2->second->current!=0) ? it2->second->current->metadata.versionvector[versionindex] : 0;
+                uint64_t current_version = stored_version(it2->second, versionindex);
                 log->debug_log("Current version is...%u:",current_version);
                 if (current_version+1 == version)
                 {   
                     if (it2->second->current!=0)
                     {
                         log->debug_log("deleting csid:%u,seq:%u.",it2->second->current->metadata.ccoid.csid,it2->second->current->metadata.ccoid.sequencenum);
-                        free(it2->second->current->data);
-                        delete it2->second->current;      
+                        drop_object(it2->second->current);
                     }
                     it2->second->current=it3->second;
+                    it2->second->partial=false;
                     log->debug_log("%p:%p",it2->second->current,it3->second);
                     rc=0;
                     log->debug_log("switched from version %u to %u: current-> reflects:%u",current_version,version,it2->second->current->metadata.versionvector[versionindex]);
@@ -413,8 +698,7 @@ int doCache::parityConfirm(InodeNumber inum, StripeId sid, uint64_t version)
                         log->debug_log("current version is:%u",current_version2);
                         if (current_version2+1==itconf->second->metadata.versionvector[versionindex])
                         {
-                            free(it2->second->current->data);
-                            delete it2->second->current;      
+                            drop_object(it2->second->current);
                             it2->second->current=itconf->second;                            
                             it2->second->confirmed->erase(itconf++);
                             log->debug_log("switch again: version %u to +1",current_version2);
@@ -449,6 +733,8 @@ int doCache::parityConfirm(InodeNumber inum, StripeId sid, uint64_t version)
                 log->debug_log("no unconfirmed version:%llu",version);
             }
             it->second->busy=true;
+            it2->second->referenced=true;
+            account(p_shard, it2->second);
             pthread_mutex_unlock(&it2->second->entry_mutex);
         }
         else
@@ -459,7 +745,7 @@ int doCache::parityConfirm(InodeNumber inum, StripeId sid, uint64_t version)
     }
     else
     {
-        pthread_mutex_unlock(&mutex);
+        pthread_mutex_unlock(&p_shard->mutex);
         log->debug_log("no inum entry for %llu",inum);
     }
     log->debug_log("rc:%d",rc);
@@ -471,13 +757,38 @@ int doCache::garbage_collection()
 {
     int rc = 0;
     log->debug_log("Start garbage collection");
+    for (uint32_t i=0; i<shardcnt; i++)
+    {
+        pthread_mutex_lock(&shards[i].mutex);
+        if (gc_shard(&shards[i]))
+        {
+            rc = -1;
+        }
+        pthread_mutex_unlock(&shards[i].mutex);
+        evict(i);
+    }
+    struct cache_stats stats;
+    get_stats(&stats);
+    uint64_t reads = stats.readhits+stats.readmisses;
+    log->debug_log("inodes:%u, bytes:%llu/%llu, hits:%llu, misses:%llu, evictions:%llu",stats.inodes,stats.bytes,stats.budget,stats.hits,stats.misses,stats.evictions);
+    log->debug_log("reads:%llu, read hit rate:%.1f%%, read ahead:%llu",reads,(reads>0) ? 100.0*stats.readhits/reads : 0.0,stats.prefetches);
+    return rc;
+}
+
+/**
+ * @brief removes the old on-disk versions of the dirty entries, the shard
+ * mutex must be held.
+ */
+int doCache::gc_shard(struct cache_shard *p_shard)
+{
+    int rc = 0;
     filelayout_raid *fl;
     uint64_t currentversion;
     StripeUnitId versionindex;
     std::map<StripeId,struct cache_entry*>::iterator itsid;
-    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_cache->begin();
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_shard->map->begin();
     //bool dodecrement;
-    for (it;it!=p_cache->end(); it++)
+    for (it;it!=p_shard->map->end(); it++)
     {        
         if (!it->second->busy || DEACTIVATE_BUSY_BIT)// && it->second->last_modified + gc_inum_timeout < time(0))
         {    
@@ -504,7 +815,7 @@ int doCache::garbage_collection()
                                 it->second->dirty=false;
                                 for (itsid; itsid!=it->second->map->end(); itsid++)
                                 {
-                                    if (itsid->second->dirty)
+                                    if (itsid->second->dirty && itsid->second->current!=NULL)
                                     {                        
                                         if (pthread_mutex_trylock(&itsid->second->entry_mutex)==0)
                                         {
@@ -512,7 +823,7 @@ int doCache::garbage_collection()
                                             {
                                                 currentversion=itsid->second->current->metadata.versionvector[versionindex];
                                                 log->debug_log("Pointer:%p,Currentversion of inum:%llu, sid:%u is %u",itsid->second->current,it->first, itsid->first, currentversion);
-                                                rc = p_fileio->remove_lower_than(it->first, itsid->first, currentversion);
+                                                rc = p_fileio->remove_lower_than_async(it->first, itsid->first, currentversion);
                                                 itsid->second->dirty=false;
                                                 //dodecrement=true;
                                                 pthread_mutex_unlock(&itsid->second->entry_mutex);
@@ -570,4 +881,366 @@ int doCache::garbage_collection()
     }
     return rc;
 }
-    
\ No newline at end of file
+    
+
+/**
+ * @brief clock sweep over the shard until it fits its share of the budget.
+ * Entries touched since the last sweep get a second chance. Only entries
+ * without pending versions or reserved version numbers are dropped, they
+ * are read from disk again on the next access.
+ * @return number of evicted entries
+ */
+int doCache::evict(uint32_t shard)
+{
+    struct cache_shard *p_shard = &shards[shard];
+    size_t target = budget/shardcnt;
+    if (budget==0 || p_shard->bytes<=target)
+    {
+        return 0;
+    }
+    int cnt=0;
+    pthread_mutex_lock(&p_shard->mutex);
+    size_t visits = 2*p_shard->map->size();
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = p_shard->map->lower_bound(p_shard->hand);
+    for (size_t i=0; i<visits && p_shard->bytes>target; i++)
+    {
+        if (it==p_shard->map->end())
+        {
+            it = p_shard->map->begin();
+        }
+        if (pthread_mutex_trylock(&it->second->smutex)!=0)
+        {
+            it++;
+            continue;
+        }
+        std::map<StripeId,struct cache_entry*>::iterator itsid = it->second->map->begin();
+        while (itsid!=it->second->map->end() && p_shard->bytes>target)
+        {
+            struct cache_entry *p_entry = itsid->second;
+            if (p_entry->referenced)
+            {
+                p_entry->referenced = false;
+                itsid++;
+            }
+            else if (evict_entry(p_shard, it->first, itsid->first, p_entry))
+            {
+                it->second->map->erase(itsid++);
+                cnt++;
+            }
+            else
+            {
+                itsid++;
+            }
+        }
+        bool empty = it->second->map->empty();
+        pthread_mutex_unlock(&it->second->smutex);
+        if (empty)
+        {
+            // nobody waits for smutex while the shard mutex is held
+            pthread_mutex_destroy(&it->second->smutex);
+            delete it->second->map;
+            delete it->second;
+            p_shard->map->erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+    p_shard->hand = (it==p_shard->map->end()) ? 0 : it->first;
+    p_shard->evictions += cnt;
+    pthread_mutex_unlock(&p_shard->mutex);
+    log->debug_log("shard:%u, evicted:%d, bytes:%llu",shard,cnt,p_shard->bytes);
+    return cnt;
+}
+
+/**
+ * @brief frees the entry if nothing is pending on it, smutex is held.
+ */
+bool doCache::evict_entry(struct cache_shard *p_shard, InodeNumber inum, StripeId sid, struct cache_entry *p_entry)
+{
+    if (pthread_mutex_trylock(&p_entry->entry_mutex)!=0)
+    {
+        return false;
+    }
+    bool evictable = p_entry->unconfirmed->empty() && p_entry->confirmed->empty();
+    if (evictable && p_entry->myvec_entry!=NULL)
+    {
+        // a reserved but not yet written version is only known here
+        uint32_t stored = stored_version(p_entry, p_entry->myvec_entry-&p_entry->versionvec[0]);
+        evictable = (*p_entry->myvec_entry==stored);
+    }
+    if (!evictable)
+    {
+        pthread_mutex_unlock(&p_entry->entry_mutex);
+        return false;
+    }
+    if (p_entry->current!=NULL)
+    {
+        if (p_entry->dirty)
+        {
+            filelayout_raid *fl = (filelayout_raid*) &p_entry->current->metadata.filelayout[0];
+            StripeUnitId versionindex = p_raid->get_my_stripeunitid(fl,p_entry->current->metadata.offset,this->id);
+            p_fileio->remove_lower_than_async(inum, sid, p_entry->current->metadata.versionvector[versionindex]);
+        }
+        drop_object(p_entry->current);
+        p_entry->current = NULL;
+    }
+    account(p_shard, p_entry);
+    pthread_mutex_unlock(&p_entry->entry_mutex);
+    pthread_mutex_destroy(&p_entry->entry_mutex);
+    delete p_entry->unconfirmed;
+    delete p_entry->confirmed;
+    delete p_entry;
+    return true;
+}
+
+void doCache::set_readahead(uint32_t stripes)
+{
+    readahead = stripes;
+}
+
+/**
+ * @brief get_entry for the client read path. Counts read hits and reads
+ * the following stripes ahead once the inode is read sequentially.
+ */
+int doCache::read_entry(InodeNumber inum, StripeId sid, struct data_object **p_out)
+{
+    return read_entry_async(inum, sid, p_out, NULL, NULL);
+}
+
+static void read_entry_done(void *arg, int rc, struct data_object *p_do)
+{
+    struct prefetch_job *p_job = (struct prefetch_job *) arg;
+    p_job->p_cache->read_done(p_job, rc, p_do);
+}
+
+/**
+ * @brief like read_entry, but a miss is read on a disk I/O thread. Returns
+ * DOCACHE_PENDING then, cb gets the object once it is inserted. Without
+ * cb the miss is read by the caller. Either way the object is released by
+ * the caller.
+ */
+int doCache::read_entry_async(InodeNumber inum, StripeId sid, struct data_object **p_out, void (*cb)(void *arg, int rc, struct data_object *p_do), void *arg)
+{
+    int rc=-1;
+    bool pending=false;
+    std::vector<StripeId> ahead;
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, inum);
+    pthread_mutex_lock(&it->second->smutex);
+    pthread_mutex_unlock(&p_shard->mutex);
+
+    *p_out = NULL;
+    std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(sid);
+    if (it2 == it->second->map->end())
+    {
+        __sync_fetch_and_add(&p_shard->readmisses, 1);
+        if (cb!=NULL)
+        {
+            __sync_fetch_and_add(&p_shard->misses, 1);
+            pending = true;
+        }
+        else
+        {
+            initialize_cache_entry(p_shard, it, sid);
+            it2 = it->second->map->find(sid);
+        }
+    }
+    else
+    {
+        __sync_fetch_and_add(&p_shard->hits, 1);
+        __sync_fetch_and_add(&p_shard->readhits, 1);
+        pending = (cb!=NULL && it2->second->partial && it2->second->current==NULL);
+    }
+    if (!pending)
+    {
+        it2->second->referenced = true;
+        load_partial(p_shard, inum, sid, it2->second);
+        *p_out = it2->second->current;
+        pin(*p_out);
+    }
+    if (readahead>0)
+    {
+        if (sid!=it->second->nextread)
+        {
+            it->second->prefetched = sid;
+        }
+        else if (it->second->prefetched < sid+readahead)
+        {
+            StripeId next = (it->second->prefetched > sid) ? it->second->prefetched+1 : sid+1;
+            for (next; next<=sid+readahead; next++)
+            {
+                if (it->second->map->find(next)==it->second->map->end())
+                {
+                    ahead.push_back(next);
+                }
+            }
+            it->second->prefetched = sid+readahead;
+        }
+        it->second->nextread = sid+1;
+    }
+    pthread_mutex_unlock(&it->second->smutex);
+    if (pending)
+    {
+        struct prefetch_job *p_job = new struct prefetch_job;
+        p_job->p_cache = this;
+        p_job->inum = inum;
+        p_job->sid = sid;
+        p_job->evictions = p_shard->evictions;
+        p_job->cb = cb;
+        p_job->arg = arg;
+        if (p_fileio->read_stripe_object_async(inum, sid, &read_entry_done, p_job))
+        {
+            log->warning_log("read failed:inum:%llu,sid:%u",inum,sid);
+            delete p_job;
+        }
+        else
+        {
+            rc = DOCACHE_PENDING;
+        }
+    }
+    else if (*p_out!=NULL)
+    {
+        rc=0;
+    }
+    if (!ahead.empty())
+    {
+        prefetch(inum, ahead);
+    }
+    log->debug_log("inum:%llu, sid:%u, readahead:%u, rc:%d",inum,sid,ahead.size(),rc);
+    return rc;
+}
+
+/**
+ * @brief inserts the object read for read_entry_async and hands the cached
+ * object to the waiting request. If the shard evicted since the read was
+ * issued the object may be older than the evicted version and is read again.
+ */
+void doCache::read_done(struct prefetch_job *p_job, int rc, struct data_object *p_do)
+{
+    struct cache_shard *p_shard = &shards[get_shard(p_job->inum)];
+    struct data_object *p_out = NULL;
+    bool reread = false;
+    pthread_mutex_lock(&p_shard->mutex);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, p_job->inum);
+    pthread_mutex_lock(&it->second->smutex);
+    uint64_t evictions = p_shard->evictions;
+    pthread_mutex_unlock(&p_shard->mutex);
+
+    std::map<StripeId,struct cache_entry*>::iterator it2 = it->second->map->find(p_job->sid);
+    if (it2 == it->second->map->end())
+    {
+        if (evictions!=p_job->evictions)
+        {
+            reread = true;
+        }
+        else
+        {
+            insert_read_entry(p_shard, it, p_job->sid, (rc==0) ? p_do : NULL);
+            p_do = NULL;
+            it2 = it->second->map->find(p_job->sid);
+        }
+    }
+    else if (it2->second->partial && it2->second->current==NULL)
+    {
+        if (rc==0 && p_do!=NULL)
+        {
+            it2->second->partial = false;
+            it2->second->current = p_do;
+            account(p_shard, it2->second);
+            p_do = NULL;
+        }
+    }
+    if (!reread)
+    {
+        it2->second->referenced = true;
+        p_out = it2->second->current;
+        pin(p_out);
+    }
+    pthread_mutex_unlock(&it->second->smutex);
+    if (p_do!=NULL)
+    {
+        free(p_do->data);
+        delete p_do;
+    }
+    if (reread)
+    {
+        p_job->evictions = evictions;
+        if (p_fileio->read_stripe_object_async(p_job->inum, p_job->sid, &read_entry_done, p_job)==0)
+        {
+            return;
+        }
+        log->warning_log("read failed:inum:%llu,sid:%u",p_job->inum,p_job->sid);
+    }
+    p_job->cb(p_job->arg, (p_out!=NULL) ? 0 : -1, p_out);
+    delete p_job;
+}
+
+static void prefetch_read_done(void *arg, int rc, struct data_object *p_do)
+{
+    struct prefetch_job *p_job = (struct prefetch_job *) arg;
+    p_job->p_cache->prefetch_done(p_job, rc, p_do);
+}
+
+/**
+ * @brief reads the stripes on the disk I/O threads, they are inserted
+ * by prefetch_done.
+ */
+void doCache::prefetch(InodeNumber inum, std::vector<StripeId> &sids)
+{
+    struct cache_shard *p_shard = &shards[get_shard(inum)];
+    std::vector<StripeId>::iterator it = sids.begin();
+    for (it; it!=sids.end(); it++)
+    {
+        struct prefetch_job *p_job = new struct prefetch_job;
+        p_job->p_cache = this;
+        p_job->inum = inum;
+        p_job->sid = *it;
+        p_job->evictions = p_shard->evictions;
+        p_job->cb = NULL;
+        p_job->arg = NULL;
+        if (p_fileio->read_stripe_object_async(inum, *it, &prefetch_read_done, p_job))
+        {
+            log->warning_log("read ahead failed:inum:%llu,sid:%u",inum,*it);
+            delete p_job;
+        }
+    }
+}
+
+/**
+ * @brief inserts a stripe read ahead unless it is cached meanwhile. If the
+ * shard evicted since the read was issued the object may be older than
+ * the evicted version and is dropped.
+ */
+void doCache::prefetch_done(struct prefetch_job *p_job, int rc, struct data_object *p_do)
+{
+    uint32_t shard = get_shard(p_job->inum);
+    struct cache_shard *p_shard = &shards[shard];
+    bool inserted = false;
+    pthread_mutex_lock(&p_shard->mutex);
+    if (rc==0 && p_do!=NULL && p_shard->evictions==p_job->evictions)
+    {
+        std::map<InodeNumber,struct stripe_cache_entry*>::iterator it = lookup(p_shard, p_job->inum);
+        pthread_mutex_lock(&it->second->smutex);
+        if (it->second->map->find(p_job->sid)==it->second->map->end())
+        {
+            insert_read_entry(p_shard, it, p_job->sid, p_do);
+            p_shard->prefetches++;
+            inserted = true;
+        }
+        pthread_mutex_unlock(&it->second->smutex);
+    }
+    pthread_mutex_unlock(&p_shard->mutex);
+    if (!inserted && p_do!=NULL)
+    {
+        free(p_do->data);
+        delete p_do;
+    }
+    delete p_job;
+    if (inserted)
+    {
+        evict(shard);
+    }
+}
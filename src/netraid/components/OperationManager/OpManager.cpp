@@ -11,20 +11,15 @@ bool timer_watchdog_killswitch=false;
 
 void* timer_watchdog(void *p_in)
 {
-    std::map<InodeNumber, StripeManager*> *p_map = (std::map<InodeNumber, StripeManager*>*)p_in;
+    OpManager *p_opman = (OpManager *) p_in;
     time_t iteration_start;
     double end_diff;
-    std::map<InodeNumber, StripeManager*>::iterator it;
     double interval = 2.0;
     
     while (!timer_watchdog_killswitch)
     {
         iteration_start = time(0);
-        it = p_map->begin();
-        for(it; it!=p_map->end(); it++)
-        {
-            it->second->timeout_check();
-        }
+        p_opman->timeout_check();
         end_diff = interval-difftime(time(0),iteration_start);
         if (0<end_diff)
         {
@@ -74,6 +69,7 @@ int calculate_parity_block(struct operation_participant *p_op)
  */
 int calculate_parity_block(struct operation_primcoordinator *p_op)
 {
+    void *inputs[PARITY_MAX_INPUTS];
     std::map<StripeId,struct datacollection_primco*>::iterator its = p_op->datamap_primco->begin();
     for (its; its!=p_op->datamap_primco->end(); its++)
     {        
@@ -83,21 +79,36 @@ int calculate_parity_block(struct operation_primcoordinator *p_op)
             return -1;
         }
         its->second->finalparity = malloc(p_op->datalength);
-        if (its->second->existing==NULL)
-        {            
-                memcpy(its->second->finalparity, it->second->data,p_op->datalength) ;
+        if (its->second->finalparity == NULL)
+        {
+            return -1;
         }
-        else
+        // fold the existing block and all received parity updates in one pass
+        int n=0;
+        if (its->second->existing!=NULL)
         {
-                calc_parity(it->second->data ,its->second->existing->data,its->second->finalparity,p_op->datalength);
+            inputs[n++] = its->second->existing->data;
         }
-        if (its->second->paritymap->size()>1)
+        for(it; it!=its->second->paritymap->end(); it++)
         {
-            it++;
-            for(it; it!=its->second->paritymap->end(); it++)
+            if (n==PARITY_MAX_INPUTS)
             {
-                calc_parity(it->second->data ,its->second->finalparity,its->second->finalparity,p_op->datalength);
-            }    
+                calc_parity_n(&inputs[0], n, its->second->finalparity, p_op->datalength);
+                n=0;
+                inputs[n++] = its->second->finalparity;
+            }
+            inputs[n++] = it->second->data;
+        }
+        if (n==1)
+        {
+            if (inputs[0]!=its->second->finalparity)
+            {
+                memcpy(its->second->finalparity, inputs[0], p_op->datalength);
+            }
+        }
+        else
+        {
+            calc_parity_n(&inputs[0], n, its->second->finalparity, p_op->datalength);
         }
     }
     return 0;
@@ -132,7 +143,7 @@ void free_dataobject_collection(struct dataobject_collection *p)
         //  if (p->existing!=NULL)free(p->existing); // freeed by docache
         //if (p->existing != p->recv_data) free(p->recv_data);
         free(p->parity_data);
-        free(p);
+        delete p;
     }
 };
 
@@ -335,11 +346,17 @@ void print_struct_participant(struct Participants_bf *p, stringstream& ss)
     ss<<"\n";
 }
 
-OpManager::OpManager(Logger *p_log, int (*p_cb)(queue_priorities, OPHead*), serverid_t myid,doCache *docache,Filestorage *fileio) {
-    p_opmap = new std::map<InodeNumber, StripeManager*>();
+OpManager::OpManager(Logger *p_log, int (*p_cb)(queue_priorities, OPHead*), serverid_t myid,doCache *docache,Filestorage *fileio, uint32_t shards) {
+    shardcnt = (shards>0) ? shards : OPMANAGER_DEFAULT_SHARDS;
+    this->shards = new struct opmap_shard[shardcnt];
+    for (uint32_t i=0; i<shardcnt; i++)
+    {
+        pthread_mutex_init(&this->shards[i].mutex, NULL);
+        this->shards[i].map = new std::map<InodeNumber, StripeManager*>();
+        this->shards[i].lookups = 0;
+        this->shards[i].contended = 0;
+    }
     p_queuePush = p_cb;
-    globallock_mutex = PTHREAD_MUTEX_INITIALIZER;
-    opmap_getentry_mutex = PTHREAD_MUTEX_INITIALIZER;
     log = p_log;
     p_raid = new Libraid4(log);
     id = myid;
@@ -348,7 +365,7 @@ OpManager::OpManager(Logger *p_log, int (*p_cb)(queue_priorities, OPHead*), serv
     sequence_num = 0;
     
     pthread_t timeout_thread;
-    pthread_create(&timeout_thread, NULL, timer_watchdog , this->p_opmap );     
+    pthread_create(&timeout_thread, NULL, timer_watchdog , this );     
 }
 
 
@@ -359,41 +376,115 @@ OpManager::~OpManager()
 {
     log->debug_log("Shutting down");
     timer_watchdog_killswitch=true;
-    pthread_mutex_destroy(&globallock_mutex);
     delete p_raid;
-    std::map<InodeNumber, StripeManager*>::iterator it = p_opmap->begin();
-    for(it;it!=p_opmap->end();it++)
+    for (uint32_t i=0; i<shardcnt; i++)
     {
-        delete it->second;
+        std::map<InodeNumber, StripeManager*>::iterator it = shards[i].map->begin();
+        for(it;it!=shards[i].map->end();it++)
+        {
+            delete it->second;
+        }
+        delete shards[i].map;
+        pthread_mutex_destroy(&shards[i].mutex);
     }
-    delete p_opmap;
+    delete[] shards;
 }
 
+/**
+ * @brief partition of the inode, the multiplicative hash spreads
+ * sequentially allocated inode numbers.
+ */
+struct opmap_shard* OpManager::get_shard(InodeNumber inum)
+{
+    uint64_t h = (uint64_t)inum * 0x9E3779B97F4A7C15ULL;
+    return &shards[(h>>32)%shardcnt];
+}
+
+void OpManager::shard_lock(struct opmap_shard *p_shard)
+{
+    if (pthread_mutex_trylock(&p_shard->mutex))
+    {
+        pthread_mutex_lock(&p_shard->mutex);
+        p_shard->contended++;
+    }
+    p_shard->lookups++;
+}
 
 int OpManager::insert(void *data)
 {
     int rc = 0;
     log->debug_log("start insert.");
     StripeManager *p_sm;
-    
-    struct OPHead *ophead = (struct OPHead *) data;    
-    pthread_mutex_lock(&globallock_mutex);
-    std::map<InodeNumber,StripeManager*>::iterator it = this->p_opmap->find(ophead->inum);
-    if (it==this->p_opmap->end())
+    rc = get_entry(((struct OPHead *) data)->inum, &p_sm);
+    log->debug_log("end:rc=%d.",rc);
+    return rc;
+}       
+
+/**
+ * @brief runs the timeout check of every stripe manager. Stripe managers
+ * are never removed, so the shard is only locked while collecting them.
+ */
+void OpManager::timeout_check()
+{
+    std::vector<StripeManager*> sms;
+    for (uint32_t i=0; i<shardcnt; i++)
     {
-        p_sm = new StripeManager(log,p_queuePush,p_docache,this->id,p_fileio);
-        this->p_opmap->insert(std::pair<InodeNumber, StripeManager*>(ophead->inum,p_sm));
-        log->debug_log("new stripe manager inserted for inum:%llu inserted",ophead->inum);
+        sms.clear();
+        pthread_mutex_lock(&shards[i].mutex);
+        std::map<InodeNumber, StripeManager*>::iterator it = shards[i].map->begin();
+        for(it; it!=shards[i].map->end(); it++)
+        {
+            sms.push_back(it->second);
+        }
+        pthread_mutex_unlock(&shards[i].mutex);
+        std::vector<StripeManager*>::iterator vit = sms.begin();
+        for (vit; vit!=sms.end(); vit++)
+        {
+            (*vit)->timeout_check();
+        }
     }
-    else
+}
+
+uint32_t OpManager::get_shardcount()
+{
+    return shardcnt;
+}
+
+void OpManager::get_shard_stats(uint32_t shard, struct opmap_stats *p_stats)
+{
+    memset(p_stats, 0, sizeof(struct opmap_stats));
+    if (shard>=shardcnt) return;
+    pthread_mutex_lock(&shards[shard].mutex);
+    p_stats->lookups = shards[shard].lookups;
+    p_stats->contended = shards[shard].contended;
+    p_stats->inodes = shards[shard].map->size();
+    pthread_mutex_unlock(&shards[shard].mutex);
+}
+
+/**
+ * @brief logs the totals and the most contended shard.
+ */
+void OpManager::report()
+{
+    struct opmap_stats stats, total;
+    uint32_t hottest = 0;
+    uint64_t hottest_contended = 0;
+    memset(&total, 0, sizeof(total));
+    for (uint32_t i=0; i<shardcnt; i++)
     {
-        
-        log->debug_log("server manager found for %llu.",ophead->inum);
+        get_shard_stats(i, &stats);
+        total.lookups += stats.lookups;
+        total.contended += stats.contended;
+        total.inodes += stats.inodes;
+        if (stats.contended>hottest_contended)
+        {
+            hottest = i;
+            hottest_contended = stats.contended;
+        }
     }
-    pthread_mutex_unlock(&globallock_mutex);
-    log->debug_log("end:rc=%d.",rc);
-    return rc;
-}       
+    log->debug_log("shards:%u, inodes:%u, lookups:%llu, contended:%llu, hottest shard:%u (%llu)",
+            shardcnt, total.inodes, total.lookups, total.contended, hottest, hottest_contended);
+}
 
 /**
  * @param csid
@@ -449,38 +540,39 @@ int OpManager::client_insert_read(struct operation_client_read *op, struct EInod
     op->groups = new std::map<uint32_t,struct operation_group*>;
     
     filelayout_raid *p_fl = (filelayout_raid *) &p_einode->inode.layout_info;
-    struct FileStripeList *p_fsl = p_raid->get_stripes(p_fl, op->ophead.offset, op->ophead.length);
-    p_raid->printFileStripeList(p_fsl);
-    std::map<StripeId,struct Stripe_layout*>::iterator it = p_fsl->stripemap->begin();
+    struct StripeCursor cursor;
+    struct StripeSpan span;
+    stripe_cursor_init(&cursor, op->ophead.offset, op->ophead.length);
     
     size_t lengthdecr = op->ophead.length;
     //char *newdata_iter = (char*) newdata;
-    for (it; it!=p_fsl->stripemap->end(); it++)
+    while (p_raid->next_stripe(p_fl, &cursor, &span))
     {
         if (!lengthdecr) break;
         struct operation_group *p_gr = new struct operation_group;
         p_gr->sumap = new std::map<StripeUnitId,struct StripeUnit*>();
-        p_gr->stripe_id = it->first;
-        log->debug_log("StripeId:%u.",it->first);                
-        std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = it->second->blockmap->begin();
-        for (it2; it2!=it->second->blockmap->end(); it2++)
+        p_gr->recovermap = NULL;
+        p_gr->stripe_id = span.sid;
+        log->debug_log("StripeId:%u.",span.sid);                
+        for (int u=0; u<span.unitcnt; u++)
         {
             if (!lengthdecr) break;
             log->debug_log("Length left = %u",lengthdecr);
-            log->debug_log("StripeUnitId:%u",it2->first);
-            struct StripeUnit *p_su = new struct StripeUnit; //it2->second;
-            p_su->start = it2->second->start;
-            p_su->end = it2->second->end;
-            p_su->assignedto = it2->second->assignedto;
+            log->debug_log("StripeUnitId:%u",span.units[u].id);
+            struct StripeUnit *p_su = new struct StripeUnit;
+            p_su->start = span.units[u].start;
+            p_su->end = span.units[u].end;
+            p_su->assignedto = span.units[u].assignedto;
             p_su->opsize = (lengthdecr > p_fl->raid4.stripeunitsize) ? p_fl->raid4.stripeunitsize : lengthdecr;
             p_su->newdata = NULL;
+            p_su->do_recv = NULL;
             //newdata_iter += p_su->opsize;
-            p_gr->sumap->insert(std::pair<StripeUnitId,struct StripeUnit*>(it2->first,p_su));
+            p_gr->sumap->insert(std::pair<StripeUnitId,struct StripeUnit*>(span.units[u].id,p_su));
             lengthdecr = (lengthdecr > p_fl->raid4.stripeunitsize) ? lengthdecr-p_fl->raid4.stripeunitsize : 0;
             
         }
         log->debug_log("Participants:%u",*(uint16_t*)&p_gr->participants);
-        op->groups->insert(std::pair<uint32_t, struct operation_group*>(it->first,p_gr));
+        op->groups->insert(std::pair<uint32_t, struct operation_group*>(span.sid,p_gr));
         op->ophead.stripecnt++;
     }    
     rc = insert(op);
@@ -501,7 +593,6 @@ int OpManager::client_insert_read(struct operation_client_read *op, struct EInod
     {
         log->warning_log("could not insert operation");
     }
-    free_FileStripeList(p_fsl);
     log->debug_log("done.rc:%d",rc);
     return rc;
 }
@@ -598,9 +689,10 @@ int OpManager::get_entry(InodeNumber inum, StripeManager **p_sm)
 {
     int rc=-1;
     log->debug_log("inum:%llu",inum);
-    pthread_mutex_lock(&globallock_mutex);
-    std::map<InodeNumber,StripeManager*>::iterator it = this->p_opmap->find(inum);
-    if (it!=this->p_opmap->end())
+    struct opmap_shard *p_shard = get_shard(inum);
+    shard_lock(p_shard);
+    std::map<InodeNumber,StripeManager*>::iterator it = p_shard->map->find(inum);
+    if (it!=p_shard->map->end())
     {
         *p_sm = it->second;
         rc=0;        
@@ -608,12 +700,12 @@ int OpManager::get_entry(InodeNumber inum, StripeManager **p_sm)
     else
     {
         StripeManager *p_smnew = new StripeManager(log,p_queuePush,p_docache,this->id,p_fileio);
-        this->p_opmap->insert(std::pair<InodeNumber, StripeManager*>(inum,p_smnew));
+        p_shard->map->insert(std::pair<InodeNumber, StripeManager*>(inum,p_smnew));
         *p_sm = p_smnew;
         rc=0;
         log->debug_log("No operation for that inode number. created it.");
     }
-    pthread_mutex_unlock(&globallock_mutex);
+    pthread_mutex_unlock(&p_shard->mutex);
     log->debug_log("rc:%d",rc);
     return rc;
 }
@@ -733,6 +825,20 @@ int OpManager::handle_committed_msg(struct dstask_ccc_recv_committed *p_task)
     return rc;
 }
 
+int OpManager::handle_primco_written(struct dstask_primco_written *p_task)
+{
+    int rc=-1;  
+    log->debug_log("op:csid=%u, inum:%llu",p_task->dshead.ophead.cco_id.csid, p_task->dshead.ophead.inum);
+    StripeManager *p_sm;
+    rc = this->get_entry(p_task->dshead.ophead.inum, &p_sm);
+    if (!rc)
+    {
+        rc = p_sm->handle_primco_written(p_task);
+    }
+    log->debug_log("rc:%u",rc);
+    return rc;
+}
+
 int OpManager::cleanup(struct operation_client_read *op)
 {    
     int rc=-1;  
@@ -814,6 +920,25 @@ int OpManager::client_handle_read_response(struct data_object *p_do, InodeNumber
     return rc;
 }
 
+/**
+ * @brief requests parity and peer units for the incomplete stripes of a read
+ * so a slow or failed unit is rebuilt instead of waited for.
+ * @return number of degraded stripes, <0 if the read is unknown
+ */
+int OpManager::client_read_degraded(struct operation_client_read *op)
+{
+    int rc=-1;
+    log->debug_log("inum:%llu,csid:%u,seq:%u",op->ophead.inum,op->ophead.cco_id.csid,op->ophead.cco_id.sequencenum);
+    StripeManager *p_sm;
+    rc = get_entry(op->ophead.inum, &p_sm);
+    if (!rc)
+    {
+        rc = p_sm->read_degraded(op->ophead.cco_id);
+    }
+    log->debug_log("rc:%d",rc);
+    return rc;
+}
+
 int OpManager::handle_prepare_msg(struct dstask_ccc_recv_prepare *p_task, struct operation_participant **part_out )
 {
     struct operation_participant *p_part;        
@@ -826,6 +951,7 @@ int OpManager::handle_prepare_msg(struct dstask_ccc_recv_prepare *p_task, struct
         std::map<StripeId,struct dataobject_collection*>::iterator it =p_part->datamap->begin();
         for (it; it!=p_part->datamap->end(); it++)
         {
+            p_docache->release(it->second->existing);
             rc = p_docache->get_entry(p_head->inum, it->first, &it->second->existing);
             if (!rc)
             {
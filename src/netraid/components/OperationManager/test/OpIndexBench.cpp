@@ -0,0 +1,140 @@
+/**
+ * \file OpIndexBench.cpp
+ *
+ * \brief Lookup cost of in-flight operations in the StripeManager.
+ *
+ * For growing numbers of in-flight operations the benchmark times the
+ * lookup of a composite write by the sequence number of one of its sub
+ * operations (client result path) and of a primary coordinator operation by
+ * ccoid and offset (coordination path).
+ *
+ * Usage: OpIndexBench [lookups per run]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "components/OperationManager/OpManager.h"
+
+#define BENCH_SU_SIZE 4096
+#define BENCH_GROUPSIZE 4
+
+static int bench_push(queue_priorities prio, OPHead *p_head)
+{
+    return 0;
+}
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static void bench_layout(struct OPHead *p_head)
+{
+    struct filelayout_raid4 *p_fl = (struct filelayout_raid4 *) &p_head->filelayout[0];
+    memset(&p_head->filelayout[0], 0, sizeof(p_head->filelayout));
+    p_fl->type = raid4;
+    p_fl->groupsize = BENCH_GROUPSIZE;
+    p_fl->servercount = BENCH_GROUPSIZE+1;
+    p_fl->stripeunitsize = BENCH_SU_SIZE;
+    for (int i=0; i<BENCH_GROUPSIZE+1; i++)
+    {
+        p_fl->serverids[i] = i;
+    }
+}
+
+static void run(Logger *log, char *data, int n, long lookups)
+{
+    StripeManager *p_sm = new StripeManager(log, &bench_push, NULL, 0, NULL);
+    std::vector<struct operation_composite*> comps;
+    std::vector<uint32_t> subseqs;
+    std::vector<struct operation_primcoordinator*> primcos;
+    for (int i=0; i<n; i++)
+    {
+        struct operation_composite *p_op = new struct operation_composite;
+        memset(&p_op->ophead, 0, sizeof(struct OPHead));
+        p_op->ops = new std::map<uint32_t,operation*>();
+        p_op->sending = 0;
+        p_op->ophead.cco_id.csid = i;
+        p_op->ophead.offset = (uint64_t)i*BENCH_SU_SIZE*BENCH_GROUPSIZE;
+        p_op->ophead.length = BENCH_SU_SIZE;
+        p_op->ophead.type = operation_client_composite_directwrite_type;
+        bench_layout(&p_op->ophead);
+        if (p_sm->insert(p_op, data))
+        {
+            printf("insert failed for %d\n", i);
+            continue;
+        }
+        comps.push_back(p_op);
+        std::map<uint32_t,operation*>::iterator it = p_op->ops->begin();
+        for (it; it!=p_op->ops->end(); it++)
+        {
+            subseqs.push_back(it->first);
+        }
+
+        struct operation_primcoordinator *p_prim = new struct operation_primcoordinator;
+        memset(&p_prim->ophead, 0, sizeof(struct OPHead));
+        p_prim->ophead.cco_id.csid = 1000000+i;
+        p_prim->ophead.cco_id.sequencenum = i;
+        p_prim->ophead.offset = p_op->ophead.offset;
+        p_prim->ophead.length = BENCH_SU_SIZE*BENCH_GROUPSIZE;
+        p_sm->opvec_insert(&p_prim->ophead);
+        primcos.push_back(p_prim);
+    }
+
+    struct CCO_id ccoid;
+    struct operation_composite *p_found;
+    long hits = 0;
+    srand(n);
+    uint64_t start = now_ns();
+    for (long l=0; l<lookups; l++)
+    {
+        ccoid.csid = 0;
+        ccoid.sequencenum = subseqs[rand()%subseqs.size()];
+        if (!p_sm->get_op(ccoid, &p_found)) hits++;
+    }
+    uint64_t comp_ns = now_ns()-start;
+
+    struct operation_primcoordinator *p_prim;
+    start = now_ns();
+    for (long l=0; l<lookups; l++)
+    {
+        struct operation_primcoordinator *p_want = primcos[rand()%primcos.size()];
+        if (!p_sm->get_op(p_want->ophead.cco_id, p_want->ophead.offset, &p_prim)) hits++;
+    }
+    uint64_t prim_ns = now_ns()-start;
+    printf("%6d %8zu %12.1f %12.1f %10ld\n", n, subseqs.size(), (double)comp_ns/lookups, (double)prim_ns/lookups, hits);
+
+    for (size_t i=0; i<primcos.size(); i++)
+    {
+        p_sm->opvec_erase(&primcos[i]->ophead);
+        delete primcos[i];
+    }
+    for (size_t i=0; i<comps.size(); i++)
+    {
+        p_sm->cleanup(comps[i]);
+    }
+    delete p_sm;
+}
+
+int main(int argc, char **argv)
+{
+    long lookups = (argc>1) ? atol(argv[1]) : 1000000;
+    Logger *log = new Logger();
+    string s = string("/tmp/OpIndexBench.log");
+    log->set_log_location(s);
+    log->set_console_output(false);
+    char *data = (char*) calloc(BENCH_SU_SIZE, 1);
+    printf("%6s %8s %12s %12s %10s\n", "ops", "subops", "comp[ns]", "primco[ns]", "hits");
+    for (int n=16; n<=4096; n*=2)
+    {
+        run(log, data, n, lookups);
+    }
+    free(data);
+    delete log;
+    return 0;
+}
@@ -0,0 +1,605 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "components/diskio/AsyncIO.h"
+
+#ifdef AIO_HAVE_URING
+#include <linux/io_uring.h>
+#endif
+
+using namespace std;
+
+/* failed waits for completions until new requests go to the pool */
+#define AIO_REAPER_MAX_ERRORS   100
+#define AIO_REAPER_BACKOFF_MS   100
+
+struct aio_uring
+{
+    int         fd;
+    uint32_t    sq_entries;
+    uint32_t    cq_entries;
+    void        *sqptr;
+    size_t      sqsize;
+    void        *cqptr;
+    size_t      cqsize;
+    void        *sqes;
+    size_t      sqesize;
+    unsigned    *sqhead;
+    unsigned    *sqtail;
+    unsigned    *sqmask;
+    unsigned    *sqarray;
+    unsigned    *cqhead;
+    unsigned    *cqtail;
+    unsigned    *cqmask;
+    void        *cqes;
+    bool        fixedbufs;
+};
+
+struct aio_waiter
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    bool            done;
+};
+
+/* the instance whose I/O thread this is, execute runs inline on it */
+static __thread AsyncIO *aio_self = NULL;
+
+static void* aio_pool_thread(void *obj)
+{
+    aio_self = (AsyncIO *) obj;
+    ((AsyncIO *) obj)->run_pool();
+    return NULL;
+}
+
+static void* aio_reaper_thread(void *obj)
+{
+    aio_self = (AsyncIO *) obj;
+    ((AsyncIO *) obj)->run_reaper();
+    return NULL;
+}
+
+static void aio_wakeup(struct aio_request *p_req)
+{
+    struct aio_waiter *p_w = (struct aio_waiter *) p_req->arg;
+    pthread_mutex_lock(&p_w->mutex);
+    p_w->done = true;
+    pthread_cond_signal(&p_w->cond);
+    pthread_mutex_unlock(&p_w->mutex);
+}
+
+AsyncIO::AsyncIO(Logger *p_log, uint32_t n, int threads, bool uring)
+{
+    log = p_log;
+    entries = (n>0) ? n : AIO_DEFAULT_ENTRIES;
+    threadcnt = (threads>0) ? threads : AIO_DEFAULT_THREADS;
+    want_uring = uring;
+    running = false;
+    p_ring = NULL;
+    ring_failed = false;
+    inflight = 0;
+    buffers = NULL;
+    pthread_mutex_init(&sqmutex, NULL);
+    pthread_cond_init(&sqcond, NULL);
+    pthread_mutex_init(&poolmutex, NULL);
+    pthread_cond_init(&poolcond, NULL);
+    pthread_mutex_init(&bufmutex, NULL);
+    p_poolqueue = new std::deque<struct aio_request*>();
+    p_pool = new std::vector<pthread_t>();
+    p_freebufs = new std::vector<int>();
+}
+
+AsyncIO::AsyncIO(const AsyncIO& orig)
+{
+}
+
+AsyncIO::~AsyncIO()
+{
+    if (running)
+    {
+        pthread_mutex_lock(&poolmutex);
+        running = false;
+        pthread_cond_broadcast(&poolcond);
+        pthread_mutex_unlock(&poolmutex);
+        std::vector<pthread_t>::iterator it = p_pool->begin();
+        for (it; it!=p_pool->end(); it++)
+        {
+            pthread_join(*it, NULL);
+        }
+        if (p_ring!=NULL)
+        {
+            // a request without owner stops the reaper
+            submit_uring(NULL);
+            pthread_join(reaper, NULL);
+        }
+    }
+    teardown_uring();
+    if (buffers!=NULL)
+    {
+        free(buffers);
+    }
+    delete p_freebufs;
+    delete p_pool;
+    delete p_poolqueue;
+    pthread_mutex_destroy(&bufmutex);
+    pthread_cond_destroy(&poolcond);
+    pthread_mutex_destroy(&poolmutex);
+    pthread_cond_destroy(&sqcond);
+    pthread_mutex_destroy(&sqmutex);
+}
+
+/**
+ * @brief allocates the buffer pool, sets up the ring if requested and
+ * starts the reaper and the pool threads.
+ */
+int AsyncIO::start()
+{
+    int rc=0;
+    if (running)
+    {
+        return 0;
+    }
+    if (posix_memalign(&buffers, 4096, (size_t)AIO_BUFFER_COUNT*AIO_BUFFER_SIZE)==0)
+    {
+        for (int i=AIO_BUFFER_COUNT-1; i>=0; i--)
+        {
+            p_freebufs->push_back(i);
+        }
+    }
+    else
+    {
+        log->warning_log("no buffer pool allocated");
+        buffers = NULL;
+    }
+    running = true;
+    if (want_uring && setup_uring()==0)
+    {
+        rc = pthread_create(&reaper, NULL, aio_reaper_thread, this);
+        if (rc)
+        {
+            log->error_log("reaper thread not created:rc=%d",rc);
+            teardown_uring();
+        }
+    }
+    for (int i=0; i<threadcnt; i++)
+    {
+        pthread_t t;
+        rc = pthread_create(&t, NULL, aio_pool_thread, this);
+        if (rc)
+        {
+            log->error_log("io thread not created:rc=%d",rc);
+            break;
+        }
+        p_pool->push_back(t);
+    }
+    log->debug_log("uring:%d, threads:%u, rc:%d",uses_uring(),p_pool->size(),rc);
+    return rc;
+}
+
+bool AsyncIO::uses_uring()
+{
+    return p_ring!=NULL;
+}
+
+void AsyncIO::init_request(struct aio_request *p_req, enum aio_op op)
+{
+    memset(p_req, 0, sizeof(struct aio_request));
+    p_req->op = op;
+    p_req->fd = -1;
+    p_req->bufindex = -1;
+}
+
+/**
+ * @brief hands the request over, p_req->cb is called from an I/O thread
+ * once it is done. cb must not block and may free the request.
+ * @return 0, a request the ring does not take is run by the pool
+ */
+int AsyncIO::submit(struct aio_request *p_req)
+{
+    if (!running)
+    {
+        perform(p_req);
+        return 0;
+    }
+    // the reaper must not wait for ring space it frees itself
+    if (p_req->op!=aio_call && p_ring!=NULL && !ring_failed && !pthread_equal(pthread_self(), reaper))
+    {
+        if (submit_uring(p_req)==0)
+        {
+            return 0;
+        }
+    }
+    return submit_pool(p_req);
+}
+
+/**
+ * @brief submits the request and waits for it.
+ * @return the request result
+ */
+int AsyncIO::execute(struct aio_request *p_req)
+{
+    if (!running || aio_self==this)
+    {
+        // waiting on an own I/O thread could block all of them
+        p_req->cb = NULL;
+        perform(p_req);
+        return p_req->res;
+    }
+    struct aio_waiter w;
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    w.done = false;
+    p_req->cb = &aio_wakeup;
+    p_req->arg = &w;
+    // a submitted request always completes, w must outlive it
+    submit(p_req);
+    pthread_mutex_lock(&w.mutex);
+    while (!w.done)
+    {
+        pthread_cond_wait(&w.cond, &w.mutex);
+    }
+    pthread_mutex_unlock(&w.mutex);
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.mutex);
+    return p_req->res;
+}
+
+/**
+ * @brief returns a pooled buffer of at least length bytes or NULL, the
+ * buffers are registered with the ring.
+ */
+void* AsyncIO::get_buffer(size_t length, int *index)
+{
+    void *p_buf = NULL;
+    *index = -1;
+    if (buffers==NULL || length>AIO_BUFFER_SIZE)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&bufmutex);
+    if (!p_freebufs->empty())
+    {
+        *index = p_freebufs->back();
+        p_freebufs->pop_back();
+        p_buf = (char*)buffers + (size_t)*index*AIO_BUFFER_SIZE;
+    }
+    pthread_mutex_unlock(&bufmutex);
+    return p_buf;
+}
+
+void AsyncIO::put_buffer(int index)
+{
+    if (index<0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bufmutex);
+    p_freebufs->push_back(index);
+    pthread_mutex_unlock(&bufmutex);
+}
+
+void AsyncIO::perform(struct aio_request *p_req)
+{
+    int res=0;
+    switch (p_req->op)
+    {
+        case aio_read:
+        {
+            res = pread(p_req->fd, p_req->buf, p_req->length, p_req->offset);
+            break;
+        }
+        case aio_write:
+        {
+            res = pwrite(p_req->fd, p_req->buf, p_req->length, p_req->offset);
+            break;
+        }
+        case aio_fsync:
+        {
+            res = fdatasync(p_req->fd);
+            break;
+        }
+        case aio_call:
+        {
+            res = p_req->fn(p_req);
+            break;
+        }
+    }
+    if (res<0 && p_req->op!=aio_call)
+    {
+        res = -errno;
+    }
+    complete(p_req, res);
+}
+
+void AsyncIO::complete(struct aio_request *p_req, int res)
+{
+    p_req->res = res;
+    if (p_req->cb!=NULL)
+    {
+        p_req->cb(p_req);
+    }
+}
+
+int AsyncIO::submit_pool(struct aio_request *p_req)
+{
+    pthread_mutex_lock(&poolmutex);
+    p_poolqueue->push_back(p_req);
+    pthread_cond_signal(&poolcond);
+    pthread_mutex_unlock(&poolmutex);
+    return 0;
+}
+
+/**
+ * @brief pool thread, leaves once stopped and the queue is drained.
+ */
+void AsyncIO::run_pool()
+{
+    while (1)
+    {
+        pthread_mutex_lock(&poolmutex);
+        while (p_poolqueue->empty() && running)
+        {
+            pthread_cond_wait(&poolcond, &poolmutex);
+        }
+        if (p_poolqueue->empty())
+        {
+            pthread_mutex_unlock(&poolmutex);
+            break;
+        }
+        struct aio_request *p_req = p_poolqueue->front();
+        p_poolqueue->pop_front();
+        pthread_mutex_unlock(&poolmutex);
+        perform(p_req);
+    }
+}
+
+#ifdef AIO_HAVE_URING
+
+int AsyncIO::setup_uring()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd<0)
+    {
+        log->warning_log("io_uring not available, errno:%d",errno);
+        return -1;
+    }
+    struct aio_uring *p_r = new struct aio_uring;
+    memset(p_r, 0, sizeof(struct aio_uring));
+    p_r->fd = fd;
+    p_r->sq_entries = params.sq_entries;
+    p_r->cq_entries = params.cq_entries;
+    p_r->sqsize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    p_r->cqsize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    p_r->sqesize = params.sq_entries*sizeof(struct io_uring_sqe);
+    p_r->sqptr = mmap(NULL, p_r->sqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    p_r->cqptr = mmap(NULL, p_r->cqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    p_r->sqes = mmap(NULL, p_r->sqesize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (p_r->sqptr==MAP_FAILED || p_r->cqptr==MAP_FAILED || p_r->sqes==MAP_FAILED)
+    {
+        log->error_log("ring mapping failed, errno:%d",errno);
+        p_ring = p_r;
+        teardown_uring();
+        return -1;
+    }
+    char *sq = (char*) p_r->sqptr;
+    char *cq = (char*) p_r->cqptr;
+    p_r->sqhead = (unsigned*) (sq+params.sq_off.head);
+    p_r->sqtail = (unsigned*) (sq+params.sq_off.tail);
+    p_r->sqmask = (unsigned*) (sq+params.sq_off.ring_mask);
+    p_r->sqarray = (unsigned*) (sq+params.sq_off.array);
+    p_r->cqhead = (unsigned*) (cq+params.cq_off.head);
+    p_r->cqtail = (unsigned*) (cq+params.cq_off.tail);
+    p_r->cqmask = (unsigned*) (cq+params.cq_off.ring_mask);
+    p_r->cqes = cq+params.cq_off.cqes;
+    p_r->fixedbufs = false;
+    if (buffers!=NULL)
+    {
+        struct iovec iov[AIO_BUFFER_COUNT];
+        for (int i=0; i<AIO_BUFFER_COUNT; i++)
+        {
+            iov[i].iov_base = (char*)buffers + (size_t)i*AIO_BUFFER_SIZE;
+            iov[i].iov_len = AIO_BUFFER_SIZE;
+        }
+        // fails if the pool exceeds RLIMIT_MEMLOCK, plain reads/writes then
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, AIO_BUFFER_COUNT)==0)
+        {
+            p_r->fixedbufs = true;
+        }
+        else
+        {
+            log->warning_log("buffers not registered, errno:%d",errno);
+        }
+    }
+    p_ring = p_r;
+    log->debug_log("sq:%u, cq:%u, fixed buffers:%d",p_r->sq_entries,p_r->cq_entries,p_r->fixedbufs);
+    return 0;
+}
+
+void AsyncIO::teardown_uring()
+{
+    if (p_ring==NULL)
+    {
+        return;
+    }
+    if (p_ring->sqptr!=NULL && p_ring->sqptr!=MAP_FAILED)
+    {
+        munmap(p_ring->sqptr, p_ring->sqsize);
+    }
+    if (p_ring->cqptr!=NULL && p_ring->cqptr!=MAP_FAILED)
+    {
+        munmap(p_ring->cqptr, p_ring->cqsize);
+    }
+    if (p_ring->sqes!=NULL && p_ring->sqes!=MAP_FAILED)
+    {
+        munmap(p_ring->sqes, p_ring->sqesize);
+    }
+    close(p_ring->fd);
+    delete p_ring;
+    p_ring = NULL;
+}
+
+/**
+ * @brief queues one entry and enters the kernel. A NULL request submits a
+ * nop that stops the reaper.
+ * @return 0 once the kernel took the entry, its completion is reaped. -1
+ * if it did not, the entry is withdrawn then.
+ */
+int AsyncIO::submit_uring(struct aio_request *p_req)
+{
+    int rc=0;
+    pthread_mutex_lock(&sqmutex);
+    while (p_req!=NULL && inflight>=p_ring->sq_entries)
+    {
+        pthread_cond_wait(&sqcond, &sqmutex);
+    }
+    unsigned tail = *p_ring->sqtail;
+    unsigned index = tail & *p_ring->sqmask;
+    struct io_uring_sqe *sqe = &((struct io_uring_sqe*)p_ring->sqes)[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    if (p_req==NULL)
+    {
+        sqe->opcode = IORING_OP_NOP;
+    }
+    else if (p_req->op==aio_fsync)
+    {
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = p_req->fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    }
+    else
+    {
+        sqe->fd = p_req->fd;
+        sqe->off = p_req->offset;
+        if (p_req->bufindex>=0 && p_ring->fixedbufs)
+        {
+            sqe->opcode = (p_req->op==aio_read) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = (unsigned long) p_req->buf;
+            sqe->len = p_req->length;
+            sqe->buf_index = p_req->bufindex;
+        }
+        else
+        {
+            // the iovec lives in the request until the completion
+            p_req->iov.iov_base = p_req->buf;
+            p_req->iov.iov_len = p_req->length;
+            sqe->opcode = (p_req->op==aio_read) ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = (unsigned long) &p_req->iov;
+            sqe->len = 1;
+        }
+    }
+    sqe->user_data = (unsigned long) p_req;
+    p_ring->sqarray[index] = index;
+    __sync_synchronize();
+    *p_ring->sqtail = tail+1;
+    __sync_synchronize();
+    inflight++;
+    int ret;
+    do
+    {
+        ret = syscall(__NR_io_uring_enter, p_ring->fd, 1, 0, 0, NULL, 0);
+    } while (ret<0 && errno==EINTR);
+    __sync_synchronize();
+    if (*p_ring->sqhead==tail)
+    {
+        // without SQPOLL only io_uring_enter consumes entries, this one
+        // never completes and may be taken back
+        log->error_log("entry not submitted, ret:%d, errno:%d",ret,errno);
+        *p_ring->sqtail = tail;
+        inflight--;
+        pthread_cond_broadcast(&sqcond);
+        rc = -1;
+    }
+    pthread_mutex_unlock(&sqmutex);
+    return rc;
+}
+
+/**
+ * @brief waits for completions and runs their callbacks. If waiting keeps
+ * failing it backs off, and new requests go to the pool. The requests in
+ * flight are still reaped.
+ */
+void AsyncIO::run_reaper()
+{
+    bool stop=false;
+    int errors=0;
+    std::vector<std::pair<struct aio_request*,int> > done;
+    while (!stop)
+    {
+        int ret = syscall(__NR_io_uring_enter, p_ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret<0 && errno!=EINTR)
+        {
+            if (errors==0)
+            {
+                log->error_log("io_uring_enter failed, errno:%d",errno);
+            }
+            errors++;
+            if (errors==AIO_REAPER_MAX_ERRORS)
+            {
+                log->error_log("ring failed %d times, new requests go to the pool",errors);
+                ring_failed = true;
+            }
+            usleep(1000*((errors<AIO_REAPER_BACKOFF_MS) ? errors : AIO_REAPER_BACKOFF_MS));
+        }
+        else
+        {
+            errors = 0;
+        }
+        unsigned head = *p_ring->cqhead;
+        __sync_synchronize();
+        unsigned tail = *p_ring->cqtail;
+        while (head!=tail)
+        {
+            struct io_uring_cqe *cqe = &((struct io_uring_cqe*)p_ring->cqes)[head & *p_ring->cqmask];
+            struct aio_request *p_req = (struct aio_request *) (unsigned long) cqe->user_data;
+            if (p_req==NULL)
+            {
+                stop=true;
+            }
+            else
+            {
+                done.push_back(std::pair<struct aio_request*,int>(p_req,cqe->res));
+            }
+            head++;
+        }
+        __sync_synchronize();
+        *p_ring->cqhead = head;
+        if (done.empty())
+        {
+            continue;
+        }
+        pthread_mutex_lock(&sqmutex);
+        inflight -= done.size();
+        pthread_cond_broadcast(&sqcond);
+        pthread_mutex_unlock(&sqmutex);
+        std::vector<std::pair<struct aio_request*,int> >::iterator it = done.begin();
+        for (it; it!=done.end(); it++)
+        {
+            complete(it->first, it->second);
+        }
+        done.clear();
+    }
+}
+
+#else
+
+int AsyncIO::setup_uring()
+{
+    return -1;
+}
+
+void AsyncIO::teardown_uring()
+{
+}
+
+int AsyncIO::submit_uring(struct aio_request *p_req)
+{
+    return submit_pool(p_req);
+}
+
+void AsyncIO::run_reaper()
+{
+}
+
+#endif
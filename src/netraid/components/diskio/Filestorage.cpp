@@ -26,9 +26,173 @@ static int getdir (string dir, vector<string> &files)
     return 0;
 }
 
+/* completion of the writes issued by one write_file_async call */
+struct aio_write_group
+{
+    pthread_mutex_t mutex;
+    int             pending;
+    int             rc;
+    void            (*cb)(void *arg, int rc);
+    void            *arg;
+};
+
+struct aio_write_job
+{
+    struct aio_request  req;    // first member, the completion gets the job
+    AsyncIO             *p_aio;
+    SegmentStore        *p_segs;
+    InodeNumber         inum;
+    StripeId            sid;
+    uint32_t            version;
+    int                 *fh;
+    bool                *fhvalid;
+    struct aio_write_group *p_group;
+    std::string         inodedir;   // set if the file is opened by the job
+    std::string         stripedir;
+    std::string         path;
+};
+
+struct aio_stripe_job
+{
+    struct aio_request  req;
+    Filestorage         *p_fs;
+    InodeNumber         inum;
+    StripeId            sid;
+    uint32_t            version;
+    struct data_object  *p_do;
+    void                (*cb)(void *arg, int rc, struct data_object *p_do);
+    void                *arg;
+};
+
+static void write_group_done(struct aio_write_group *p_group, int rc)
+{
+    pthread_mutex_lock(&p_group->mutex);
+    if (rc)
+    {
+        p_group->rc = rc;
+    }
+    bool last = (--p_group->pending==0);
+    pthread_mutex_unlock(&p_group->mutex);
+    if (last)
+    {
+        p_group->cb(p_group->arg, p_group->rc);
+        pthread_mutex_destroy(&p_group->mutex);
+        delete p_group;
+    }
+}
+
+static void release_write_buffer(struct aio_write_job *p_job)
+{
+    if (p_job->req.bufindex>=0)
+    {
+        p_job->p_aio->put_buffer(p_job->req.bufindex);
+    }
+    else
+    {
+        free(p_job->req.buf);
+    }
+}
+
+static int segment_append(struct aio_request *p_req)
+{
+    struct aio_write_job *p_job = (struct aio_write_job *) p_req;
+    return p_job->p_segs->append(p_job->inum, p_job->sid, p_job->version, p_job->req.buf, p_job->req.length, p_job->fh);
+}
 
+static int open_object(struct aio_request *p_req)
+{
+    struct aio_write_job *p_job = (struct aio_write_job *) p_req;
+    xsystools_fs_mkdir(p_job->inodedir);
+    xsystools_fs_mkdir(p_job->stripedir);
+    *p_job->fh = open(p_job->path.c_str(),O_WRONLY | O_CREAT,  S_IRUSR | S_IWUSR );
+    return *p_job->fh;
+}
 
-Filestorage::Filestorage(Logger *p_log, const char *p_base, serverid_t myid, bool dosync)
+static void write_job_done(struct aio_request *p_req)
+{
+    struct aio_write_job *p_job = (struct aio_write_job *) p_req;
+    int rc=0;
+    if (p_req->fn==&open_object && p_req->res>=0)
+    {
+        // opened on an I/O thread, now the data
+        int fd = p_req->res;
+        void *buffer = p_req->buf;
+        size_t total = p_req->length;
+        int bufindex = p_req->bufindex;
+        p_job->p_aio->init_request(p_req, aio_write);
+        p_req->fd = fd;
+        p_req->buf = buffer;
+        p_req->length = total;
+        p_req->bufindex = bufindex;
+        p_req->cb = &write_job_done;
+        if (!p_job->p_aio->submit(p_req))
+        {
+            return;
+        }
+        p_req->res = -1;
+    }
+    if (p_req->op==aio_call)
+    {
+        rc = (p_req->res<0) ? -1 : 0;
+    }
+    else if (p_req->res!=(int)p_req->length)
+    {
+        rc = -1;
+        close(*p_job->fh);
+    }
+    if (!rc && p_job->fhvalid!=NULL)
+    {
+        *p_job->fhvalid = true;
+    }
+    release_write_buffer(p_job);
+    struct aio_write_group *p_group = p_job->p_group;
+    delete p_job;
+    if (p_group!=NULL)
+    {
+        write_group_done(p_group, rc);
+    }
+}
+
+/**
+ * @brief hands the job to the I/O threads, a job they do not take fails
+ * right away.
+ */
+static void submit_write_job(struct aio_write_job *p_job)
+{
+    if (p_job->p_aio->submit(&p_job->req))
+    {
+        p_job->req.res = -1;
+        write_job_done(&p_job->req);
+    }
+}
+
+static int stripe_read(struct aio_request *p_req)
+{
+    struct aio_stripe_job *p_job = (struct aio_stripe_job *) p_req;
+    return p_job->p_fs->read_stripe_object(p_job->inum, p_job->sid, &p_job->p_do);
+}
+
+static void stripe_read_done(struct aio_request *p_req)
+{
+    struct aio_stripe_job *p_job = (struct aio_stripe_job *) p_req;
+    p_job->cb(p_job->arg, p_req->res, (p_req->res==0) ? p_job->p_do : NULL);
+    delete p_job;
+}
+
+static int stripe_remove(struct aio_request *p_req)
+{
+    struct aio_stripe_job *p_job = (struct aio_stripe_job *) p_req;
+    return p_job->p_fs->remove_lower_than(p_job->inum, p_job->sid, p_job->version);
+}
+
+static void stripe_remove_done(struct aio_request *p_req)
+{
+    delete (struct aio_stripe_job *) p_req;
+}
+
+
+
+Filestorage::Filestorage(Logger *p_log, const char *p_base, serverid_t myid, bool dosync, enum storage_layout layout, size_t segsize)
 {
     log = p_log;
     ostringstream relpath;
@@ -45,6 +209,16 @@ Filestorage::Filestorage(Logger *p_log, const char *p_base, serverid_t myid, boo
     log->debug_log("Fsync activated:%d",on);
     log->debug_log("created:%s",basedir.c_str());
     size_metadata = sizeof(struct dataobject_metadata);
+    p_segs = NULL;
+    if (layout==layout_segments)
+    {
+        p_segs = new SegmentStore(log, basedir+"/segments", segsize);
+    }
+    log->debug_log("layout:%s",(p_segs!=NULL) ? "segments" : "files");
+    p_commit = new GroupCommit(log, dosync, GROUPCOMMIT_DEFAULT_BATCH, GROUPCOMMIT_DEFAULT_DELAY);
+    p_commit->start();
+    // requests run inline until start_aio is called
+    p_aio = new AsyncIO(log, AIO_DEFAULT_ENTRIES, AIO_DEFAULT_THREADS, false);
 }
 
 Filestorage::Filestorage(const Filestorage& orig)
@@ -53,7 +227,13 @@ Filestorage::Filestorage(const Filestorage& orig)
 
 Filestorage::~Filestorage()
 {    
+    delete p_aio;
+    delete p_commit;
     delete p_raid;
+    if (p_segs!=NULL)
+    {
+        delete p_segs;
+    }
 }
 
 void Filestorage::create_checksum(struct data_object *p_do)
@@ -90,22 +270,13 @@ int Filestorage::_create_block_object(struct OPHead *p_head,struct dataobject_co
 int Filestorage::write_file(struct OPHead *p_head,std::map<StripeId,struct dataobject_collection*>*datamap)
 {
     int rc=-1;
-    ostringstream relpath;
-    relpath <<  basedir.c_str() << "/" << p_head->inum;
-
-    log->debug_log("Write file...%llu, relpath:%s",p_head->inum,relpath.str().c_str());
-    xsystools_fs_mkdir(relpath.str());
+    log->debug_log("Write file...%llu",p_head->inum);
     
     std::map<StripeId,struct dataobject_collection*>::iterator it = datamap->begin();
     for (it; it!= datamap->end(); it++)
     {
-        ostringstream s;
-        s << relpath.str().c_str();
-        s << "/" << it->first;
-        log->debug_log("path:%s",s.str().c_str());
-        if (!xsystools_fs_mkdir(s.str()))
+        if (!create_stripe_dir(p_head->inum, it->first))
         {
-            log->debug_log("Error occured while trying to create stripe dir.");
             return -1;
         }
         struct data_object p_do;
@@ -115,9 +286,8 @@ int Filestorage::write_file(struct OPHead *p_head,std::map<StripeId,struct datao
         filelayout_raid *p_fl = (filelayout_raid*) &p_do.metadata.filelayout;
         serverid_t suid = p_raid->get_my_stripeunitid(p_fl,p_head->offset, id);
         uint32_t *p_myversion = &p_do.metadata.versionvector[suid];
-        s << "/" << *p_myversion;
         //int fh;
-        rc = write_object(&p_do, s.str().c_str(),&it->second->filehandle);
+        rc = write_object(&p_do, p_head->inum, it->first, *p_myversion, &it->second->filehandle);
         if (rc==0)
         {
             it->second->fhvalid=true;
@@ -140,17 +310,12 @@ int Filestorage::write_file(struct OPHead *p_head, struct datacollection_primco
                     
     filelayout_raid *p_fl = (filelayout_raid*) &p_head->filelayout[0];
     StripeId sid = p_raid->getStripeId(p_fl, p_head->offset);
-    std::string stripe_path = getPath(p_head->inum);
-    xsystools_fs_mkdir(stripe_path);
-    stripe_path = getPath(p_head->inum,sid);
-    log->debug_log("Write file...%llu, path:%s",p_head->inum,stripe_path.c_str());
-    if (!xsystools_fs_mkdir(stripe_path))
+    log->debug_log("Write file...%llu, sid:%u",p_head->inum,sid);
+    if (!create_stripe_dir(p_head->inum, sid))
     {
-        log->debug_log("Error occured while trying to create stripe dir.");
         return -1;
     }
-    stripe_path = getPath(p_head->inum,sid,p_dcol->newobject->metadata.versionvector[default_groupsize]);
-    rc = write_object(p_dcol->newobject, stripe_path.c_str(), &p_dcol->filehandle);
+    rc = write_object(p_dcol->newobject, p_head->inum, sid, p_dcol->newobject->metadata.versionvector[default_groupsize], &p_dcol->filehandle);
     if (rc==0)
     {
         p_dcol->fhvalid=true;
@@ -166,145 +331,286 @@ int Filestorage::write_file(struct operation_participant *p_part)
     log->debug_log("start");
     filelayout_raid *p_fl = ( filelayout_raid*) &p_part->ophead.filelayout[0];
     StripeId sid = p_raid->getStripeId(p_fl, p_part->ophead.offset);
-    std::string stripe_path = getPath( p_part->ophead.inum);
-    xsystools_fs_mkdir(stripe_path);
-    stripe_path = getPath( p_part->ophead.inum,sid);
-    log->debug_log("Write file...%llu, path:%s", p_part->ophead.inum,stripe_path.c_str());
-    if (!xsystools_fs_mkdir(stripe_path))
+    log->debug_log("Write file...%llu, sid:%u", p_part->ophead.inum,sid);
+    if (!create_stripe_dir(p_part->ophead.inum, sid))
     {
-        log->debug_log("Error occured while trying to create stripe dir.");
         return -1;
     }
     std::map<StripeId,struct dataobject_collection*>::iterator it = p_part->datamap->begin();
     for (it; it!=p_part->datamap->end(); it++)
     {
         log->debug_log("current version:%u",it->second->mycurrentversion);
-        //log->debug_log("vec0:%u,vec1:%u,vec2:%u",it->second->versionvector[0],it->second->versionvector[1],it->second->versionvector[2]);
-        stripe_path = getPath( p_part->ophead.inum,sid, it->second->mycurrentversion+1);
-                
-        struct data_object *newobj = new struct data_object;
-        newobj->data = it->second->recv_data;
-        newobj->metadata.ccoid=p_part->ophead.cco_id;
-        newobj->metadata.datalength = it->second->recv_length;
-        memcpy(&newobj->metadata.filelayout[0],&p_part->ophead.filelayout[0], sizeof(newobj->metadata.filelayout));
-        newobj->metadata.offset = p_part->ophead.offset;
-        newobj->metadata.operationlength = p_part->ophead.length;
-        memcpy(&newobj->metadata.versionvector[0],&it->second->versionvector[0],sizeof(newobj->metadata.versionvector));    
-
-        rc = write_object(newobj, stripe_path.c_str(), &it->second->filehandle);
+        struct data_object *newobj = new_participant_object(p_part, it->second);
+        rc = write_object(newobj, p_part->ophead.inum, sid, it->second->mycurrentversion+1, &it->second->filehandle);
         log->debug_log("write object returned:%d",rc);
         if (rc==0)
         {
             it->second->fhvalid=true;
             log->debug_log("Filehandle valid");
         }
-        /*if(!no_sync)
-        {
-            fsync(fh);
-            log->debug_log("flushed");
-        }
-        close(fh);
-        log->debug_log("closed...");**/
         it->second->newblock= newobj;
         log->debug_log("data block:%u, rc:%d",newobj->metadata.ccoid.csid,rc);
     }
     return rc;
 }
 
-int Filestorage::write_object(struct data_object *p_do, const char *file, int *fh)
+/**
+ * @brief like write_file, but the writes are submitted to the I/O threads.
+ * cb is called from an I/O thread once all objects are written, the
+ * handles of the written objects are marked valid.
+ */
+int Filestorage::write_file_async(struct operation_participant *p_part, void (*cb)(void *arg, int rc), void *arg)
+{
+    filelayout_raid *p_fl = ( filelayout_raid*) &p_part->ophead.filelayout[0];
+    StripeId sid = p_raid->getStripeId(p_fl, p_part->ophead.offset);
+    log->debug_log("Write file...%llu, sid:%u", p_part->ophead.inum,sid);
+    struct aio_write_group *p_group = new struct aio_write_group;
+    pthread_mutex_init(&p_group->mutex, NULL);
+    p_group->pending = 1;
+    p_group->rc = 0;
+    p_group->cb = cb;
+    p_group->arg = arg;
+    std::map<StripeId,struct dataobject_collection*>::iterator it = p_part->datamap->begin();
+    for (it; it!=p_part->datamap->end(); it++)
+    {
+        struct data_object *newobj = new_participant_object(p_part, it->second);
+        it->second->newblock = newobj;
+        it->second->fhvalid = false;
+        struct aio_write_job *p_job = prepare_write(newobj, p_part->ophead.inum, sid, it->second->mycurrentversion+1, &it->second->filehandle, true);
+        pthread_mutex_lock(&p_group->mutex);
+        if (p_job==NULL)
+        {
+            p_group->rc = -1;
+            pthread_mutex_unlock(&p_group->mutex);
+            continue;
+        }
+        p_group->pending++;
+        pthread_mutex_unlock(&p_group->mutex);
+        p_job->fhvalid = &it->second->fhvalid;
+        p_job->p_group = p_group;
+        submit_write_job(p_job);
+    }
+    write_group_done(p_group, 0);
+    return 0;
+}
+
+/**
+ * @brief writes the object of the primary coordinator on an I/O thread,
+ * cb is called from an I/O thread once it is written.
+ */
+int Filestorage::write_file_async(struct OPHead *p_head, struct datacollection_primco* p_dcol, void (*cb)(void *arg, int rc), void *arg)
+{
+    filelayout_raid *p_fl = (filelayout_raid*) &p_head->filelayout[0];
+    StripeId sid = p_raid->getStripeId(p_fl, p_head->offset);
+    log->debug_log("Write file...%llu, sid:%u",p_head->inum,sid);
+    p_dcol->fhvalid = false;
+    struct aio_write_job *p_job = prepare_write(p_dcol->newobject, p_head->inum, sid, p_dcol->newobject->metadata.versionvector[default_groupsize], &p_dcol->filehandle, true);
+    if (p_job==NULL)
+    {
+        cb(arg, -1);
+        return 0;
+    }
+    struct aio_write_group *p_group = new struct aio_write_group;
+    pthread_mutex_init(&p_group->mutex, NULL);
+    p_group->pending = 1;
+    p_group->rc = 0;
+    p_group->cb = cb;
+    p_group->arg = arg;
+    p_job->fhvalid = &p_dcol->fhvalid;
+    p_job->p_group = p_group;
+    submit_write_job(p_job);
+    return 0;
+}
+
+struct data_object* Filestorage::new_participant_object(struct operation_participant *p_part, struct dataobject_collection *p_dcol)
+{
+    struct data_object *newobj = new struct data_object;
+    newobj->data = p_dcol->recv_data;
+    newobj->metadata.ccoid=p_part->ophead.cco_id;
+    newobj->metadata.datalength = p_dcol->recv_length;
+    memcpy(&newobj->metadata.filelayout[0],&p_part->ophead.filelayout[0], sizeof(newobj->metadata.filelayout));
+    newobj->metadata.offset = p_part->ophead.offset;
+    newobj->metadata.operationlength = p_part->ophead.length;
+    memcpy(&newobj->metadata.versionvector[0],&p_dcol->versionvector[0],sizeof(newobj->metadata.versionvector));
+    return newobj;
+}
+
+/**
+ * @brief create the inode and stripe directory of the file layout, nothing
+ * to do for segments.
+ */
+bool Filestorage::create_stripe_dir(InodeNumber inum, StripeId sid)
+{
+    if (p_segs!=NULL)
+    {
+        return true;
+    }
+    xsystools_fs_mkdir(getPath(inum));
+    std::string stripe_path = getPath(inum,sid);
+    log->debug_log("path:%s",stripe_path.c_str());
+    if (!xsystools_fs_mkdir(stripe_path))
+    {
+        log->debug_log("Error occured while trying to create stripe dir.");
+        return false;
+    }
+    return true;
+}
+
+int Filestorage::write_object(struct data_object *p_do, InodeNumber inum, StripeId sid, uint32_t version, int *fh)
+{
+    int rc=-1;
+    struct aio_write_job *p_job = prepare_write(p_do, inum, sid, version, fh, false);
+    if (p_job!=NULL)
+    {
+        p_job->req.cb = NULL;
+        int res = p_aio->execute(&p_job->req);
+        if (p_job->req.op==aio_call)
+        {
+            rc = res;
+        }
+        else if (res==(int)p_job->req.length)
+        {
+            rc=0;
+        }
+        else
+        {
+            log->error_log("error writing file. count=%d",res);
+            close(*fh);
+        }
+        release_write_buffer(p_job);
+        delete p_job;
+    }
+    log->debug_log("rc:%d",rc);
+    return rc;
+}
+
+/**
+ * @brief serializes the object into an I/O buffer and opens its file.
+ * With deferopen the directories and the file are created by the request
+ * on an I/O thread.
+ * @return the write request, its buffer is released by the completion
+ */
+struct aio_write_job* Filestorage::prepare_write(struct data_object *p_do, InodeNumber inum, StripeId sid, uint32_t version, int *fh, bool deferopen)
 {
-    int rc=0;    
-    log->debug_log("Writing file:%s",file);
+    log->debug_log("Writing inum:%llu,sid:%u,version:%u",inum,sid,version);
     log->debug_log("metadata:%u,length:%u",size_metadata,p_do->metadata.datalength);
     create_checksum(p_do);    
-    
-    //std::stringstream ss;
-    //print_dataobject(p_do, ss);
-    //log->debug_log("Writing:%s ",ss.str().c_str());
-    //int fh = open(file, O_WRONLY);
     size_t total = size_metadata+p_do->metadata.datalength+sizeof(p_do->checksum);
-    void *buffer = malloc(total);
-
-    if (buffer!=NULL)
-    {
-        log->debug_log("Totala size is:%u",total);
-        void *tmp = buffer;
-        memcpy(tmp,&p_do->metadata, size_metadata);
-        log->debug_log("Totala size is:%u",total);
-        tmp+=size_metadata;
-        memcpy(tmp,p_do->data,  p_do->metadata.datalength);
-        log->debug_log("Totala size is:%u",total);
-        tmp+=p_do->metadata.datalength;
-        memcpy(tmp,&p_do->checksum, sizeof(p_do->checksum));
-        log->debug_log("Total size is:%u",total);
-        *fh = open(file,O_WRONLY | O_CREAT,  S_IRUSR | S_IWUSR );
-        if(*fh == NULL)
+    int bufindex;
+    char *buffer = (char*) p_aio->get_buffer(total, &bufindex);
+    if (buffer==NULL)
+    {
+        buffer = (char*) malloc(total);
+    }
+    if (buffer==NULL)
+    {
+        log->debug_log("could not allocate buffer");
+        return NULL;
+    }
+    log->debug_log("Total size is:%u",total);
+    char *tmp = buffer;
+    memcpy(tmp,&p_do->metadata, size_metadata);
+    tmp+=size_metadata;
+    memcpy(tmp,p_do->data,  p_do->metadata.datalength);
+    tmp+=p_do->metadata.datalength;
+    memcpy(tmp,&p_do->checksum, sizeof(p_do->checksum));
+
+    struct aio_write_job *p_job = new struct aio_write_job;
+    p_job->p_aio = p_aio;
+    p_job->p_segs = p_segs;
+    p_job->inum = inum;
+    p_job->sid = sid;
+    p_job->version = version;
+    p_job->fh = fh;
+    p_job->fhvalid = NULL;
+    p_job->p_group = NULL;
+    if (p_segs!=NULL)
+    {
+        p_aio->init_request(&p_job->req, aio_call);
+        p_job->req.fn = &segment_append;
+    }
+    else if (deferopen)
+    {
+        p_aio->init_request(&p_job->req, aio_call);
+        p_job->req.fn = &open_object;
+        p_job->inodedir = getPath(inum);
+        p_job->stripedir = getPath(inum, sid);
+        p_job->path = getPath(inum, sid, version);
+    }
+    else
+    {
+        std::string file = getPath(inum, sid, version);
+        *fh = open(file.c_str(),O_WRONLY | O_CREAT,  S_IRUSR | S_IWUSR );
+        if (*fh<0)
         {
             log->debug_log("could not create file handle...");
-        }
-        else
-        {
-            size_t count = write(*fh, buffer, total);
-            log->debug_log("metadata written:%d",count);
-            if (count!=total)
+            if (bufindex>=0)
             {
-                log->error_log("error writing file. count=%u",count);
-                rc=-1;
+                p_aio->put_buffer(bufindex);
             }
             else
             {
-                rc=0;
-            }            
-        }  
-        free(buffer);
-    }
-    else
-    {
-        log->debug_log("could not allocate buffer");
+                free(buffer);
+            }
+            delete p_job;
+            return NULL;
+        }
+        p_aio->init_request(&p_job->req, aio_write);
+        p_job->req.fd = *fh;
     }
-    //if(!no_sync)
-    //{
-    //    fsync(*fh);
-    //}
-    //close(*fh);
-    log->debug_log("rc:%d",rc);
-    return rc;
+    p_job->req.buf = buffer;
+    p_job->req.length = total;
+    p_job->req.bufindex = bufindex;
+    p_job->req.cb = &write_job_done;
+    return p_job;
 }
 
 int Filestorage::read_object(struct OPHead *p_head, std::map<StripeId,struct dataobject_collection*> *p_map)
 {
     int rc=-1;    
     uint32_t version;
-    std::string stripe_path;
     std::map<StripeId,struct dataobject_collection*>::iterator it_map;
     filelayout_raid *p_fl = ( filelayout_raid*) &p_head->filelayout[0];
-    struct FileStripeList *p_fsl = p_raid->get_stripes(p_fl, p_head->offset, p_head->length);
-    std::map<StripeId,struct Stripe_layout*>::iterator it = p_fsl->stripemap->begin();
-    for (it; it!= p_fsl->stripemap->end(); it++)
+    struct StripeCursor cursor;
+    struct StripeSpan span;
+    stripe_cursor_init(&cursor, p_head->offset, p_head->length);
+    serverid_t suid = p_raid->get_my_stripeunitid(p_fl,p_head->offset, id);
+    while (p_raid->next_stripe(p_fl, &cursor, &span))
     {
-        stripe_path = getPath(p_head->inum, it->first);
-        rc = get_max_version(stripe_path, &version);
-        log->debug_log("open dir %s: version:%u", stripe_path.c_str(), version);
+        it_map = p_map->find(span.sid);
+        if (it_map==p_map->end())
+        {
+            log->debug_log("stripe %u not in map.",span.sid);
+            continue;
+        }
+        rc = get_max_version(p_head->inum, span.sid, &version);
+        log->debug_log("inum:%llu,sid:%u: version:%u", p_head->inum, span.sid, version);
         if (version==0)
         {
-            it_map = p_map->find(it->first);
             it_map->second->existing=NULL;
             log->debug_log("No object found.");
             it_map->second->mycurrentversion=0;
         }
         else
         {
-            //it_map = p_map->find();
-            serverid_t suid = p_raid->get_my_stripeunitid(p_fl,p_head->offset, id);
             uint32_t *p_myversion = &it_map->second->versionvector[suid];
             it_map->second->mycurrentversion=*p_myversion;        
         }        
         log->debug_log("current version %u.",it_map->second->mycurrentversion);
     }    
-    free_FileStripeList(p_fsl);
     return rc;
 }
 
+int Filestorage::get_max_version(InodeNumber inum, StripeId sid, uint32_t *version)
+{
+    if (p_segs!=NULL)
+    {
+        return p_segs->get_max_version(inum, sid, version);
+    }
+    std::string path = getPath(inum, sid);
+    return get_max_version(path, version);
+}
+
 int Filestorage::get_max_version(std::string& dir, uint32_t *version)
 {
     vector<string> files = vector<string>();
@@ -358,41 +664,123 @@ int Filestorage::get_min_version(std::string& dir, uint32_t *version)
     return rc;
 }
 
+/**
+ * @brief reads only the metadata of the newest object of a stripe. Used
+ * where the version vector is needed but the old data is not.
+ */
+int Filestorage::read_stripe_metadata(InodeNumber inum, StripeId sid, struct dataobject_metadata *p_md)
+{
+    int rc=-1;
+    uint32_t version;
+    get_max_version(inum, sid, &version);
+    log->debug_log("inum:%llu,stripeid:%u, version:%u",inum,sid,version);
+    if (version>0 && p_segs!=NULL)
+    {
+        rc = p_segs->read_head(inum, sid, version, p_md, size_metadata);
+    }
+    else if (version>0)
+    {
+        int fh;
+        std::string path = getPath(inum,sid,version);
+        if((fh = open(path.c_str(), O_RDONLY)) != -1)
+        {
+            rc = (pread(fh, p_md, size_metadata, 0)==(ssize_t)size_metadata) ? 0 : -3;
+            close(fh);
+        }
+        else
+        {
+            log->debug_log("Error opening file");
+            rc=-2;
+        }
+    }
+    else
+    {
+        log->debug_log("No such file found.");
+    }
+    return rc;
+}
+
 int Filestorage::read_stripe_object(InodeNumber inum, StripeId sid, struct data_object **p_out)
 {
     int rc=-1;
     uint32_t version;
-    std::string path = getPath(inum, sid);
-    get_max_version(path, &version);
+    get_max_version(inum, sid, &version);
     log->debug_log("inum:%llu,stripeid:%u, version:%u",inum,sid,version);
-    if (version>0)
+    if (version>0 && p_segs!=NULL)
+    {
+        void *segbuf;
+        size_t length;
+        rc = p_segs->read(inum, sid, version, &segbuf, &length);
+        if (rc==0)
+        {
+            char *buffer = (char*) segbuf;
+            struct dataobject_metadata *p_md = (struct dataobject_metadata *) buffer;
+            if (length>=size_metadata && length>=size_metadata+p_md->datalength+sizeof((*p_out)->checksum))
+            {
+                *p_out = new data_object;
+                memcpy(&(*p_out)->metadata, buffer, size_metadata);
+                (*p_out)->data = malloc(p_md->datalength);
+                memcpy((*p_out)->data, buffer+size_metadata, p_md->datalength);
+                memcpy(&(*p_out)->checksum, buffer+size_metadata+p_md->datalength, sizeof((*p_out)->checksum));
+            }
+            else
+            {
+                log->error_log("short segment record:%zu",length);
+                rc=-3;
+            }
+            free(segbuf);
+        }
+    }
+    else if (version>0)
     {
         int fh;
-        path = getPath(inum,sid,version);
+        std::string path = getPath(inum,sid,version);
         log->debug_log("path:%s.",path.c_str());
-        try
+        if((fh = open(path.c_str(), O_RDONLY)) != -1)
         {
-            if((fh = open(path.c_str(), O_RDONLY)) != -1)
+            struct stat st;
+            fstat(fh, &st);
+            // the whole object with one read into an I/O buffer
+            struct aio_request req;
+            p_aio->init_request(&req, aio_read);
+            req.fd = fh;
+            req.length = st.st_size;
+            req.buf = p_aio->get_buffer(req.length, &req.bufindex);
+            if (req.buf==NULL)
+            {
+                req.buf = malloc(req.length);
+            }
+            int res = p_aio->execute(&req);
+            close(fh);
+            char *buffer = (char*) req.buf;
+            struct dataobject_metadata *p_md = (struct dataobject_metadata *) buffer;
+            if (res>=(int)size_metadata && res>=(int)(size_metadata+p_md->datalength+sizeof((*p_out)->checksum)))
             {
-                size_t count;
                 *p_out = new data_object;
-                count = pread(fh, &(*p_out)->metadata, sizeof((*p_out)->metadata), 0);
-                (*p_out)->data = malloc((*p_out)->metadata.datalength);
-                count = pread(fh, (*p_out)->data, (*p_out)->metadata.datalength,sizeof((*p_out)->metadata));
-                count = pread(fh, &(*p_out)->checksum, sizeof((*p_out)->checksum),(*p_out)->metadata.datalength+sizeof((*p_out)->metadata));
-                close(fh);
-                //log->debug_log("Object read:%s",(char*)(*p_out)->data);
+                memcpy(&(*p_out)->metadata, buffer, size_metadata);
+                (*p_out)->data = malloc(p_md->datalength);
+                memcpy((*p_out)->data, buffer+size_metadata, p_md->datalength);
+                memcpy(&(*p_out)->checksum, buffer+size_metadata+p_md->datalength, sizeof((*p_out)->checksum));
                 rc=0;
             }
             else
             {
-                log->debug_log("Error opening file");
-                rc=-2;
+                log->error_log("short read:%d",res);
+                rc=-3;
+            }
+            if (req.bufindex>=0)
+            {
+                p_aio->put_buffer(req.bufindex);
+            }
+            else
+            {
+                free(req.buf);
             }
         }
-        catch(...)
+        else
         {
-            rc=-3;
+            log->debug_log("Error opening file");
+            rc=-2;
         }
     }
     else
@@ -402,6 +790,84 @@ int Filestorage::read_stripe_object(InodeNumber inum, StripeId sid, struct data_
     return rc;
 }
 
+/**
+ * @brief reads the current version of the stripe unit on an I/O thread,
+ * cb gets the object or NULL if none was read.
+ */
+int Filestorage::read_stripe_object_async(InodeNumber inum, StripeId sid, void (*cb)(void *arg, int rc, struct data_object *p_do), void *arg)
+{
+    struct aio_stripe_job *p_job = new struct aio_stripe_job;
+    p_aio->init_request(&p_job->req, aio_call);
+    p_job->req.fn = &stripe_read;
+    p_job->req.cb = &stripe_read_done;
+    p_job->p_fs = this;
+    p_job->inum = inum;
+    p_job->sid = sid;
+    p_job->version = 0;
+    p_job->p_do = NULL;
+    p_job->cb = cb;
+    p_job->arg = arg;
+    if (p_aio->submit(&p_job->req))
+    {
+        delete p_job;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief writes a stripe unit built outside of an operation, e.g. by the
+ * rebuild engine, and waits until it is committed.
+ */
+int Filestorage::write_stripe_object(InodeNumber inum, StripeId sid, uint32_t version, struct data_object *p_do)
+{
+    int fh=-1;
+    if (!create_stripe_dir(inum, sid))
+    {
+        return -1;
+    }
+    int rc = write_object(p_do, inum, sid, version, &fh);
+    if (rc==0)
+    {
+        rc = commit(&fh, 1);
+    }
+    log->debug_log("inum:%llu,sid:%u,version:%u,rc:%d",inum,sid,version,rc);
+    return rc;
+}
+
+/**
+ * @brief appends every (inode, stripe) this server holds a unit of
+ */
+int Filestorage::list_stripes(std::vector<std::pair<InodeNumber,StripeId> > *p_out)
+{
+    if (p_segs!=NULL)
+    {
+        return p_segs->list(p_out);
+    }
+    vector<string> inodes = vector<string>();
+    int rc = getdir(basedir, inodes);
+    vector<string>::iterator it = inodes.begin();
+    for (it; it!=inodes.end(); it++)
+    {
+        if (!isdigit((*it)[0])) continue;
+        InodeNumber inum = strtoull(it->c_str(), NULL, 10);
+        vector<string> stripes = vector<string>();
+        getdir(getPath(inum), stripes);
+        vector<string>::iterator its = stripes.begin();
+        for (its; its!=stripes.end(); its++)
+        {
+            if (!isdigit((*its)[0])) continue;
+            p_out->push_back(std::pair<InodeNumber,StripeId>(inum, strtoul(its->c_str(), NULL, 10)));
+        }
+    }
+    return rc;
+}
+
+std::string Filestorage::get_basedir()
+{
+    return basedir;
+}
+
 std::string Filestorage::getPath( InodeNumber inum)
 {
     ostringstream relpath;
@@ -425,6 +891,10 @@ std::string Filestorage::getPath( InodeNumber inum, StripeId sid, uint32_t versi
 
 int Filestorage::remove_lower_than(InodeNumber inum, StripeId sid, uint32_t version)
 {
+    if (p_segs!=NULL)
+    {
+        return p_segs->remove_lower_than(inum, sid, version);
+    }
     string stripe_path = getPath(inum, sid);
     vector<string> files = vector<string>();
     int rc = getdir(stripe_path,files);
@@ -441,6 +911,30 @@ int Filestorage::remove_lower_than(InodeNumber inum, StripeId sid, uint32_t vers
     return rc;
 }
 
+/**
+ * @brief removes the old versions on an I/O thread.
+ */
+int Filestorage::remove_lower_than_async(InodeNumber inum, StripeId sid, uint32_t version)
+{
+    struct aio_stripe_job *p_job = new struct aio_stripe_job;
+    p_aio->init_request(&p_job->req, aio_call);
+    p_job->req.fn = &stripe_remove;
+    p_job->req.cb = &stripe_remove_done;
+    p_job->p_fs = this;
+    p_job->inum = inum;
+    p_job->sid = sid;
+    p_job->version = version;
+    p_job->p_do = NULL;
+    p_job->cb = NULL;
+    p_job->arg = NULL;
+    if (p_aio->submit(&p_job->req))
+    {
+        delete p_job;
+        return -1;
+    }
+    return 0;
+}
+
 int Filestorage::remove_File(std::string path, const char  *filename)
 {
     int rc=0;
@@ -453,4 +947,52 @@ int Filestorage::remove_File(std::string path, const char  *filename)
         rc=-1;
     }
     return rc;    
-}
\ No newline at end of file
+}
+
+/**
+ * @brief reclaims the space of removed versions, only the segment layout
+ * needs this.
+ */
+int Filestorage::compact()
+{
+    int rc=0;
+    if (p_segs!=NULL)
+    {
+        rc = p_segs->compact();
+    }
+    return rc;
+}
+
+/**
+ * @brief flushes and closes the handles returned by write_file, blocks
+ * until the group commit containing them is on disk.
+ */
+int Filestorage::commit(int *fds, int n)
+{
+    return p_commit->commit(fds, n);
+}
+
+/**
+ * @brief like commit, but returns immediately. cb is called from the
+ * flusher thread.
+ */
+int Filestorage::commit_async(int *fds, int n, void (*cb)(void *arg, int rc), void *arg)
+{
+    return p_commit->commit_async(fds, n, cb, arg);
+}
+
+void Filestorage::set_commit_bounds(size_t maxbatch, uint32_t maxdelay)
+{
+    p_commit->set_bounds(maxbatch, maxdelay);
+}
+
+/**
+ * @brief starts the I/O threads, io_uring is used if requested and
+ * available. Until then all disk requests run on the calling thread.
+ */
+int Filestorage::start_aio(bool uring, int threads)
+{
+    delete p_aio;
+    p_aio = new AsyncIO(log, AIO_DEFAULT_ENTRIES, threads, uring);
+    return p_aio->start();
+}
@@ -0,0 +1,309 @@
+#include <string.h>
+#include <vector>
+
+#include "components/diskio/GroupCommit.h"
+
+using namespace std;
+
+typedef std::pair<dev_t,ino_t> file_key;
+
+static void* groupcommit_flusher(void *obj)
+{
+    GroupCommit *p_gc = (GroupCommit *) obj;
+    while (1)
+    {
+        if (p_gc->flush_batch()<0)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+GroupCommit::GroupCommit(Logger *p_log, bool sync, size_t batch, uint32_t delay)
+{
+    log = p_log;
+    dosync = sync;
+    running = false;
+    maxbatch = (batch>0) ? batch : GROUPCOMMIT_DEFAULT_BATCH;
+    maxdelay = delay;
+    pendingfds = 0;
+    batches = 0;
+    syncs = 0;
+    requests = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&workcond, NULL);
+    pthread_cond_init(&donecond, NULL);
+    p_queue = new std::deque<struct commit_request*>();
+}
+
+GroupCommit::GroupCommit(const GroupCommit& orig)
+{
+}
+
+GroupCommit::~GroupCommit()
+{
+    if (running)
+    {
+        pthread_mutex_lock(&mutex);
+        running = false;
+        pthread_cond_signal(&workcond);
+        pthread_mutex_unlock(&mutex);
+        pthread_join(flusher, NULL);
+    }
+    delete p_queue;
+    pthread_cond_destroy(&donecond);
+    pthread_cond_destroy(&workcond);
+    pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * @brief starts the flusher thread, without fsync nothing is batched and
+ * the handles are closed right away.
+ */
+int GroupCommit::start()
+{
+    int rc=0;
+    if (dosync && !running)
+    {
+        running = true;
+        rc = pthread_create(&flusher, NULL, groupcommit_flusher, this);
+        if (rc)
+        {
+            log->error_log("flusher thread not created:rc=%d",rc);
+            running = false;
+        }
+    }
+    log->debug_log("sync:%d, batch:%u, delay:%uus, rc:%d",dosync,maxbatch,maxdelay,rc);
+    return rc;
+}
+
+void GroupCommit::set_bounds(size_t batch, uint32_t delay)
+{
+    pthread_mutex_lock(&mutex);
+    if (batch>0) maxbatch = batch;
+    maxdelay = delay;
+    pthread_mutex_unlock(&mutex);
+}
+
+struct commit_request* GroupCommit::new_request(int *fds, int n)
+{
+    struct commit_request *p_req = new struct commit_request;
+    p_req->fds = (int *) malloc(n*sizeof(int));
+    memcpy(p_req->fds, fds, n*sizeof(int));
+    p_req->fdcnt = n;
+    p_req->cb = NULL;
+    p_req->arg = NULL;
+    p_req->done = false;
+    p_req->rc = 0;
+    return p_req;
+}
+
+int GroupCommit::close_fds(int *fds, int n)
+{
+    int rc=0;
+    for (int i=0; i<n; i++)
+    {
+        if (close(fds[i]))
+        {
+            rc=-1;
+        }
+    }
+    return rc;
+}
+
+/**
+ * @brief blocks until the handles are on disk, the handles are closed.
+ */
+int GroupCommit::commit(int *fds, int n)
+{
+    if (!running)
+    {
+        return close_fds(fds, n);
+    }
+    struct commit_request *p_req = new_request(fds, n);
+    pthread_mutex_lock(&mutex);
+    p_queue->push_back(p_req);
+    pendingfds += n;
+    pthread_cond_signal(&workcond);
+    while (!p_req->done)
+    {
+        pthread_cond_wait(&donecond, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    int rc = p_req->rc;
+    free(p_req->fds);
+    delete p_req;
+    return rc;
+}
+
+/**
+ * @brief queues the handles and returns. cb is called by the flusher
+ * thread once they are on disk and closed, it must not block.
+ */
+int GroupCommit::commit_async(int *fds, int n, void (*cb)(void *arg, int rc), void *arg)
+{
+    if (!running)
+    {
+        int rc = close_fds(fds, n);
+        cb(arg, rc);
+        return 0;
+    }
+    struct commit_request *p_req = new_request(fds, n);
+    p_req->cb = cb;
+    p_req->arg = arg;
+    pthread_mutex_lock(&mutex);
+    p_queue->push_back(p_req);
+    pendingfds += n;
+    pthread_cond_signal(&workcond);
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/**
+ * @brief waits for work, collects a batch bounded by maxbatch handles or
+ * maxdelay microseconds and syncs every distinct file once.
+ * @return -1 if the committer is stopped
+ */
+int GroupCommit::flush_batch()
+{
+    std::vector<struct commit_request*> batch;
+    pthread_mutex_lock(&mutex);
+    while (p_queue->empty() && running)
+    {
+        pthread_cond_wait(&workcond, &mutex);
+    }
+    if (!running && p_queue->empty())
+    {
+        pthread_mutex_unlock(&mutex);
+        return -1;
+    }
+    if (pendingfds<maxbatch && maxdelay>0)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (maxdelay%1000000)*1000;
+        deadline.tv_sec += maxdelay/1000000 + deadline.tv_nsec/1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (pendingfds<maxbatch && running)
+        {
+            if (pthread_cond_timedwait(&workcond, &mutex, &deadline)==ETIMEDOUT)
+            {
+                break;
+            }
+        }
+    }
+    size_t fdcnt=0;
+    while (!p_queue->empty() && fdcnt<maxbatch)
+    {
+        fdcnt += p_queue->front()->fdcnt;
+        batch.push_back(p_queue->front());
+        p_queue->pop_front();
+    }
+    pendingfds -= fdcnt;
+    pthread_mutex_unlock(&mutex);
+
+    // one sync per file, segment handles share their file. Several files
+    // of one device are written back by a single syncfs. syncfs does not
+    // report the write errors of a single file, so every file is checked
+    // by its own fdatasync afterwards, that one has nothing left to write.
+    std::map<file_key,int> files;
+    std::map<dev_t,int> devices;
+    std::vector<struct commit_request*>::iterator it = batch.begin();
+    for (it; it!=batch.end(); it++)
+    {
+        for (int i=0; i<(*it)->fdcnt; i++)
+        {
+            struct stat st;
+            if (fstat((*it)->fds[i], &st)==0)
+            {
+                if (files.insert(std::pair<file_key,int>(file_key(st.st_dev, st.st_ino),(*it)->fds[i])).second)
+                {
+                    devices[st.st_dev]++;
+                }
+            }
+            else
+            {
+                (*it)->rc = -1;
+            }
+        }
+    }
+    std::map<dev_t,int> devrc;
+    std::map<file_key,int> filerc;
+    int synccnt=0;
+    std::map<file_key,int>::iterator itf = files.begin();
+    for (itf; itf!=files.end(); itf++)
+    {
+        dev_t dev = itf->first.first;
+        if (devices[dev]>1)
+        {
+            if (devrc.find(dev)==devrc.end())
+            {
+                devrc[dev] = syncfs(itf->second);
+                if (devrc[dev]!=0)
+                {
+                    log->error_log("syncfs failed, errno:%d",errno);
+                }
+                synccnt++;
+            }
+        }
+        else
+        {
+            synccnt++;
+        }
+        int rc = fdatasync(itf->second);
+        if (rc!=0)
+        {
+            log->error_log("flush failed, errno:%d",errno);
+        }
+        else if (devices[dev]>1)
+        {
+            rc = devrc[dev];
+        }
+        filerc[itf->first] = rc;
+    }
+    for (it=batch.begin(); it!=batch.end(); it++)
+    {
+        for (int i=0; i<(*it)->fdcnt; i++)
+        {
+            struct stat st;
+            if (fstat((*it)->fds[i], &st)==0 && filerc[file_key(st.st_dev, st.st_ino)]!=0)
+            {
+                (*it)->rc = -1;
+            }
+        }
+        if (close_fds((*it)->fds, (*it)->fdcnt))
+        {
+            (*it)->rc = -1;
+        }
+    }
+    log->debug_log("batch: requests:%u, handles:%u, syncs:%d",batch.size(),fdcnt,synccnt);
+
+    // synchronous requests are freed by their waiter once done is set
+    std::vector<struct commit_request*> async;
+    for (it=batch.begin(); it!=batch.end(); it++)
+    {
+        if ((*it)->cb!=NULL)
+        {
+            async.push_back(*it);
+        }
+    }
+    pthread_mutex_lock(&mutex);
+    batches++;
+    syncs += synccnt;
+    requests += batch.size();
+    for (it=batch.begin(); it!=batch.end(); it++)
+    {
+        (*it)->done = true;
+    }
+    pthread_cond_broadcast(&donecond);
+    pthread_mutex_unlock(&mutex);
+
+    for (it=async.begin(); it!=async.end(); it++)
+    {
+        (*it)->cb((*it)->arg, (*it)->rc);
+        free((*it)->fds);
+        delete *it;
+    }
+    return 0;
+}
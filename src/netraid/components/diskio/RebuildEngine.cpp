@@ -0,0 +1,604 @@
+#include "components/diskio/RebuildEngine.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* context of one asynchronous unit read */
+struct rebuild_read {
+    RebuildEngine           *p_engine;
+    struct rebuild_stripe   *p_st;
+    serverid_t              server;
+};
+
+static inline uint64_t rebuild_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static void* rebuild_thread(void *data)
+{
+    RebuildEngine *p_engine = (RebuildEngine *) data;
+    p_engine->run();
+    pthread_exit(0);
+}
+
+/**
+ * @param storagedir storage directory shared with the other servers, their
+ * units are read from <storagedir>/serverid_<id>
+ * @param p_local storage the rebuilt units are written to
+ */
+RebuildEngine::RebuildEngine(Logger *p_log, std::string storagedir, serverid_t myid, Filestorage *p_local, enum storage_layout layout, size_t segsize)
+{
+    log = p_log;
+    this->storagedir = storagedir;
+    id = myid;
+    this->p_local = p_local;
+    this->layout = layout;
+    this->segsize = segsize;
+    p_raid = new Libraid4(log);
+    batch = REBUILD_DEFAULT_BATCH;
+    rate = REBUILD_DEFAULT_RATE;
+    foreground = 0;
+    stopflag = false;
+    threadvalid = false;
+    pending = 0;
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+RebuildEngine::~RebuildEngine()
+{
+    stop();
+    std::map<serverid_t,Filestorage*>::iterator it = peers.begin();
+    for (it; it!=peers.end(); it++)
+    {
+        delete it->second;
+    }
+    delete p_raid;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * @brief runs the rebuild on a background thread
+ */
+int RebuildEngine::start()
+{
+    if (threadvalid)
+    {
+        return -1;
+    }
+    stopflag = false;
+    int rc = pthread_create(&thread, NULL, rebuild_thread, this);
+    threadvalid = (rc==0);
+    log->debug_log("rc:%d",rc);
+    return rc;
+}
+
+/**
+ * @brief stops after the current batch, the checkpoint is kept.
+ */
+void RebuildEngine::stop()
+{
+    stopflag = true;
+    if (threadvalid)
+    {
+        pthread_join(thread, NULL);
+        threadvalid = false;
+    }
+}
+
+void RebuildEngine::set_batch(uint32_t stripes)
+{
+    batch = (stripes>0) ? stripes : 1;
+}
+
+/**
+ * @param mbps MB/s read and written by the rebuild, 0 is unthrottled
+ */
+void RebuildEngine::set_rate(uint32_t mbps)
+{
+    rate = mbps;
+}
+
+/**
+ * @brief called for every foreground task, the next batch runs at
+ * REBUILD_FOREGROUND_PCT of the rate.
+ */
+void RebuildEngine::foreground_io()
+{
+    __sync_fetch_and_add(&foreground, 1);
+}
+
+void RebuildEngine::get_stats(struct rebuild_stats *p_stats)
+{
+    pthread_mutex_lock(&mutex);
+    *p_stats = stats;
+    pthread_mutex_unlock(&mutex);
+}
+
+void RebuildEngine::report()
+{
+    struct rebuild_stats s;
+    get_stats(&s);
+    double pct = (s.total>0) ? 100.0*s.scanned/s.total : 100.0;
+    time_t elapsed = (s.started>0) ? time(0)-s.started : 0;
+    log->debug_log("rebuild %s: %.1f%% (%llu/%llu stripes), rebuilt:%llu, skipped:%llu, failed:%llu, %llu MB, throttled:%llu ms, %lu s",
+            s.done ? "done" : (s.running ? "running" : "stopped"), pct, s.scanned, s.total,
+            s.rebuilt, s.skipped, s.failed, s.bytes/(1024*1024), s.throttled/1000, elapsed);
+}
+
+/**
+ * @brief one pass over all stripes of the other servers. Resumes after the
+ * checkpoint if one exists, removes it once the pass completed.
+ * @return 0 if completed, 1 if stopped, <0 on error
+ */
+int RebuildEngine::run()
+{
+    int rc = open_peers();
+    if (rc)
+    {
+        log->error_log("no other server found below %s",storagedir.c_str());
+        return rc;
+    }
+    std::map<rebuild_key,std::vector<serverid_t> > stripes;
+    scan(&stripes);
+
+    std::map<rebuild_key,std::vector<serverid_t> >::iterator it = stripes.begin();
+    rebuild_key last;
+    uint64_t done = 0;
+    if (load_checkpoint(&last))
+    {
+        it = stripes.upper_bound(last);
+        std::map<rebuild_key,std::vector<serverid_t> >::iterator itc = stripes.begin();
+        for (itc; itc!=it; itc++) done++;
+        log->debug_log("resuming after inum:%llu,sid:%u, %llu stripes done",last.first,last.second,done);
+    }
+    pthread_mutex_lock(&mutex);
+    memset(&stats, 0, sizeof(stats));
+    stats.total = stripes.size();
+    stats.scanned = done;
+    stats.started = time(0);
+    stats.running = true;
+    pthread_mutex_unlock(&mutex);
+
+    while (it!=stripes.end() && !stopflag)
+    {
+        std::vector<struct rebuild_stripe*> b;
+        for (it; it!=stripes.end() && b.size()<batch; it++)
+        {
+            struct rebuild_stripe *p_st = new struct rebuild_stripe;
+            p_st->key = it->first;
+            p_st->holders = it->second;
+            b.push_back(p_st);
+        }
+        uint64_t start = rebuild_now_us();
+        read_batch(&b, true);
+        read_batch(&b, false);
+        uint64_t bytes = 0;
+        std::vector<struct rebuild_stripe*>::iterator itb = b.begin();
+        for (itb; itb!=b.end(); itb++)
+        {
+            int res = rebuild_stripe(*itb);
+            std::map<serverid_t,struct data_object*>::iterator ito = (*itb)->objects.begin();
+            for (ito; ito!=(*itb)->objects.end(); ito++)
+            {
+                if (ito->second==NULL) continue;
+                bytes += ito->second->metadata.datalength;
+                free(ito->second->data);
+                delete ito->second;
+            }
+            pthread_mutex_lock(&mutex);
+            stats.scanned++;
+            if (res==0) stats.rebuilt++;
+            else if (res>0) stats.skipped++;
+            else stats.failed++;
+            pthread_mutex_unlock(&mutex);
+            if (res<0)
+            {
+                log->error_log("rebuild of inum:%llu,sid:%u failed:%d",(*itb)->key.first,(*itb)->key.second,res);
+            }
+        }
+        save_checkpoint(b.back()->key);
+        for (itb=b.begin(); itb!=b.end(); itb++)
+        {
+            delete *itb;
+        }
+        pthread_mutex_lock(&mutex);
+        stats.bytes += bytes;
+        pthread_mutex_unlock(&mutex);
+        throttle(bytes, rebuild_now_us()-start);
+    }
+
+    pthread_mutex_lock(&mutex);
+    stats.running = false;
+    stats.done = (it==stripes.end());
+    pthread_mutex_unlock(&mutex);
+    if (it==stripes.end())
+    {
+        unlink(checkpoint_path().c_str());
+        rc = 0;
+    }
+    else
+    {
+        rc = 1;
+    }
+    report();
+    return rc;
+}
+
+/**
+ * @brief opens the storage of every other server found in the storage
+ * directory.
+ */
+int RebuildEngine::open_peers()
+{
+    DIR *dp = opendir(storagedir.c_str());
+    if (dp==NULL)
+    {
+        return -1;
+    }
+    struct dirent *dirp;
+    while ((dirp = readdir(dp)) != NULL)
+    {
+        if (strncmp(dirp->d_name,"serverid_",9)!=0) continue;
+        serverid_t peer = strtoul(&dirp->d_name[9], NULL, 10);
+        if (peer==id || peers.find(peer)!=peers.end()) continue;
+        Filestorage *p_fs = new Filestorage(log, storagedir.c_str(), peer, false, layout, segsize);
+        p_fs->start_aio(false, AIO_DEFAULT_THREADS);
+        peers.insert(std::pair<serverid_t,Filestorage*>(peer, p_fs));
+        log->debug_log("peer storage:%u",peer);
+    }
+    closedir(dp);
+    return peers.empty() ? -1 : 0;
+}
+
+/**
+ * @brief collects every stripe of the other servers and the servers holding
+ * a unit of it, ordered by inode and stripe id for the checkpoint.
+ */
+int RebuildEngine::scan(std::map<rebuild_key,std::vector<serverid_t> > *p_stripes)
+{
+    std::map<serverid_t,Filestorage*>::iterator it = peers.begin();
+    for (it; it!=peers.end(); it++)
+    {
+        std::vector<rebuild_key> keys;
+        it->second->list_stripes(&keys);
+        std::vector<rebuild_key>::iterator itk = keys.begin();
+        for (itk; itk!=keys.end(); itk++)
+        {
+            (*p_stripes)[*itk].push_back(it->first);
+        }
+    }
+    log->debug_log("%u stripes on %u servers",p_stripes->size(),peers.size());
+    return 0;
+}
+
+void RebuildEngine::read_done(void *arg, int rc, struct data_object *p_do)
+{
+    struct rebuild_read *p_rd = (struct rebuild_read *) arg;
+    RebuildEngine *p_engine = p_rd->p_engine;
+    pthread_mutex_lock(&p_engine->mutex);
+    p_rd->p_st->objects[p_rd->server] = (rc==0) ? p_do : NULL;
+    p_engine->pending--;
+    if (p_engine->pending==0)
+    {
+        pthread_cond_broadcast(&p_engine->cond);
+    }
+    pthread_mutex_unlock(&p_engine->mutex);
+    delete p_rd;
+}
+
+/**
+ * @brief reads the units of a batch in parallel on the I/O threads of the
+ * peer storages. The first pass reads one unit of every stripe not yet
+ * present locally to learn the file layout, the second pass the rest of the
+ * group of the stripes this server is part of.
+ */
+int RebuildEngine::read_batch(std::vector<struct rebuild_stripe*> *p_batch, bool first)
+{
+    int submitted = 0;
+    std::vector<struct rebuild_stripe*>::iterator it = p_batch->begin();
+    for (it; it!=p_batch->end(); it++)
+    {
+        struct rebuild_stripe *p_st = *it;
+        std::vector<serverid_t> toread;
+        if (first)
+        {
+            uint32_t version = 0;
+            p_local->get_max_version(p_st->key.first, p_st->key.second, &version);
+            if (version>0 || p_st->holders.empty())
+            {
+                // present locally, nothing to read
+                p_st->holders.clear();
+                continue;
+            }
+            toread.push_back(p_st->holders[0]);
+        }
+        else
+        {
+            if (p_st->objects.empty() || p_st->objects.begin()->second==NULL)
+            {
+                continue;
+            }
+            filelayout_raid *p_fl = (filelayout_raid *) &p_st->objects.begin()->second->metadata.filelayout[0];
+            struct StripeSpan span;
+            if (p_raid->get_stripe_span(p_fl, (size_t)p_st->key.second*get_stripe_size(p_fl), &span))
+            {
+                continue;
+            }
+            bool member = (span.parityserver_id==id);
+            for (int u=0; u<span.unitcnt; u++)
+            {
+                if (span.units[u].assignedto==id) member = true;
+                else toread.push_back(span.units[u].assignedto);
+            }
+            if (span.parityserver_id!=id) toread.push_back(span.parityserver_id);
+            if (!member)
+            {
+                p_st->holders.clear();
+                continue;
+            }
+        }
+        std::vector<serverid_t>::iterator its = toread.begin();
+        for (its; its!=toread.end(); its++)
+        {
+            std::map<serverid_t,Filestorage*>::iterator itp = peers.find(*its);
+            if (itp==peers.end() || p_st->objects.find(*its)!=p_st->objects.end())
+            {
+                continue;
+            }
+            struct rebuild_read *p_rd = new struct rebuild_read;
+            p_rd->p_engine = this;
+            p_rd->p_st = p_st;
+            p_rd->server = *its;
+            pthread_mutex_lock(&mutex);
+            pending++;
+            pthread_mutex_unlock(&mutex);
+            if (itp->second->read_stripe_object_async(p_st->key.first, p_st->key.second, &read_done, p_rd))
+            {
+                read_done(p_rd, -1, NULL);
+            }
+            submitted++;
+        }
+    }
+    pthread_mutex_lock(&mutex);
+    while (pending>0)
+    {
+        pthread_cond_wait(&cond, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    log->debug_log("%s pass, %d reads",first ? "layout" : "group",submitted);
+    return 0;
+}
+
+/**
+ * @brief xors the surviving units into the unit of this server, zero padded
+ * to the unit size. A data unit needs the parity and every other unit the
+ * parity was computed from, a unit the parity has not seen is taken as
+ * zeros.
+ * @return 0 if written, 1 if nothing to do, <0 on error
+ */
+int RebuildEngine::rebuild_stripe(struct rebuild_stripe *p_st)
+{
+    if (p_st->holders.empty() || p_st->objects.empty() || p_st->objects.begin()->second==NULL)
+    {
+        return (p_st->holders.empty()) ? 1 : -1;
+    }
+    filelayout_raid fl;
+    memcpy(&fl, &p_st->objects.begin()->second->metadata.filelayout[0], sizeof(fl));
+    size_t unitsize = fl.raid4.stripeunitsize;
+    size_t stripestart = (size_t)p_st->key.second*get_stripe_size(&fl);
+    struct StripeSpan span;
+    if (p_raid->get_stripe_span(&fl, stripestart, &span) || span.unitcnt+1>PARITY_MAX_INPUTS)
+    {
+        return -2;
+    }
+
+    void *in[PARITY_MAX_INPUTS];
+    std::vector<void*> padded;
+    int n = 0;
+    int rc = 0;
+    struct data_object newobj;
+    uint32_t version = 0;
+    struct data_object *p_meta = NULL;
+    int myunit = -1;
+    for (int u=0; u<span.unitcnt; u++)
+    {
+        if (span.units[u].assignedto==id) myunit = u;
+    }
+    struct data_object *p_par = NULL;
+    if (myunit>=0)
+    {
+        std::map<serverid_t,struct data_object*>::iterator it = p_st->objects.find(span.parityserver_id);
+        p_par = (it!=p_st->objects.end()) ? it->second : NULL;
+        if (p_par==NULL)
+        {
+            return -3;
+        }
+        version = p_par->metadata.versionvector[myunit];
+        if (version==0)
+        {
+            return 1;
+        }
+        p_meta = p_par;
+        in[n++] = p_par->data;
+        if (p_par->metadata.datalength<unitsize)
+        {
+            padded.push_back(calloc(1,unitsize));
+            memcpy(padded.back(), p_par->data, p_par->metadata.datalength);
+            in[0] = padded.back();
+        }
+    }
+    uint32_t vv[default_groupsize+1];
+    memset(&vv[0], 0, sizeof(vv));
+    for (int u=0; u<span.unitcnt && rc==0; u++)
+    {
+        if (u==myunit) continue;
+        std::map<serverid_t,struct data_object*>::iterator it = p_st->objects.find(span.units[u].assignedto);
+        struct data_object *p_do = (it!=p_st->objects.end()) ? it->second : NULL;
+        if (p_do==NULL)
+        {
+            if (p_par!=NULL && p_par->metadata.versionvector[u]>0)
+            {
+                log->debug_log("unit %u of inum:%llu,sid:%u missing",u,p_st->key.first,p_st->key.second);
+                rc = -4;
+            }
+            continue;
+        }
+        if (p_par!=NULL && p_do->metadata.versionvector[u]!=p_par->metadata.versionvector[u])
+        {
+            log->debug_log("unit %u version %u, parity built from %u",u,p_do->metadata.versionvector[u],p_par->metadata.versionvector[u]);
+            rc = -5;
+            continue;
+        }
+        if (p_par==NULL)
+        {
+            // the parity records the version of every unit
+            vv[u] = p_do->metadata.versionvector[u];
+            if (p_do->metadata.versionvector[default_groupsize]>version)
+            {
+                version = p_do->metadata.versionvector[default_groupsize];
+            }
+            if (p_meta==NULL) p_meta = p_do;
+        }
+        in[n] = p_do->data;
+        if (p_do->metadata.datalength<unitsize)
+        {
+            padded.push_back(calloc(1,unitsize));
+            memcpy(padded.back(), p_do->data, p_do->metadata.datalength);
+            in[n] = padded.back();
+        }
+        n++;
+    }
+    if (rc==0 && p_meta==NULL)
+    {
+        rc = 1;
+    }
+    if (rc==0)
+    {
+        newobj.data = malloc(unitsize);
+        if (n>1)
+        {
+            calc_parity_n(&in[0], n, newobj.data, unitsize);
+        }
+        else
+        {
+            memcpy(newobj.data, in[0], unitsize);
+        }
+        newobj.metadata = p_meta->metadata;
+        newobj.metadata.datalength = unitsize;
+        if (myunit>=0)
+        {
+            newobj.metadata.offset = stripestart+myunit*unitsize;
+        }
+        else
+        {
+            if (version==0) version = 1;
+            vv[default_groupsize] = version;
+            memcpy(&newobj.metadata.versionvector[0], &vv[0], sizeof(vv));
+            newobj.metadata.offset = stripestart;
+        }
+        rc = p_local->write_stripe_object(p_st->key.first, p_st->key.second, version, &newobj);
+        free(newobj.data);
+        if (rc==0)
+        {
+            pthread_mutex_lock(&mutex);
+            stats.bytes += unitsize;
+            pthread_mutex_unlock(&mutex);
+        }
+        log->debug_log("inum:%llu,sid:%u,unit:%d,version:%u,inputs:%d,rc:%d",p_st->key.first,p_st->key.second,myunit,version,n,rc);
+    }
+    std::vector<void*>::iterator itp = padded.begin();
+    for (itp; itp!=padded.end(); itp++)
+    {
+        free(*itp);
+    }
+    return rc;
+}
+
+/**
+ * @brief sleeps so the batch does not exceed the configured rate. While
+ * foreground tasks arrived the rate is lowered to REBUILD_FOREGROUND_PCT,
+ * without a rate the engine pauses briefly between batches.
+ */
+void RebuildEngine::throttle(uint64_t bytes, uint64_t took_us)
+{
+    uint64_t fg = __sync_fetch_and_and(&foreground, 0);
+    uint64_t r = rate;
+    uint64_t sleep_us = 0;
+    if (fg>0 && r>0)
+    {
+        r = r*REBUILD_FOREGROUND_PCT/100;
+        if (r==0) r = 1;
+    }
+    if (r>0)
+    {
+        uint64_t want = bytes*1000000/(r*1024*1024);
+        if (want>took_us) sleep_us = want-took_us;
+    }
+    else if (fg>0)
+    {
+        sleep_us = REBUILD_BACKOFF_USLEEP;
+    }
+    if (sleep_us>0)
+    {
+        usleep(sleep_us);
+        pthread_mutex_lock(&mutex);
+        stats.throttled += sleep_us;
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+std::string RebuildEngine::checkpoint_path()
+{
+    return p_local->get_basedir()+"/"+REBUILD_CHECKPOINT_FILE;
+}
+
+/**
+ * @param[out] p_key last stripe of the last finished batch
+ * @return true if a checkpoint exists
+ */
+bool RebuildEngine::load_checkpoint(rebuild_key *p_key)
+{
+    FILE *f = fopen(checkpoint_path().c_str(), "r");
+    if (f==NULL)
+    {
+        return false;
+    }
+    unsigned long long inum;
+    unsigned long sid;
+    bool valid = (fscanf(f, "%llu %lu", &inum, &sid)==2);
+    fclose(f);
+    if (valid)
+    {
+        p_key->first = inum;
+        p_key->second = sid;
+    }
+    return valid;
+}
+
+/**
+ * @brief the checkpoint is replaced atomically by renaming a temporary file
+ */
+int RebuildEngine::save_checkpoint(rebuild_key key)
+{
+    std::string path = checkpoint_path();
+    std::string tmp = path+".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f==NULL)
+    {
+        log->error_log("could not write %s",tmp.c_str());
+        return -1;
+    }
+    fprintf(f, "%llu %lu\n", (unsigned long long) key.first, (unsigned long) key.second);
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+    return rename(tmp.c_str(), path.c_str());
+}
@@ -0,0 +1,632 @@
+#include <sys/uio.h>
+#include <string.h>
+#include <limits.h>
+#include <set>
+#include <vector>
+#include <sstream>
+
+#include "components/diskio/SegmentStore.h"
+
+using namespace std;
+
+static const size_t size_recordhead = sizeof(struct segment_record_head);
+
+SegmentStore::SegmentStore(Logger *p_log, std::string dir, size_t size)
+{
+    log = p_log;
+    basedir = dir;
+    segsize = (size>0) ? size : SEGMENT_DEFAULT_SIZE;
+    activeseg = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_rwlock_init(&seglock, NULL);
+    p_index = new std::map<segment_key, std::map<uint32_t,struct segment_entry>*>();
+    p_segments = new std::map<uint32_t, struct segment_info>();
+    xsystools_fs_mkdir(basedir);
+    if (recover())
+    {
+        log->error_log("recovery of %s failed.",basedir.c_str());
+    }
+    log->debug_log("segment dir:%s, segment size:%llu, active:%u",basedir.c_str(),segsize,activeseg);
+}
+
+SegmentStore::SegmentStore(const SegmentStore& orig)
+{
+}
+
+SegmentStore::~SegmentStore()
+{
+    std::map<uint32_t, struct segment_info>::iterator its = p_segments->begin();
+    for (its; its!=p_segments->end(); its++)
+    {
+        close(its->second.fd);
+    }
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->begin();
+    for (it; it!=p_index->end(); it++)
+    {
+        delete it->second;
+    }
+    delete p_segments;
+    delete p_index;
+    pthread_rwlock_destroy(&seglock);
+    pthread_mutex_destroy(&mutex);
+}
+
+std::string SegmentStore::getPath(uint32_t segid)
+{
+    ostringstream relpath;
+    relpath << basedir.c_str() << "/seg_" << segid;
+    return relpath.str();
+}
+
+/**
+ * @brief opens or creates a segment file, requires mutex
+ */
+int SegmentStore::open_segment(uint32_t segid)
+{
+    std::string path = getPath(segid);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd==-1)
+    {
+        log->error_log("could not open segment %s, errno:%d",path.c_str(),errno);
+        return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    struct segment_info info;
+    info.fd = fd;
+    info.size = st.st_size;
+    info.live = 0;
+    p_segments->insert(std::pair<uint32_t, struct segment_info>(segid,info));
+    return 0;
+}
+
+/**
+ * @brief rebuilds the index from the segment files. Segments are replayed
+ * in id order, so a record copied by compaction replaces its original.
+ * Versions dropped by remove_lower_than reappear until the next garbage
+ * collection run, which is harmless because only the newest is read.
+ */
+int SegmentStore::recover()
+{
+    int rc=0;
+    std::set<uint32_t> ids;
+    DIR *dp = opendir(basedir.c_str());
+    if (dp==NULL)
+    {
+        return -1;
+    }
+    struct dirent *dirp;
+    while ((dirp = readdir(dp)) != NULL)
+    {
+        if (strncmp(dirp->d_name,"seg_",4)==0)
+        {
+            ids.insert((uint32_t) strtoul(&dirp->d_name[4],NULL,10));
+        }
+    }
+    closedir(dp);
+
+    pthread_mutex_lock(&mutex);
+    std::set<uint32_t>::iterator it = ids.begin();
+    for (it; it!=ids.end(); it++)
+    {
+        if (open_segment(*it)==0)
+        {
+            rc = recover_segment(*it, p_segments->find(*it)->second.fd);
+        }
+        activeseg = *it+1;
+    }
+    if (open_segment(activeseg))
+    {
+        rc=-1;
+    }
+    pthread_mutex_unlock(&mutex);
+    log->debug_log("recovered %u segments, index size:%u",ids.size(),p_index->size());
+    return rc;
+}
+
+/**
+ * @brief crc of a record, the crc field of the head counts as 0
+ */
+static uint32_t record_crc(struct segment_record_head *head, void *data, size_t length)
+{
+    uint32_t saved = head->crc;
+    head->crc = 0;
+    uint32_t crc = crc32c(0, head, size_recordhead);
+    head->crc = saved;
+    return crc32c(crc, data, length);
+}
+
+/**
+ * @brief reads the record at offset and verifies it against its crc
+ * @return 0 if it is complete and intact
+ */
+int SegmentStore::check_record(int fd, size_t size, size_t offset, struct segment_record_head *head)
+{
+    if (pread(fd, head, size_recordhead, offset)!=(ssize_t)size_recordhead ||
+        head->magic!=SEGMENT_RECORD_MAGIC || head->length > size-offset-size_recordhead)
+    {
+        return -1;
+    }
+    void *payload = malloc(head->length+1);
+    if (payload==NULL) return -1;
+    int rc = -1;
+    if (pread(fd, payload, head->length, offset+size_recordhead)==(ssize_t)head->length &&
+        record_crc(head, payload, head->length)==head->crc)
+    {
+        rc = 0;
+    }
+    free(payload);
+    return rc;
+}
+
+/**
+ * @brief finds the first intact record at or after *offset. Appends finish
+ * out of order, so an unwritten hole or a torn record may be followed by
+ * durable ones; the scan skips to the next magic with a valid crc.
+ * @return 0 and the record in *offset and head, -1 if there is none
+ */
+int SegmentStore::next_record(int fd, size_t size, size_t *offset, struct segment_record_head *head)
+{
+    if (*offset+size_recordhead > size) return -1;
+    if (check_record(fd, size, *offset, head)==0) return 0;
+
+    const uint32_t magic = SEGMENT_RECORD_MAGIC;
+    char *window = (char*) malloc(SEGMENT_SCAN_WINDOW);
+    if (window==NULL) return -1;
+    size_t pos = *offset+1;
+    int rc = -1;
+    while (rc!=0 && pos+size_recordhead <= size)
+    {
+        ssize_t n = pread(fd, window, SEGMENT_SCAN_WINDOW, pos);
+        if (n<(ssize_t)sizeof(magic)) break;
+        size_t i=0;
+        for (i; i+sizeof(magic)<=(size_t)n; i++)
+        {
+            if (memcmp(window+i, &magic, sizeof(magic))==0 && check_record(fd, size, pos+i, head)==0)
+            {
+                *offset = pos+i;
+                rc = 0;
+                break;
+            }
+        }
+        // the last bytes may hold the start of a magic
+        pos += (rc==0) ? 0 : i;
+    }
+    free(window);
+    return rc;
+}
+
+/**
+ * @brief scans a segment and indexes its intact records. Damaged ranges
+ * between them are skipped, only the tail after the last intact record is
+ * cut off. Requires mutex.
+ */
+int SegmentStore::recover_segment(uint32_t segid, int fd)
+{
+    struct segment_info *p_info = &p_segments->find(segid)->second;
+    size_t offset = 0;
+    size_t end = 0;
+    struct segment_record_head head;
+    while (next_record(fd, p_info->size, &offset, &head)==0)
+    {
+        if (offset!=end)
+        {
+            log->error_log("segment %u: skipped damaged bytes %llu-%llu",segid,end,offset);
+        }
+        struct segment_entry e;
+        e.segid = segid;
+        e.offset = offset+size_recordhead;
+        e.length = head.length;
+        p_info->live += size_recordhead+head.length;
+        index_insert(segment_key(head.inum,head.sid), head.version, &e);
+        offset += size_recordhead+head.length;
+        end = offset;
+    }
+    if (end<p_info->size)
+    {
+        log->error_log("segment %u truncated at %llu, was %llu",segid,end,p_info->size);
+        if (ftruncate(fd, end))
+        {
+            return -1;
+        }
+        p_info->size = end;
+    }
+    return 0;
+}
+
+/**
+ * @brief reserves space in the active segment, starts a new segment if
+ * the record does not fit.
+ */
+int SegmentStore::reserve(size_t total, uint32_t *segid, size_t *offset, int *fd)
+{
+    int rc=0;
+    pthread_mutex_lock(&mutex);
+    std::map<uint32_t, struct segment_info>::iterator it = p_segments->find(activeseg);
+    if (it->second.size>0 && it->second.size+total>segsize)
+    {
+        if (open_segment(activeseg+1)==0)
+        {
+            activeseg++;
+            it = p_segments->find(activeseg);
+            log->debug_log("new active segment:%u",activeseg);
+        }
+    }
+    *segid = activeseg;
+    *offset = it->second.size;
+    *fd = it->second.fd;
+    it->second.size += total;
+    it->second.live += total;
+    pthread_mutex_unlock(&mutex);
+    return rc;
+}
+
+/**
+ * @brief requires mutex. An existing entry of the same version is replaced.
+ */
+void SegmentStore::index_insert(segment_key key, uint32_t version, struct segment_entry *e)
+{
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->find(key);
+    if (it==p_index->end())
+    {
+        std::map<uint32_t,struct segment_entry> *p_versions = new std::map<uint32_t,struct segment_entry>();
+        it = p_index->insert(std::pair<segment_key, std::map<uint32_t,struct segment_entry>*>(key,p_versions)).first;
+    }
+    std::map<uint32_t,struct segment_entry>::iterator itv = it->second->find(version);
+    if (itv!=it->second->end())
+    {
+        drop_entry(&itv->second);
+        itv->second = *e;
+    }
+    else
+    {
+        it->second->insert(std::pair<uint32_t,struct segment_entry>(version,*e));
+    }
+}
+
+/**
+ * @brief accounts the record of e as dead, requires mutex
+ */
+void SegmentStore::drop_entry(struct segment_entry *e)
+{
+    std::map<uint32_t, struct segment_info>::iterator it = p_segments->find(e->segid);
+    if (it!=p_segments->end())
+    {
+        it->second.live -= size_recordhead+e->length;
+    }
+}
+
+/**
+ * @brief appends a version of a stripe unit.
+ * @param[out] fh duplicated descriptor of the segment, the caller may
+ * fsync and close it like the file of the one-file-per-version layout.
+ */
+int SegmentStore::append(InodeNumber inum, StripeId sid, uint32_t version, void *data, size_t length, int *fh)
+{
+    int rc=-1;
+    struct segment_record_head head;
+    memset(&head, 0, size_recordhead);
+    head.magic = SEGMENT_RECORD_MAGIC;
+    head.version = version;
+    head.inum = inum;
+    head.sid = sid;
+    head.length = length;
+    head.crc = record_crc(&head, data, length);
+
+    size_t total = size_recordhead+length;
+    uint32_t segid;
+    size_t offset;
+    int fd;
+    reserve(total, &segid, &offset, &fd);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &head;
+    iov[0].iov_len = size_recordhead;
+    iov[1].iov_base = data;
+    iov[1].iov_len = length;
+    pthread_rwlock_rdlock(&seglock);
+    ssize_t count = pwritev(fd, &iov[0], 2, offset);
+    if (count==(ssize_t)total && fh!=NULL)
+    {
+        *fh = dup(fd);
+    }
+    pthread_rwlock_unlock(&seglock);
+
+    struct segment_entry e;
+    e.segid = segid;
+    e.offset = offset+size_recordhead;
+    e.length = length;
+    pthread_mutex_lock(&mutex);
+    if (count==(ssize_t)total)
+    {
+        index_insert(segment_key(inum,sid), version, &e);
+        rc=0;
+    }
+    else
+    {
+        log->error_log("error writing segment %u. count=%d",segid,count);
+        drop_entry(&e);
+    }
+    pthread_mutex_unlock(&mutex);
+    log->debug_log("inum:%llu,sid:%u,version:%u at %u:%llu, rc:%d",inum,sid,version,segid,offset,rc);
+    return rc;
+}
+
+/**
+ * @param[out] data malloc'ed payload, freed by the caller
+ * @return 0 on success, -1 if the version does not exist, -2 on io error
+ */
+int SegmentStore::read(InodeNumber inum, StripeId sid, uint32_t version, void **data, size_t *length)
+{
+    int rc=-1;
+    struct segment_entry e;
+    int fd=-1;
+    pthread_rwlock_rdlock(&seglock);
+    pthread_mutex_lock(&mutex);
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->find(segment_key(inum,sid));
+    if (it!=p_index->end())
+    {
+        std::map<uint32_t,struct segment_entry>::iterator itv = it->second->find(version);
+        if (itv!=it->second->end())
+        {
+            e = itv->second;
+            fd = p_segments->find(e.segid)->second.fd;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    if (fd!=-1)
+    {
+        *data = malloc(e.length);
+        if (*data!=NULL && pread(fd, *data, e.length, e.offset)==(ssize_t)e.length)
+        {
+            *length = e.length;
+            rc=0;
+        }
+        else
+        {
+            free(*data);
+            *data = NULL;
+            rc=-2;
+        }
+    }
+    pthread_rwlock_unlock(&seglock);
+    return rc;
+}
+
+/**
+ * @brief reads the first length bytes of an object into buf
+ */
+int SegmentStore::read_head(InodeNumber inum, StripeId sid, uint32_t version, void *buf, size_t length)
+{
+    int rc=-1;
+    struct segment_entry e;
+    int fd=-1;
+    pthread_rwlock_rdlock(&seglock);
+    pthread_mutex_lock(&mutex);
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->find(segment_key(inum,sid));
+    if (it!=p_index->end())
+    {
+        std::map<uint32_t,struct segment_entry>::iterator itv = it->second->find(version);
+        if (itv!=it->second->end())
+        {
+            e = itv->second;
+            fd = p_segments->find(e.segid)->second.fd;
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    if (fd!=-1)
+    {
+        rc = (length<=e.length && pread(fd, buf, length, e.offset)==(ssize_t)length) ? 0 : -2;
+    }
+    pthread_rwlock_unlock(&seglock);
+    return rc;
+}
+
+/**
+ * @param[out] version 0 if no version exists
+ */
+int SegmentStore::get_max_version(InodeNumber inum, StripeId sid, uint32_t *version)
+{
+    *version=0;
+    pthread_mutex_lock(&mutex);
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->find(segment_key(inum,sid));
+    if (it!=p_index->end() && !it->second->empty())
+    {
+        *version = it->second->rbegin()->first;
+    }
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/**
+ * @brief appends the key of every stripe unit with a live version
+ */
+int SegmentStore::list(std::vector<segment_key> *p_out)
+{
+    pthread_mutex_lock(&mutex);
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->begin();
+    for (it; it!=p_index->end(); it++)
+    {
+        if (!it->second->empty())
+        {
+            p_out->push_back(it->first);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/**
+ * @param[out] version UINT_MAX if no version exists
+ */
+int SegmentStore::get_min_version(InodeNumber inum, StripeId sid, uint32_t *version)
+{
+    *version=UINT_MAX;
+    pthread_mutex_lock(&mutex);
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->find(segment_key(inum,sid));
+    if (it!=p_index->end() && !it->second->empty())
+    {
+        *version = it->second->begin()->first;
+    }
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/**
+ * @brief drops all versions older than version from the index, the space
+ * is reclaimed by compact()
+ */
+int SegmentStore::remove_lower_than(InodeNumber inum, StripeId sid, uint32_t version)
+{
+    int cnt=0;
+    pthread_mutex_lock(&mutex);
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator it = p_index->find(segment_key(inum,sid));
+    if (it!=p_index->end())
+    {
+        std::map<uint32_t,struct segment_entry>::iterator itv = it->second->begin();
+        while (itv!=it->second->end() && itv->first<version)
+        {
+            drop_entry(&itv->second);
+            it->second->erase(itv++);
+            cnt++;
+        }
+        if (it->second->empty())
+        {
+            delete it->second;
+            p_index->erase(it);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+    log->debug_log("inum:%llu,sid:%u,removed %d versions lower than %u",inum,sid,cnt,version);
+    return 0;
+}
+
+/**
+ * @brief compacts all sealed segments whose live share dropped below
+ * SEGMENT_COMPACT_LIVE_PCT. Called by the garbage collector.
+ */
+int SegmentStore::compact()
+{
+    int rc=0;
+    std::vector<uint32_t> candidates;
+    pthread_mutex_lock(&mutex);
+    std::map<uint32_t, struct segment_info>::iterator it = p_segments->begin();
+    for (it; it!=p_segments->end(); it++)
+    {
+        if (it->first!=activeseg && (it->second.live==0 || it->second.live*100 < it->second.size*SEGMENT_COMPACT_LIVE_PCT))
+        {
+            candidates.push_back(it->first);
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    std::vector<uint32_t>::iterator itc = candidates.begin();
+    for (itc; itc!=candidates.end(); itc++)
+    {
+        if (compact_segment(*itc))
+        {
+            rc=-1;
+        }
+    }
+    return rc;
+}
+
+/**
+ * @brief copies the live records of a sealed segment to the active one
+ * and removes the segment once nothing points into it anymore.
+ */
+int SegmentStore::compact_segment(uint32_t segid)
+{
+    int fd;
+    size_t size;
+    pthread_mutex_lock(&mutex);
+    std::map<uint32_t, struct segment_info>::iterator it = p_segments->find(segid);
+    fd = it->second.fd;
+    size = it->second.size;
+    pthread_mutex_unlock(&mutex);
+    log->debug_log("compacting segment %u, size:%llu",segid,size);
+
+    std::set<int> written;
+    struct segment_record_head head;
+    size_t offset=0;
+    int moved=0;
+    while (next_record(fd, size, &offset, &head)==0)
+    {
+        segment_key key(head.inum,head.sid);
+        size_t payload = offset+size_recordhead;
+        bool live=false;
+        pthread_mutex_lock(&mutex);
+        std::map<segment_key, std::map<uint32_t,struct segment_entry>*>::iterator iti = p_index->find(key);
+        if (iti!=p_index->end())
+        {
+            std::map<uint32_t,struct segment_entry>::iterator itv = iti->second->find(head.version);
+            live = (itv!=iti->second->end() && itv->second.segid==segid && itv->second.offset==payload);
+        }
+        pthread_mutex_unlock(&mutex);
+
+        if (live)
+        {
+            size_t total = size_recordhead+head.length;
+            void *buffer = malloc(total);
+            if (buffer==NULL || pread(fd, buffer, total, offset)!=(ssize_t)total)
+            {
+                free(buffer);
+                return -1;
+            }
+            uint32_t newseg;
+            size_t newoffset;
+            int newfd;
+            reserve(total, &newseg, &newoffset, &newfd);
+            pthread_rwlock_rdlock(&seglock);
+            ssize_t count = pwrite(newfd, buffer, total, newoffset);
+            pthread_rwlock_unlock(&seglock);
+            free(buffer);
+
+            struct segment_entry e;
+            e.segid = newseg;
+            e.offset = newoffset+size_recordhead;
+            e.length = head.length;
+            pthread_mutex_lock(&mutex);
+            // the version may have been collected while it was copied
+            iti = p_index->find(key);
+            std::map<uint32_t,struct segment_entry>::iterator itv;
+            if (count==(ssize_t)total && iti!=p_index->end() &&
+               (itv=iti->second->find(head.version))!=iti->second->end() &&
+               itv->second.segid==segid && itv->second.offset==payload)
+            {
+                drop_entry(&itv->second);
+                itv->second = e;
+                moved++;
+            }
+            else
+            {
+                drop_entry(&e);
+            }
+            pthread_mutex_unlock(&mutex);
+            written.insert(newfd);
+        }
+        offset += size_recordhead+head.length;
+    }
+
+    std::set<int>::iterator itw = written.begin();
+    for (itw; itw!=written.end(); itw++)
+    {
+        fdatasync(*itw);
+    }
+
+    int rc=-1;
+    pthread_rwlock_wrlock(&seglock);
+    pthread_mutex_lock(&mutex);
+    it = p_segments->find(segid);
+    if (it->second.live==0)
+    {
+        close(it->second.fd);
+        unlink(getPath(segid).c_str());
+        p_segments->erase(it);
+        rc=0;
+    }
+    pthread_mutex_unlock(&mutex);
+    pthread_rwlock_unlock(&seglock);
+    log->debug_log("segment %u: moved %d records, removed:%d",segid,moved,rc==0);
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <sstream>
+#include <fcntl.h>
+#include <string.h>
+
+#include "components/diskio/AsyncIO.h"
+
+
+namespace
+{
+
+static void count_done(struct aio_request *p_req)
+{
+    int *p_cnt = (int *) p_req->arg;
+    if (p_req->res==(int)p_req->length) __sync_fetch_and_add(p_cnt, 1);
+}
+
+static int return_seven(struct aio_request *p_req)
+{
+    return 7;
+}
+
+class AsyncIOTest : public ::testing::Test
+{
+public:
+    Logger *log;
+
+    AsyncIOTest()
+    {
+        log = new Logger();
+        string s = string("/tmp/AsyncIOTest.log");
+	log->set_log_location(s);
+        log->set_console_output(false);
+    }
+    ~AsyncIOTest()
+    {
+        delete log;
+    }
+
+    int open_tmp(const char *name)
+    {
+        std::string path = std::string("/tmp/AsyncIOTest/")+name;
+        return open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    }
+
+    void roundtrip(AsyncIO *p_aio)
+    {
+        int fd = open_tmp("roundtrip");
+        ASSERT_GE(fd, 0);
+        size_t len = 100000;
+        struct aio_request req;
+        p_aio->init_request(&req, aio_write);
+        req.fd = fd;
+        req.length = len;
+        req.buf = p_aio->get_buffer(len, &req.bufindex);
+        ASSERT_TRUE(req.buf!=NULL);
+        memset(req.buf, 0x5a, len);
+        ASSERT_EQ(p_aio->execute(&req), len);
+        p_aio->put_buffer(req.bufindex);
+
+        // unregistered buffer at an offset
+        char tail[16];
+        memset(tail, 0x11, sizeof(tail));
+        p_aio->init_request(&req, aio_write);
+        req.fd = fd;
+        req.buf = tail;
+        req.length = sizeof(tail);
+        req.offset = len;
+        ASSERT_EQ(p_aio->execute(&req), sizeof(tail));
+
+        p_aio->init_request(&req, aio_fsync);
+        req.fd = fd;
+        ASSERT_EQ(p_aio->execute(&req), 0);
+
+        p_aio->init_request(&req, aio_read);
+        req.fd = fd;
+        req.length = len+sizeof(tail);
+        req.buf = p_aio->get_buffer(req.length, &req.bufindex);
+        ASSERT_EQ(p_aio->execute(&req), len+sizeof(tail));
+        char *p = (char*) req.buf;
+        ASSERT_EQ(p[0], 0x5a);
+        ASSERT_EQ(p[len-1], 0x5a);
+        ASSERT_EQ(p[len], 0x11);
+        p_aio->put_buffer(req.bufindex);
+
+        p_aio->init_request(&req, aio_call);
+        req.fn = &return_seven;
+        ASSERT_EQ(p_aio->execute(&req), 7);
+        close(fd);
+    }
+
+protected:
+    void SetUp()
+    {
+        system("rm -rf /tmp/AsyncIOTest && mkdir /tmp/AsyncIOTest");
+    }
+
+    void TearDown()
+    {
+    }
+};
+
+
+TEST_F(AsyncIOTest, inline_before_start)
+{
+    AsyncIO *p_aio = new AsyncIO(log, 0, 0, true);
+    int fd = open_tmp("inline");
+    char buf[8] = "abcdefg";
+    int cnt=0;
+    struct aio_request req;
+    p_aio->init_request(&req, aio_write);
+    req.fd = fd;
+    req.buf = buf;
+    req.length = sizeof(buf);
+    req.cb = &count_done;
+    req.arg = &cnt;
+    ASSERT_EQ(p_aio->submit(&req), 0);
+    ASSERT_EQ(cnt, 1);
+    close(fd);
+    delete p_aio;
+}
+
+TEST_F(AsyncIOTest, roundtrip_threads)
+{
+    AsyncIO *p_aio = new AsyncIO(log, 0, 2, false);
+    ASSERT_EQ(p_aio->start(), 0);
+    ASSERT_FALSE(p_aio->uses_uring());
+    roundtrip(p_aio);
+    delete p_aio;
+}
+
+TEST_F(AsyncIOTest, roundtrip_uring)
+{
+    AsyncIO *p_aio = new AsyncIO(log, 0, 2, true);
+    ASSERT_EQ(p_aio->start(), 0);
+    if (!p_aio->uses_uring())
+    {
+        printf("io_uring not available, thread pool used.\n");
+    }
+    roundtrip(p_aio);
+    delete p_aio;
+}
+
+TEST_F(AsyncIOTest, many_async_writes)
+{
+    // more requests than ring entries
+    AsyncIO *p_aio = new AsyncIO(log, 16, 2, true);
+    ASSERT_EQ(p_aio->start(), 0);
+    int fd = open_tmp("many");
+    const int n = 1000;
+    struct aio_request *reqs = new struct aio_request[n];
+    uint32_t *values = new uint32_t[n];
+    int cnt=0;
+    for (int i=0; i<n; i++)
+    {
+        values[i] = i;
+        p_aio->init_request(&reqs[i], aio_write);
+        reqs[i].fd = fd;
+        reqs[i].buf = &values[i];
+        reqs[i].length = sizeof(uint32_t);
+        reqs[i].offset = i*sizeof(uint32_t);
+        reqs[i].cb = &count_done;
+        reqs[i].arg = &cnt;
+        ASSERT_EQ(p_aio->submit(&reqs[i]), 0);
+    }
+    while (cnt<n) usleep(100);
+    uint32_t v;
+    for (int i=0; i<n; i+=97)
+    {
+        ASSERT_EQ(pread(fd, &v, sizeof(v), i*sizeof(uint32_t)), sizeof(v));
+        ASSERT_EQ(v, i);
+    }
+    close(fd);
+    delete p_aio;
+    delete[] reqs;
+    delete[] values;
+}
+
+}//namespace
@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <sstream>
+#include <fcntl.h>
+
+#include "components/diskio/GroupCommit.h"
+
+
+namespace
+{
+
+struct writer_data
+{
+    GroupCommit *p_gc;
+    int id;
+    int iterations;
+    int failed;
+};
+
+static int open_tmp(int id, int i)
+{
+    std::stringstream ss("");
+    ss << "/tmp/GroupCommitTest/" << id << "_" << i;
+    int fd = open(ss.str().c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    write(fd, "data", 4);
+    return fd;
+}
+
+static void* writer(void *p)
+{
+    struct writer_data *d = (struct writer_data *) p;
+    for (int i=0; i<d->iterations; i++)
+    {
+        int fd = open_tmp(d->id, i);
+        if (d->p_gc->commit(&fd, 1)) d->failed++;
+    }
+    return NULL;
+}
+
+static void async_done(void *arg, int rc)
+{
+    int *p_cnt = (int *) arg;
+    if (rc==0) __sync_fetch_and_add(p_cnt, 1);
+}
+
+class GroupCommitTest : public ::testing::Test
+{
+public:
+    Logger *log;
+
+    GroupCommitTest()
+    {
+        log = new Logger();
+        string s = string("/tmp/GroupCommitTest.log");
+	log->set_log_location(s);
+        log->set_console_output(false);
+    }
+    ~GroupCommitTest()
+    {
+        delete log;
+    }
+
+protected:
+    void SetUp()
+    {
+        system("rm -rf /tmp/GroupCommitTest && mkdir /tmp/GroupCommitTest");
+    }
+
+    void TearDown()
+    {
+    }
+};
+
+
+TEST_F(GroupCommitTest, nosync_closes)
+{
+    GroupCommit *p_gc = new GroupCommit(log, false, 8, 100);
+    ASSERT_EQ(p_gc->start(), 0);
+    int fd = open_tmp(0, 0);
+    ASSERT_EQ(p_gc->commit(&fd, 1), 0);
+    ASSERT_EQ(fcntl(fd, F_GETFD), -1);
+    int cnt=0;
+    fd = open_tmp(0, 1);
+    ASSERT_EQ(p_gc->commit_async(&fd, 1, &async_done, &cnt), 0);
+    ASSERT_EQ(cnt, 1);
+    ASSERT_EQ(p_gc->batches, 0);
+    delete p_gc;
+}
+
+TEST_F(GroupCommitTest, concurrent_writers_share_batches)
+{
+    GroupCommit *p_gc = new GroupCommit(log, true, 64, 2000);
+    ASSERT_EQ(p_gc->start(), 0);
+    const int threads = 8;
+    pthread_t tid[threads];
+    struct writer_data d[threads];
+    for (int i=0; i<threads; i++)
+    {
+        d[i].p_gc = p_gc;
+        d[i].id = i;
+        d[i].iterations = 20;
+        d[i].failed = 0;
+        pthread_create(&tid[i], NULL, writer, &d[i]);
+    }
+    for (int i=0; i<threads; i++)
+    {
+        pthread_join(tid[i], NULL);
+        ASSERT_EQ(d[i].failed, 0);
+    }
+    ASSERT_EQ(p_gc->requests, threads*20);
+    ASSERT_LT(p_gc->batches, p_gc->requests);
+    delete p_gc;
+}
+
+TEST_F(GroupCommitTest, async_and_same_file)
+{
+    GroupCommit *p_gc = new GroupCommit(log, true, 4, 100000);
+    ASSERT_EQ(p_gc->start(), 0);
+    int fd = open_tmp(1, 0);
+    int fds[4];
+    for (int i=0; i<4; i++)
+    {
+        fds[i] = dup(fd);
+    }
+    close(fd);
+    int cnt=0;
+    ASSERT_EQ(p_gc->commit_async(&fds[0], 2, &async_done, &cnt), 0);
+    // the batch is full with the second request
+    ASSERT_EQ(p_gc->commit(&fds[2], 2), 0);
+    while (cnt==0) usleep(100);
+    ASSERT_EQ(cnt, 1);
+    // all handles refer to the same file
+    ASSERT_EQ(p_gc->syncs, 1);
+    delete p_gc;
+}
+
+}//namespace
@@ -0,0 +1,233 @@
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include "components/diskio/RebuildEngine.h"
+
+#define TEST_SU_SIZE    4096
+#define TEST_GROUPSIZE  4       // three data units and the parity
+#define TEST_INUM       7
+#define TEST_STRIPES    5
+
+
+namespace
+{
+
+class RebuildEngineTest : public ::testing::Test
+{
+public:
+    Logger *log;
+    std::string dir;
+    filelayout_raid fl;
+    Libraid4 *p_raid;
+
+    RebuildEngineTest()
+    {
+        log = new Logger();
+        string s = string("/tmp/RebuildEngineTest.log");
+	log->set_log_location(s);
+        log->set_console_output(false);
+        dir = std::string("/tmp/RebuildEngineTest");
+        memset(&fl, 0, sizeof(fl));
+        fl.raid4.type = raid4;
+        fl.raid4.groupsize = TEST_GROUPSIZE;
+        fl.raid4.servercount = TEST_GROUPSIZE;
+        fl.raid4.stripeunitsize = TEST_SU_SIZE;
+        for (int i=0; i<TEST_GROUPSIZE; i++)
+        {
+            fl.raid4.serverids[i] = i;
+        }
+        p_raid = new Libraid4(log);
+    }
+    ~RebuildEngineTest()
+    {
+        delete p_raid;
+        delete log;
+    }
+
+protected:
+    void SetUp()
+    {
+        std::string cmd = std::string("rm -rf ")+dir;
+        system(cmd.c_str());
+    }
+
+    void TearDown()
+    {
+    }
+
+    static char unit_byte(StripeId sid, int unit, size_t i)
+    {
+        return (char)(sid*31+unit*7+i*13);
+    }
+
+    /* writes every unit and the parity of the stripes to their servers */
+    void populate(Filestorage **stores)
+    {
+        for (StripeId sid=0; sid<TEST_STRIPES; sid++)
+        {
+            struct StripeSpan span;
+            ASSERT_EQ(p_raid->get_stripe_span(&fl, sid*get_stripe_size(&fl), &span), 0);
+            struct data_object obj;
+            memset(&obj.metadata, 0, sizeof(obj.metadata));
+            memcpy(&obj.metadata.filelayout[0], &fl, sizeof(fl));
+            obj.metadata.datalength = TEST_SU_SIZE;
+            for (int u=0; u<span.unitcnt; u++)
+            {
+                obj.metadata.versionvector[u] = u+1;
+            }
+            char *parity = (char*) calloc(1, TEST_SU_SIZE);
+            for (int u=0; u<span.unitcnt; u++)
+            {
+                char *data = (char*) malloc(TEST_SU_SIZE);
+                for (size_t i=0; i<TEST_SU_SIZE; i++)
+                {
+                    data[i] = unit_byte(sid, u, i);
+                    parity[i] ^= data[i];
+                }
+                obj.data = data;
+                obj.metadata.offset = span.units[u].start;
+                ASSERT_EQ(stores[span.units[u].assignedto]->write_stripe_object(TEST_INUM, sid, u+1, &obj), 0);
+                free(data);
+            }
+            obj.data = parity;
+            obj.metadata.offset = span.units[0].start;
+            ASSERT_EQ(stores[span.parityserver_id]->write_stripe_object(TEST_INUM, sid, 1, &obj), 0);
+            free(parity);
+        }
+    }
+
+    void wipe(serverid_t id)
+    {
+        std::ostringstream cmd;
+        cmd << "rm -rf " << dir << "/serverid_" << id << "/" << TEST_INUM;
+        system(cmd.str().c_str());
+    }
+};
+
+
+TEST_F(RebuildEngineTest, rebuild_data_server)
+{
+    Filestorage *stores[TEST_GROUPSIZE];
+    for (int i=0; i<TEST_GROUPSIZE; i++)
+    {
+        stores[i] = new Filestorage(log, dir.c_str(), i, false);
+    }
+    populate(stores);
+    wipe(1);
+
+    RebuildEngine *p_engine = new RebuildEngine(log, dir, 1, stores[1], layout_files, 0);
+    p_engine->set_batch(2);
+    ASSERT_EQ(p_engine->run(), 0);
+    struct rebuild_stats stats;
+    p_engine->get_stats(&stats);
+    ASSERT_EQ(stats.total, TEST_STRIPES);
+    ASSERT_EQ(stats.rebuilt, TEST_STRIPES);
+    ASSERT_EQ(stats.failed, 0);
+    ASSERT_TRUE(stats.done);
+
+    for (StripeId sid=0; sid<TEST_STRIPES; sid++)
+    {
+        struct StripeSpan span;
+        p_raid->get_stripe_span(&fl, sid*get_stripe_size(&fl), &span);
+        int unit = -1;
+        for (int u=0; u<span.unitcnt; u++)
+        {
+            if (span.units[u].assignedto==1) unit = u;
+        }
+        ASSERT_NE(unit, -1);
+        struct data_object *p_do;
+        ASSERT_EQ(stores[1]->read_stripe_object(TEST_INUM, sid, &p_do), 0);
+        uint32_t version;
+        stores[1]->get_max_version(TEST_INUM, sid, &version);
+        ASSERT_EQ(version, unit+1);
+        ASSERT_EQ(p_do->metadata.datalength, TEST_SU_SIZE);
+        for (size_t i=0; i<TEST_SU_SIZE; i++)
+        {
+            ASSERT_EQ(((char*)p_do->data)[i], unit_byte(sid, unit, i));
+        }
+        free(p_do->data);
+        delete p_do;
+    }
+    // a second pass finds every unit present
+    ASSERT_EQ(p_engine->run(), 0);
+    p_engine->get_stats(&stats);
+    ASSERT_EQ(stats.skipped, TEST_STRIPES);
+    delete p_engine;
+    for (int i=0; i<TEST_GROUPSIZE; i++)
+    {
+        delete stores[i];
+    }
+}
+
+TEST_F(RebuildEngineTest, rebuild_parity_server)
+{
+    Filestorage *stores[TEST_GROUPSIZE];
+    for (int i=0; i<TEST_GROUPSIZE; i++)
+    {
+        stores[i] = new Filestorage(log, dir.c_str(), i, false);
+    }
+    populate(stores);
+    struct StripeSpan span;
+    p_raid->get_stripe_span(&fl, 0, &span);
+    serverid_t parity = span.parityserver_id;
+    wipe(parity);
+
+    RebuildEngine *p_engine = new RebuildEngine(log, dir, parity, stores[parity], layout_files, 0);
+    ASSERT_EQ(p_engine->run(), 0);
+    struct data_object *p_do;
+    ASSERT_EQ(stores[parity]->read_stripe_object(TEST_INUM, 0, &p_do), 0);
+    for (size_t i=0; i<TEST_SU_SIZE; i++)
+    {
+        char expected = 0;
+        for (int u=0; u<span.unitcnt; u++) expected ^= unit_byte(0, u, i);
+        ASSERT_EQ(((char*)p_do->data)[i], expected);
+    }
+    for (int u=0; u<span.unitcnt; u++)
+    {
+        ASSERT_EQ(p_do->metadata.versionvector[u], u+1);
+    }
+    free(p_do->data);
+    delete p_do;
+    delete p_engine;
+    for (int i=0; i<TEST_GROUPSIZE; i++)
+    {
+        delete stores[i];
+    }
+}
+
+TEST_F(RebuildEngineTest, resume_from_checkpoint)
+{
+    Filestorage *stores[TEST_GROUPSIZE];
+    for (int i=0; i<TEST_GROUPSIZE; i++)
+    {
+        stores[i] = new Filestorage(log, dir.c_str(), i, false);
+    }
+    populate(stores);
+    wipe(0);
+    // pretend an earlier run finished the first two stripes
+    std::ostringstream cp;
+    cp << "echo '" << TEST_INUM << " 1' > " << stores[0]->get_basedir() << "/" << REBUILD_CHECKPOINT_FILE;
+    system(cp.str().c_str());
+
+    RebuildEngine *p_engine = new RebuildEngine(log, dir, 0, stores[0], layout_files, 0);
+    ASSERT_EQ(p_engine->run(), 0);
+    struct rebuild_stats stats;
+    p_engine->get_stats(&stats);
+    ASSERT_EQ(stats.scanned, TEST_STRIPES);
+    ASSERT_EQ(stats.rebuilt, TEST_STRIPES-2);
+    uint32_t version;
+    stores[0]->get_max_version(TEST_INUM, 0, &version);
+    ASSERT_EQ(version, 0);
+    stores[0]->get_max_version(TEST_INUM, 2, &version);
+    ASSERT_EQ(version, 1);
+    // removed once the pass completed
+    ASSERT_NE(access((stores[0]->get_basedir()+"/"+REBUILD_CHECKPOINT_FILE).c_str(), F_OK), 0);
+    delete p_engine;
+    for (int i=0; i<TEST_GROUPSIZE; i++)
+    {
+        delete stores[i];
+    }
+}
+
+}
@@ -0,0 +1,271 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <sstream>
+#include <fstream>
+
+#include "components/diskio/SegmentStore.h"
+
+
+namespace
+{
+
+class SegmentStoreTest : public ::testing::Test
+{
+public:
+    Logger *log;
+    std::string dir;
+    size_t segsize;
+    size_t unitsize;
+
+    SegmentStoreTest()
+    {
+        log = new Logger();
+        string s = string("/tmp/SegmentStoreTest.log");
+	log->set_log_location(s);
+        log->set_console_output(false);
+        dir = std::string("/tmp/SegmentStoreTest");
+        unitsize = 4096;
+        // room for four records per segment
+        segsize = 4*(unitsize+sizeof(struct segment_record_head));
+    }
+    ~SegmentStoreTest()
+    {
+        delete log;
+    }
+
+protected:
+    void SetUp()
+    {
+        std::string cmd = std::string("rm -rf ")+dir;
+        system(cmd.c_str());
+    }
+
+    void TearDown()
+    {
+    }
+    
+    int count_segments()
+    {
+        int cnt=0;
+        DIR *dp = opendir(dir.c_str());
+        struct dirent *dirp;
+        while ((dirp = readdir(dp)) != NULL)
+        {
+            if (strncmp(dirp->d_name,"seg_",4)==0) cnt++;
+        }
+        closedir(dp);
+        return cnt;
+    }
+};
+
+static void *unit_data(size_t len, uint32_t version)
+{
+    void *p = malloc(len);
+    memset(p, version&0xff, len);
+    return p;
+}
+
+static bool check_unit(SegmentStore *p_store, InodeNumber inum, StripeId sid, uint32_t version, size_t len)
+{
+    void *data;
+    size_t length;
+    if (p_store->read(inum, sid, version, &data, &length)!=0) return false;
+    void *ref = unit_data(len, version);
+    bool res = (length==len && memcmp(data, ref, len)==0);
+    free(ref);
+    free(data);
+    return res;
+}
+
+
+TEST_F(SegmentStoreTest, append_read)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    uint32_t version;
+    ASSERT_EQ(p_store->get_max_version(3, 1, &version), 0);
+    ASSERT_EQ(version, 0);
+    for (uint32_t v=1; v<=3; v++)
+    {
+        void *p = unit_data(unitsize, v);
+        int fh=-1;
+        ASSERT_EQ(p_store->append(3, 1, v, p, unitsize, &fh), 0);
+        ASSERT_NE(fh, -1);
+        ASSERT_EQ(fsync(fh), 0);
+        close(fh);
+        free(p);
+    }
+    ASSERT_EQ(p_store->get_max_version(3, 1, &version), 0);
+    ASSERT_EQ(version, 3);
+    ASSERT_EQ(p_store->get_min_version(3, 1, &version), 0);
+    ASSERT_EQ(version, 1);
+    ASSERT_TRUE(check_unit(p_store, 3, 1, 2, unitsize));
+    ASSERT_EQ(p_store->read(3, 2, 1, NULL, NULL), -1);
+    delete p_store;
+}
+
+TEST_F(SegmentStoreTest, read_head)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    void *p = unit_data(unitsize, 5);
+    int fh=-1;
+    ASSERT_EQ(p_store->append(4, 2, 5, p, unitsize, &fh), 0);
+    close(fh);
+    char head[64];
+    ASSERT_EQ(p_store->read_head(4, 2, 5, head, sizeof(head)), 0);
+    ASSERT_EQ(memcmp(head, p, sizeof(head)), 0);
+    // longer than the object or a missing version
+    char *big = (char*) malloc(unitsize+1);
+    ASSERT_NE(p_store->read_head(4, 2, 5, big, unitsize+1), 0);
+    ASSERT_EQ(p_store->read_head(4, 2, 6, head, sizeof(head)), -1);
+    free(big);
+    free(p);
+    delete p_store;
+}
+
+TEST_F(SegmentStoreTest, remove_and_compact)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    // three segments worth of versions of two stripes
+    for (uint32_t v=1; v<=6; v++)
+    {
+        for (StripeId sid=0; sid<2; sid++)
+        {
+            void *p = unit_data(unitsize, v);
+            ASSERT_EQ(p_store->append(3, sid, v, p, unitsize, NULL), 0);
+            free(p);
+        }
+    }
+    ASSERT_EQ(count_segments(), 3);
+    p_store->remove_lower_than(3, 0, 6);
+    p_store->remove_lower_than(3, 1, 6);
+    uint32_t version;
+    p_store->get_min_version(3, 0, &version);
+    ASSERT_EQ(version, 6);
+    ASSERT_EQ(p_store->compact(), 0);
+    // the sealed segments held dead versions only
+    ASSERT_EQ(count_segments(), 1);
+    ASSERT_TRUE(check_unit(p_store, 3, 0, 6, unitsize));
+    ASSERT_TRUE(check_unit(p_store, 3, 1, 6, unitsize));
+    delete p_store;
+}
+
+TEST_F(SegmentStoreTest, compact_moves_live_records)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    for (StripeId sid=0; sid<4; sid++)
+    {
+        void *p = unit_data(unitsize, 1);
+        ASSERT_EQ(p_store->append(3, sid, 1, p, unitsize, NULL), 0);
+        free(p);
+    }
+    for (StripeId sid=0; sid<3; sid++)
+    {
+        void *p = unit_data(unitsize, 2);
+        ASSERT_EQ(p_store->append(3, sid, 2, p, unitsize, NULL), 0);
+        free(p);
+        p_store->remove_lower_than(3, sid, 2);
+    }
+    // segment 0 keeps a single live record of stripe 3
+    ASSERT_EQ(p_store->compact(), 0);
+    ASSERT_EQ(count_segments(), 1);
+    ASSERT_TRUE(check_unit(p_store, 3, 3, 1, unitsize));
+    ASSERT_TRUE(check_unit(p_store, 3, 0, 2, unitsize));
+    delete p_store;
+}
+
+TEST_F(SegmentStoreTest, recover)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    for (uint32_t v=1; v<=5; v++)
+    {
+        void *p = unit_data(unitsize, v);
+        ASSERT_EQ(p_store->append(7, 2, v, p, unitsize, NULL), 0);
+        free(p);
+    }
+    delete p_store;
+    
+    // torn record at the end of the last segment
+    std::string path = dir+"/seg_1";
+    int fd = open(path.c_str(), O_WRONLY|O_APPEND);
+    struct segment_record_head head;
+    head.magic = SEGMENT_RECORD_MAGIC;
+    head.length = unitsize;
+    ASSERT_EQ(write(fd, &head, sizeof(head)), sizeof(head));
+    close(fd);
+    
+    p_store = new SegmentStore(log, dir, segsize);
+    uint32_t version;
+    p_store->get_max_version(7, 2, &version);
+    ASSERT_EQ(version, 5);
+    ASSERT_TRUE(check_unit(p_store, 7, 2, 1, unitsize));
+    ASSERT_TRUE(check_unit(p_store, 7, 2, 5, unitsize));
+    void *p = unit_data(unitsize, 6);
+    ASSERT_EQ(p_store->append(7, 2, 6, p, unitsize, NULL), 0);
+    free(p);
+    ASSERT_TRUE(check_unit(p_store, 7, 2, 6, unitsize));
+    delete p_store;
+}
+
+TEST_F(SegmentStoreTest, recover_skips_hole)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    for (uint32_t v=1; v<=3; v++)
+    {
+        void *p = unit_data(unitsize, v);
+        ASSERT_EQ(p_store->append(7, 2, v, p, unitsize, NULL), 0);
+        free(p);
+    }
+    delete p_store;
+
+    // the second append never reached the disk, the third one did
+    size_t record = sizeof(struct segment_record_head)+unitsize;
+    void *zero = calloc(1, record);
+    std::string path = dir+"/seg_0";
+    int fd = open(path.c_str(), O_WRONLY);
+    ASSERT_EQ(pwrite(fd, zero, record, record), (ssize_t)record);
+    close(fd);
+    free(zero);
+
+    p_store = new SegmentStore(log, dir, segsize);
+    uint32_t version;
+    p_store->get_max_version(7, 2, &version);
+    ASSERT_EQ(version, 3);
+    ASSERT_TRUE(check_unit(p_store, 7, 2, 1, unitsize));
+    ASSERT_FALSE(check_unit(p_store, 7, 2, 2, unitsize));
+    ASSERT_TRUE(check_unit(p_store, 7, 2, 3, unitsize));
+    delete p_store;
+}
+
+TEST_F(SegmentStoreTest, recover_torn_payload)
+{
+    SegmentStore *p_store = new SegmentStore(log, dir, segsize);
+    for (uint32_t v=1; v<=2; v++)
+    {
+        void *p = unit_data(unitsize, v);
+        ASSERT_EQ(p_store->append(7, 2, v, p, unitsize, NULL), 0);
+        free(p);
+    }
+    delete p_store;
+
+    // the head of the last record is intact, its payload is not
+    size_t record = sizeof(struct segment_record_head)+unitsize;
+    std::string path = dir+"/seg_0";
+    int fd = open(path.c_str(), O_WRONLY);
+    char garbage[16];
+    memset(garbage, 0xee, sizeof(garbage));
+    ASSERT_EQ(pwrite(fd, garbage, sizeof(garbage), 2*record-sizeof(garbage)), (ssize_t)sizeof(garbage));
+    close(fd);
+
+    p_store = new SegmentStore(log, dir, segsize);
+    uint32_t version;
+    p_store->get_max_version(7, 2, &version);
+    ASSERT_EQ(version, 1);
+    ASSERT_TRUE(check_unit(p_store, 7, 2, 1, unitsize));
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    ASSERT_EQ((size_t)st.st_size, record);
+    delete p_store;
+}
+
+}//namespace
@@ -6,6 +6,9 @@
  */
 
 #include <map>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "components/network/ServerManager.h"
 
@@ -235,4 +238,31 @@ bool ServerManager::exists(serverid_t id)
     }
     log->debug_log("exists id:%u = %s",id,(rc)?"true":"false");
     return rc;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief true if the server runs on this host: a loopback address or the
+ * address of one of the local interfaces
+ */
+bool ServerManager::is_local(serverid_t id)
+{
+    ipaddress_t dest;
+    uint16_t port;
+    if (get_server_address(&id, &dest, &port)) return false;
+    struct in_addr addr;
+    if (inet_pton(AF_INET, dest, &addr)!=1) return strcmp(dest,"localhost")==0;
+    if ((ntohl(addr.s_addr)>>24)==127) return true;
+    bool rc=false;
+    struct ifaddrs *p_ifs;
+    if (getifaddrs(&p_ifs)) return false;
+    for (struct ifaddrs *p_if=p_ifs; p_if!=NULL && !rc; p_if=p_if->ifa_next)
+    {
+        if (p_if->ifa_addr!=NULL && p_if->ifa_addr->sa_family==AF_INET)
+        {
+            rc = ((struct sockaddr_in*)p_if->ifa_addr)->sin_addr.s_addr==addr.s_addr;
+        }
+    }
+    freeifaddrs(p_ifs);
+    log->debug_log("id:%u, local:%d",id,rc);
+    return rc;
+}
@@ -0,0 +1,328 @@
+/*
+ * File:   ShmRing.cpp
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "components/network/ShmRing.h"
+
+#define SHM_RING_CTL_SIZE       4096    // the ring starts on its own page
+#define SHM_RING_POLL_MS        1000    // waits on the peer socket
+
+ShmRing::ShmRing(Logger *p_log)
+{
+    log = p_log;
+    p_ctl = NULL;
+    ring = NULL;
+    mapsize = 0;
+    size = 0;
+    memfd = -1;
+    data_fd = -1;
+    space_fd = -1;
+    sock_fd = -1;
+}
+
+ShmRing::~ShmRing()
+{
+    cleanup();
+}
+
+void ShmRing::cleanup()
+{
+    if (p_ctl!=NULL) munmap(p_ctl, mapsize);
+    p_ctl = NULL;
+    ring = NULL;
+    if (memfd>=0) close(memfd);
+    if (data_fd>=0) close(data_fd);
+    if (space_fd>=0) close(space_fd);
+    if (sock_fd>=0) close(sock_fd);
+    memfd = data_fd = space_fd = sock_fd = -1;
+}
+
+std::string ShmRing::socket_path(uint16_t port)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "%s%u", SHM_RING_SOCKET_PREFIX, port);
+    return std::string(path);
+}
+
+/**
+ * @brief creates the region and the doorbells of a new ring
+ */
+int ShmRing::create(size_t ringsize)
+{
+    size = ringsize;
+    mapsize = SHM_RING_CTL_SIZE+size;
+    memfd = memfd_create("netraid_shm", MFD_CLOEXEC);
+    if (memfd<0 || ftruncate(memfd, mapsize))
+    {
+        log->error_log("shared memory of %llu bytes not created:%s",mapsize,strerror(errno));
+        cleanup();
+        return -1;
+    }
+    data_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    space_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    void *p = mmap(NULL, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (data_fd<0 || space_fd<0 || p==MAP_FAILED)
+    {
+        log->error_log("ring not created:%s",strerror(errno));
+        cleanup();
+        return -1;
+    }
+    p_ctl = (struct shm_ring_ctl*) p;
+    ring = (char*) p + SHM_RING_CTL_SIZE;
+    p_ctl->head = 0;
+    p_ctl->tail = 0;
+    p_ctl->size = size;
+    p_ctl->writer_waiting = 0;
+    return 0;
+}
+
+/**
+ * @brief maps the ring created by the peer, takes ownership of the fds
+ */
+int ShmRing::attach(int fds[SHM_RING_FDS])
+{
+    memfd = fds[0];
+    data_fd = fds[1];
+    space_fd = fds[2];
+    struct stat st;
+    if (fstat(memfd, &st) || st.st_size<=SHM_RING_CTL_SIZE)
+    {
+        log->error_log("invalid ring region");
+        cleanup();
+        return -1;
+    }
+    mapsize = st.st_size;
+    void *p = mmap(NULL, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p==MAP_FAILED)
+    {
+        log->error_log("ring not mapped:%s",strerror(errno));
+        cleanup();
+        return -1;
+    }
+    p_ctl = (struct shm_ring_ctl*) p;
+    ring = (char*) p + SHM_RING_CTL_SIZE;
+    size = mapsize-SHM_RING_CTL_SIZE;
+    if (p_ctl->size!=size)
+    {
+        log->error_log("ring size mismatch");
+        cleanup();
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief creates a ring and passes it to the server listening next to the
+ * given tcp port. Fails if the server does not offer shared memory.
+ */
+int ShmRing::connect(uint16_t port)
+{
+    if (create(SHM_RING_DEFAULT_SIZE)) return -1;
+    std::string path = socket_path(port);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path)-1);
+    sock_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (sock_fd<0 || ::connect(sock_fd, (struct sockaddr*)&addr, sizeof(addr)))
+    {
+        log->debug_log("no shared memory server at %s",path.c_str());
+        cleanup();
+        return -1;
+    }
+    int fds[SHM_RING_FDS] = {memfd, data_fd, space_fd};
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    memset(cbuf, 0, sizeof(cbuf));
+    char byte = 0;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr *p_cmsg = CMSG_FIRSTHDR(&msg);
+    p_cmsg->cmsg_level = SOL_SOCKET;
+    p_cmsg->cmsg_type = SCM_RIGHTS;
+    p_cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(p_cmsg), fds, sizeof(fds));
+    if (sendmsg(sock_fd, &msg, MSG_NOSIGNAL)!=1)
+    {
+        log->warning_log("ring not passed:%s",strerror(errno));
+        cleanup();
+        return -1;
+    }
+    log->debug_log("connected to %s",path.c_str());
+    return 0;
+}
+
+/**
+ * @brief receives a ring over a connected unix socket, the socket is kept
+ * to notice when the peer is gone. Does not block, the caller waits until
+ * the socket is readable.
+ */
+int ShmRing::accept(int sockfd)
+{
+    int fds[SHM_RING_FDS];
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    char byte;
+    struct iovec iov;
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    ssize_t n = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC|MSG_DONTWAIT);
+    struct cmsghdr *p_cmsg = CMSG_FIRSTHDR(&msg);
+    if (n!=1 || p_cmsg==NULL || p_cmsg->cmsg_type!=SCM_RIGHTS || p_cmsg->cmsg_len!=CMSG_LEN(sizeof(fds)))
+    {
+        log->warning_log("no ring received");
+        close(sockfd);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(p_cmsg), sizeof(fds));
+    sock_fd = sockfd;
+    return attach(fds);
+}
+
+/**
+ * @brief waits until the reader freed space
+ * @return 0, or -1 if the peer is gone
+ */
+int ShmRing::wait_space()
+{
+    p_ctl->writer_waiting = 1;
+    __sync_synchronize();
+    while (p_ctl->head-p_ctl->tail==size)
+    {
+        struct pollfd pfd[2];
+        pfd[0].fd = space_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = sock_fd;
+        pfd[1].events = POLLIN;
+        int rc = poll(pfd, 2, SHM_RING_POLL_MS);
+        if (rc>0 && (pfd[1].revents & (POLLIN|POLLHUP|POLLERR)))
+        {
+            // the peer never sends on the socket, readable means closed
+            log->warning_log("peer closed the ring");
+            p_ctl->writer_waiting = 0;
+            return -1;
+        }
+        if (rc>0)
+        {
+            eventfd_t v;
+            eventfd_read(space_fd, &v);
+        }
+    }
+    p_ctl->writer_waiting = 0;
+    return 0;
+}
+
+/**
+ * @brief appends the buffers to the ring, waits for space if it is full.
+ * Only one thread may write at a time.
+ * @return 0, or -1 if the peer is gone or the ring is broken
+ */
+int ShmRing::write(const std::vector<boost::asio::const_buffer>& bufs)
+{
+    std::vector<boost::asio::const_buffer>::const_iterator it = bufs.begin();
+    for (it; it!=bufs.end(); it++)
+    {
+        const char *src = (const char*) boost::asio::buffer_cast<const void*>(*it);
+        size_t length = boost::asio::buffer_size(*it);
+        while (length>0)
+        {
+            uint64_t head = p_ctl->head;
+            uint64_t used = head-p_ctl->tail;
+            if (used>size)
+            {
+                log->error_log("broken ring, head:%llu, tail:%llu",head,p_ctl->tail);
+                return -1;
+            }
+            uint64_t space = size-used;
+            if (space==0)
+            {
+                eventfd_write(data_fd, 1);
+                if (wait_space()) return -1;
+                continue;
+            }
+            size_t n = std::min((uint64_t)length, space);
+            size_t pos = head%size;
+            size_t first = std::min((uint64_t)n, size-pos);
+            memcpy(ring+pos, src, first);
+            memcpy(ring, src+first, n-first);
+            __sync_synchronize();
+            p_ctl->head = head+n;
+            src += n;
+            length -= n;
+        }
+    }
+    eventfd_write(data_fd, 1);
+    return 0;
+}
+
+/**
+ * @return the bytes to read, -1 if the ring is broken
+ */
+ssize_t ShmRing::available()
+{
+    uint64_t avail = p_ctl->head-p_ctl->tail;
+    __sync_synchronize();
+    if (avail>size)
+    {
+        log->error_log("broken ring, head:%llu, tail:%llu",p_ctl->head,p_ctl->tail);
+        return -1;
+    }
+    return avail;
+}
+
+/**
+ * @brief copies up to length bytes out of the ring, does not block
+ * @return the bytes copied, -1 if the ring is broken
+ */
+ssize_t ShmRing::read_some(void *buf, size_t length)
+{
+    uint64_t tail = p_ctl->tail;
+    ssize_t avail = available();
+    if (avail<0) return -1;
+    size_t n = std::min((uint64_t)length, (uint64_t)avail);
+    if (n==0) return 0;
+    size_t pos = tail%size;
+    size_t first = std::min((uint64_t)n, size-pos);
+    memcpy(buf, ring+pos, first);
+    memcpy((char*)buf+first, ring, n-first);
+    __sync_synchronize();
+    p_ctl->tail = tail+n;
+    __sync_synchronize();
+    if (p_ctl->writer_waiting)
+    {
+        eventfd_write(space_fd, 1);
+    }
+    return n;
+}
+
+int ShmRing::get_data_fd()
+{
+    return data_fd;
+}
+
+int ShmRing::get_sock_fd()
+{
+    return sock_fd;
+}
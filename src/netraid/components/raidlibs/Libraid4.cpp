@@ -132,23 +132,91 @@ StripeUnitId Libraid4::get_my_stripeunitid(filelayout_raid *fl, size_t offset, s
     }
     else
     {
-        struct Stripe_layout *p_slay = get_stripe(fl, offset);
-        std::map<StripeUnitId,struct StripeUnit*>::iterator it = p_slay->blockmap->begin();
-        for (it; it!=p_slay->blockmap->end();it++)
+        StripeId sid = get_stripe_id(fl,offset);
+        for (StripeUnitId i=0; i<(StripeUnitId)(fl->raid4.groupsize-1); i++)
         {
-            if (it->second->assignedto==myid)
+            if (get_server_id(fl,sid,i)==myid)
             {
-                suid=it->first;
+                suid=i;
                 log->debug_log("Successful.");
                 break;
             }
         }
-        free_StripeLayout(p_slay);
     }
     log->debug_log("ret:%d",suid);
     return suid; 
 }
 
+/**
+ * @brief fills p_span with the units of the stripe containing start that
+ * are touched by [start,end).
+ * @return 0 on success, -1 if the group does not fit into a StripeSpan
+ */
+int Libraid4::fill_span(filelayout_raid *fl, size_t start, size_t end, struct StripeSpan *p_span)
+{
+    size_t stripestart = get_stripe_start(fl,start);
+    size_t stripeend = stripestart+get_stripe_size(fl);
+    if (end>stripeend) end = stripeend;
+    if (fl->raid4.groupsize-1 > default_groupsize+1)
+    {
+        log->error_log("groupsize %u exceeds span capacity.",fl->raid4.groupsize);
+        return -1;
+    }
+    p_span->sid = get_stripe_id(fl,start);
+    p_span->parityserver_id = get_coordinator(fl,start);
+    p_span->isfull = (start==stripestart && end==stripeend);
+    p_span->unitcnt = 0;
+    size_t i = start;
+    while (i<end)
+    {
+        struct StripeUnitSpan *unit = &p_span->units[p_span->unitcnt++];
+        unit->id = (i-stripestart)/fl->raid4.stripeunitsize;
+        unit->start = i;
+        unit->end = stripestart+(unit->id+1)*fl->raid4.stripeunitsize;
+        if (unit->end>end) unit->end = end;
+        unit->assignedto = get_server_id(fl,p_span->sid,unit->id);
+        i = unit->end;
+    }
+    return 0;
+}
+
+/**
+ * @brief walks the stripes of an operation without allocating. Initialise
+ * the cursor with stripe_cursor_init and call until false is returned.
+ * @param[in,out] c cursor, advanced to the next stripe
+ * @param[out] p_span units of the current stripe touched by the operation
+ * @return true if p_span holds a stripe
+ */
+bool Libraid4::next_stripe(filelayout_raid *fl, struct StripeCursor *c, struct StripeSpan *p_span)
+{
+    if (c->pos>=c->end)
+    {
+        return false;
+    }
+    if (fill_span(fl, c->pos, c->end, p_span))
+    {
+        return false;
+    }
+    c->pos = p_span->units[p_span->unitcnt-1].end;
+    return true;
+}
+
+/**
+ * @brief allocation free counterpart of get_stripe(fl,offset), all units of
+ * the stripe containing offset.
+ */
+int Libraid4::get_stripe_span(filelayout_raid *fl, size_t offset, struct StripeSpan *p_span)
+{
+    size_t stripestart = get_stripe_start(fl,offset);
+    return fill_span(fl, stripestart, stripestart+get_stripe_size(fl), p_span);
+}
+
+uint32_t Libraid4::get_stripe_count(filelayout_raid *fl, size_t offset, size_t length)
+{
+    if (!length) return 0;
+    return get_stripe_id(fl,offset+length-1)-get_stripe_id(fl,offset)+1;
+}
+
 struct Stripe_layout* Libraid4::get_stripe(filelayout_raid *fl, size_t offset)
 {
     log->debug_log("offset:%llu",offset);
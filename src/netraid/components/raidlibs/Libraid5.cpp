@@ -72,8 +72,7 @@ int Libraid5::create_initial_filelayout(InodeNumber inum, filelayout *p_fl)
 uint8_t Libraid5::is_coordinator(struct filelayout_raid5 *fl, size_t offset, serverid_t myid)
 {
     log->debug_log("myid:%llu.",myid);
-    struct Stripe_layout *slay = get_stripe(fl,offset);
-    if (slay->parityserver_id==myid)
+    if (get_parity_id(fl,get_stripe_id(fl,offset))==myid)
     {
         log->debug_log("is parity server.");
         return 2;
@@ -114,21 +113,81 @@ StripeId Libraid5::getStripeId(struct filelayout_raid5 *fl, size_t offset)
 StripeUnitId Libraid5::get_my_stripeunitid(struct filelayout_raid5 *fl, size_t offset, serverid_t myid)
 {
     StripeUnitId suid=0;
-    struct Stripe_layout *p_slay = get_stripe(fl, offset);
-    std::map<StripeUnitId,struct StripeUnit*>::iterator it = p_slay->blockmap->begin();
-    for (it; it!=p_slay->blockmap->end();it++)
+    struct StripeSpan span;
+    if (!get_stripe_span(fl, offset, &span))
     {
-        if (it->second->assignedto==myid)
+        for (int i=0; i<span.unitcnt; i++)
         {
-            suid=it->first;
-            log->debug_log("Successful.");
-            break;
+            if (span.units[i].assignedto==myid)
+            {
+                suid=span.units[i].id;
+                log->debug_log("Successful.");
+                break;
+            }
         }
     }
     log->debug_log("ret:%u",suid);
     return suid; 
 }
 
+/**
+ * @brief fills p_span with the units of the stripe containing start that
+ * are touched by [start,end).
+ * @return 0 on success, -1 if the group does not fit into a StripeSpan
+ */
+int Libraid5::fill_span(filelayout_raid5 *fl, size_t start, size_t end, struct StripeSpan *p_span)
+{
+    size_t stripestart = get_stripe_start(fl,start);
+    size_t stripeend = stripestart+get_stripe_size(fl);
+    if (end>stripeend) end = stripeend;
+    if (fl->groupsize-1 > default_groupsize+1)
+    {
+        log->error_log("groupsize %u exceeds span capacity.",fl->groupsize);
+        return -1;
+    }
+    p_span->sid = get_stripe_id(fl,start);
+    p_span->parityserver_id = get_parity_id(fl,p_span->sid);
+    p_span->isfull = (start==stripestart && end==stripeend);
+    p_span->unitcnt = 0;
+    size_t i = start;
+    while (i<end)
+    {
+        struct StripeUnitSpan *unit = &p_span->units[p_span->unitcnt++];
+        size_t idx = (i-stripestart)/fl->stripeunitsize;
+        unit->id = get_stripeunit_id(fl,i);
+        unit->start = i;
+        unit->end = stripestart+(idx+1)*fl->stripeunitsize;
+        if (unit->end>end) unit->end = end;
+        unit->assignedto = get_server_id(fl,p_span->sid,unit->id);
+        i = unit->end;
+    }
+    return 0;
+}
+
+/**
+ * @brief walks the stripes of an operation without allocating, see
+ * Libraid4::next_stripe
+ */
+bool Libraid5::next_stripe(filelayout_raid5 *fl, struct StripeCursor *c, struct StripeSpan *p_span)
+{
+    if (c->pos>=c->end)
+    {
+        return false;
+    }
+    if (fill_span(fl, c->pos, c->end, p_span))
+    {
+        return false;
+    }
+    c->pos = p_span->units[p_span->unitcnt-1].end;
+    return true;
+}
+
+int Libraid5::get_stripe_span(filelayout_raid5 *fl, size_t offset, struct StripeSpan *p_span)
+{
+    size_t stripestart = get_stripe_start(fl,offset);
+    return fill_span(fl, stripestart, stripestart+get_stripe_size(fl), p_span);
+}
+
 struct Stripe_layout* Libraid5::get_stripe(filelayout_raid5 *fl, size_t offset)
 {
     log->debug_log("offset:%llu",offset);
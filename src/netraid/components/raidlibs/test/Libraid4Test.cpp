@@ -313,4 +313,44 @@ TEST_F(Libraid4Test, get_secondary_coordinator_1)
     ASSERT_EQ(p_raid->get_secondary_coord(p_r5,1120000), 0); //1nd group starts
 }
 
+TEST_F(Libraid4Test, stripe_span)
+{
+    filelayout fl;    
+    int rc = p_raid->create_initial_filelayout(inum,&fl);
+    ASSERT_EQ(rc ,0);
+    filelayout_raid *p_r4 = (filelayout_raid *) &fl;
+    struct StripeSpan span;
+    
+    rc = p_raid->get_stripe_span(p_r4, 75000, &span);
+    ASSERT_EQ(rc ,0);
+    ASSERT_EQ(span.sid, 1);
+    ASSERT_TRUE(span.isfull);
+    ASSERT_EQ(span.unitcnt, 7);
+    ASSERT_EQ(span.parityserver_id, 7);
+    ASSERT_EQ(span.units[0].start, 70000);
+    ASSERT_EQ(span.units[6].end, 140000);
+    ASSERT_EQ(span.units[3].assignedto, 3);
+    
+    struct StripeCursor cursor;
+    stripe_cursor_init(&cursor, 65000, 80000);
+    ASSERT_EQ(p_raid->get_stripe_count(p_r4, 65000, 80000), 3);
+    ASSERT_TRUE(p_raid->next_stripe(p_r4, &cursor, &span));
+    ASSERT_EQ(span.sid, 0);
+    ASSERT_FALSE(span.isfull);
+    ASSERT_EQ(span.unitcnt, 1);
+    ASSERT_EQ(span.units[0].id, 6);
+    ASSERT_EQ(span.units[0].start, 65000);
+    ASSERT_EQ(span.units[0].end, 70000);
+    ASSERT_TRUE(p_raid->next_stripe(p_r4, &cursor, &span));
+    ASSERT_EQ(span.sid, 1);
+    ASSERT_TRUE(span.isfull);
+    ASSERT_TRUE(p_raid->next_stripe(p_r4, &cursor, &span));
+    ASSERT_EQ(span.sid, 2);
+    ASSERT_FALSE(span.isfull);
+    ASSERT_EQ(span.unitcnt, 1);
+    ASSERT_EQ(span.units[0].start, 140000);
+    ASSERT_EQ(span.units[0].end, 145000);
+    ASSERT_FALSE(p_raid->next_stripe(p_r4, &cursor, &span));
+}
+
 }//namespace
@@ -0,0 +1,257 @@
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "components/scheduler/TaskScheduler.h"
+
+using namespace std;
+
+static inline uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static inline int hist_bucket(uint64_t us)
+{
+    int b=0;
+    while (us>0 && b<SCHED_HIST_BUCKETS-1)
+    {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+TaskScheduler::TaskScheduler(Logger *p_log, int classes)
+{
+    log = p_log;
+    classcnt = (classes>SCHED_MAX_CLASSES) ? SCHED_MAX_CLASSES : classes;
+    policy = sched_strict;
+    affinity = false;
+    running = true;
+    workers = 0;
+    idle = 0;
+    queued = 0;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&cond, NULL);
+    queues = new std::deque<struct sched_item>[classcnt];
+    memset(stats, 0, sizeof(stats));
+    for (int i=0; i<SCHED_MAX_CLASSES; i++)
+    {
+        weights[i] = 1;
+        credits[i] = 1;
+    }
+}
+
+TaskScheduler::TaskScheduler(const TaskScheduler& orig)
+{
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    stop();
+    delete[] queues;
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * @brief weights are given from the highest priority class on, missing
+ * entries default to 1. A weight of 0 is raised to 1 so no class starves.
+ */
+void TaskScheduler::set_policy(enum sched_policy p, const std::vector<uint32_t>& w)
+{
+    pthread_mutex_lock(&mutex);
+    policy = p;
+    for (int i=0; i<classcnt; i++)
+    {
+        weights[i] = (i<(int)w.size() && w[i]>0) ? w[i] : 1;
+        credits[i] = weights[i];
+    }
+    pthread_mutex_unlock(&mutex);
+    log->debug_log("policy:%s, classes:%d",(p==sched_strict) ? "strict" : "weighted",classcnt);
+}
+
+void TaskScheduler::set_affinity(bool enable)
+{
+    affinity = enable;
+}
+
+int TaskScheduler::push(int cls, void *p)
+{
+    if (cls<0 || cls>=classcnt)
+    {
+        return -2;
+    }
+    struct sched_item item;
+    item.p = p;
+    item.enqueued = now_us();
+    pthread_mutex_lock(&mutex);
+    queues[cls].push_back(item);
+    queued++;
+    stats[cls].pushed++;
+    if (idle>0)
+    {
+        pthread_cond_signal(&cond);
+    }
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+/**
+ * @brief takes the next task according to the policy, mutex must be held.
+ * In weighted mode a class without credits is skipped until no class with
+ * work has credits left, then all credits are refilled.
+ */
+void* TaskScheduler::dequeue()
+{
+    int cls = -1;
+    for (int i=0; i<classcnt; i++)
+    {
+        if (!queues[i].empty() && (policy==sched_strict || credits[i]>0))
+        {
+            cls = i;
+            break;
+        }
+    }
+    if (cls<0)
+    {
+        for (int i=0; i<classcnt; i++)
+        {
+            credits[i] = weights[i];
+            if (cls<0 && !queues[i].empty())
+            {
+                cls = i;
+            }
+        }
+        if (cls<0) return NULL;
+    }
+    if (policy==sched_weighted)
+    {
+        credits[cls]--;
+    }
+    struct sched_item item = queues[cls].front();
+    queues[cls].pop_front();
+    queued--;
+    uint64_t wait = now_us()-item.enqueued;
+    stats[cls].popped++;
+    stats[cls].hist[hist_bucket(wait)]++;
+    if (wait>stats[cls].maxwait) stats[cls].maxwait = wait;
+    return item.p;
+}
+
+/**
+ * @brief blocks until a task is queued, returns NULL once stopped.
+ */
+void* TaskScheduler::pop()
+{
+    void *p = NULL;
+    pthread_mutex_lock(&mutex);
+    while (running && queued==0)
+    {
+        idle++;
+        pthread_cond_wait(&cond, &mutex);
+        idle--;
+    }
+    if (running)
+    {
+        p = dequeue();
+    }
+    pthread_mutex_unlock(&mutex);
+    return p;
+}
+
+void* TaskScheduler::try_pop()
+{
+    pthread_mutex_lock(&mutex);
+    void *p = dequeue();
+    pthread_mutex_unlock(&mutex);
+    return p;
+}
+
+void TaskScheduler::stop()
+{
+    pthread_mutex_lock(&mutex);
+    running = false;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief called once by every worker thread, pins the n-th worker to
+ * core n modulo the online cores if affinity is enabled.
+ * @return worker index
+ */
+int TaskScheduler::register_worker()
+{
+    int index = __sync_fetch_and_add(&workers, 1);
+    if (affinity)
+    {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cores>0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(index%cores, &set);
+            int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (rc)
+            {
+                log->warning_log("worker %d not pinned:rc=%d",index,rc);
+            }
+        }
+    }
+    return index;
+}
+
+size_t TaskScheduler::size()
+{
+    pthread_mutex_lock(&mutex);
+    size_t n = queued;
+    pthread_mutex_unlock(&mutex);
+    return n;
+}
+
+void TaskScheduler::get_stats(int cls, struct sched_class_stats *p_stats)
+{
+    memset(p_stats, 0, sizeof(struct sched_class_stats));
+    if (cls<0 || cls>=classcnt) return;
+    pthread_mutex_lock(&mutex);
+    *p_stats = stats[cls];
+    pthread_mutex_unlock(&mutex);
+}
+
+/**
+ * @brief upper bound of the histogram bucket holding the given percentile
+ * of the queue wait times in microseconds.
+ */
+uint64_t TaskScheduler::percentile(int cls, double pct)
+{
+    struct sched_class_stats s;
+    get_stats(cls, &s);
+    if (s.popped==0) return 0;
+    uint64_t target = (uint64_t)(s.popped*pct/100.0);
+    uint64_t sum = 0;
+    for (int b=0; b<SCHED_HIST_BUCKETS; b++)
+    {
+        sum += s.hist[b];
+        if (sum>target || sum==s.popped)
+        {
+            return (b==0) ? 0 : ((uint64_t)1<<b)-1;
+        }
+    }
+    return s.maxwait;
+}
+
+void TaskScheduler::report()
+{
+    for (int i=0; i<classcnt; i++)
+    {
+        struct sched_class_stats s;
+        get_stats(i, &s);
+        if (s.pushed==0) continue;
+        log->debug_log("class %d: pushed:%llu, popped:%llu, wait p50:%lluus, p99:%lluus, max:%lluus",
+                i, s.pushed, s.popped, percentile(i,50), percentile(i,99), s.maxwait);
+    }
+}
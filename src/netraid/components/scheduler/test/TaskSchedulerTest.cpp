@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "components/scheduler/TaskScheduler.h"
+
+
+namespace
+{
+
+static void* pop_one(void *obj)
+{
+    TaskScheduler *p_sched = (TaskScheduler *) obj;
+    return p_sched->pop();
+}
+
+class TaskSchedulerTest : public ::testing::Test
+{
+public:
+    Logger *log;
+    int items[64];
+
+    TaskSchedulerTest()
+    {
+        log = new Logger();
+        string s = string("/tmp/TaskSchedulerTest.log");
+	log->set_log_location(s);
+        log->set_console_output(false);
+    }
+    ~TaskSchedulerTest()
+    {
+        delete log;
+    }
+};
+
+
+TEST_F(TaskSchedulerTest, strict_priority)
+{
+    TaskScheduler *p_sched = new TaskScheduler(log, 3);
+    ASSERT_EQ(p_sched->push(2, &items[0]), 0);
+    ASSERT_EQ(p_sched->push(1, &items[1]), 0);
+    ASSERT_EQ(p_sched->push(0, &items[2]), 0);
+    ASSERT_EQ(p_sched->push(0, &items[3]), 0);
+    ASSERT_EQ(p_sched->push(3, &items[4]), -2);
+    ASSERT_EQ(p_sched->size(), 4);
+    ASSERT_EQ(p_sched->pop(), &items[2]);
+    ASSERT_EQ(p_sched->pop(), &items[3]);
+    ASSERT_EQ(p_sched->pop(), &items[1]);
+    ASSERT_EQ(p_sched->pop(), &items[0]);
+    ASSERT_TRUE(p_sched->try_pop()==NULL);
+    delete p_sched;
+}
+
+TEST_F(TaskSchedulerTest, weighted_round)
+{
+    TaskScheduler *p_sched = new TaskScheduler(log, 2);
+    std::vector<uint32_t> weights;
+    weights.push_back(3);
+    weights.push_back(1);
+    p_sched->set_policy(sched_weighted, weights);
+    for (int i=0; i<8; i++)
+    {
+        p_sched->push(0, &items[i]);
+        p_sched->push(1, &items[32+i]);
+    }
+    // three of class 0, then one of class 1 per round
+    int low=0;
+    for (int i=0; i<8; i++)
+    {
+        if (p_sched->pop()>=(void*)&items[32]) low++;
+    }
+    ASSERT_EQ(low, 2);
+    delete p_sched;
+}
+
+TEST_F(TaskSchedulerTest, wakeup_and_stop)
+{
+    TaskScheduler *p_sched = new TaskScheduler(log, 4);
+    pthread_t thread;
+    void *res;
+    pthread_create(&thread, NULL, &pop_one, p_sched);
+    usleep(10000);
+    // any class wakes the parked worker
+    p_sched->push(3, &items[5]);
+    pthread_join(thread, &res);
+    ASSERT_EQ(res, &items[5]);
+
+    pthread_create(&thread, NULL, &pop_one, p_sched);
+    usleep(10000);
+    p_sched->stop();
+    pthread_join(thread, &res);
+    ASSERT_TRUE(res==NULL);
+    delete p_sched;
+}
+
+TEST_F(TaskSchedulerTest, wait_histogram)
+{
+    TaskScheduler *p_sched = new TaskScheduler(log, 2);
+    p_sched->set_affinity(true);
+    ASSERT_EQ(p_sched->register_worker(), 0);
+    p_sched->push(1, &items[0]);
+    usleep(20000);
+    p_sched->pop();
+    struct sched_class_stats stats;
+    p_sched->get_stats(1, &stats);
+    ASSERT_EQ(stats.pushed, 1);
+    ASSERT_EQ(stats.popped, 1);
+    ASSERT_GE(stats.maxwait, 20000);
+    ASSERT_GE(p_sched->percentile(1, 99), 16383);
+    ASSERT_EQ(p_sched->percentile(0, 99), 0);
+    p_sched->report();
+    delete p_sched;
+}
+
+}//namespace
@@ -0,0 +1,53 @@
+/*
+ * File:   ClusterHarness.h
+ *
+ * Starts a complete system on the local host for the benchmarker: N data
+ * servers and the metadata server as child processes. Every data server
+ * gets its own ports (derived from its id) and its own storage directory,
+ * the output of all processes goes to the harness directory. The config
+ * files in /etc/r2d2 are generated from the templates in ../conf and the
+ * previous ones are restored on stop. stop also runs at exit and on
+ * SIGINT, SIGTERM and SIGHUP, only one harness may run at a time.
+ */
+
+#ifndef CLUSTERHARNESS_H
+#define	CLUSTERHARNESS_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "logging/Logger.h"
+
+#define CLUSTER_HARNESS_CONF_DIR        "../conf"
+#define CLUSTER_HARNESS_START_TIMEOUT   30      // seconds a process may take to listen
+
+class ClusterHarness
+{
+public:
+    ClusterHarness(Logger *p_log, std::string dir, std::string dsbin, std::string mdsbin);
+    virtual ~ClusterHarness();
+
+    int start(uint32_t dataservers);
+    int stop();
+    uint32_t get_dataservers();
+
+private:
+    Logger *log;
+    std::string dir;
+    std::string dsbin;
+    std::string mdsbin;
+    std::vector<pid_t> ds_pids;
+    pid_t mds_pid;
+    std::vector<std::string> backups;   // restored from .bak by stop
+    std::vector<std::string> generated; // had no previous config, removed by stop
+
+    int write_config(std::string src, std::string target,
+        std::map<std::string,std::string>& values, std::vector<std::string>& append, std::string drop_prefix);
+    pid_t spawn(std::string bin, std::string arg, std::string out);
+    int wait_listen(pid_t pid, uint16_t port);
+};
+
+#endif	/* CLUSTERHARNESS_H */
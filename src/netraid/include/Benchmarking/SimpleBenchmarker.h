@@ -15,9 +15,11 @@
 #include "EmbeddedInode.h"
 #include "tools/sys_tools.h"
 #include "tools/parity.h"
+#include "tools/latency_histogram.h"
 #include "time.h"
 #include "logging/Logger.h"
 #include "components/raidlibs/Libraid4.h"
+#include "components/diskio/Filestorage.h"
 #include "components/network/sshwrapper.h"
 #include "client/Client.h"
 #include "components/configurationManager/ConfigurationManager.h"
@@ -26,12 +28,48 @@
 enum benchtype
 {
     stripe,
+    stripermw,
+    stripepipelined,
     stripeunit,
     stripeunitlocked,
     lockroundtrip,
     pingpongbench,
     readsubench,
     diskiobench,
+    mixed,
+};
+
+/* operations of the mixed workload */
+enum mixop
+{
+    mix_read,
+    mix_write,
+    mix_lockedwrite,
+    MIX_OPS,
+};
+
+struct mix_params
+{
+    uint32_t    readpct;        // reads, the rest are writes
+    uint32_t    lockpct;        // writes done under a byte range lock
+    uint32_t    conflictpct;    // operations on the stripe shared by all threads
+    size_t      opsize;         // 0 is one stripe
+    bool        random;         // random or sequential offsets
+    uint32_t    span;           // operations per thread region
+};
+
+struct conflict_params
+{
+    uint32_t    stripes;        // stripes shared by all threads
+    uint32_t    overlappct;     // writes to the shared stripes, the rest are private
+    uint32_t    partialpct;     // shared writes shifted by stripe units
+    double      zipf;           // skew over the shared stripes, 0 is uniform
+    uint32_t    retries;        // of an aborted write
+    bool        baseline;       // also run the workload under byte range locks
+    size_t      suSize;
+    uint32_t    units;          // data units per stripe
+    std::vector<double> *cdf;   // of the stripe ids
+    uint32_t    *partial;       // stripes that got a shifted write
 };
 
 struct resultdata 
@@ -61,6 +99,14 @@ struct thread_data {
     struct EInode       *einode;
     struct timertimes   starttime;
     std::map<uint32_t, struct resultdata*>  *results;
+    struct mix_params   *mix;
+    LatencyHistogram    *hist;  // MIX_OPS histograms in us
+    unsigned int        seed;
+    int                 errors;
+    struct conflict_params  *ccc;
+    uint64_t            commits;
+    uint64_t            aborts;
+    uint64_t            retries;
 };
 
 class SimpleBenchmarker
@@ -75,7 +121,11 @@ public:
     std::string mdsbin;
     std::string mdsip;
     bool sync;
+    bool rmwcompare;    // s also writes the stripes unit by unit
     size_t size;
+    struct mix_params mix;
+    struct conflict_params ccc;
+    uint32_t dataservers;   // started by the cluster harness, 0 if external
     
     Logger *log;
     SimpleBenchmarker(int iter, int threads, std::string logloc);
@@ -84,12 +134,16 @@ public:
     int fullbench();
     int eval_StripeUnit();
     int eval_Stripe();
+    int eval_Stripe_pipelined();
     int eval_Stripe_lockmode();
     int eval_lock_roundtrip();
     int eval_ReadSU();
     int eval_pingpong();
+    int eval_Mixed();
+    int eval_Conflict();
     int parity_calc();
     int device_diskio(int threads, size_t bytes, int iterations, std::string dir,bool sync);
+    int storage_layout(std::string dir);
     int tcpTest();
     void write_result(const char *path, std::stringstream& ss);
     void send_results();
@@ -109,7 +163,10 @@ private:
     int createRandomFile(InodeNumber *inum);
     struct thread_data* newThreadDataSU(struct EInode *einode, StripeUnitId sid);
     struct thread_data* newThreadDataS(struct EInode *einode, StripeId sid);
+    struct thread_data* newThreadDataMix(struct EInode *einode, int id, size_t opsize);
+    int run_Conflict(bool lockmode, unsigned int seed, std::stringstream& json, std::stringstream& csv);
     int perform(std::vector<struct thread_data*> *v, void* cb(void*));
+    double run_Stripe(enum benchtype bench);
     
     int analyse(std::vector<struct thread_data*> *vec, enum benchtype bench, int threads);
     int systeminfo();
@@ -32,6 +32,7 @@
 #include "components/network/AsynClient.h"
 #include "custom_protocols/storage/SPdata.h"
 #include "custom_protocols/storage/SPNetraid_client.h"
+#include "client/WriteBuffer.h"
 #include "logging/Logger.h"
 #include "components/configurationManager/ConfigurationManager.h"
 
@@ -52,17 +53,23 @@ class Client {
 
         int handle_write(       struct EInode *p_einode, size_t offset, size_t length, void *data);
         int handle_write_lock(  struct EInode *p_einode, size_t offset, size_t length, void *data);
+        int handle_write_async( struct EInode *p_einode, size_t offset, size_t length, void *data,
+                                spn_write_cb cb, void *arg, struct spn_write_handle **pp_handle);
+        int wait_write(         struct spn_write_handle *p_handle);
         int handle_read(        struct EInode *p_einode, size_t offset, size_t length, void **data);
+        int flush(              struct EInode *p_einode);
         int pingpong();
         Pnfsdummy_client *p_pnfs_cl;
         
 private:
         SPNetraid_client *p_spn_cl;
+        WriteBuffer *p_wbuf;        // NULL unless write.buffer is set
         ConfigurationManager *p_cm;
         
         ClientSessionId csid;
 
         ByterangeLockManager *p_brlman;
+        int flush_range(struct EInode *p_einode, size_t offset, size_t length);
         uint32_t ds_count;
         Logger *log;
         std::string mds_address;        
@@ -0,0 +1,87 @@
+/*
+ * File:   WriteBuffer.h
+ *
+ * Per file write-back buffer of the client. Adjacent small writes are
+ * collected until their stripe is complete and then written as one full
+ * stripe write. An incomplete stripe is written on flush, when a write
+ * does not continue it or after a timeout.
+ */
+
+#ifndef WRITEBUFFER_H
+#define	WRITEBUFFER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "global_types.h"
+#include "EmbeddedInode.h"
+#include "logging/Logger.h"
+#include "components/raidlibs/Libraid4.h"
+
+#define WBUF_DEFAULT_TIMEOUT    50      // ms an incomplete stripe is held
+
+/* writes a range of a file, the flush target of the buffer */
+typedef int (*wbuf_write_fn)(void *arg, ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data);
+
+/**
+ * @brief the bytes buffered for one file. They are one run of adjacent
+ * bytes inside a single stripe, data holds the whole stripe.
+ */
+struct wbuf_file {
+    struct EInode       einode;
+    ClientSessionId     csid;
+    size_t              stripestart;
+    size_t              stripesize;
+    size_t              start;
+    size_t              length;     // 0 if nothing is buffered
+    char                *data;
+    uint64_t            first_us;   // when the run was started
+    int                 error;      // of a timed out flush, returned once
+    pthread_mutex_t     mutex;      // held while the file is written
+};
+
+struct wbuf_stats {
+    uint64_t    writes;
+    uint64_t    coalesced;      // writes copied into a buffer
+    uint64_t    fullstripes;    // buffers written as full stripe
+    uint64_t    partial;        // incomplete buffers written
+    uint64_t    passthrough;    // whole stripes written without copy
+    uint64_t    timeouts;
+};
+
+class WriteBuffer
+{
+public:
+    WriteBuffer(Logger *p_log, wbuf_write_fn fn, void *arg, uint32_t timeout_ms=WBUF_DEFAULT_TIMEOUT);
+    virtual ~WriteBuffer();
+
+    int write(ClientSessionId csid, struct EInode *p_einode, size_t offset, size_t length, void *data);
+    int flush(InodeNumber inum);
+    int flush(InodeNumber inum, uint64_t start, uint64_t end);
+    int flush_all();
+    void get_stats(struct wbuf_stats *p_stats);
+    void timeout_run();
+
+private:
+    Logger *log;
+    wbuf_write_fn fn;
+    void *arg;
+    uint32_t timeout;           // ms
+    std::map<InodeNumber,struct wbuf_file*> files;
+    pthread_mutex_t mutex;      // files and stats
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool stopflag;
+    struct wbuf_stats stats;
+
+    struct wbuf_file* get_file(InodeNumber inum);
+    int flush_file(struct wbuf_file *p_f);
+    int take_error(struct wbuf_file *p_f);
+    void count(uint64_t *p_counter);
+};
+
+#endif	/* WRITEBUFFER_H */
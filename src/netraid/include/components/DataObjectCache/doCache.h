@@ -27,6 +27,12 @@
 
 static uint32_t sizeof_versionvec = sizeof(uint32_t)*(default_groupsize+1);
 
+#define DOCACHE_DEFAULT_SHARDS  16
+/* stripes read ahead once an inode is read sequentially */
+#define DOCACHE_DEFAULT_READAHEAD   4
+/* read_entry_async: the object is read from disk, the callback gets it */
+#define DOCACHE_PENDING     1
+
 struct stripe_cache_entry
 {
     std::map<StripeId,struct cache_entry*>      *map;
@@ -36,6 +42,8 @@ struct stripe_cache_entry
     //uint32_t           dirtycnter;
     bool                dirty;
     bool                busy;
+    StripeId            nextread;   // expected sid of a sequential read
+    StripeId            prefetched; // highest sid read ahead
 };
 
 struct cache_entry
@@ -48,34 +56,110 @@ struct cache_entry
     uint32_t *myvec_entry;
     pthread_mutex_t entry_mutex;
     bool dirty;
+    bool referenced;    // second chance for the clock
+    size_t bytes;       // accounted in the shard
+    bool partial;       // only the metadata was read, current is loaded on demand
+    uint32_t diskvec[default_groupsize+1];  // stored versions while partial
+};
+
+/* inodes are spread over the shards by hash, each has its own lock */
+struct cache_shard
+{
+    std::map<InodeNumber,struct stripe_cache_entry*> *map;
+    pthread_mutex_t     mutex;
+    size_t              bytes;
+    InodeNumber         hand;       // clock position
+    uint64_t            hits;
+    uint64_t            misses;
+    uint64_t            evictions;
+    uint64_t            readhits;
+    uint64_t            readmisses;
+    uint64_t            prefetches;
+};
+
+struct cache_stats
+{
+    uint64_t    hits;
+    uint64_t    misses;
+    uint64_t    evictions;
+    uint64_t    readhits;
+    uint64_t    readmisses;
+    uint64_t    prefetches;
+    size_t      bytes;
+    size_t      budget;
+    uint32_t    inodes;
+};
+
+/* object handed out by get_entry, read_entry or get_unconfirmed */
+struct object_pin
+{
+    uint32_t    count;
+    bool        retired;    // no longer cached, freed by the last release
+};
+
+class doCache;
+
+struct prefetch_job
+{
+    doCache             *p_cache;
+    InodeNumber         inum;
+    StripeId            sid;
+    uint64_t            evictions;  // shard evictions when issued
+    void                (*cb)(void *arg, int rc, struct data_object *p_do); // NULL for read ahead
+    void                *arg;
 };
 
 class doCache {
 public:
-    doCache(Logger *p_log, Filestorage *p_fileio, serverid_t servid);    
+    doCache(Logger *p_log, Filestorage *p_fileio, serverid_t servid, size_t budget=0, uint32_t shards=DOCACHE_DEFAULT_SHARDS);
     doCache(const doCache& orig);
     virtual ~doCache();
     int garbage_collection();
     
-    int get_next_version_vector(InodeNumber inum, StripeId sid, uint32_t *versionvec, uint8_t vindex);
+    int get_next_version_vector(InodeNumber inum, StripeId sid, uint32_t *versionvec, uint8_t vindex, bool readdata=true);
+    int get_stored_version(InodeNumber inum, StripeId sid, uint8_t vindex, uint32_t *version);
     int reset_version_vector(InodeNumber inum , StripeId sid, uint8_t vindex);
     int get_entry(InodeNumber inum, StripeId sid, struct data_object **p_out);
+    int read_entry(InodeNumber inum, StripeId sid, struct data_object **p_out);
+    int read_entry_async(InodeNumber inum, StripeId sid, struct data_object **p_out, void (*cb)(void *arg, int rc, struct data_object *p_do), void *arg);
+    void read_done(struct prefetch_job *p_job, int rc, struct data_object *p_do);
+    void set_readahead(uint32_t stripes);
+    void prefetch_done(struct prefetch_job *p_job, int rc, struct data_object *p_do);
     int get_unconfirmed(InodeNumber inum, StripeId sid, struct data_object **p_out);
+    void release(struct data_object *p_do);
     int set_entry(InodeNumber inum, StripeId sid, struct data_object *p_in);
     int parityUnconfirmed(InodeNumber inum, StripeId sid, struct data_object *p_in);
     int parityConfirm(InodeNumber inum, StripeId sid, uint64_t version);
-    
+    int evict(uint32_t shard);
+    void get_stats(struct cache_stats *p_stats);
     
 private:
     Logger *log;
     Filestorage *p_fileio;
-    pthread_mutex_t mutex;
     
-    std::map<InodeNumber,struct stripe_cache_entry*> *p_cache;
+    struct cache_shard *shards;
+    uint32_t shardcnt;
+    size_t budget;              // bytes, 0 is unbounded
+    uint32_t readahead;
     serverid_t id;
     Libraid4 *p_raid;
-    uint64_t initialize_cache_entry(std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid);
+    std::map<struct data_object*,struct object_pin> *pinned;
+    pthread_mutex_t pin_mutex;
+    void pin(struct data_object *p_do);
+    void drop_object(struct data_object *p_do);
+    uint64_t initialize_cache_entry(struct cache_shard *p_shard, std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid);
+    void initialize_version_entry(struct cache_shard *p_shard, std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid);
+    void load_partial(struct cache_shard *p_shard, InodeNumber inum, StripeId sid, struct cache_entry *p_entry);
+    uint32_t stored_version(struct cache_entry *p_entry, uint8_t vindex);
     struct stripe_cache_entry* create_stripe_cache_entry();
+    struct cache_entry* create_cache_entry(struct data_object *p_in);
+    uint32_t get_shard(InodeNumber inum);
+    std::map<InodeNumber,struct stripe_cache_entry*>::iterator lookup(struct cache_shard *p_shard, InodeNumber inum);
+    void account(struct cache_shard *p_shard, struct cache_entry *p_entry);
+    bool evict_entry(struct cache_shard *p_shard, InodeNumber inum, StripeId sid, struct cache_entry *p_entry);
+    int gc_shard(struct cache_shard *p_shard);
+    void insert_read_entry(struct cache_shard *p_shard, std::map<InodeNumber,struct stripe_cache_entry*>::iterator cacheit, StripeId sid, struct data_object *p_do);
+    void prefetch(InodeNumber inum, std::vector<StripeId> &sids);
 };
 
 #endif	/* DOCACHE_H */
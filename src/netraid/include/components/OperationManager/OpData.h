@@ -16,6 +16,7 @@
 #include "global_types.h"
 #include "EmbeddedInode.h"
 #include "custom_protocols/global_protocol_data.h"
+#include "tools/slab_pool.h"
 
 #define OPERATION_TIMEOUT_LEVEL_A  2
 
@@ -68,11 +69,13 @@ struct dataobject_collection {
     uint32_t            mycurrentversion;
     int            filehandle;
     bool                fhvalid;
+    SLAB_ALLOCATED
 };
 
 struct paritydata {
     size_t length;
     void *data;
+    SLAB_ALLOCATED
 };
 
 
@@ -84,6 +87,7 @@ struct datacollection_primco {
     uint32_t                                    versionvec[default_groupsize+1];
     int                                    filehandle;
     bool                                        fhvalid;
+    SLAB_ALLOCATED
 };
 
 enum optype {
@@ -126,6 +130,10 @@ enum tasktypes {
     regendpoint,
     maintenance_garbagecollection,
     dspingpong,
+    docommit_flushed,
+    docommit_written,
+    primco_written,
+    read_loaded,
 };
 
 enum opstatus {
@@ -174,12 +182,14 @@ struct Participants_bf {
 
 struct dstask_head {
     struct OPHead               ophead;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_smallwrite {
     struct dstask_head          dshead;
     serverid_t                  receiver;
     struct Participants_bf      participants;
+    SLAB_ALLOCATED
 };
 
 
@@ -190,21 +200,25 @@ struct dstask_spn_send_read {
     StripeUnitId                stripeunitid;
     size_t                      offset;
     size_t                      end;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_send_received {
     struct dstask_head          dshead;
     serverid_t                  receiver;
     struct Participants_bf      participants;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_send_prepare{
     struct dstask_head          dshead;
     serverid_t                  receiver;
+    SLAB_ALLOCATED
 };
 struct dstask_ccc_recv_prepare{
     struct dstask_head          dshead;
     serverid_t                  sender;
+    SLAB_ALLOCATED
 };
 
 struct dstask_spn_recv {
@@ -213,25 +227,30 @@ struct dstask_spn_recv {
     StripeId                    stripeid;
     size_t                      length;
     void                        *data;
+    SLAB_ALLOCATED
 };
 
 struct dstask_endpointreg       {
     struct dstask_head          dshead;
     char                        *ip;
+    SLAB_ALLOCATED
 };
 
 struct dstask_writetodisk {
     struct dstask_head          dshead;
     struct operation_primcoordinator *p_op;
+    SLAB_ALLOCATED
 };
 
 struct dstask_write_fileobject {
     struct dstask_head          dshead;
     struct datacollection_primco *data_col;
+    SLAB_ALLOCATED
 };
 
 struct dstask_proccess_result {
     struct dstask_head          dshead;
+    SLAB_ALLOCATED
 };
 
 struct dstask_cancommit {
@@ -242,6 +261,7 @@ struct dstask_cancommit {
     struct Participants_bf      recv_from;
     StripeId                    stripeid;
     uint32_t                    version;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_recv_committed{
@@ -249,11 +269,13 @@ struct dstask_ccc_recv_committed{
     serverid_t                  sender;
     struct Participants_bf      recv_from;
     time_t                      recv_ts;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_send_result{
     struct dstask_head          dshead;
     serverid_t                  receiver;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_received {
@@ -262,6 +284,7 @@ struct dstask_ccc_received {
     struct Participants_bf      recv_from;
     struct Participants_bf  participants;
     StripeId                stripeid;
+    SLAB_ALLOCATED
 };
         
 
@@ -269,6 +292,7 @@ struct dstask_ccc_stripewrite_cancommit {
     struct dstask_head          dshead;
     serverid_t                  receiver;
     uint32_t                    version;
+    SLAB_ALLOCATED
 };
 
 struct dstask_ccc_stripewrite_cancommit_received {
@@ -276,6 +300,7 @@ struct dstask_ccc_stripewrite_cancommit_received {
     serverid_t                  receiver;
     uint32_t                    version;
     struct Participants_bf      recv_from;
+    SLAB_ALLOCATED
 };
 
 
@@ -284,17 +309,48 @@ struct operation_dstask_docommit {
     serverid_t                  receiver;
     struct Participants_bf      participants;
     struct vvecmap              vvmap;
+    SLAB_ALLOCATED
 };
 
 struct dstask_pingpong {
     struct dstask_head          dshead;
     serverid_t                  sender;
     uint32_t                    counter;
+    SLAB_ALLOCATED
+};
+
+/* also used for docommit_written */
+struct dstask_docommit_flushed {
+    struct dstask_head          dshead;
+    struct operation_participant *p_part;
+    int                         rc;
+    SLAB_ALLOCATED
+};
+
+/* completion of a parity write of the primary coordinator */
+struct dstask_primco_written {
+    struct dstask_head          dshead;
+    struct operation_primcoordinator *p_op;
+    StripeId                    stripeid;
+    int                         rc;
+    int                         (*p_queuePush)(queue_priorities, OPHead*);
+    SLAB_ALLOCATED
+};
+
+/* stripe unit read from disk for a read request that missed the cache */
+struct dstask_read_loaded {
+    struct dstask_head          dshead;
+    StripeId                    stripeid;
+    StripeUnitId                suid;
+    int                         rc;
+    struct data_object          *p_do;
+    SLAB_ALLOCATED
 };
 
 struct dstask_maintenance_gc {
     struct dstask_head          dshead;    
 //    time_t                      next_due;
+    SLAB_ALLOCATED
 };
 
 struct operation_participant {
@@ -307,6 +363,7 @@ struct operation_participant {
     bool                                                isready;
     uint16_t                                            stripecnt;
     uint16_t                                            stripecnt_recv;    
+    SLAB_ALLOCATED
 };
 
 struct operation_primcoordinator {
@@ -317,6 +374,9 @@ struct operation_primcoordinator {
     struct Participants_bf                              received_from;
     pthread_mutex_t                                     mutex_private;
     std::map<StripeId,struct datacollection_primco*>    *datamap_primco;
+    uint32_t                                            writing;    // parity writes in flight
+    bool                                                phase3_due; // committed, waits for the writes
+    SLAB_ALLOCATED
 };
 
 
@@ -330,6 +390,7 @@ struct operation_client {
 struct operation_composite {
     struct OPHead                             ophead;
     std::map<uint32_t,operation*>             *ops;
+    uint32_t                                  sending;  // sends reading the callers buffer
 };
 
 struct operation_client_write {
@@ -351,6 +412,7 @@ struct operation_group {
     StripeId                                    stripe_id;
     struct Participants_bf                      participants;
     std::map<StripeUnitId,struct StripeUnit*>   *sumap;
+    std::map<StripeUnitId,struct StripeUnit*>   *recovermap;    // peers and parity of a degraded read, else NULL
     bool                                        isready;
 };
 
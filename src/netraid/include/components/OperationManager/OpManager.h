@@ -9,6 +9,7 @@
 #define	OPMANAGER_H
 
 #include <time.h>
+#include <unordered_map>
 
 #include "OpData.h"
 #include "coco/communication/ConcurrentQueue.h"
@@ -16,7 +17,7 @@
 #include "components/raidlibs/Libraid4.h"
 #include "components/DataObjectCache/doCache.h"
 
-static pthread_mutex_t segnum_mutex;
+static pthread_mutex_t segnum_mutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t sequence_num=1;    
 
 static uint32_t getSequenceNumber(){
@@ -258,6 +259,24 @@ void free_data_object(struct data_object *p);
 void free_parity_data(struct paritydata *p);
 
 
+/* operation tables and the ccoid index, keyed by ccoid_to_uint64 */
+typedef std::unordered_map<uint64_t, struct operation_client_read*>  readop_map;
+typedef std::unordered_map<uint64_t, struct operation_composite*>    writeop_map;
+typedef std::unordered_map<uint64_t, struct operation_participant*>  partop_map;
+typedef std::unordered_map<uint64_t, struct OPHead*>                 opindex_map;
+/* composite write of every sub operation sequence number */
+typedef std::unordered_map<uint32_t, struct operation_composite*>    subop_map;
+
+/**
+ * @brief completion of a parity write, called by an I/O thread.
+ */
+static void primco_written_cb(void *arg, int rc)
+{
+    struct dstask_primco_written *p_task = (struct dstask_primco_written *) arg;
+    p_task->rc = rc;
+    p_task->p_queuePush(realtimetask, (struct OPHead*) p_task);
+}
+
 class StripeManager{
 public:
     StripeManager(Logger *p_log, int (*p_cb)(queue_priorities, OPHead*), doCache *docache, serverid_t servid,Filestorage *fileio){
@@ -267,14 +286,15 @@ public:
         partops_mutex = PTHREAD_MUTEX_INITIALIZER;
         writeops_mutex = PTHREAD_MUTEX_INITIALIZER;
         readops_mutex = PTHREAD_MUTEX_INITIALIZER;
-        segnum_mutex =  PTHREAD_MUTEX_INITIALIZER;
         switchmap_mutex = PTHREAD_MUTEX_INITIALIZER;
         id = servid;
         p_queuePush = p_cb;
         p_ops           = new std::map<uint64_t, std::vector<struct OPHead*>* >;    
-        p_readops       = new std::map<uint64_t, struct operation_client_read*>;
-        p_writeops      = new std::map<uint64_t, struct operation_composite*>;
-        p_partops       = new std::map<uint64_t, struct operation_participant*>; 
+        p_readops       = new readop_map;
+        p_writeops      = new writeop_map;
+        p_partops       = new partop_map; 
+        p_opindex       = new opindex_map;
+        p_subops        = new subop_map;
         operation_active=false;
         p_raid = new Libraid4(log);
         p_docache = docache;
@@ -285,13 +305,15 @@ public:
     {
         pthread_mutex_destroy(&globallock_mutex);
         delete p_raid;
+        delete p_opindex;
+        delete p_subops;
     }
     
     /*
     bool mapinsert_readops(struct CCO_id ccoid , struct operation_client_read *p_op)
     {
         pthread_mutex_lock(&readops_mutex);
-        std::pair<std::map<uint64_t, struct operation_client_read*>::iterator,bool> ret;
+        std::pair<readop_map::iterator,bool> ret;
         try 
         {
                 ret = p_readops->insert(std::pair<uint64_t, struct operation_client_read*>(ccoid_to_uint64(ccoid), p_op));
@@ -307,7 +329,7 @@ public:
     int insert(struct operation_participant *p_op)
     {
         int rc=-1;
-        std::map<uint64_t, struct operation_participant*>::iterator it = p_partops->find(ccoid_to_uint64(p_op->ophead.cco_id));
+        partop_map::iterator it = p_partops->find(ccoid_to_uint64(p_op->ophead.cco_id));
         if (it!= p_partops->end())
         {
             log->debug_log("such an operation alredy exists.");
@@ -334,12 +356,12 @@ public:
     int insert(struct operation_client_read *p_op)
     {
         int rc=-1;
-        std::pair<std::map<uint64_t, struct operation_client_read*>::iterator,bool> ret;
+        std::pair<readop_map::iterator,bool> ret;
         bool locked=true;
         pthread_mutex_lock(&readops_mutex);
         p_op->ophead.cco_id.sequencenum = getSequenceNumber();
         uint64_t ccoid_combined = ccoid_to_uint64(p_op->ophead.cco_id);
-        std::map<uint64_t, struct operation_client_read*>::iterator it = p_readops->find(ccoid_combined);
+        readop_map::iterator it = p_readops->find(ccoid_combined);
         if (it!= p_readops->end())
         {
             log->debug_log("the client already has an read request for that operation.");
@@ -363,15 +385,7 @@ public:
                     for (it3; it3!=it2->second->sumap->end(); it3++)
                     {
                         log->debug_log("stripeunit id :%u",it3->first);
-                        struct dstask_spn_send_read *p_t = new struct dstask_spn_send_read;
-                        p_t->dshead.ophead=p_op->ophead;
-                        p_t->dshead.ophead.type = cl_task_type;
-                        p_t->dshead.ophead.subtype = send_spn_read;
-                        p_t->end = it3->second->end;
-                        p_t->receiver = it3->second->assignedto;
-                        p_t->stripeid = it2->first;
-                        p_t->stripeunitid = it3->first;
-                        p_t->offset = it3->second->start;
+                        struct dstask_spn_send_read *p_t = read_task(p_op, it2->first, it3->first, it3->second);
                         log->debug_log("XXXpushed read request:sid:%u,suid:%u,server:%u",p_t->stripeid, p_t->stripeunitid,p_t->receiver);
                         p_queuePush(client_prim,(struct OPHead*)p_t);
                     }
@@ -396,7 +410,7 @@ public:
         p_op->ophead.cco_id.sequencenum = getSequenceNumber();
         uint64_t ccocomb = ccoid_to_uint64(p_op->ophead.cco_id);
         log->debug_log("insert:inum:%u,csid:%u,seq:%u",p_op->ophead.inum,p_op->ophead.cco_id.csid,p_op->ophead.cco_id.sequencenum);
-        std::map<uint64_t, struct operation_composite*>::iterator itsm = p_writeops->find(ccocomb);
+        writeop_map::iterator itsm = p_writeops->find(ccocomb);
         if (itsm!= p_writeops->end())
         {
             log->debug_log("the client already has an write request for that operation.");
@@ -409,55 +423,58 @@ public:
             pthread_mutex_unlock(&writeops_mutex);
             locked=false;
             filelayout_raid *p_fl = (filelayout_raid *) &p_op->ophead.filelayout[0];
-            struct FileStripeList *p_fsl = p_raid->get_stripes(p_fl, p_op->ophead.offset, p_op->ophead.length);
-            std::map<StripeId,struct Stripe_layout*>::iterator it = p_fsl->stripemap->begin();
+            struct StripeCursor cursor;
+            struct StripeSpan span;
+            stripe_cursor_init(&cursor, p_op->ophead.offset, p_op->ophead.length);
+            uint32_t stripecnt = p_raid->get_stripe_count(p_fl, p_op->ophead.offset, p_op->ophead.length);
             
             size_t lengthdecr = p_op->ophead.length;
             size_t tmpoffset = p_op->ophead.offset;
             char *data_iter = (char*) data;
-            for (it; it!=p_fsl->stripemap->end(); it++)
+            while (p_raid->next_stripe(p_fl, &cursor, &span))
             {
                 struct operation_client_write *p_wrop = new struct operation_client_write;
                 p_wrop->group = new struct operation_group;
                 p_wrop->group->sumap = new std::map<StripeUnitId,struct StripeUnit*>();
+                p_wrop->group->recovermap = NULL;
                 memcpy(&p_wrop->ophead,&p_op->ophead, sizeof(struct OPHead));
                 p_wrop->ophead.cco_id.sequencenum = getSequenceNumber();
                 p_wrop->ophead.offset = tmpoffset;
                 p_wrop->ophead.length = get_stripe_size(p_fl)<lengthdecr ? get_stripe_size(p_fl) :lengthdecr ;
                 tmpoffset+=p_wrop->ophead.length;
-                log->debug_log("stripeid:%u, seq:%u, oplength:%u",it->first,p_wrop->ophead.cco_id.sequencenum,p_wrop->ophead.length);
+                log->debug_log("stripeid:%u, seq:%u, oplength:%u",span.sid,p_wrop->ophead.cco_id.sequencenum,p_wrop->ophead.length);
                 if (!lengthdecr) break;
                 
                 memset(&p_wrop->participants,0,sizeof(struct Participants_bf));
                 p_wrop->participants.end=0;
                 p_wrop->participants.start=(uint8_t)3;
-                p_wrop->group->stripe_id = it->first;         
+                p_wrop->group->stripe_id = span.sid;         
                 if (p_op->ophead.subtype==0)
                 {
-                    p_wrop->ophead.type = it->second->isfull ?  operation_client_s_write : operation_client_su_write;
+                    p_wrop->ophead.type = span.isfull ?  operation_client_s_write : operation_client_su_write;
                 }
                 else
                 {
-                    p_wrop->ophead.type = it->second->isfull ?  operation_client_s_write_direct : operation_client_su_write_direct;
+                    p_wrop->ophead.type = span.isfull ?  operation_client_s_write_direct : operation_client_su_write_direct;
                 }
                 
-                std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = it->second->blockmap->begin();
-                for (it2; it2!=it->second->blockmap->end(); it2++)
+                for (int u=0; u<span.unitcnt; u++)
                 {
+                    struct StripeUnitSpan *p_unit = &span.units[u];
                     log->debug_log("Length left = %u",lengthdecr);
-                    log->debug_log("StripeUnitId:%u",it2->first);
+                    log->debug_log("StripeUnitId:%u",p_unit->id);
                     if (!lengthdecr) break;
-                    struct StripeUnit *p_su = new struct StripeUnit; //it2->second;
-                    p_su->start = it2->second->start;
-                    p_su->end = it2->second->end;
-                    p_su->assignedto = it2->second->assignedto;
+                    struct StripeUnit *p_su = new struct StripeUnit;
+                    p_su->start = p_unit->start;
+                    p_su->end = p_unit->end;
+                    p_su->assignedto = p_unit->assignedto;
                     p_su->opsize = (lengthdecr > p_fl->raid4.stripeunitsize) ? p_fl->raid4.stripeunitsize : lengthdecr;
                     p_su->newdata = data_iter;
                     data_iter += p_su->opsize;
-                    p_wrop->group->sumap->insert(std::pair<StripeUnitId,struct StripeUnit*>(it2->first,p_su));
-                    if (it->second->isfull)
+                    p_wrop->group->sumap->insert(std::pair<StripeUnitId,struct StripeUnit*>(p_unit->id,p_su));
+                    if (span.isfull)
                     {
-                        for (i=0; i<p_fsl->size; i++)
+                        for (i=0; i<stripecnt; i++)
                         {
                             participant_settrue(&p_wrop->participants, i);
                         }
@@ -465,7 +482,7 @@ public:
                     }
                     else
                     {
-                        participant_settrue(&p_wrop->participants, it2->first);
+                        participant_settrue(&p_wrop->participants, p_unit->id);
                         p_wrop->ophead.cco_id.sequencenum = getSequenceNumber();
                     }                    
                     lengthdecr = (lengthdecr > p_fl->raid4.stripeunitsize) ? lengthdecr-p_fl->raid4.stripeunitsize : 0;
@@ -475,9 +492,15 @@ public:
                 p_op->ops->insert(std::pair<uint32_t, operation*>(p_wrop->ophead.cco_id.sequencenum,(operation*)p_wrop));
                 p_op->ophead.stripecnt++;
             } 
-            free_FileStripeList(p_fsl);
+            pthread_mutex_lock(&writeops_mutex);
+            locked=true;
+            std::map<uint32_t,operation*>::iterator itsub = p_op->ops->begin();
+            for (itsub; itsub!=p_op->ops->end(); itsub++)
+            {
+                (*p_subops)[itsub->first] = p_op;
+            }
         }        
-        if (locked) pthread_mutex_unlock(&readops_mutex);
+        if (locked) pthread_mutex_unlock(&writeops_mutex);
         log->debug_log("rc:%d",rc);
         return rc;
     }
@@ -557,13 +580,63 @@ public:
         return rc;
     }
     
+    /**
+     * @brief adds the operation to the vector of its offset and to the
+     * ccoid index. ops_mutex must be held.
+     */
+    void opvec_insert(struct OPHead *p_head)
+    {
+        std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(p_head->offset);
+        if (it!=this->p_ops->end())
+        {
+            it->second->push_back(p_head);
+        }
+        else
+        {
+            std::vector<struct OPHead*> *opvec = new std::vector<struct OPHead*>;
+            opvec->push_back(p_head);
+            this->p_ops->insert(std::pair<uint64_t,std::vector<struct OPHead*>*>(p_head->offset,opvec));
+        }
+        (*p_opindex)[ccoid_to_uint64(p_head->cco_id)] = p_head;
+    }
+    
+    /**
+     * @brief removes the operation with the ccoid of p_head from the vector
+     * of its offset and from the index. ops_mutex must be held.
+     * @return true if it was found
+     */
+    bool opvec_erase(struct OPHead *p_head)
+    {
+        bool found=false;
+        std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(p_head->offset);
+        if (it!=this->p_ops->end())
+        {
+            std::vector<struct OPHead*>::iterator it2 = it->second->begin();
+            for (it2; it2!=it->second->end(); it2++)
+            {
+                if ((*it2)->cco_id.csid==p_head->cco_id.csid && (*it2)->cco_id.sequencenum==p_head->cco_id.sequencenum)
+                {
+                    it->second->erase(it2);
+                    found=true;
+                    break;
+                }
+            }
+        }
+        opindex_map::iterator itidx = p_opindex->find(ccoid_to_uint64(p_head->cco_id));
+        if (itidx!=p_opindex->end() && itidx->second->offset==p_head->offset)
+        {
+            p_opindex->erase(itidx);
+        }
+        return found;
+    }
+    
     int get_op(struct CCO_id ccoid, struct operation_client_read **p_op)
     {
         int rc=-1;
         uint64_t ccoid_combined = ccoid_to_uint64(ccoid);
         log->debug_log("find:%llu, csid:%u,seq:%u",ccoid_combined,ccoid.csid, ccoid.sequencenum);   
        // pthread_mutex_lock(&readops_mutex);
-        std::map<uint64_t, struct operation_client_read*>::iterator it = p_readops->find(ccoid_combined);
+        readop_map::iterator it = p_readops->find(ccoid_combined);
        // pthread_mutex_unlock(&readops_mutex);
         if (it!= p_readops->end())
         {
@@ -583,34 +656,14 @@ public:
         log->debug_log("start:csid:%u,seq:%u,offset:%llu",ccoid.csid,ccoid.sequencenum,offset);
         int rc=-3;
         //pthread_mutex_lock(&ops_mutex);
-        std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(offset);
-        if (it!=this->p_ops->end())
+        opindex_map::iterator itidx = p_opindex->find(ccoid_to_uint64(ccoid));
+        if (itidx!=p_opindex->end() && itidx->second->offset==offset)
         {
-            struct OPHead *p_existing;            
-            std::vector<struct OPHead*>::iterator it2 = it->second->begin();
-            while (it2 != it->second->end())
-            {
-                p_existing = *it2;
-                log->debug_log("csid:%u,seq:%u",p_existing->cco_id.csid,p_existing->cco_id.sequencenum);
-                if (p_existing->cco_id.csid==ccoid.csid && p_existing->cco_id.sequencenum==ccoid.sequencenum)
-                {
-                    log->debug_log("Found operation");
-                    //if (p_existing->type==operation_primcoord_type)
-                    //{
-                        *p_out = (struct operation_primcoordinator*)p_existing;
-                        //log->debug_log("return:%p",p_existing);
-                        rc=0;
-                        break;
-                    /*}
-                    else
-                    {
-                        log->debug_log("Invalid type:%u",p_existing->type);
-                    }*/
-                }
-                it2++;
-            }
+            log->debug_log("Found operation");
+            *p_out = (struct operation_primcoordinator*)itidx->second;
+            rc=0;
         }
-        else
+        else if (this->p_ops->find(offset)==this->p_ops->end())
         {
             log->debug_log("no vector found for offset:%u.",offset);
             rc=-1;
@@ -624,7 +677,7 @@ public:
     {
         int rc=-1;
         log->debug_log("start: look for csid:%u, seq:%u.",ccoid.csid, ccoid.sequencenum);
-        std::map<uint64_t, struct operation_participant*>::iterator it = p_partops->find(ccoid_to_uint64(ccoid));
+        partop_map::iterator it = p_partops->find(ccoid_to_uint64(ccoid));
         if (it!=this->p_partops->end())
         {
             *p_out = it->second;
@@ -638,24 +691,20 @@ public:
         return rc;
     }
     
+    /**
+     * @brief composite write of a sub operation, matched by its sequence
+     * number. writeops_mutex must be held.
+     */
     int get_op(struct CCO_id ccoid, struct operation_composite **p_out)
     {
         int rc=-1;
         log->debug_log("start: csid:%u,seq:%u",ccoid.csid,ccoid.sequencenum);
-        //pthread_mutex_lock(&writeops_mutex);
-        std::map<uint64_t,struct operation_composite*>::iterator it = p_writeops->begin();
-        for (it;it!= p_writeops->end();it++)
+        subop_map::iterator it = p_subops->find(ccoid.sequencenum);
+        if (it!=p_subops->end())
         {
-            //log->debug_log("csid:%u,seq:%u",it->)
-            std::map<uint32_t,operation*>::iterator it2 = it->second->ops->find(ccoid.sequencenum);
-            if (it2!=it->second->ops->end())
-            {                
-                *p_out = it->second;
-                rc=0;
-                break;
-            }
+            *p_out = it->second;
+            rc=0;
         }
-        //pthread_mutex_unlock(&writeops_mutex);
         log->debug_log("operation found=rc:%d",rc);
         return rc;
     }
@@ -663,23 +712,11 @@ public:
     struct OPHead* get_op(struct OPHead *p_head)
     {
         log->debug_log("start.");
-        //pthread_mutex_lock(&ops_mutex);
-        std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(p_head->offset);
-        if (it!=this->p_ops->end())
+        opindex_map::iterator it = p_opindex->find(ccoid_to_uint64(p_head->cco_id));
+        if (it!=p_opindex->end() && it->second->offset==p_head->offset)
         {
-            struct OPHead *p_existing;
-            std::vector<struct OPHead*>::iterator it2 = it->second->begin();
-            while (it2 != it->second->end())
-            {
-                p_existing = *it2;
-                if (p_existing->cco_id.csid==p_head->cco_id.csid && p_existing->cco_id.sequencenum==p_head->cco_id.sequencenum)
-                {
-                    pthread_mutex_unlock(&ops_mutex);
-                    return p_existing;
-                }
-            }
+            return it->second;
         }
-       // pthread_mutex_unlock(&ops_mutex);
         return NULL;
     }
     
@@ -694,9 +731,7 @@ public:
         std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->lower_bound(p_ophead->offset);
         if (it==this->p_ops->end())
         {
-            std::vector<struct OPHead*> *opvec = new std::vector<struct OPHead*>;
-            opvec->push_back(p_ophead);
-            this->p_ops->insert(std::pair<uint64_t,std::vector<struct OPHead*>*>(p_ophead->offset,opvec));
+            opvec_insert(p_ophead);
             pthread_mutex_unlock(&ops_mutex);
             locked=false;
             rc = 0;
@@ -738,7 +773,7 @@ public:
                 }
             }
         }  
-        if (locked) pthread_mutex_lock(&ops_mutex);
+        if (locked) pthread_mutex_unlock(&ops_mutex);
         if (!conflict_detected)
         {
             rc = handle_ready_phase1(p_ophead);
@@ -778,6 +813,8 @@ public:
             memcpy(&p_primop->participants ,& p_task->participants, sizeof(struct Participants_bf));
             p_primop->ophead.status = opstatus_init;
             p_primop->mutex_private = PTHREAD_MUTEX_INITIALIZER;
+            p_primop->writing = 0;
+            p_primop->phase3_due = false;
             pthread_mutex_lock(&p_primop->mutex_private);
                         
             stringstream ss;
@@ -799,20 +836,8 @@ public:
             p_primop->datamap_primco->insert(std::pair<StripeId,struct datacollection_primco*>(p_task->stripeid,p_dc));
             log->debug_log("created primco datamap:%p",p_primop->datamap_primco);
         
-            std::vector<struct OPHead*> *opvec;
-            if (rc==-1)
-            {
-                opvec = new std::vector<struct OPHead*>;
-                opvec->push_back(&p_primop->ophead);
-                this->p_ops->insert(std::pair<uint64_t,std::vector<struct OPHead*>*>(p_ophead->offset,opvec));
-                log->debug_log("pushed back, created vec.");
-            }
-            else
-            {
-                std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(p_ophead->offset);
-                it->second->push_back(&p_primop->ophead);
-                log->debug_log("pushed back. no lower bound found.");
-            }                   
+            opvec_insert(&p_primop->ophead);
+            log->debug_log("pushed back.");
             rc = 0;          
         }        
         pthread_mutex_unlock(&ops_mutex);
@@ -887,6 +912,8 @@ public:
             memset(&p_primop->participants, 0, sizeof(struct Participants_bf));
             p_primop->received_from.start = 3;        
             p_primop->mutex_private = PTHREAD_MUTEX_INITIALIZER;
+            p_primop->writing = 0;
+            p_primop->phase3_due = false;
             pthread_mutex_lock(&p_primop->mutex_private);
             oplocked=true;
             fullParticipants(&p_primop->participants, p_fl->raid4.groupsize-1);            
@@ -913,20 +940,8 @@ public:
             p_dc->newobject=NULL;
             p_primop->datamap_primco->insert(std::pair<StripeId,struct datacollection_primco*>(sid,p_dc));
             log->debug_log("created primco datamap:%p",p_primop->datamap_primco);
-            std::vector<struct OPHead*> *opvec;
-            if (rc==-1)
-            {
-                opvec = new std::vector<struct OPHead*>;
-                opvec->push_back(&p_primop->ophead);
-                this->p_ops->insert(std::pair<uint64_t,std::vector<struct OPHead*>*>(p_ophead->offset,opvec));
-                log->debug_log("pushed back, created vec.");
-            }
-            else
-            {
-                std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(p_ophead->offset);
-                it->second->push_back(&p_primop->ophead);
-                log->debug_log("pushed back. no lower bound found.");
-            }                   
+            opvec_insert(&p_primop->ophead);
+            log->debug_log("pushed back.");
             rc = 0;            
         }        
         
@@ -1042,6 +1057,36 @@ public:
         return rc;
     }
     
+    /**
+     * @brief a parity object of the operation is written. Runs phase 3 if
+     * all participants committed meanwhile.
+     */
+    int handle_primco_written(struct dstask_primco_written *p_task)
+    {
+        int rc = p_task->rc;
+        struct operation_primcoordinator *p_op = p_task->p_op;
+        pthread_mutex_lock(&p_op->mutex_private);
+        std::map<StripeId,struct datacollection_primco*>::iterator its = p_op->datamap_primco->find(p_task->stripeid);
+        log->debug_log("Object written to disk:rc=%d",rc);
+        if (!rc && its!=p_op->datamap_primco->end())
+        {
+            rc = p_docache->parityUnconfirmed(p_op->ophead.inum, its->first, its->second->newobject);
+            log->debug_log("Cache updated...rc=%d",rc);
+        }
+        else
+        {
+            log->warning_log("Writing failed... rc=%d",rc);
+        }
+        if (__sync_sub_and_fetch(&p_op->writing, 1)==0 && p_op->phase3_due)
+        {
+            log->debug_log("phase three ready.");
+            rc = handle_primcoord_phase_3(p_op);
+        }
+        pthread_mutex_unlock(&p_op->mutex_private);
+        log->debug_log("rc:%d",rc);
+        return rc;
+    }
+    
     int cleanup(struct operation_client_write *op)
     {
         int rc=-1;
@@ -1068,25 +1113,9 @@ public:
         //p_writeops->erase()
         //pthread_mutex_unlock(&writeops_mutex);
         pthread_mutex_lock(&ops_mutex);
-        std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it3 = p_ops->find(op->ophead.offset);
-        if (it3!=p_ops->end())
+        if (opvec_erase(&op->ophead))
         {
-            std::vector<struct OPHead*>::iterator it4 = it3->second->begin();
-            for (it4; it4!=it3->second->end(); it4++)
-            {
-                if ((*it4)->cco_id.csid==op->ophead.cco_id.csid && (*it4)->cco_id.sequencenum==op->ophead.cco_id.sequencenum)
-                {
-                    log->debug_log("found operation to remove");
-                    it3->second->erase(it4);
-                    //if (it3->second->empty())
-                    //{
-                    //    log->debug_log("removed vector of offset:%llu",it3->first);
-                    //    p_ops->erase(it3);                        
-                    //}
-                    rc=0;
-                    break;
-                }
-            }
+            log->debug_log("found operation to remove");
         }        
         pthread_mutex_unlock(&ops_mutex);
         delete op;
@@ -1099,6 +1128,15 @@ public:
         int rc=-1;
         log->debug_log("op inum:%llu",op->ophead.inum);
         
+        // unlinked first, responses of a degraded read may still arrive
+        pthread_mutex_lock(&readops_mutex);
+        readop_map::iterator it3 = p_readops->find(ccoid_to_uint64(op->ophead.cco_id));
+        if (it3!=p_readops->end())
+        {
+            p_readops->erase(it3);          
+        }        
+        pthread_mutex_unlock(&readops_mutex);
+        
         std::map<uint32_t,struct operation_group *>::iterator it = op->groups->begin();
         for (it; it!=op->groups->end(); it++)
         {
@@ -1110,19 +1148,15 @@ public:
                 //free(it2->second->olddata);
                // free(it2->second);
             }
+            if (it->second->recovermap!=NULL)
+            {
+                free_recovermap(it->second->recovermap);
+            }
             //free(it->second);
         }
         delete op->groups;
         log->debug_log("groups deleted.");
         rc=0;
-        
-        pthread_mutex_lock(&readops_mutex);
-        std::map<uint64_t, struct operation_client_read*>::iterator it3 = p_readops->find(ccoid_to_uint64(op->ophead.cco_id));
-        if (it3!=p_readops->end())
-        {
-            p_readops->erase(it3);          
-        }        
-        pthread_mutex_unlock(&readops_mutex);
         delete op;
         log->debug_log("rc=%u",rc);
         return rc;
@@ -1134,8 +1168,20 @@ public:
         struct OPHead *p_head;        
         pthread_mutex_lock(&writeops_mutex);
         uint64_t ccocomb = ccoid_to_uint64(p_op->ophead.cco_id);
-        std::map<uint64_t, struct operation_composite*>::iterator it2 = p_writeops->find(ccocomb);
-        p_writeops->erase(it2)      ;
+        writeop_map::iterator it2 = p_writeops->find(ccocomb);
+        if (it2!=p_writeops->end())
+        {
+            p_writeops->erase(it2);
+        }
+        std::map<uint32_t,operation*>::iterator itsub = p_op->ops->begin();
+        for (itsub; itsub!=p_op->ops->end(); itsub++)
+        {
+            subop_map::iterator itidx = p_subops->find(itsub->first);
+            if (itidx!=p_subops->end() && itidx->second==p_op)
+            {
+                p_subops->erase(itidx);
+            }
+        }
         
         /*std::map<uint32_t,operation*>::iterator it = p_op->ops->begin();
         for (it;it!=p_op->ops->end(); it++)
@@ -1170,21 +1216,9 @@ public:
     void cleanup(struct operation_primcoordinator *op)
     {
         pthread_mutex_lock(&ops_mutex);
-        struct OPHead *p_existing;
-        std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(op->ophead.offset);
-        if (it!=this->p_ops->end())
+        if (opvec_erase(&op->ophead))
         {            
-            std::vector<struct OPHead*>::iterator it2 = it->second->begin();
-            while (it2 != it->second->end())
-            {                
-                p_existing = *it2;
-                if (p_existing->cco_id.csid==op->ophead.cco_id.csid)
-                {
-                    free_operation_primcoordinator(op);
-                    it->second->erase(it2);
-                    break;
-                }
-            }
+            free_operation_primcoordinator(op);
         }
         pthread_mutex_unlock(&ops_mutex);
     }
@@ -1192,9 +1226,18 @@ public:
     void cleanup(struct operation_participant *op)
     {
         pthread_mutex_lock(&partops_mutex);
-        std::map<uint64_t, struct operation_participant*>::iterator it = p_partops->find(ccoid_to_uint64(op->ophead.cco_id));
+        partop_map::iterator it = p_partops->find(ccoid_to_uint64(op->ophead.cco_id));
         if (it!= p_partops->end())
         {
+            if (op->datamap!=NULL)
+            {
+                // the old objects are pinned in the cache
+                std::map<StripeId,struct dataobject_collection*>::iterator itd = op->datamap->begin();
+                for (itd; itd!=op->datamap->end(); itd++)
+                {
+                    p_docache->release(itd->second->existing);
+                }
+            }
             free_operation_participant(op);
             
             p_partops->erase(it);
@@ -1206,8 +1249,11 @@ public:
     {
         log->debug_log("sid:%u,suid:%u",sid,suid);
         int rc=-1;
+        bool attached=false;
         struct operation_client_read *p_op;
+        struct operation_group *p_gr = NULL;
         
+        pthread_mutex_lock(&readops_mutex);
         rc = get_op(ccoid, &p_op);
         if (!rc)
         {
@@ -1220,14 +1266,35 @@ public:
             std::map<uint32_t,struct operation_group *>::iterator it = p_op->groups->find(sid);
             if (it!=p_op->groups->end())
             {
-                std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = it->second->sumap->find(suid);
-                if (it2!=it->second->sumap->end())
+                p_gr = it->second;
+                std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = p_gr->sumap->find(suid);
+                if (it2!=p_gr->sumap->end())
                 {
                     log->debug_log("found stripe unit %u",suid);
+                    if (it2->second->newdata!=NULL)
+                    {
+                        // late answer of a unit already rebuilt from parity
+                        log->debug_log("stripe unit %u already present",suid);
+                        rc=-5;
+                    }
+                    else
+                    {
+                        it2->second->newdata=(char *)p_do->data;
+                        it2->second->do_recv = p_do;
+                        it2->second->start = p_do->metadata.offset;
+                        it2->second->end   = p_do->metadata.offset+p_do->metadata.datalength;
+                        attached=true;
+                        rc = 0;
+                    }
+                }
+                else if (p_gr->recovermap!=NULL &&
+                        (it2=p_gr->recovermap->find(suid))!=p_gr->recovermap->end() &&
+                        it2->second->do_recv==NULL)
+                {
+                    log->debug_log("recovery unit %u received",suid);
                     it2->second->newdata=(char *)p_do->data;
                     it2->second->do_recv = p_do;
-                    it2->second->start = p_do->metadata.offset;
-                    it2->second->end   = p_do->metadata.offset+p_do->metadata.datalength;
+                    attached=true;
                     rc = 0;
                 }
                 else
@@ -1242,7 +1309,16 @@ public:
                 rc=-3;
             }
         }
-        if (rc==0)
+        if (rc==0 && p_gr->recovermap!=NULL && !p_gr->isready)
+        {
+            int rrc = rebuild_unit(p_op, p_gr);
+            if (rrc<0)
+            {
+                log->debug_log("rebuild of sid:%u failed",sid);
+                p_op->ophead.status = opstatus_failure;
+            }
+        }
+        if (rc==0 && p_op->ophead.status!=opstatus_failure)
         {
             if (check_isready(p_op) )
             {
@@ -1272,6 +1348,95 @@ public:
                 log->debug_log("not ready yet.");
             }
         }
+        pthread_mutex_unlock(&readops_mutex);
+        if (!attached)
+        {
+            // nobody waits for this object anymore
+            free(p_do->data);
+            delete p_do;
+        }
+        log->debug_log("rc:%d",rc);
+        return rc;
+    }
+    
+    /**
+     * @brief switches every incomplete stripe of a read with exactly one
+     * missing unit into degraded mode. The parity and the units the read
+     * does not cover are requested, the missing unit is rebuilt by
+     * rebuild_unit once they arrived. A unit answering in the meantime wins.
+     * @return number of stripes switched, -2 if the read is gone
+     */
+    int read_degraded(struct CCO_id ccoid)
+    {
+        int rc=0;
+        struct operation_client_read *p_op;
+        std::vector<struct dstask_spn_send_read*> tasks;
+        
+        pthread_mutex_lock(&readops_mutex);
+        if (get_op(ccoid, &p_op))
+        {
+            pthread_mutex_unlock(&readops_mutex);
+            return -2;
+        }
+        filelayout_raid *p_fl = (filelayout_raid *)&p_op->ophead.filelayout[0];
+        size_t unitsize = p_fl->raid4.stripeunitsize;
+        StripeUnitId paritysuid = p_fl->raid4.groupsize-1;
+        std::map<uint32_t,struct operation_group *>::iterator it = p_op->groups->begin();
+        for (it; it!=p_op->groups->end() && !p_op->isready; it++)
+        {
+            struct operation_group *p_gr = it->second;
+            if (p_gr->isready || p_gr->recovermap!=NULL) continue;
+            
+            struct StripeUnit *p_missing = NULL;
+            StripeUnitId missing = 0;
+            uint32_t missingcnt = 0;
+            std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = p_gr->sumap->begin();
+            for (it2; it2!=p_gr->sumap->end(); it2++)
+            {
+                if (it2->second->newdata==NULL)
+                {
+                    p_missing = it2->second;
+                    missing = it2->first;
+                    missingcnt++;
+                }
+            }
+            if (missingcnt!=1)
+            {
+                log->debug_log("sid:%u has %u missing units, parity rebuilds one",it->first,missingcnt);
+                continue;
+            }
+            size_t stripestart = p_missing->start - p_missing->start%unitsize - missing*unitsize;
+            struct StripeSpan span;
+            if (p_raid->get_stripe_span(p_fl, stripestart, &span)) continue;
+            p_gr->recovermap = new std::map<StripeUnitId,struct StripeUnit*>();
+            for (StripeUnitId i=0; i<=paritysuid; i++)
+            {
+                if (i==missing || p_gr->sumap->find(i)!=p_gr->sumap->end()) continue;
+                struct StripeUnit *p_su = new struct StripeUnit;
+                p_su->start = (i==paritysuid) ? stripestart : stripestart+i*unitsize;
+                p_su->end = p_su->start+unitsize;
+                p_su->opsize = unitsize;
+                p_su->assignedto = (i==paritysuid) ? span.parityserver_id : span.units[i].assignedto;
+                p_su->olddata = NULL;
+                p_su->newdata = NULL;
+                p_su->paritydata = NULL;
+                p_su->do_recv = NULL;
+                p_gr->recovermap->insert(std::pair<StripeUnitId,struct StripeUnit*>(i,p_su));
+                struct dstask_spn_send_read *p_t = read_task(p_op, it->first, i, p_su);
+                // the data server derives its unit id from the offset
+                p_t->dshead.ophead.offset = p_su->start;
+                tasks.push_back(p_t);
+            }
+            log->debug_log("sid:%u, suid:%u degraded, %u recovery reads",it->first,missing,p_gr->recovermap->size());
+            rc++;
+        }
+        pthread_mutex_unlock(&readops_mutex);
+        
+        std::vector<struct dstask_spn_send_read*>::iterator itt = tasks.begin();
+        for (itt; itt!=tasks.end(); itt++)
+        {
+            p_queuePush(client_prim,(struct OPHead*)*itt);
+        }
         log->debug_log("rc:%d",rc);
         return rc;
     }
@@ -1304,45 +1469,47 @@ public:
                 !iscoord ? p_op->iamsecco=false : p_op->iamsecco = true;
                 p_op->datamap = new std::map<StripeId,struct dataobject_collection*>;
                 
-                FileStripeList *p_fsl = p_raid->get_stripes(p_fl,p_task_sp->dshead.ophead.offset,p_task_sp->dshead.ophead.length);
-                std::map<StripeId,struct Stripe_layout*>::iterator it = p_fsl->stripemap->begin();
-                for (it; it!=p_fsl->stripemap->end(); it++)
+                struct StripeCursor cursor;
+                struct StripeSpan span;
+                stripe_cursor_init(&cursor, p_task_sp->dshead.ophead.offset, p_task_sp->dshead.ophead.length);
+                StripeUnitId suid = p_raid->get_my_stripeunitid(p_fl,p_task_sp->dshead.ophead.offset,this->id);
+                while (p_raid->next_stripe(p_fl, &cursor, &span))
                 {
                     struct dataobject_collection *p_doc = new struct dataobject_collection;
                     p_doc->fhvalid=false;
-                    //if (p_task_sp->dshead.ophead.subtype==received_spn_write_s)
-                    //{
-                    StripeUnitId suid = p_raid->get_my_stripeunitid(p_fl,p_task_sp->dshead.ophead.offset,this->id);
-                    rc = p_docache->get_entry(p_op->ophead.inum, it->first,&p_doc->existing);
-                    
-                    if (!rc)
+                    if (p_task_sp->dshead.ophead.subtype==received_spn_write_s)
                     {
-                        p_doc->mycurrentversion = p_doc->existing->metadata.versionvector[suid];
+                        // the client sent the whole stripe and its parity,
+                        // the old unit is overwritten without being read
+                        p_doc->existing=NULL;
+                        rc = p_docache->get_stored_version(p_op->ophead.inum, span.sid, suid, &p_doc->mycurrentversion);
                     }
                     else
                     {
-                        p_doc->mycurrentversion = 0;
-                        p_doc->existing=NULL;
+                        rc = p_docache->get_entry(p_op->ophead.inum, span.sid,&p_doc->existing);
+                        if (!rc)
+                        {
+                            p_doc->mycurrentversion = p_doc->existing->metadata.versionvector[suid];
+                        }
+                        else
+                        {
+                            p_doc->mycurrentversion = 0;
+                            p_doc->existing=NULL;
+                        }
                     }
                     log->debug_log("found existing _VERSION_:%u",p_doc->mycurrentversion);
                     log->debug_log("reading existing returned:%d",rc);
-                    //}
-                    //else
-                    //{
-                     //   p_doc->existing = NULL;
-                    //}
                     p_doc->recv_data = NULL;
                     p_doc->parity_data=NULL;
-                    p_op->datamap->insert(std::pair<StripeId,struct dataobject_collection*>(it->first,p_doc));
+                    p_op->datamap->insert(std::pair<StripeId,struct dataobject_collection*>(span.sid,p_doc));
                     p_op->stripecnt++;
-                    log->debug_log("inserted stripe id:%u",it->first);
+                    log->debug_log("inserted stripe id:%u",span.sid);
                 }
                 p_op->participants = p_task_sp->participants;
                 p_op->ophead.status = opstatus_init;
                 p_op->primcoordinator = get_coordinator(p_fl,p_task_sp->dshead.ophead.offset);   
                 rc = insert(p_op);
                 log->debug_log("inserted:rc=%d",rc);
-                free_FileStripeList(p_fsl);
             }
             
             std::map<StripeId,struct dataobject_collection*>::iterator it = p_op->datamap->find(p_task_sp->stripeid);
@@ -1415,6 +1582,8 @@ public:
                 memset(&p_primop->received_from, 0, sizeof(struct Participants_bf));
                 memset(&p_primop->participants, 0, sizeof(struct Participants_bf));
                 p_primop->mutex_private = PTHREAD_MUTEX_INITIALIZER;
+                p_primop->writing = 0;
+                p_primop->phase3_due = false;
                 p_primop->received_from.start = 3;        
                 p_primop->ophead.status=opstatus_init;
                 log->debug_log("stripe id is:%u",p_task->stripeid);
@@ -1446,29 +1615,8 @@ public:
                 log->debug_log("created primco datamap:%p",p_primop->datamap_primco);
                // pthread_mutex_lock(&globallock_mutex);
                 
-                if (rc==-1)
-                {
-                    std::vector<struct OPHead*> *opvec;
-                    std::map<uint64_t,std::vector<struct OPHead*>*>::iterator it_v = this->p_ops->find(p_task->dshead.ophead.offset);
-                    if (it_v!=this->p_ops->end())
-                    {
-                        opvec = it_v->second;
-                        opvec->push_back(&p_primop->ophead);
-                    }
-                    else
-                    {
-                        opvec = new std::vector<struct OPHead*>;
-                        opvec->push_back(&p_primop->ophead);
-                        this->p_ops->insert(std::pair<uint64_t,std::vector<struct OPHead*>*>(p_task->dshead.ophead.offset,opvec));                    
-                    }
-                    log->debug_log("pushed back, created vec offset:%llu",p_task->dshead.ophead.offset);
-                }
-                else
-                {
-                    std::map<uint64_t, std::vector<struct OPHead*>* >::iterator it = this->p_ops->find(p_task->dshead.ophead.offset);
-                    it->second->push_back(&p_primop->ophead);
-                    log->debug_log("pushed back. no lower bound found.");
-                }                   
+                opvec_insert(&p_primop->ophead);
+                log->debug_log("pushed back, offset:%llu",p_task->dshead.ophead.offset);
                 rc = 0;            
                 //pthread_mutex_unlock(&globallock_mutex);
             }
@@ -1558,6 +1706,7 @@ public:
         StripeId sid = p_raid->getStripeId(p_fl,p_task->dshead.ophead.offset);
         struct dataobject_collection *p_col  = new struct dataobject_collection;
         p_col->mycurrentversion = 1;
+        p_col->fhvalid = false;
         p_col->recv_data = p_task->data;
         p_col->recv_length = p_task->length;
         for (int i=0; i<p_fl->raid4.groupsize; i++)
@@ -1570,8 +1719,10 @@ public:
         
         struct data_object *p_obj = it->second->newblock;
         p_docache->set_entry(p_task->dshead.ophead.inum, sid, p_obj);
-        fsync(p_col->filehandle);
-        close(p_col->filehandle);
+        if (p_col->fhvalid)
+        {
+            p_fileio->commit(&p_col->filehandle, 1);
+        }
         //free(p_col->recv_data);
         delete p_col;
         delete p_direct->datamap;
@@ -1588,9 +1739,11 @@ private:
     int (*p_queuePush)(queue_priorities, OPHead*);
     uint32_t (*p_cb_getSeq)();
     std::map<uint64_t, std::vector<struct OPHead*>* > *p_ops;
-    std::map<uint64_t, struct operation_client_read*> *p_readops;
-    std::map<uint64_t, struct operation_composite*> *p_writeops;
-    std::map<uint64_t, struct operation_participant*> *p_partops;
+    readop_map *p_readops;
+    writeop_map *p_writeops;
+    partop_map *p_partops;
+    opindex_map *p_opindex;     // entries of p_ops
+    subop_map *p_subops;        // guarded by writeops_mutex
     //std::map<StripeId, >*p_switchmap;
     pthread_mutex_t globallock_mutex;
     pthread_mutex_t ops_mutex;
@@ -1647,7 +1800,7 @@ private:
            // p_dstask->data_col = it->second;
             log->debug_log("stripe id is:%u",it->first);
             
-            p_docache->get_next_version_vector(p_op->ophead.inum, it->first, &it->second->versionvec[0], p_fl->raid4.groupsize-1);
+            p_docache->get_next_version_vector(p_op->ophead.inum, it->first, &it->second->versionvec[0], p_fl->raid4.groupsize-1, false);
                 //p_docache->get_entry(p_task->dshead.ophead.inum, p_task->stripeid,&p_do);
             for (int i=0; i<=default_groupsize; i++)
             {
@@ -1658,12 +1811,12 @@ private:
             {   
                 memcpy(&it->second->newobject->metadata.versionvector[0], &it->second->versionvec[0], sizeof(it->second->newobject->metadata.versionvector));
                 log->debug_log("Operation ready.");
-                struct Stripe_layout *p_sl = p_raid->get_stripe(p_fl,p_op->ophead.offset);
-                std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = p_sl->blockmap->begin();
-                for (it2; it2!=p_sl->blockmap->end(); it2++)
+                struct StripeSpan span;
+                p_raid->get_stripe_span(p_fl,p_op->ophead.offset,&span);
+                for (int u=0; u<span.unitcnt; u++)
                 {
                     struct operation_dstask_docommit *p_task = create_dstask_send_docommit((operation*)p_op);
-                    p_task->receiver = it2->second->assignedto;
+                    p_task->receiver = span.units[u].assignedto;
                     p_task->vvmap.stripeid=it->first;
 
                     memcpy(&p_task->vvmap.versionvector[0],&it->second->versionvec[0], sizeof(p_task->vvmap.versionvector));
@@ -1673,7 +1826,6 @@ private:
                     log->debug_log("pushed. for receiver:%u",p_task->receiver);
                     //rc = p_docache->get_next_version_vector(p_op->ophead.inum,it->first,it_vec->second->versionvec,default_groupsize);
                 }
-                free_StripeLayout(p_sl);    
                 //p_docache->reset_version_vector(p_op->ophead.inum ,it->first, default_groupsize);
             }
             else
@@ -1708,28 +1860,25 @@ private:
         //log->debug_log("%s.\n",ss.str().c_str());
         
         filelayout_raid *p_fl = (filelayout_raid*) &p_op->ophead.filelayout[0];
-        struct FileStripeList *p_fs = p_raid->get_stripes(p_fl,p_op->ophead.offset, p_op->ophead.length);
-
-        std::map<StripeId,struct Stripe_layout*>::iterator it = p_fs->stripemap->begin();
-        for (it; it!=p_fs->stripemap->end();it++)
+        struct StripeCursor cursor;
+        struct StripeSpan span;
+        stripe_cursor_init(&cursor, p_op->ophead.offset, p_op->ophead.length);
+        while (p_raid->next_stripe(p_fl, &cursor, &span))
         {
             //p_docache->;
-            log->debug_log("FilestripeList: stripeID:%llu",it->first);
-            p_raid->printStripeLayout(it->second);
-            std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = it->second->blockmap->begin();
-            for (it2; it2!=it->second->blockmap->end();it2++)
+            log->debug_log("FilestripeList: stripeID:%llu",span.sid);
+            for (int u=0; u<span.unitcnt; u++)
             {
                 struct dstask_ccc_send_prepare *p_task = new struct dstask_ccc_send_prepare;
                 memcpy(&p_task->dshead.ophead, &p_op->ophead , sizeof(struct OPHead));
                 p_task->dshead.ophead.subtype = send_prepare;
                 p_task->dshead.ophead.type = ds_task_type;
-                p_task->receiver=it2->second->assignedto;
+                p_task->receiver=span.units[u].assignedto;
                 rc = p_queuePush(prim_recv, (struct OPHead*)p_task);
                 log->debug_log("pushed will be sent to %u. task pointer:%p",p_task->receiver,p_task);
             }
         }
         memset(&p_op->received_from,0,sizeof(p_op->received_from));
-        free_FileStripeList(p_fs);
         log->debug_log("rc:%d",rc);
         return rc;
     }
@@ -1751,11 +1900,12 @@ private:
         memset(&p_op->received_from,0,sizeof(p_op->received_from));
 
         filelayout_raid *p_fl = (filelayout_raid*) &p_op->ophead.filelayout[0];
-        struct FileStripeList *p_fs = p_raid->get_stripes(p_fl,p_op->ophead.offset, p_op->ophead.length);
-        std::map<StripeId,struct Stripe_layout*>::iterator it = p_fs->stripemap->begin();
-        for (it; it!=p_fs->stripemap->end();it++)
+        struct StripeCursor cursor;
+        struct StripeSpan span;
+        stripe_cursor_init(&cursor, p_op->ophead.offset, p_op->ophead.length);
+        while (p_raid->next_stripe(p_fl, &cursor, &span))
         {
-            std::map<StripeId,struct datacollection_primco*>::iterator it_vec = p_op->datamap_primco->find(it->first);
+            std::map<StripeId,struct datacollection_primco*>::iterator it_vec = p_op->datamap_primco->find(span.sid);
             //if (it_vec->second->existing==NULL)
            // {
            //     log->debug_log("reading block:sid %u",it->first);
@@ -1764,18 +1914,16 @@ private:
             //rc = p_docache->get_next_version(p_op->ophead.inum,it->first,&version);
             //log->debug_log("get next version returned: %u, rc:%d",version,rc);
 
-            rc = p_docache->get_next_version_vector(p_op->ophead.inum,it->first,it_vec->second->versionvec,default_groupsize);
+            rc = p_docache->get_next_version_vector(p_op->ophead.inum,span.sid,it_vec->second->versionvec,default_groupsize);
             log->debug_log("rc:%d. got current version vector",rc);
             //it_vec->second->versionvec[default_groupsize] = version;
             log->debug_log("parity version:%u",it_vec->second->versionvec[default_groupsize]);        
-            log->debug_log("FilestripeList: stripeID:%llu",it->first);
-            //p_raid->printStripeLayout(it->second);
-            std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = it->second->blockmap->begin();
-            for (it2; it2!=it->second->blockmap->end();it2++)
+            log->debug_log("FilestripeList: stripeID:%llu",span.sid);
+            for (int u=0; u<span.unitcnt; u++)
             {
                 struct operation_dstask_docommit *p_task = create_dstask_send_docommit((operation*)p_op);
-                p_task->receiver = it2->second->assignedto;
-                p_task->vvmap.stripeid=it->first;
+                p_task->receiver = span.units[u].assignedto;
+                p_task->vvmap.stripeid=span.sid;
                 memcpy(&p_task->vvmap.versionvector[0],&it_vec->second->versionvec[0], sizeof(p_task->vvmap.versionvector));
                 //p_task->vvmap.versionvector[default_groupsize] = it_vec->second->versionvec[default_groupsize];
 
@@ -1785,7 +1933,6 @@ private:
                 log->debug_log("pushed. for receiver:%u",p_task->receiver);
             }
         }
-        free_FileStripeList(p_fs);
         log->debug_log("do commit messages queued."); 
 
         //log->debug_log("inum:%llu",p_.ophead.inum);
@@ -1884,17 +2031,17 @@ private:
             print_dataobject_metadata(&its->second->newobject->metadata,ss);
             log->debug_log("%s",ss.str().c_str());
             log->debug_log("write to disk");
-            rc = p_fileio->write_file(&p_op->ophead, its->second); 
-            log->debug_log("Object written to disk:rc=%d",rc);
-            if (!rc)
-            {
-                rc = p_docache->parityUnconfirmed(p_op->ophead.inum, its->first, its->second->newobject);
-                log->debug_log("Cache updated...rc=%d",rc);
-            }
-            else
-            {
-                log->warning_log("Writing failed... rc=%d",rc);
-            }
+            // the cache is updated by handle_primco_written once the object is written
+            struct dstask_primco_written *p_task = new struct dstask_primco_written;
+            memcpy(&p_task->dshead.ophead, &p_op->ophead, sizeof(struct OPHead));
+            p_task->dshead.ophead.type = ds_task_type;
+            p_task->dshead.ophead.subtype = primco_written;
+            p_task->p_op = p_op;
+            p_task->stripeid = its->first;
+            p_task->rc = 0;
+            p_task->p_queuePush = p_queuePush;
+            __sync_fetch_and_add(&p_op->writing, 1);
+            rc = p_fileio->write_file_async(&p_op->ophead, its->second, &primco_written_cb, p_task);
         }
         log->debug_log("rc:%d",rc);
         return rc;
@@ -1904,48 +2051,45 @@ private:
     {
         int rc=-1;
         log->debug_log("STATUS:csid:%u,seq:%u,status:%u",p_op->ophead.cco_id.csid,p_op->ophead.cco_id.sequencenum, p_op->ophead.status);
+        if (p_op->writing>0)
+        {
+            // the participants were faster than the parity writes of phase 2,
+            // handle_primco_written continues
+            log->debug_log("phase three waits for %u writes.",p_op->writing);
+            p_op->phase3_due = true;
+            return 0;
+        }
         p_op->ophead.status = opstatus_success;
         
+        std::vector<int> fds;
         std::map<StripeId,struct datacollection_primco*>::iterator it2 = p_op->datamap_primco->begin();
         for(it2; it2!= p_op->datamap_primco->end(); it2++)
         {
-            while (!it2->second->fhvalid) 
+            if (it2->second->fhvalid)
             {
-                usleep(100); 
-                //busy wait for the file to be written
-                // if fvalid is false, processing the phase_3 at the participant side
-                // was faster than finishing phase_2 at the coordinator
+                fds.push_back(it2->second->filehandle);
             }
-            try
-            {
-                if(!p_fileio->no_sync)
-                {
-                    log->debug_log("flushing file buffer");
-                    fsync(it2->second->filehandle);
-                    log->debug_log("flushed.");
-                }
-                log->debug_log("Closing...");
-                close(it2->second->filehandle);
-                log->debug_log("Closed");                
-            }
-            catch (...)
-            {
-                log->error_log("ERROR:flush or close failed...");
-            }
-        }        
+        }
+        // flushed together with the parity blocks of concurrent operations
+        if (!fds.empty() && p_fileio->commit(&fds[0], fds.size()))
+        {
+            // the parity is not durable, the participants must not commit
+            log->error_log("ERROR:flush or close failed...");
+            p_op->ophead.status = opstatus_failure;
+        }
+        log->debug_log("flushed and closed %u handles.",fds.size());
         log->debug_log("STATUS:csid:%u,seq:%u,status:%u",p_op->ophead.cco_id.csid,p_op->ophead.cco_id.sequencenum, p_op->ophead.status);
         filelayout_raid *p_fl = (filelayout_raid*) &p_op->ophead.filelayout[0];
-        struct FileStripeList *p_fs = p_raid->get_stripes(p_fl,p_op->ophead.offset, p_op->ophead.length);
-        
-        std::map<StripeId,struct Stripe_layout*>::iterator it = p_fs->stripemap->begin();
-        for (it; it!=p_fs->stripemap->end();it++)
+        struct StripeCursor cursor;
+        struct StripeSpan span;
+        stripe_cursor_init(&cursor, p_op->ophead.offset, p_op->ophead.length);
+        while (p_raid->next_stripe(p_fl, &cursor, &span))
         {
-            log->debug_log("FilestripeList: stripeID:%llu",it->first);
-            std::map<StripeUnitId,struct StripeUnit*>::iterator it2 = it->second->blockmap->begin();
-            for (it2; it2!=it->second->blockmap->end();it2++)
+            log->debug_log("FilestripeList: stripeID:%llu",span.sid);
+            for (int u=0; u<span.unitcnt; u++)
             {
                 struct dstask_ccc_send_result *p_task = new struct dstask_ccc_send_result;
-                p_task->receiver=it2->second->assignedto;
+                p_task->receiver=span.units[u].assignedto;
                 memcpy(&p_task->dshead.ophead, &p_op->ophead , sizeof(struct OPHead));
                 p_task->dshead.ophead.subtype = send_result;   
                 p_task->dshead.ophead.type = ds_task_type;                
@@ -1960,9 +2104,12 @@ private:
         //for(it2; it2!= p_op->datamap_primco->end(); it2++)
         while (it2!=p_op->datamap_primco->end())
         {
-            log->debug_log("parity confirm start sid:%u",it2->first);
-            rc = p_docache->parityConfirm(p_op->ophead.inum, it2->first, it2->second->versionvec[default_groupsize] );
-            log->debug_log("parity confirm rc:%d, sid:%u",rc,it2->first);
+            if (p_op->ophead.status==opstatus_success)
+            {
+                log->debug_log("parity confirm start sid:%u",it2->first);
+                rc = p_docache->parityConfirm(p_op->ophead.inum, it2->first, it2->second->versionvec[default_groupsize] );
+                log->debug_log("parity confirm rc:%d, sid:%u",rc,it2->first);
+            }
             if (it2->second->paritymap!=NULL)
             {
                 log->debug_log("clean up parity map");
@@ -1995,31 +2142,13 @@ private:
         
         pthread_mutex_lock(&ops_mutex);
         log->debug_log("got ops lock");
-        bool found=false;
-        std::map<uint64_t, std::vector<struct OPHead*>*>::iterator itops = this->p_ops->find(p_op->ophead.offset);
-        if(itops!=this->p_ops->end())
-        {
-            log->debug_log("found entry");
-            std::vector<struct OPHead*>::iterator itvec = itops->second->begin();
-            for (itvec; itvec!= itops->second->end(); itvec++)
-            {
-                log->debug_log("check csid:%u,seq:%u",(*itvec)->cco_id.csid,(*itvec)->cco_id.sequencenum);
-                if ((*itvec)->cco_id.csid==p_op->ophead.cco_id.csid && (*itvec)->cco_id.sequencenum==p_op->ophead.cco_id.sequencenum)
-                {
-                    itops->second->erase(itvec);
-                    log->debug_log("removed operation from vector.");
-                    found=true;
-                    break;
-                }
-            }
-        }
+        bool found=opvec_erase(&p_op->ophead);
         if (!found)
         {
             log->debug_log("ERROR: entry not found");
         }
         pthread_mutex_unlock(&ops_mutex);
         //memset(&p_op->received_from,0,sizeof(p_op->received_from));        
-        free_FileStripeList(p_fs);
         log->debug_log("rc:%d",rc);
         return rc;
     }    
@@ -2034,7 +2163,7 @@ private:
         {
             filelayout_raid *p_fl = (filelayout_raid *) &p_op->ophead.filelayout[0];            
             StripeUnitId suid = p_raid->get_my_stripeunitid(p_fl,p_op->ophead.offset,this->id);
-            rc = p_docache->get_next_version_vector(p_op->ophead.inum, it->first, &it->second->versionvector[0], suid);
+            rc = p_docache->get_next_version_vector(p_op->ophead.inum, it->first, &it->second->versionvector[0], suid, false);
             
             struct dstask_ccc_stripewrite_cancommit *p_task = new struct dstask_ccc_stripewrite_cancommit;
 
@@ -2228,13 +2357,161 @@ private:
         return false;
     }
     
+    struct dstask_spn_send_read* read_task(struct operation_client_read *p_op, StripeId sid, StripeUnitId suid, struct StripeUnit *p_su)
+    {
+        struct dstask_spn_send_read *p_t = new struct dstask_spn_send_read;
+        p_t->dshead.ophead=p_op->ophead;
+        p_t->dshead.ophead.type = cl_task_type;
+        p_t->dshead.ophead.subtype = send_spn_read;
+        p_t->end = p_su->end;
+        p_t->receiver = p_su->assignedto;
+        p_t->stripeid = sid;
+        p_t->stripeunitid = suid;
+        p_t->offset = p_su->start;
+        return p_t;
+    }
     
+    /**
+     * @brief rebuilds the missing unit of a degraded stripe as the xor of the
+     * parity and all other units, zero padded to the unit size. The peers
+     * must carry the versions the parity was computed from.
+     * @return 0 if rebuilt, 1 if nothing to do or still waiting, -1 if the
+     * stripe is inconsistent
+     */
+    int rebuild_unit(struct operation_client_read *p_op, struct operation_group *p_gr)
+    {
+        filelayout_raid *p_fl = (filelayout_raid *)&p_op->ophead.filelayout[0];
+        size_t unitsize = p_fl->raid4.stripeunitsize;
+        StripeUnitId paritysuid = p_fl->raid4.groupsize-1;
+        struct StripeUnit *p_missing = NULL;
+        
+        std::map<StripeUnitId,struct StripeUnit*>::iterator it = p_gr->sumap->begin();
+        for (it; it!=p_gr->sumap->end(); it++)
+        {
+            if (it->second->newdata==NULL) p_missing = it->second;
+        }
+        if (p_missing==NULL) return 1;
+        it = p_gr->recovermap->find(paritysuid);
+        if (it==p_gr->recovermap->end() || it->second->do_recv==NULL) return 1;
+        struct data_object *p_par = it->second->do_recv;
+        if (!check_metadata_consistency(p_par)) return -1;
+        
+        void *in[PARITY_MAX_INPUTS];
+        std::vector<void*> padded;
+        int n=0;
+        in[n++] = p_par->data;
+        if (p_par->metadata.datalength<unitsize)
+        {
+            padded.push_back(calloc(1,unitsize));
+            memcpy(padded.back(), p_par->data, p_par->metadata.datalength);
+            in[0] = padded.back();
+        }
+        int rc=0;
+        for (StripeUnitId i=0; i<paritysuid && rc==0; i++)
+        {
+            struct StripeUnit *p_su = NULL;
+            it = p_gr->sumap->find(i);
+            if (it!=p_gr->sumap->end())
+            {
+                if (it->second==p_missing) continue;
+                p_su = it->second;
+            }
+            else
+            {
+                it = p_gr->recovermap->find(i);
+                if (it!=p_gr->recovermap->end()) p_su = it->second;
+            }
+            if (p_su==NULL || p_su->do_recv==NULL || n>=PARITY_MAX_INPUTS)
+            {
+                rc=1;
+                break;
+            }
+            struct data_object *p_peer = p_su->do_recv;
+            if (!check_metadata_consistency(p_peer) ||
+                p_peer->metadata.versionvector[i]!=p_par->metadata.versionvector[i])
+            {
+                log->debug_log("unit %u version %u, parity built from %u",i,p_peer->metadata.versionvector[i],p_par->metadata.versionvector[i]);
+                rc=-1;
+                break;
+            }
+            in[n] = p_peer->data;
+            if (p_peer->metadata.datalength<unitsize)
+            {
+                size_t l = p_peer->metadata.datalength;
+                padded.push_back(calloc(1,unitsize));
+                memcpy(padded.back(), p_peer->data, l);
+                in[n] = padded.back();
+            }
+            n++;
+        }
+        if (rc==0)
+        {
+            struct data_object *p_do = new struct data_object;
+            p_do->data = malloc(unitsize);
+            if (n>1)
+            {
+                calc_parity_n(&in[0], n, p_do->data, unitsize);
+            }
+            else
+            {
+                memcpy(p_do->data, in[0], unitsize);
+            }
+            size_t unitstart = p_missing->start - p_missing->start%unitsize;
+            p_do->metadata = p_par->metadata;
+            p_do->metadata.offset = unitstart;
+            p_do->metadata.datalength = p_missing->end-unitstart;
+            calc_parity(&p_do->metadata, sizeof(p_do->metadata), &p_do->checksum);
+            p_missing->do_recv = p_do;
+            p_missing->newdata = (char*)p_do->data;
+            p_missing->start = unitstart;
+            log->debug_log("rebuilt unit at offset:%llu from %d objects",unitstart,n);
+        }
+        std::vector<void*>::iterator itp = padded.begin();
+        for (itp; itp!=padded.end(); itp++)
+        {
+            free(*itp);
+        }
+        return rc;
+    }
+    
+    void free_recovermap(std::map<StripeUnitId,struct StripeUnit*> *p_map)
+    {
+        std::map<StripeUnitId,struct StripeUnit*>::iterator it = p_map->begin();
+        for (it; it!=p_map->end(); it++)
+        {
+            if (it->second->do_recv!=NULL)
+            {
+                free(it->second->do_recv->data);
+                delete it->second->do_recv;
+            }
+            delete it->second;
+        }
+        delete p_map;
+    }
+    
+    
+};
+
+
+/* inode partitions of the stripe manager table */
+#define OPMANAGER_DEFAULT_SHARDS 64
+
+struct opmap_shard {
+    pthread_mutex_t                         mutex;
+    std::map<InodeNumber, StripeManager*>   *map;
+    uint64_t                                lookups;
+    uint64_t                                contended;  // lookups that found the mutex taken
 };
 
+struct opmap_stats {
+    uint64_t    lookups;
+    uint64_t    contended;
+    size_t      inodes;
+};
 
 class OpManager {
 public:
-    OpManager(Logger *p_log, int (*p_cb)(queue_priorities, OPHead*), serverid_t myid,doCache *p_docache,Filestorage *fileio);
+    OpManager(Logger *p_log, int (*p_cb)(queue_priorities, OPHead*), serverid_t myid,doCache *p_docache,Filestorage *fileio, uint32_t shards=OPMANAGER_DEFAULT_SHARDS);
     OpManager(const OpManager& orig);
     virtual ~OpManager();
     //uint32_t getSequenceNumber();
@@ -2245,6 +2522,7 @@ public:
     int client_insert(struct operation_composite *op, void *newdata);
     int client_result(InodeNumber inum, struct CCO_id ccoid, opstatus result);
     int client_handle_read_response(struct data_object *p_do, InodeNumber inum, StripeId stripeid, StripeUnitId stripeunitid, struct CCO_id ccoid);
+    int client_read_degraded(struct operation_client_read *op);
     
     //int dataserver_prim_operation(struct operation_primcoordinator *p_op);
     int get_operation_structure(struct OPHead *p_head, struct OPHead **p_op);
@@ -2254,6 +2532,7 @@ public:
     int handle_prepare_msg(struct dstask_ccc_recv_prepare *p_task, struct operation_participant **part_out);
     int handle_cancommit_msg(struct dstask_cancommit *p_task);
     int handle_committed_msg(struct dstask_ccc_recv_committed *p_task);
+    int handle_primco_written(struct dstask_primco_written *p_task);
     int handle_docommit_msg(struct operation_dstask_docommit *p_task, struct operation_participant **part_out);
     int handle_result_msg(struct dstask_proccess_result *p_task, struct operation_participant **part_out);
     int handle_stripewrite_cancommit(struct dstask_ccc_stripewrite_cancommit_received *p_task);
@@ -2265,10 +2544,14 @@ public:
     void cleanup(struct operation_participant *op);
     void cleanup(struct operation_primcoordinator *op);
     
+    void timeout_check();
+    uint32_t get_shardcount();
+    void get_shard_stats(uint32_t shard, struct opmap_stats *p_stats);
+    void report();
+    
 private:
-    std::map<InodeNumber, StripeManager*> *p_opmap;
-    pthread_mutex_t globallock_mutex;
-    pthread_mutex_t opmap_getentry_mutex;
+    struct opmap_shard *shards;
+    uint32_t shardcnt;
     Logger *log;
     serverid_t id;
     doCache *p_docache;
@@ -2279,8 +2562,8 @@ private:
     int insert( void *data);
     
     int get_entry(InodeNumber inum, StripeManager **p_sm);
-    void opmap_lock();
-    void opmap_unlock();
+    struct opmap_shard* get_shard(InodeNumber inum);
+    void shard_lock(struct opmap_shard *p_shard);
 };
 
 
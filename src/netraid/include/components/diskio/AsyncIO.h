@@ -0,0 +1,115 @@
+/*
+ * File:   AsyncIO.h
+ * Author: markus
+ *
+ * Asynchronous disk I/O for the data server. Requests are submitted to an
+ * io_uring instance driven by raw system calls, a reaper thread runs the
+ * completion callbacks. Without io_uring a small I/O thread pool executes
+ * the requests. Work that is not a plain read or write (directory scans,
+ * unlinks, segment appends) always runs on the pool.
+ */
+
+#ifndef ASYNCIO_H
+#define	ASYNCIO_H
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#include "logging/Logger.h"
+
+#ifdef __NR_io_uring_setup
+#define AIO_HAVE_URING
+#endif
+
+/* submission queue entries, also bounds the requests in flight */
+#define AIO_DEFAULT_ENTRIES     256
+#define AIO_DEFAULT_THREADS     4
+/* registered buffers, large enough for a stripe unit and its metadata */
+#define AIO_BUFFER_COUNT        32
+#define AIO_BUFFER_SIZE         (1024*1024+4096)
+
+enum aio_op
+{
+    aio_read,
+    aio_write,
+    aio_fsync,
+    aio_call,       // runs fn on the I/O thread pool
+};
+
+struct aio_request
+{
+    enum aio_op op;
+    int         fd;
+    void        *buf;
+    size_t      length;
+    off_t       offset;
+    int         bufindex;   // registered buffer or -1
+    int         (*fn)(struct aio_request *p_req);
+    void        (*cb)(struct aio_request *p_req);
+    void        *arg;
+    int         res;        // bytes transfered, fn result or -errno
+    struct iovec iov;       // used by the ring
+};
+
+struct aio_uring;
+
+class AsyncIO
+{
+public:
+    AsyncIO(Logger *p_log, uint32_t entries, int threads, bool uring);
+    AsyncIO(const AsyncIO& orig);
+    virtual ~AsyncIO();
+
+    int start();
+    bool uses_uring();
+    int submit(struct aio_request *p_req);
+    int execute(struct aio_request *p_req);
+
+    void* get_buffer(size_t length, int *index);
+    void put_buffer(int index);
+
+    void init_request(struct aio_request *p_req, enum aio_op op);
+
+    void run_pool();
+    void run_reaper();
+
+private:
+    Logger *log;
+    uint32_t entries;
+    int threadcnt;
+    bool want_uring;
+    bool running;
+
+    struct aio_uring *p_ring;
+    volatile bool ring_failed;     // the reaper gave up, requests go to the pool
+    pthread_mutex_t sqmutex;
+    pthread_cond_t sqcond;
+    uint32_t inflight;
+    pthread_t reaper;
+
+    pthread_mutex_t poolmutex;
+    pthread_cond_t poolcond;
+    std::deque<struct aio_request*> *p_poolqueue;
+    std::vector<pthread_t> *p_pool;
+
+    pthread_mutex_t bufmutex;
+    void *buffers;
+    std::vector<int> *p_freebufs;
+
+    int setup_uring();
+    void teardown_uring();
+    int submit_uring(struct aio_request *p_req);
+    int submit_pool(struct aio_request *p_req);
+    void perform(struct aio_request *p_req);
+    void complete(struct aio_request *p_req, int res);
+};
+
+#endif	/* ASYNCIO_H */
+
@@ -27,24 +27,47 @@
 #include "global_types.h"
 #include "components/raidlibs/raid_data.h"
 #include "components/raidlibs/Libraid4.h"
+#include "components/diskio/SegmentStore.h"
+#include "components/diskio/GroupCommit.h"
+#include "components/diskio/AsyncIO.h"
 
 using namespace std;
 
+enum storage_layout
+{
+    layout_files,       // one file per stripe unit version
+    layout_segments,    // append-only segment files, see SegmentStore
+};
+
 
 class Filestorage
 {
 public:
     bool no_sync;
-    Filestorage(Logger *p_log, const char *p_base, serverid_t myid,bool dosync);
+    Filestorage(Logger *p_log, const char *p_base, serverid_t myid,bool dosync, enum storage_layout layout=layout_files, size_t segsize=0);
     Filestorage(const Filestorage& orig);
     virtual ~Filestorage();
     
     int write_file(struct operation_participant *p_part);
     int write_file(struct OPHead *p_head, struct datacollection_primco* p_dcol);
     int write_file(struct OPHead *p_head,std::map<StripeId,struct dataobject_collection*>*datamap);
+    int write_file_async(struct operation_participant *p_part, void (*cb)(void *arg, int rc), void *arg);
+    int write_file_async(struct OPHead *p_head, struct datacollection_primco* p_dcol, void (*cb)(void *arg, int rc), void *arg);
     int read_object(struct OPHead *p_head, std::map<StripeId,struct dataobject_collection*> *p_map);
     int read_stripe_object(InodeNumber inum, StripeId sid, struct data_object **p_out);
+    int read_stripe_metadata(InodeNumber inum, StripeId sid, struct dataobject_metadata *p_md);
+    int read_stripe_object_async(InodeNumber inum, StripeId sid, void (*cb)(void *arg, int rc, struct data_object *p_do), void *arg);
+    int write_stripe_object(InodeNumber inum, StripeId sid, uint32_t version, struct data_object *p_do);
+    int list_stripes(std::vector<std::pair<InodeNumber,StripeId> > *p_out);
+    int get_max_version(InodeNumber inum, StripeId sid, uint32_t *version);
     int remove_lower_than(InodeNumber inum, StripeId sid, uint32_t version);
+    int remove_lower_than_async(InodeNumber inum, StripeId sid, uint32_t version);
+    int compact();
+    int commit(int *fds, int n);
+    int commit_async(int *fds, int n, void (*cb)(void *arg, int rc), void *arg);
+    void set_commit_bounds(size_t maxbatch, uint32_t maxdelay);
+    int start_aio(bool uring, int threads);
+    std::string get_basedir();
     
 private:
     Logger *log;
@@ -52,13 +75,19 @@ private:
     serverid_t id;
     Libraid4 *p_raid;
     uint32_t size_metadata;
+    SegmentStore *p_segs;
+    GroupCommit *p_commit;
+    AsyncIO *p_aio;
     
 
     int create_block_object_prty(struct OPHead *p_head,struct dataobject_collection  *p_dcol, struct data_object *p_do);
     int create_block_object_recv(struct OPHead *p_head,struct dataobject_collection  *p_dcol, struct data_object *p_do);
     int _create_block_object(struct OPHead *p_head,struct dataobject_collection  *p_dcol, struct data_object *p_do);
     
-    int write_object(struct data_object *p_do, const char *file, int *fh);
+    int write_object(struct data_object *p_do, InodeNumber inum, StripeId sid, uint32_t version, int *fh);
+    struct aio_write_job* prepare_write(struct data_object *p_do, InodeNumber inum, StripeId sid, uint32_t version, int *fh, bool deferopen);
+    struct data_object* new_participant_object(struct operation_participant *p_part, struct dataobject_collection *p_dcol);
+    bool create_stripe_dir(InodeNumber inum, StripeId sid);
     void create_checksum(struct data_object *p_do);
     
     int get_max_version(std::string& dir,uint32_t *version);
@@ -0,0 +1,79 @@
+/*
+ * File:   GroupCommit.h
+ * Author: markus
+ *
+ * Batches the flushes of written stripe objects. Writers hand over the
+ * file handles of a finished write and get a completion once a single
+ * flusher thread synced them. Handles of the same file are synced only
+ * once per batch, so with the segment layout a batch costs one fdatasync.
+ * A batch spanning several files of one device is flushed with syncfs,
+ * every file is still checked by its own fdatasync for write errors.
+ */
+
+#ifndef GROUPCOMMIT_H
+#define	GROUPCOMMIT_H
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <deque>
+#include <map>
+
+#include "logging/Logger.h"
+
+/* number of file handles that close a batch */
+#define GROUPCOMMIT_DEFAULT_BATCH   64
+/* microseconds the flusher waits for a batch to fill up */
+#define GROUPCOMMIT_DEFAULT_DELAY   200
+
+struct commit_request
+{
+    int         *fds;
+    int         fdcnt;
+    void        (*cb)(void *arg, int rc);
+    void        *arg;
+    bool        done;
+    int         rc;
+};
+
+class GroupCommit
+{
+public:
+    GroupCommit(Logger *p_log, bool dosync, size_t maxbatch, uint32_t maxdelay);
+    GroupCommit(const GroupCommit& orig);
+    virtual ~GroupCommit();
+
+    int start();
+    void set_bounds(size_t maxbatch, uint32_t maxdelay);
+    int commit(int *fds, int n);
+    int commit_async(int *fds, int n, void (*cb)(void *arg, int rc), void *arg);
+    int flush_batch();
+
+    uint64_t batches;
+    uint64_t syncs;
+    uint64_t requests;
+
+private:
+    Logger *log;
+    bool dosync;
+    bool running;
+    size_t maxbatch;
+    uint32_t maxdelay;
+    size_t pendingfds;
+
+    pthread_t flusher;
+    pthread_mutex_t mutex;
+    pthread_cond_t workcond;
+    pthread_cond_t donecond;
+    std::deque<struct commit_request*> *p_queue;
+
+    struct commit_request* new_request(int *fds, int n);
+    int close_fds(int *fds, int n);
+};
+
+#endif	/* GROUPCOMMIT_H */
+
@@ -0,0 +1,105 @@
+/*
+ * File:   RebuildEngine.h
+ *
+ * Rebuilds the stripe units of a replaced data server. The engine walks the
+ * stripes found in the storage directories of the other servers, reads the
+ * surviving units and the parity of every stripe this server is part of and
+ * writes the missing unit. Progress is checkpointed so a restarted rebuild
+ * continues after the last finished batch.
+ */
+
+#ifndef REBUILDENGINE_H
+#define	REBUILDENGINE_H
+
+#include <pthread.h>
+#include <time.h>
+#include <map>
+#include <vector>
+#include <string>
+
+#include "global_types.h"
+#include "logging/Logger.h"
+#include "components/OperationManager/OpData.h"
+#include "components/raidlibs/raid_data.h"
+#include "components/raidlibs/Libraid4.h"
+#include "components/diskio/Filestorage.h"
+#include "tools/parity.h"
+
+#define REBUILD_DEFAULT_BATCH       64      // stripes read in parallel
+#define REBUILD_DEFAULT_RATE        0       // MB/s, 0 is unthrottled
+#define REBUILD_FOREGROUND_PCT      25      // share of the rate while foreground I/O is active
+#define REBUILD_BACKOFF_USLEEP      10000   // pause between batches under foreground load if unthrottled
+#define REBUILD_CHECKPOINT_FILE     "rebuild.checkpoint"
+
+typedef std::pair<InodeNumber,StripeId> rebuild_key;
+
+struct rebuild_stats {
+    uint64_t    total;      // stripes found on the peers
+    uint64_t    scanned;    // stripes examined so far
+    uint64_t    rebuilt;
+    uint64_t    skipped;    // not part of this server or already present
+    uint64_t    failed;
+    uint64_t    bytes;      // read and written
+    uint64_t    throttled;  // microseconds slept
+    time_t      started;
+    bool        running;
+    bool        done;
+};
+
+/* one stripe of a batch and the units read for it */
+struct rebuild_stripe {
+    rebuild_key                                 key;
+    std::vector<serverid_t>                     holders;
+    std::map<serverid_t,struct data_object*>    objects;
+};
+
+class RebuildEngine
+{
+public:
+    RebuildEngine(Logger *p_log, std::string storagedir, serverid_t myid, Filestorage *p_local, enum storage_layout layout, size_t segsize);
+    virtual ~RebuildEngine();
+
+    int start();
+    void stop();
+    int run();
+    void set_batch(uint32_t stripes);
+    void set_rate(uint32_t mbps);
+    void foreground_io();
+    void get_stats(struct rebuild_stats *p_stats);
+    void report();
+
+private:
+    Logger *log;
+    std::string storagedir;
+    serverid_t id;
+    Filestorage *p_local;
+    Libraid4 *p_raid;
+    enum storage_layout layout;
+    size_t segsize;
+    std::map<serverid_t,Filestorage*> peers;
+
+    uint32_t batch;
+    uint32_t rate;
+    uint64_t foreground;        // tasks seen, updated atomically
+    volatile bool stopflag;
+    pthread_t thread;
+    bool threadvalid;
+
+    pthread_mutex_t mutex;      // stats and the pending reads
+    pthread_cond_t cond;
+    uint32_t pending;
+    struct rebuild_stats stats;
+
+    int open_peers();
+    int scan(std::map<rebuild_key,std::vector<serverid_t> > *p_stripes);
+    int read_batch(std::vector<struct rebuild_stripe*> *p_batch, bool first);
+    int rebuild_stripe(struct rebuild_stripe *p_st);
+    void throttle(uint64_t bytes, uint64_t took_us);
+    std::string checkpoint_path();
+    bool load_checkpoint(rebuild_key *p_key);
+    int save_checkpoint(rebuild_key key);
+
+    static void read_done(void *arg, int rc, struct data_object *p_do);
+};
+
+#endif	/* REBUILDENGINE_H */
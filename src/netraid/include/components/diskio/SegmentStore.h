@@ -0,0 +1,109 @@
+/*
+ * File:   SegmentStore.h
+ * Author: markus
+ *
+ * Append-only storage of stripe unit versions. All versions written by a
+ * server go to a few large segment files instead of one file per version.
+ * An in-memory index maps (inum, sid, version) to the record location,
+ * compaction copies the live records out of mostly dead segments.
+ */
+
+#ifndef SEGMENTSTORE_H
+#define	SEGMENTSTORE_H
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <map>
+#include <vector>
+#include <string>
+
+#include "global_types.h"
+#include "logging/Logger.h"
+#include "components/raidlibs/raid_data.h"
+#include "tools/sys_tools.h"
+#include "tools/crc32c.h"
+
+#define SEGMENT_RECORD_MAGIC        0x5345474dU
+#define SEGMENT_DEFAULT_SIZE        (64*1024*1024)
+/* compact sealed segments with less than this percentage of live bytes */
+#define SEGMENT_COMPACT_LIVE_PCT    50
+/* bytes read at once while searching the next record after a bad one */
+#define SEGMENT_SCAN_WINDOW         (1024*1024)
+
+struct segment_record_head
+{
+    uint32_t    magic;
+    uint32_t    version;
+    InodeNumber inum;
+    StripeId    sid;
+    uint64_t    length;
+    uint32_t    crc;        // over the head with crc=0 and the payload
+};
+
+struct segment_entry
+{
+    uint32_t    segid;
+    size_t      offset;     // offset of the payload
+    size_t      length;     // payload length
+};
+
+struct segment_info
+{
+    int         fd;
+    size_t      size;
+    size_t      live;
+};
+
+typedef std::pair<InodeNumber,StripeId> segment_key;
+
+class SegmentStore
+{
+public:
+    SegmentStore(Logger *p_log, std::string dir, size_t segsize);
+    SegmentStore(const SegmentStore& orig);
+    virtual ~SegmentStore();
+
+    int append(InodeNumber inum, StripeId sid, uint32_t version, void *data, size_t length, int *fh);
+    int read(InodeNumber inum, StripeId sid, uint32_t version, void **data, size_t *length);
+    int read_head(InodeNumber inum, StripeId sid, uint32_t version, void *buf, size_t length);
+    int get_max_version(InodeNumber inum, StripeId sid, uint32_t *version);
+    int get_min_version(InodeNumber inum, StripeId sid, uint32_t *version);
+    int remove_lower_than(InodeNumber inum, StripeId sid, uint32_t version);
+    int compact();
+    int list(std::vector<segment_key> *p_out);
+
+private:
+    Logger *log;
+    std::string basedir;
+    size_t segsize;
+    uint32_t activeseg;
+
+    /* protects index and segments */
+    pthread_mutex_t mutex;
+    /* held shared during pread/pwrite, exclusive when a segment is closed */
+    pthread_rwlock_t seglock;
+
+    std::map<segment_key, std::map<uint32_t,struct segment_entry>*> *p_index;
+    std::map<uint32_t, struct segment_info> *p_segments;
+
+    std::string getPath(uint32_t segid);
+    int open_segment(uint32_t segid);
+    int recover();
+    int recover_segment(uint32_t segid, int fd);
+    int check_record(int fd, size_t size, size_t offset, struct segment_record_head *head);
+    int next_record(int fd, size_t size, size_t *offset, struct segment_record_head *head);
+    int reserve(size_t total, uint32_t *segid, size_t *offset, int *fd);
+    void index_insert(segment_key key, uint32_t version, struct segment_entry *e);
+    void drop_entry(struct segment_entry *e);
+    int compact_segment(uint32_t segid);
+};
+
+#endif	/* SEGMENTSTORE_H */
+
@@ -10,21 +10,60 @@
 
 #include <iostream>
 #include <pthread.h>
+#include <deque>
+#include <map>
+#include <vector>
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include "components/network/ServerManager.h"
+#include "components/network/ShmRing.h"
 #include "custom_protocols/global_protocol_data.h"
 #include "logging/Logger.h"
 
 using boost::asio::ip::tcp;
 
+#define ASYN_CLIENT_DEFAULT_CONNS   2   // connections per peer
+#define ASYN_CLIENT_MAX_BATCH       32  // messages per gathering write
+
+/* a message waiting in the send queue of a connection */
+struct asyn_send_req {
+    std::vector<boost::asio::const_buffer> bufs;
+    size_t total;
+    int rc;
+    bool done;
+};
+
+/**
+ * @brief one connection to a peer. A sender that finds the connection
+ * idle writes for everybody: it takes up to ASYN_CLIENT_MAX_BATCH queued
+ * messages and sends them with one gathering write. The other senders
+ * wait, one of them writes the next batch if its message is not done.
+ */
+struct asyn_conn {
+    tcp::socket *p_sock;
+    ShmRing *p_ring;        // used instead of the socket for local peers
+    std::deque<struct asyn_send_req*> queue;
+    bool writing;
+    size_t pending;         // bytes queued or being written
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+struct asyn_peer {
+    std::vector<struct asyn_conn*> conns;
+    uint32_t next;          // round robin among equally loaded connections
+};
+
 template<class data> class AsynClient {
 public:
-    AsynClient(Logger *p_log, ServerManager *sm)
+    AsynClient(Logger *p_log, ServerManager *sm, uint32_t conns=ASYN_CLIENT_DEFAULT_CONNS)
     {
         log = p_log;
         p_sm = sm;
+        connections = (conns>0) ? conns : 1;
         sockmutex = PTHREAD_MUTEX_INITIALIZER;
+        msgs_sent = 0;
+        writes = 0;
     }
     
     AsynClient(const AsynClient& orig)
@@ -33,142 +72,310 @@ public:
 
     virtual ~AsynClient()
     {
+        typename std::map<serverid_t,struct asyn_peer*>::iterator it = peers.begin();
+        for (it; it!=peers.end(); it++)
+        {
+            std::vector<struct asyn_conn*>::iterator itc = it->second->conns.begin();
+            for (itc; itc!=it->second->conns.end(); itc++)
+            {
+                close_conn(*itc);
+                pthread_mutex_destroy(&(*itc)->mutex);
+                pthread_cond_destroy(&(*itc)->cond);
+                delete *itc;
+            }
+            delete it->second;
+        }
+        pthread_mutex_destroy(&sockmutex);
     }
     
+    /**
+     * @brief number of connections opened to each peer, applies to peers
+     * not contacted yet
+     */
+    void set_connections(uint32_t conns)
+    {
+        pthread_mutex_lock(&sockmutex);
+        connections = (conns>0) ? conns : 1;
+        pthread_mutex_unlock(&sockmutex);
+        log->debug_log("connections per peer:%u",connections);
+    }
+
+    void get_stats(uint64_t *p_msgs, uint64_t *p_writes)
+    {
+        *p_msgs = msgs_sent;
+        *p_writes = writes;
+    }
+
     int send(data *p_msg, serverid_t id)
     {
-        int rc=0;
+        struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_msg;
+        std::vector<boost::asio::const_buffer> payload;
+        if (p_customhead->datablock!=NULL)
+        {
+            payload.push_back(boost::asio::buffer(p_customhead->datablock, p_customhead->datalength));
+        }
+        return send(p_msg, id, payload);
+    }
+    
+    /**
+     * @brief sends the head followed by the payload buffers on the least
+     * loaded connection to the server, the buffers are not copied and must
+     * stay valid until it returns. datalength is set to the payload size.
+     */
+    int send(data *p_msg, serverid_t id, const std::vector<boost::asio::const_buffer>& payload)
+    {
+        int rc=-1;
         int retry=0;
-        server_map_entry *p_entry ;
-        //pthread_mutex_lock(&sockmutex);
+        if (p_sm->get_server_entry(&id)==NULL)
+        {
+            log->debug_log("Error. no socket");
+            return -1;
+        }
+        struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_msg;
+        struct asyn_send_req req;
+        req.total = sizeof(data);
+        req.bufs.push_back(boost::asio::buffer(p_msg, sizeof(data)));
+        std::vector<boost::asio::const_buffer>::const_iterator it = payload.begin();
+        for (it; it!=payload.end(); it++)
+        {
+            req.bufs.push_back(*it);
+            req.total += boost::asio::buffer_size(*it);
+        }
+        p_customhead->datalength = req.total-sizeof(data);
+        struct asyn_peer *p_peer = get_peer(id);
         while (retry<4)
-        {            
-            try
+        {
+            req.rc = 0;
+            req.done = false;
+            rc = submit(id, select_conn(p_peer), &req);
+            if (!rc) break;
+            log->error_log("ERROR:send failed...");
+            retry++;
+        }
+        log->debug_log("done:%d.",rc);
+        return rc;
+    }
+
+        
+private:
+        boost::asio::io_service io_service;
+        ServerManager *p_sm;
+        Logger *log;
+        pthread_mutex_t sockmutex;      // peers
+        std::map<serverid_t,struct asyn_peer*> peers;
+        uint32_t connections;
+        uint64_t msgs_sent;
+        uint64_t writes;
+        
+        struct asyn_peer* get_peer(serverid_t id)
+        {
+            struct asyn_peer *p_peer;
+            pthread_mutex_lock(&sockmutex);
+            typename std::map<serverid_t,struct asyn_peer*>::iterator it = peers.find(id);
+            if (it==peers.end())
             {
-                //log->debug_log("send to id:%u.msg:%p",id,p_msg);
-                struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_msg;
-                //boost::asio::ip::tcp::socket* p_sock= this->p_sm->get_socket(&id);
-                p_entry = p_sm->get_server_entry(&id);
-                if (p_entry==NULL)
+                p_peer = new struct asyn_peer;
+                p_peer->next = 0;
+                for (uint32_t i=0; i<connections; i++)
                 {
-                    log->debug_log("Error. no socket");
-                    return -1;
+                    struct asyn_conn *p_conn = new struct asyn_conn;
+                    p_conn->p_sock = NULL;
+                    p_conn->p_ring = NULL;
+                    p_conn->writing = false;
+                    p_conn->pending = 0;
+                    pthread_mutex_init(&p_conn->mutex, NULL);
+                    pthread_cond_init(&p_conn->cond, NULL);
+                    p_peer->conns.push_back(p_conn);
                 }
-                if (p_entry->asio_sock==NULL)
+                peers[id] = p_peer;
+            }
+            else
+            {
+                p_peer = it->second;
+            }
+            pthread_mutex_unlock(&sockmutex);
+            return p_peer;
+        }
+
+        /**
+         * @brief the connection with the fewest bytes in flight, ties are
+         * broken round robin
+         */
+        struct asyn_conn* select_conn(struct asyn_peer *p_peer)
+        {
+            uint32_t cnt = p_peer->conns.size();
+            uint32_t start = __sync_fetch_and_add(&p_peer->next, 1);
+            struct asyn_conn *p_best = NULL;
+            for (uint32_t i=0; i<cnt; i++)
+            {
+                struct asyn_conn *p_conn = p_peer->conns[(start+i)%cnt];
+                size_t pending = p_conn->pending;
+                if (pending==0) return p_conn;
+                if (p_best==NULL || pending<p_best->pending) p_best = p_conn;
+            }
+            return p_best;
+        }
+
+        void close_conn(struct asyn_conn *p_conn)
+        {
+            if (p_conn->p_sock!=NULL)
+            {
+                boost::system::error_code ec;
+                p_conn->p_sock->close(ec);
+                delete p_conn->p_sock;
+                p_conn->p_sock = NULL;
+            }
+            delete p_conn->p_ring;
+            p_conn->p_ring = NULL;
+        }
+
+        /**
+         * @brief queues the message on the connection and waits until it is
+         * written, by this thread or by the one writing at the moment
+         */
+        int submit(serverid_t id, struct asyn_conn *p_conn, struct asyn_send_req *p_req)
+        {
+            pthread_mutex_lock(&p_conn->mutex);
+            p_conn->queue.push_back(p_req);
+            p_conn->pending += p_req->total;
+            while (!p_req->done)
+            {
+                if (p_conn->writing)
                 {
-                    rc = connect(&id);
-                    if (!rc)
-                    {
-                        p_entry = this->p_sm->get_server_entry(&id);
-                        //log->debug_log("psock = %p.",p_sock);
-                    }
-                    else
-                    {
-                        log->debug_log("connect failded.");
-                    }
+                    pthread_cond_wait(&p_conn->cond, &p_conn->mutex);
                 }
                 else
                 {
-                    log->debug_log("socket already connected.");
+                    // a waiting sender takes over once this batch is out
+                    p_conn->writing = true;
+                    drain(id, p_conn);
+                    p_conn->writing = false;
+                    pthread_cond_broadcast(&p_conn->cond);
                 }
-                if (p_entry==NULL || rc!=0)
+            }
+            pthread_mutex_unlock(&p_conn->mutex);
+            return p_req->rc;
+        }
+
+        /**
+         * @brief writes a batch of queued messages with one gathering
+         * write. Called with the connection mutex held, it is released
+         * during connect and write.
+         */
+        void drain(serverid_t id, struct asyn_conn *p_conn)
+        {
+            std::vector<struct asyn_send_req*> batch;
+            std::vector<boost::asio::const_buffer> bufs;
+            size_t total=0;
+            while (!p_conn->queue.empty() && batch.size()<ASYN_CLIENT_MAX_BATCH)
+            {
+                struct asyn_send_req *p_req = p_conn->queue.front();
+                p_conn->queue.pop_front();
+                batch.push_back(p_req);
+                bufs.insert(bufs.end(), p_req->bufs.begin(), p_req->bufs.end());
+                total += p_req->total;
+            }
+            tcp::socket *p_sock = p_conn->p_sock;
+            ShmRing *p_ring = p_conn->p_ring;
+            pthread_mutex_unlock(&p_conn->mutex);
+            int rc=0;
+            if (p_sock==NULL && p_ring==NULL)
+            {
+                p_ring = connect_shm(&id);
+                if (p_ring==NULL) p_sock = connect(&id);
+                if (p_sock==NULL && p_ring==NULL)
                 {
-                    log->warning_log("Socket error.");
+                    log->debug_log("connect failded.");
+                    rc=-1;
                 }
-                else
+            }
+            if (!rc && p_ring!=NULL)
+            {
+                rc = p_ring->write(bufs);
+                log->debug_log("messages:%u, size:%llu, shared memory rc:%d.",batch.size(),total,rc);
+                __sync_fetch_and_add(&writes, 1);
+                __sync_fetch_and_add(&msgs_sent, batch.size());
+            }
+            else if (!rc)
+            {
+                log->debug_log("start sending...");
+                boost::system::error_code ec;
+                size_t sent = boost::asio::write(*p_sock, bufs, ec);
+                log->debug_log("messages:%u, size:%llu, sent size:%llu.",batch.size(),total,sent);
+                if (ec || sent!=total)
                 {
-                    log->debug_log("start sending...");
-                    pthread_mutex_lock(&p_entry->sockmutex);
-                    if (p_customhead->datablock==NULL) p_customhead->datalength=0;
-                    size_t sent;
-                    sent = boost::asio::write(*p_entry->asio_sock, boost::asio::buffer(p_msg, sizeof(data)));
-                    log->debug_log("headsize: %u, sent size:%u.", sizeof(data),sent);
-                    if (sent==sizeof(data))
-                    {
-                        if (p_customhead->datablock!=NULL)
-                        {
-                            log->debug_log("Send data block:size:%llu, pointer:%p.",p_customhead->datalength,p_customhead->datablock);
-                            sent = boost::asio::write(*p_entry->asio_sock, boost::asio::buffer(p_customhead->datablock, p_customhead->datalength));
-                            log->debug_log("Sent:%llu",sent);
-                            rc = 0;
-                            if (sent!=p_customhead->datalength)
-                            {
-                                rc=-1;
-                                log->warning_log("send-length missmatch");
-                            }
-                            //else
-                            //{
-                            //    log->debug_log("sent:%u: OK",sent);
-                            //}
-                        }
-                        else
-                        {
-                            log->debug_log("No datablock attached. return ok");
-                            rc=0;
-                        }
-                    }
-                    else
-                    {
-                        log->debug_log("Error, head sent length missmatch:%u-%u",sent,sizeof(data));
-                        rc=-1;
-                    }
-                    pthread_mutex_unlock(&p_entry->sockmutex);
-                    //p_sock->close();
+                    log->warning_log("send failed:%s",ec.message().c_str());
+                    rc=-1;
                 }
-                break;
+                __sync_fetch_and_add(&writes, 1);
+                __sync_fetch_and_add(&msgs_sent, batch.size());
             }
-            catch(...)
+            pthread_mutex_lock(&p_conn->mutex);
+            p_conn->p_sock = p_sock;
+            p_conn->p_ring = p_ring;
+            if (rc)
             {
-                log->error_log("ERROR:send failed...");
-                retry++;
-                pthread_mutex_unlock(&p_entry->sockmutex);
-                delete p_entry->asio_sock;
-                p_entry->asio_sock=NULL;
+                close_conn(p_conn);
+            }
+            std::vector<struct asyn_send_req*>::iterator it = batch.begin();
+            for (it; it!=batch.end(); it++)
+            {
+                p_conn->pending -= (*it)->total;
+                (*it)->rc = rc;
+                (*it)->done = true;
             }
         }
-        //pthread_mutex_unlock(&sockmutex);
-        log->debug_log("done:%d.",rc);
-        return rc;
-    }
 
-        
-private:
-        boost::asio::io_service io_service;
-        ServerManager *p_sm;
-        Logger *log;
-        pthread_mutex_t sockmutex;
-        
-        int connect(serverid_t *servid)
+        /**
+         * @brief passes a shared memory ring to a server on this host,
+         * NULL if the server is remote or offers no ring
+         */
+        ShmRing* connect_shm(serverid_t *servid)
         {
-            int rc=0;
+            if (!p_sm->is_local(*servid)) return NULL;
+            ipaddress_t dest;
+            uint16_t port;
+            if (p_sm->get_server_address(servid, &dest, &port)) return NULL;
+            ShmRing *p_ring = new ShmRing(log);
+            if (p_ring->connect(port))
+            {
+                delete p_ring;
+                return NULL;
+            }
+            log->debug_log("sid:%u over shared memory.",*servid);
+            return p_ring;
+        }
+
+        tcp::socket* connect(serverid_t *servid)
+        {
+            tcp::socket *s = NULL;
             try
             {                
                 log->debug_log("sid:%u.",*servid);
-                boost::asio::io_service io_service;
                 tcp::resolver resolver(io_service);
 
                 ipaddress_t dest;
                 uint16_t port;
                 this->p_sm->get_server_address(servid, &dest,&port);            
-                char *port_str = (char *) malloc(8);
+                char port_str[8];
                 snprintf(port_str,8, "%u", port);            
                 log->debug_log("dest=%s, port:%s",dest,port_str);
 
                 tcp::resolver::query query(tcp::v4(),&dest[0], port_str);
                 tcp::resolver::iterator iterator = resolver.resolve(query);
-                tcp::socket *s = new tcp::socket(io_service);
+                s = new tcp::socket(io_service);
                 s->connect(*iterator);
-                this->p_sm->register_socket(servid,s);
-                free(port_str);
-                log->debug_log("done:rc=%d",rc);
+                s->set_option(tcp::no_delay(true));
+                log->debug_log("done");
             }
             catch(...)
             {
                 log->debug_log("Could not connect to id :%u",*servid);
-                rc=-1;
+                delete s;
+                s = NULL;
             }
                     
-            return rc;
+            return s;
         }
 };
 
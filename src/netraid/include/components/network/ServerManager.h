@@ -47,6 +47,7 @@ public:
     uint32_t get_server_count(uint32_t *count);
     uint32_t get_server_address(serverid_t *id, ipaddress_t *dest, uint16_t *port);
     bool     exists(serverid_t id);
+    bool     is_local(serverid_t id);
     uint32_t get_ids(std::vector<serverid_t> *asyn_tcp_server);
     uint32_t register_socket(serverid_t *servid, boost::asio::ip::tcp::socket *sock);
     boost::asio::ip::tcp::socket* get_socket(serverid_t *id);
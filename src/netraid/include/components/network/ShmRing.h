@@ -0,0 +1,68 @@
+/*
+ * File:   ShmRing.h
+ *
+ * Byte pipe between two processes on the same host. The bytes are kept in
+ * a ring in a shared memory region, eventfds ring the doorbell of the
+ * reader when bytes were added and of the writer when space was freed.
+ * Messages use the same framing as on a TCP connection: the head followed
+ * by the payload.
+ */
+
+#ifndef SHMRING_H
+#define	SHMRING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "logging/Logger.h"
+
+#define SHM_RING_DEFAULT_SIZE   (4*1024*1024)
+#define SHM_RING_SOCKET_PREFIX  "/tmp/netraid_shm_"     // followed by the tcp port
+#define SHM_RING_FDS            3                       // region, data and space doorbell
+
+/* at the start of the region, the ring follows */
+struct shm_ring_ctl {
+    volatile uint64_t head;             // bytes written
+    volatile uint64_t tail;             // bytes consumed
+    uint64_t size;
+    volatile uint32_t writer_waiting;
+};
+
+class ShmRing
+{
+public:
+    ShmRing(Logger *p_log);
+    virtual ~ShmRing();
+
+    int create(size_t size);
+    int attach(int fds[SHM_RING_FDS]);
+    int connect(uint16_t port);
+    int accept(int sockfd);
+
+    int write(const std::vector<boost::asio::const_buffer>& bufs);
+    ssize_t read_some(void *buf, size_t length);
+    ssize_t available();
+    int get_data_fd();
+    int get_sock_fd();
+
+    static std::string socket_path(uint16_t port);
+
+private:
+    Logger *log;
+    struct shm_ring_ctl *p_ctl;
+    char *ring;
+    size_t mapsize;
+    uint64_t size;      // of the ring, the peer may overwrite the copy in the region
+    int memfd;
+    int data_fd;        // signaled when bytes were added
+    int space_fd;       // signaled when bytes were consumed and the writer waits
+    int sock_fd;        // unix socket to the peer, closed when it is gone
+
+    int wait_space();
+    void cleanup();
+};
+
+#endif	/* SHMRING_H */
@@ -11,9 +11,12 @@
 #include <cstdlib>
 #include "pthread.h"
 #include <iostream>
+#include <vector>
+#include <unistd.h>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include "logging/Logger.h"
+#include "components/network/ShmRing.h"
 
 #include "coco/communication/ConcurrentQueue.h"
 #include "custom_protocols/global_protocol_data.h"
@@ -22,14 +25,47 @@ using boost::asio::ip::tcp;
 
 static ConcurrentQueue<void*> *p_workerqueue= new ConcurrentQueue<void*>;
 
-struct sockdata
+/**
+ * @brief optional receive hook. Fills the buffers the payload of the given
+ * head is read into and sets its datablock, returns non zero to receive
+ * the payload into a plain malloc'd datablock.
+ */
+typedef int (*scatter_fn)(void *p_head, std::vector<boost::asio::mutable_buffer> *p_bufs);
+
+#define ASYN_TCP_DEFAULT_LOOPS  2   // event loop threads, including the caller's
+
+static void* asyn_tcp_loop(void *ios)
 {
-    void (*cb)(void *);
-    tcp::socket *p_socket;
-    bool killthread;
-    bool threaded;
-};
+    boost::asio::io_service *io_service = (boost::asio::io_service *) ios;
+    io_service->run();
+    return NULL;
+}
+
+/**
+ * @brief sets up the buffers the payload of a received head is read into
+ * @return true if the datablock was allocated here
+ */
+static bool prepare_payload(void *p_head, scatter_fn scatter, std::vector<boost::asio::mutable_buffer> *p_bufs)
+{
+    struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
+    p_bufs->clear();
+    if (scatter!=NULL && scatter(p_head, p_bufs)==0)
+    {
+        return false;
+    }
+    p_bufs->clear();
+    p_customhead->datablock = malloc(p_customhead->datalength);
+    p_bufs->push_back(boost::asio::buffer(p_customhead->datablock,p_customhead->datalength));
+    return true;
+}
 
+/**
+ * @brief one connection. Messages are received by a chain of asynchronous
+ * reads on the event loop threads: the head, then its payload, then the
+ * complete message is handed to the callback and the next head is read.
+ * There is at most one read outstanding, so the handlers of a session
+ * never run concurrently.
+ */
 template<class data2>class session
 {
 public:
@@ -37,39 +73,26 @@ public:
   void (*pushCallback)(void*);
   session(boost::asio::io_service& io_service ,
           void (*cb)(void *),
-          Logger *p_log)
+          Logger *p_log,
+          scatter_fn scatter=NULL)
     : socket_(io_service)
   {
         pushCallback = cb;
         log=p_log;
-        p_s = new sockdata;
-        p_s->cb = pushCallback;
-        p_s->p_socket = &socket_;
-        p_s->threaded=false;
-        p_s->killthread = false;
-        
-        /*struct timeval tv;
-        tv.tv_sec  = 1; 
-        tv.tv_usec = 0;         
-        setsockopt(socket().native(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-        setsockopt(socket().native(), SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-*/
+        p_scatter = scatter;
+        p_head = NULL;
+        payload = false;
+        owned = false;
+        first = true;
+        closed = 0;
   }
 
   ~session()
   {
       log->debug_log("Shuting down session");
-      p_s->killthread=true;
-      log->debug_log("done.");
-      if (p_s->p_socket->is_open()) p_s->p_socket->close();
-      log->debug_log("done.");
-      if (p_s->threaded)
-      {
-          //pthread_cancel(worker_thread);
-          //pthread_join(worker_thread,NULL);
-      }
-      log->debug_log("done.");
-      delete p_s;
+      boost::system::error_code ec;
+      if (socket_.is_open()) socket_.close(ec);
+      discard();
       log->debug_log("done.");
   }
   
@@ -78,119 +101,350 @@ public:
       return socket_;
   }
 
+  /**
+   * @brief starts receiving, returns without blocking
+   */
   void start()
   {    
-      data2 *p_head = new data2;
-      boost::asio::read(socket_, boost::asio::buffer(p_head, sizeof(data2)));
-      struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
+      read_head();
+  }
 
-      boost::asio::ip::tcp::endpoint endpoint = socket_.remote_endpoint();
-      p_customhead->ip = (char *)malloc(32);
-      sprintf(p_customhead->ip,"%s",endpoint.address().to_string().c_str());
+  /* set once the connection failed and no read is outstanding */
+  bool is_closed()
+  {
+      return __sync_fetch_and_add(&closed, 0)!=0;
+  }
 
-      p_customhead->datablock = malloc(p_customhead->datalength);
-      boost::asio::read(
-            socket_, 
-            boost::asio::buffer(p_customhead->datablock,p_customhead->datalength));
+  void close()
+  {
+      boost::system::error_code ec;
+      socket_.close(ec);
+  }
 
-      pushCallback(p_head);
-      log->debug_log("done reading");      
-      pthread_create(&worker_thread, NULL,handle_write ,p_s);
+private:
+  void read_head()
+  {
+      p_head = new data2;
+      boost::asio::async_read(socket_, boost::asio::buffer(p_head, sizeof(data2)),
+          boost::bind(&session::handle_head, this,
+            boost::asio::placeholders::error));
   }
-  
-  
-  static void* handle_write(void*obj)
+
+  void handle_head(const boost::system::error_code& error)
   {
-      struct sockdata *p_s = (struct sockdata * ) obj;
-      p_s->threaded=true;
-      try
+      if (error)
       {
-          while(!p_s->killthread)
+          fail(error);
+          return;
+      }
+      struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
+      p_customhead->ip = NULL;
+      p_customhead->datablock = NULL;
+      if (first)
+      {
+          // the first message of a connection carries the peer address
+          boost::system::error_code ec;
+          boost::asio::ip::tcp::endpoint endpoint = socket_.remote_endpoint(ec);
+          if (!ec)
           {
-            //printf("session handle write\n");
-            //if (!error)
-            //{
-                
-                data2 *p_head = new data2;
-                boost::asio::read(*p_s->p_socket, boost::asio::buffer(p_head, sizeof(data2)));
-                struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
-
-                p_customhead->datablock = malloc(p_customhead->datalength);
-                p_customhead->ip=NULL;
-                boost::asio::read(
-                        *p_s->p_socket, 
-                        boost::asio::buffer(p_customhead->datablock,p_customhead->datalength));
-//                socket_.async_read_some(boost::asio::buffer(p_customhead->datablock,p_customhead->datalength),
-//                    boost::bind(&session::handle_read, this,
-//                    boost::asio::placeholders::error,
-//                    boost::asio::placeholders::bytes_transferred));
-            //    log->debug_log("Received: stored at:%p.\n",p_customhead->datablock);
-                //session::pushCallback(p_head);
-                //if (p_customhead->datalength==4) printf("Result:%u\n",*(uint32_t*)p_customhead->datablock);
-                    
-                p_s->cb(p_head);
-                //p_workerqueue->push((void*)p_head);
-                //printf("CB:done\n");
-           /*/ }
-            else
-            {
-              delete this;
-            }**/
+              p_customhead->ip = (char *)malloc(32);
+              sprintf(p_customhead->ip,"%s",endpoint.address().to_string().c_str());
           }
+          first = false;
       }
-      catch (boost::system::system_error &e) 
-      { 
-        /*boost::system::error_code ec = e.code(); 
-        std::cerr << ec.value() << std::endl; 
-        std::cerr << ec.category().name() << std::endl; **/
-        /*if (p_s->p_socket->is_open())
-          {
-              p_s->p_socket->cancel();
-              p_s->p_socket->close();        
-          }*/
-      } /*
-      catch(...)
+      payload = true;
+      owned = prepare_payload(p_head, p_scatter, &bufs);
+      boost::asio::async_read(socket_, bufs,
+          boost::bind(&session::handle_payload, this,
+            boost::asio::placeholders::error));
+  }
+
+  void handle_payload(const boost::system::error_code& error)
+  {
+      if (error)
+      {
+          fail(error);
+          return;
+      }
+      data2 *p_done = p_head;
+      p_head = NULL;
+      payload = false;
+      pushCallback(p_done);
+      read_head();
+  }
+
+  void fail(const boost::system::error_code& error)
+  {
+      if (error!=boost::asio::error::eof && error!=boost::asio::error::operation_aborted)
+      {
+          log->warning_log("connection failed:%s",error.message().c_str());
+      }
+      boost::system::error_code ec;
+      socket_.close(ec);
+      discard();
+      __sync_lock_test_and_set(&closed, 1);
+  }
+
+  /* frees a partly received message */
+  void discard()
+  {
+      if (p_head==NULL) return;
+      if (payload)
+      {
+          struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
+          if (p_customhead->ip!=NULL) free(p_customhead->ip);
+          if (owned) free(p_customhead->datablock);
+      }
+      delete p_head;
+      p_head = NULL;
+  }
+
+  tcp::socket socket_;
+  scatter_fn p_scatter;
+  std::vector<boost::asio::mutable_buffer> bufs;
+  data2 *p_head;          // message being received
+  bool payload;           // the head of p_head is complete
+  bool owned;             // its datablock was allocated here
+  bool first;
+  int closed;
+  Logger *log;
+};
+
+/**
+ * @brief a peer on the same host sending through a shared memory ring.
+ * The doorbell of the ring wakes an event loop thread, which frames the
+ * bytes in the ring exactly like those of a socket. The unix socket the
+ * ring was passed on is watched to notice when the peer is gone.
+ */
+template<class data2>class shm_session
+{
+public:
+  void (*pushCallback)(void*);
+  shm_session(boost::asio::io_service& io_service,
+          void (*cb)(void *),
+          Logger *p_log,
+          scatter_fn scatter,
+          ShmRing *p_ring)
+    : doorbell_(io_service, dup(p_ring->get_data_fd())),
+      peer_(io_service, dup(p_ring->get_sock_fd())),
+      strand_(io_service)
+  {
+        pushCallback = cb;
+        log = p_log;
+        p_scatter = scatter;
+        this->p_ring = p_ring;
+        p_head = NULL;
+        received = 0;
+        payload = false;
+        owned = false;
+        first = true;
+        outstanding = 0;
+        closed = 0;
+  }
+
+  ~shm_session()
+  {
+      close();
+      discard();
+      delete p_ring;
+  }
+
+  void start()
+  {
+      outstanding = 2;
+      arm_doorbell();
+      peer_.async_read_some(boost::asio::buffer(&peerbyte, 1),
+          strand_.wrap(boost::bind(&shm_session::handle_peer, this,
+            boost::asio::placeholders::error)));
+  }
+
+  bool is_closed()
+  {
+      return __sync_fetch_and_add(&closed, 0)!=0;
+  }
+
+  void close()
+  {
+      boost::system::error_code ec;
+      doorbell_.close(ec);
+      peer_.close(ec);
+  }
+
+private:
+  void arm_doorbell()
+  {
+      boost::asio::async_read(doorbell_, boost::asio::buffer(&bell, sizeof(bell)),
+          strand_.wrap(boost::bind(&shm_session::handle_doorbell, this,
+            boost::asio::placeholders::error)));
+  }
+
+  void handle_doorbell(const boost::system::error_code& error)
+  {
+      if (error || consume())
       {
-          
-          if (p_s->p_socket->is_open())
+          fail();
+          return;
+      }
+      arm_doorbell();
+  }
+
+  /**
+   * @brief the peer never sends on the socket, any completion means it is
+   * gone. What it wrote before is still delivered.
+   */
+  void handle_peer(const boost::system::error_code& error)
+  {
+      consume();
+      fail();
+  }
+
+  /**
+   * @brief frames everything in the ring and hands complete messages to
+   * the callback, a partial message is continued on the next doorbell
+   * @return 0, or -1 if the ring is broken
+   */
+  int consume()
+  {
+      ssize_t n;
+      while (true)
+      {
+          if (p_head==NULL)
+          {
+              p_head = new data2;
+              received = 0;
+          }
+          if (!payload)
           {
-              p_s->p_socket->cancel();
-              p_s->p_socket->close();        
+              n = p_ring->read_some((char*)p_head+received, sizeof(data2)-received);
+              if (n<0) return -1;
+              received += n;
+              if (received<sizeof(data2)) return 0;
+              struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
+              p_customhead->ip = NULL;
+              p_customhead->datablock = NULL;
+              if (first)
+              {
+                  p_customhead->ip = (char *)malloc(32);
+                  sprintf(p_customhead->ip,"127.0.0.1");
+                  first = false;
+              }
+              payload = true;
+              owned = prepare_payload(p_head, p_scatter, &bufs);
+              bufindex = 0;
+              received = 0;
           }
-      }*/
-      pthread_exit(0);
+          while (bufindex<bufs.size())
+          {
+              size_t length = boost::asio::buffer_size(bufs[bufindex]);
+              char *dst = (char*) boost::asio::buffer_cast<void*>(bufs[bufindex]);
+              n = p_ring->read_some(dst+received, length-received);
+              if (n<0) return -1;
+              received += n;
+              if (received<length) return 0;
+              bufindex++;
+              received = 0;
+          }
+          data2 *p_done = p_head;
+          p_head = NULL;
+          payload = false;
+          pushCallback(p_done);
+      }
   }
 
-private:
-  tcp::socket socket_;
-  pthread_t worker_thread;
-  struct sockdata *p_s; 
+  void fail()
+  {
+      close();
+      if (--outstanding==0)
+      {
+          discard();
+          __sync_lock_test_and_set(&closed, 1);
+      }
+  }
+
+  void discard()
+  {
+      if (p_head==NULL) return;
+      if (payload)
+      {
+          struct custom_protocol_reqhead_t  *p_customhead = (struct custom_protocol_reqhead_t*)p_head;
+          if (p_customhead->ip!=NULL) free(p_customhead->ip);
+          if (owned) free(p_customhead->datablock);
+      }
+      delete p_head;
+      p_head = NULL;
+  }
+
+  boost::asio::posix::stream_descriptor doorbell_;
+  boost::asio::posix::stream_descriptor peer_;
+  boost::asio::io_service::strand strand_;      // doorbell and peer handlers
+  ShmRing *p_ring;
+  scatter_fn p_scatter;
+  std::vector<boost::asio::mutable_buffer> bufs;
+  size_t bufindex;
+  size_t received;        // of the head or of bufs[bufindex]
+  uint64_t bell;
+  char peerbyte;
+  data2 *p_head;
+  bool payload;
+  bool owned;
+  bool first;
+  int outstanding;        // handlers still to run
+  int closed;
   Logger *log;
 };
 
+/**
+ * @brief accepts connections and receives their messages on a fixed set of
+ * event loop threads, independent of the number of connections. The
+ * caller runs the io_service in one thread, loops-1 further threads are
+ * started here. Peers on the same host may pass a shared memory ring over
+ * the unix socket ShmRing::socket_path(port) instead of using tcp.
+ */
 template<class data> class asyn_tcp_server
 {
 public:
   void (*pushCallback)(void *);
-  asyn_tcp_server(boost::asio::io_service& io_service, short port, void (*cb)(void *), Logger *p_log)
+  asyn_tcp_server(boost::asio::io_service& io_service, short port, void (*cb)(void *), Logger *p_log, scatter_fn scatter=NULL, int loops=ASYN_TCP_DEFAULT_LOOPS)
     : io_service_(io_service),
-      acceptor_(io_service, tcp::endpoint(tcp::v4(), port))
+      acceptor_(io_service, tcp::endpoint(tcp::v4(), port)),
+      shm_acceptor_(io_service)
     {
+        p_scatter = scatter;
         shutdown=true;
         mutex = PTHREAD_MUTEX_INITIALIZER;
         p_vec = new std::vector< session<data>*>();
-        //pthread_t worker_thread;
-        //pthread_create(&worker_thread, NULL,queueconnect , cb );
+        p_shmvec = new std::vector< shm_session<data>*>();
         this->log=p_log;
         boost::asio::socket_base::reuse_address option(true);
         acceptor_.set_option(option);
         pushCallback = cb;
-        session<data> *new_session = new session<data>(io_service_,pushCallback,log);
-        p_vec->push_back(new_session);
-       // printf("pushed:%p\n",new_session);
-        acceptor_.async_accept(new_session->socket(),
-            boost::bind(&asyn_tcp_server::handle_accept, this, new_session,
-              boost::asio::placeholders::error));
+        accept_next();
+        shm_path = ShmRing::socket_path(port);
+        try
+        {
+            unlink(shm_path.c_str());
+            boost::asio::local::stream_protocol::endpoint ep(shm_path);
+            shm_acceptor_.open(ep.protocol());
+            shm_acceptor_.bind(ep);
+            shm_acceptor_.listen();
+            accept_shm_next();
+        }
+        catch (boost::system::system_error &e)
+        {
+            log->warning_log("no shared memory transport on %s:%s",shm_path.c_str(),e.what());
+        }
+        for (int i=1; i<loops; i++)
+        {
+            pthread_t loop_thread;
+            int rc = pthread_create(&loop_thread, NULL, asyn_tcp_loop, &io_service_);
+            if (rc)
+            {
+                log->error_log("thread not created:rc=%d.",rc);
+                break;
+            }
+            loop_threads.push_back(loop_thread);
+        }
+        log->debug_log("port:%d, loops:%d",port,loops);
     }
     
   void handle_accept(session<data>* new_session,
@@ -200,20 +454,55 @@ public:
     {
       log->debug_log("session pointer %p.",new_session);
       new_session->start();
-      new_session = new session<data>(io_service_, pushCallback,log);
-      p_vec->push_back(new_session);
-     // printf("pushed:%p\n",new_session);
-      acceptor_.async_accept(new_session->socket(),
-          boost::bind(&asyn_tcp_server::handle_accept, this, new_session,
-            boost::asio::placeholders::error));      
+      accept_next();
     }
     else
     {
-      //log->debug_log("delete session");
-      //delete new_session;
+      log->debug_log("accept failed:%s",error.message().c_str());
     }
   }
   
+  void handle_accept_shm(boost::asio::local::stream_protocol::socket* p_sock,
+      const boost::system::error_code& error)
+  {
+    if (!error)
+    {
+      // the peer sends the ring right after connecting
+      p_sock->async_read_some(boost::asio::null_buffers(),
+          boost::bind(&asyn_tcp_server::handle_recv_ring, this, p_sock,
+            boost::asio::placeholders::error));
+      accept_shm_next();
+    }
+    else
+    {
+      delete p_sock;
+      log->debug_log("accept failed:%s",error.message().c_str());
+    }
+  }
+
+  void handle_recv_ring(boost::asio::local::stream_protocol::socket* p_sock,
+      const boost::system::error_code& error)
+  {
+    // the ring keeps its own descriptor of the socket
+    int fd = error ? -1 : dup(p_sock->native_handle());
+    delete p_sock;
+    ShmRing *p_ring = new ShmRing(log);
+    if (fd>=0 && p_ring->accept(fd)==0)
+    {
+        shm_session<data> *new_session = new shm_session<data>(io_service_,pushCallback,log,p_scatter,p_ring);
+        pthread_mutex_lock(&mutex);
+        p_shmvec->push_back(new_session);
+        pthread_mutex_unlock(&mutex);
+        new_session->start();
+        log->debug_log("shared memory session %p.",new_session);
+    }
+    else
+    {
+        log->debug_log("no ring received:%s",error.message().c_str());
+        delete p_ring;
+    }
+  }
+
   void setLogger(Logger *p_log){
       this->log = p_log;
   }
@@ -224,20 +513,32 @@ public:
       if (shutdown)
       {
           shutdown=false;
-         // printf("Shuting down.: vec:%u\n",p_vec->size());
           log->debug_log("Shuting down.: size:%u",p_vec->size());
+          boost::system::error_code ec;
+          acceptor_.close(ec);
+          shm_acceptor_.close(ec);
+          unlink(shm_path.c_str());
+          // no handler may run once the sessions are gone
+          io_service_.stop();
+          std::vector<pthread_t>::iterator it = loop_threads.begin();
+          for (it; it!=loop_threads.end(); it++)
+          {
+              pthread_join(*it, NULL);
+          }
           while (!p_vec->empty())
           {
               session<data>* s = p_vec->back();
               p_vec->pop_back();
-              //printf("vec:%p\n",s);
               delete s;
-              log->debug_log("Shuting down session done.");
+          }
+          while (!p_shmvec->empty())
+          {
+              delete p_shmvec->back();
+              p_shmvec->pop_back();
           }
           log->debug_log("Sessions deleted.");
           delete p_vec;
-        //  acceptor_.close();
-      //    io_service_.stop();
+          delete p_shmvec;
       }
       pthread_mutex_unlock(&mutex);
       pthread_mutex_destroy(&mutex);
@@ -245,10 +546,70 @@ public:
   }
 
 private:
+  /**
+   * @brief removes the sessions of closed connections and waits for the
+   * next connection
+   */
+  void accept_next()
+  {
+      session<data> *new_session = new session<data>(io_service_,pushCallback,log,p_scatter);
+      pthread_mutex_lock(&mutex);
+      typename std::vector< session<data>*>::iterator it = p_vec->begin();
+      while (it!=p_vec->end())
+      {
+          if ((*it)->is_closed())
+          {
+              delete *it;
+              it = p_vec->erase(it);
+          }
+          else
+          {
+              it++;
+          }
+      }
+      p_vec->push_back(new_session);
+      pthread_mutex_unlock(&mutex);
+      acceptor_.async_accept(new_session->socket(),
+          boost::bind(&asyn_tcp_server::handle_accept, this, new_session,
+            boost::asio::placeholders::error));
+  }
+
+  /**
+   * @brief removes the shared memory sessions of peers that are gone and
+   * waits for the next ring
+   */
+  void accept_shm_next()
+  {
+      pthread_mutex_lock(&mutex);
+      typename std::vector< shm_session<data>*>::iterator it = p_shmvec->begin();
+      while (it!=p_shmvec->end())
+      {
+          if ((*it)->is_closed())
+          {
+              delete *it;
+              it = p_shmvec->erase(it);
+          }
+          else
+          {
+              it++;
+          }
+      }
+      pthread_mutex_unlock(&mutex);
+      boost::asio::local::stream_protocol::socket *p_sock = new boost::asio::local::stream_protocol::socket(io_service_);
+      shm_acceptor_.async_accept(*p_sock,
+          boost::bind(&asyn_tcp_server::handle_accept_shm, this, p_sock,
+            boost::asio::placeholders::error));
+  }
+
   boost::asio::io_service& io_service_;
   tcp::acceptor acceptor_;
+  boost::asio::local::stream_protocol::acceptor shm_acceptor_;
+  std::string shm_path;
   Logger *log;
   std::vector< session<data>*> *p_vec;  
+  std::vector< shm_session<data>*> *p_shmvec;  
+  std::vector<pthread_t> loop_threads;
+  scatter_fn p_scatter;
   pthread_mutex_t mutex;
   bool shutdown;
 };
@@ -33,6 +33,9 @@ public:
     struct Stripe_layout* get_stripe(filelayout_raid *fl, size_t offset);
     struct Stripe_layout* get_stripe(filelayout_raid *fl, size_t offset, size_t length);
     struct FileStripeList* get_stripes(filelayout_raid *fl, size_t offset, size_t length);
+    bool next_stripe(filelayout_raid *fl, struct StripeCursor *c, struct StripeSpan *p_span);
+    int  get_stripe_span(filelayout_raid *fl, size_t offset, struct StripeSpan *p_span);
+    uint32_t get_stripe_count(filelayout_raid *fl, size_t offset, size_t length);
     void printFileStripeList(struct FileStripeList *p);
     void printFL(filelayout_raid *fl);
     void printStripeLayout(struct Stripe_layout *p);
@@ -53,6 +56,7 @@ private:
     
     struct Stripe_layout* getNewStripeLayout();
     struct FileStripeList* getNewFileStripeList();
+    int fill_span(filelayout_raid *fl, size_t start, size_t end, struct StripeSpan *p_span);
 };
 
 inline   serverid_t get_server_id ( filelayout_raid *fl, StripeId sid, StripeUnitId id);
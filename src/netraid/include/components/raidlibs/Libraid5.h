@@ -33,6 +33,8 @@ public:
     struct Stripe_layout* get_stripe(filelayout_raid5 *fl, size_t offset);
     struct Stripe_layout* get_stripe(filelayout_raid5 *fl, size_t offset, size_t length);
     struct FileStripeList* get_stripes(filelayout_raid5 *fl, size_t offset, size_t length);
+    bool next_stripe(filelayout_raid5 *fl, struct StripeCursor *c, struct StripeSpan *p_span);
+    int  get_stripe_span(filelayout_raid5 *fl, size_t offset, struct StripeSpan *p_span);
     void printFileStripeList(struct FileStripeList *p);
     void printFL(filelayout_raid5 *fl);
     void printStripeLayout(struct Stripe_layout *p);
@@ -54,6 +56,7 @@ private:
     
     struct Stripe_layout* getNewStripeLayout();
     struct FileStripeList* getNewFileStripeList();
+    int fill_span(filelayout_raid5 *fl, size_t start, size_t end, struct StripeSpan *p_span);
 };
 
 
@@ -69,6 +69,37 @@ struct FileStripeList {
     size_t size;
 };
 
+/*
+ * Value type counterparts of Stripe_layout and FileStripeList. They are
+ * filled by the raid libraries from the layout arithmetic alone, so walking
+ * the stripes of an operation does not touch the heap.
+ */
+struct StripeUnitSpan {
+    StripeUnitId id;
+    size_t start;
+    size_t end;
+    serverid_t assignedto;
+};
+
+struct StripeSpan {
+    StripeId sid;
+    serverid_t parityserver_id;
+    bool isfull;
+    uint8_t unitcnt;
+    struct StripeUnitSpan units[default_groupsize+1];
+};
+
+struct StripeCursor {
+    size_t pos;
+    size_t end;
+};
+
+inline void stripe_cursor_init(struct StripeCursor *c, size_t offset, size_t length)
+{
+    c->pos = offset;
+    c->end = offset+length;
+}
+
 void free_FileStripeList(struct FileStripeList *fsl);
 void free_StripeUnit(struct StripeUnit *su);
 void free_StripeLayout(struct Stripe_layout *sl);
@@ -0,0 +1,92 @@
+/*
+ * File:   TaskScheduler.h
+ * Author: markus
+ *
+ * Multi-priority run queue for the data server workers. All priority
+ * classes share one mutex and one condition, so an idle worker is woken by
+ * a push to any class and never sleeps while work is queued. Classes are
+ * served strictly by priority or by weighted round robin, where class i
+ * gets weight[i] pops per round before the round restarts. Every class
+ * keeps a histogram of the time its tasks waited in the queue.
+ */
+
+#ifndef TASKSCHEDULER_H
+#define	TASKSCHEDULER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#include "logging/Logger.h"
+
+#define SCHED_MAX_CLASSES       8
+/* log2 microsecond buckets, the last one collects everything above 1s */
+#define SCHED_HIST_BUCKETS      21
+
+enum sched_policy
+{
+    sched_strict,
+    sched_weighted,
+};
+
+struct sched_item
+{
+    void        *p;
+    uint64_t    enqueued;   // monotonic microseconds
+};
+
+struct sched_class_stats
+{
+    uint64_t    pushed;
+    uint64_t    popped;
+    uint64_t    maxwait;
+    uint64_t    hist[SCHED_HIST_BUCKETS];
+};
+
+class TaskScheduler
+{
+public:
+    TaskScheduler(Logger *p_log, int classes);
+    TaskScheduler(const TaskScheduler& orig);
+    virtual ~TaskScheduler();
+
+    void set_policy(enum sched_policy policy, const std::vector<uint32_t>& weights);
+    void set_affinity(bool enable);
+
+    int push(int cls, void *p);
+    void* pop();
+    void* try_pop();
+    void stop();
+
+    int register_worker();
+    size_t size();
+
+    void get_stats(int cls, struct sched_class_stats *p_stats);
+    uint64_t percentile(int cls, double pct);
+    void report();
+
+private:
+    Logger *log;
+    int classcnt;
+    enum sched_policy policy;
+    bool affinity;
+    bool running;
+    int workers;
+    int idle;
+    size_t queued;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::deque<struct sched_item> *queues;
+    uint32_t weights[SCHED_MAX_CLASSES];
+    uint32_t credits[SCHED_MAX_CLASSES];
+    struct sched_class_stats stats[SCHED_MAX_CLASSES];
+
+    void* dequeue();
+};
+
+#endif	/* TASKSCHEDULER_H */
+
@@ -35,9 +35,11 @@
 #include "components/raidlibs/raid_data.h"
 #include "components/raidlibs/Libraid4.h"
 #include "components/diskio/Filestorage.h"
+#include "components/diskio/RebuildEngine.h"
 #include "components/network/ServerManager.h"
 #include "components/OperationManager/OpManager.h"
 #include "components/DataObjectCache/doCache.h"
+#include "components/scheduler/TaskScheduler.h"
 
 #include "mm/mds/ByterangeLockManager.h"
 #include "exceptions/MDSException.h"
@@ -92,6 +94,7 @@ private:
     SPNBC_client *p_spnbc;
     Pnfsdummy_client *p_pnfs_cl;
     Filestorage *p_fileio;
+    RebuildEngine *p_rebuild;
     doCache *p_docache;
     serverid_t id;
     serverid_t mdsid;
@@ -101,6 +104,9 @@ private:
     
     int handle_CCC_prepare(struct dstask_ccc_recv_prepare *p_head);
     int handle_CCC_docommit(struct operation_dstask_docommit *p_task);
+    int handle_docommit_written(struct dstask_docommit_flushed *p_task);
+    int handle_read_loaded(struct dstask_read_loaded *p_task);
+    int handle_docommit_flushed(struct dstask_docommit_flushed *p_task);
     int handle_CCC_result(struct dstask_proccess_result *p_head);
     
     int handle_failure(struct operation_participant *p_part);
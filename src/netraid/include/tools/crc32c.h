@@ -0,0 +1,18 @@
+/*
+ * File:   crc32c.h
+ *
+ * CRC-32C (Castagnoli) to detect torn or corrupted records on disk.
+ */
+
+#ifndef CRC32C_H
+#define	CRC32C_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * @brief continues crc over length bytes, start with crc=0
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t length);
+
+#endif	/* CRC32C_H */
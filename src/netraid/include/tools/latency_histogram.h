@@ -0,0 +1,50 @@
+/*
+ * File:   latency_histogram.h
+ *
+ * Latency histogram in the style of HdrHistogram. Values below 2^LHIST_SUB_BITS
+ * are counted exactly, above every power of two range is split into
+ * 2^(LHIST_SUB_BITS-1) linear buckets, so a percentile is off by less than
+ * 1/64 of its value. Recording is not synchronized, every thread keeps its
+ * own histogram and they are merged afterwards.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H
+#define	LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string>
+
+#define LHIST_SUB_BITS      7
+#define LHIST_MAX_BITS      40      // values up to 2^40 us
+#define LHIST_HALF          (1<<(LHIST_SUB_BITS-1))
+#define LHIST_BUCKETS       ((LHIST_MAX_BITS-LHIST_SUB_BITS+2)*LHIST_HALF)
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t value);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    uint64_t percentile(double pct) const;
+    uint64_t get_count() const;
+    uint64_t get_min() const;
+    uint64_t get_max() const;
+    double get_mean() const;
+
+    std::string to_json() const;
+
+private:
+    uint64_t counts[LHIST_BUCKETS];
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    double sum;
+
+    static uint32_t index_of(uint64_t value);
+    static uint64_t value_at(uint32_t index);
+};
+
+#endif	/* LATENCY_HISTOGRAM_H */
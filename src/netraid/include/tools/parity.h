@@ -1,4 +1,4 @@
-/* 
+/*
  * File:   parity.h
  * Author: markus
  *
@@ -12,8 +12,32 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+/* Size of the input pointer arrays callers gather on the stack before
+ * folding a stripe with calc_parity_n. */
+#define PARITY_MAX_INPUTS 64
+
+/**
+ * @brief available xor kernels. The best supported one is selected once at
+ * startup via cpuid, the others stay callable for benchmarking.
+ */
+enum parity_kernel
+{
+    parity_kernel_scalar,
+    parity_kernel_sse2,
+    parity_kernel_avx2,
+    parity_kernel_avx512,
+    parity_kernel_count,
+};
+
 void calc_parity(void *ina, void *inb, void *out, size_t  len);
 void calc_parity (void* in, size_t length, void *out);
 
+void calc_parity_n(void **in, int n, void *out, size_t len);
+int  calc_parity_n_kernel(enum parity_kernel kernel, void **in, int n, void *out, size_t len);
+
+enum parity_kernel parity_get_kernel();
+bool parity_kernel_supported(enum parity_kernel kernel);
+const char* parity_kernel_name(enum parity_kernel kernel);
+
 #endif	/* PARITY_H */
 
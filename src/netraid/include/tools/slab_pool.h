@@ -0,0 +1,68 @@
+/*
+ * File:   slab_pool.h
+ * Author: markus
+ *
+ * Pools for the fixed size operation and task structures and for stripe
+ * unit payload buffers. Structures declare SLAB_ALLOCATED, their new and
+ * delete are then served from per thread free lists, which are refilled
+ * from and drained into a shared depot in batches. Every block carries a
+ * small header with its size class, so a structure may be deleted through
+ * any other slab allocated type, e.g. a dstask through its dstask_head.
+ */
+
+#ifndef SLAB_POOL_H
+#define	SLAB_POOL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+
+#include "logging/Logger.h"
+
+/* smallest size class, the classes double up to SLAB_MAX_SIZE */
+#define SLAB_MIN_SIZE       64
+#define SLAB_MAX_SIZE       4096
+#define SLAB_CLASSES        7
+/* blocks moved between a thread cache and the depot at once */
+#define SLAB_BATCH          32
+#define SLAB_CHUNK_SIZE     (64*1024)
+
+/* payload classes start at 4KB and double up to 1MB */
+#define SLAB_PAYLOAD_MIN        4096
+#define SLAB_PAYLOAD_CLASSES    9
+#define SLAB_PAYLOAD_KEEP       16
+#define SLAB_PAYLOAD_ALIGN      4096
+
+struct slab_stats
+{
+    uint64_t    allocs;
+    uint64_t    hits;       // served from the thread cache
+    uint64_t    frees;
+    uint64_t    chunks;
+    uint64_t    doublefrees;
+};
+
+void* slab_alloc(size_t size);
+void slab_free(void *p);
+
+void* slab_payload_alloc(size_t size);
+void slab_payload_free(void *p, size_t size);
+
+void slab_set_debug(bool enable);
+void slab_get_stats(int sizeclass, struct slab_stats *p_stats);
+void slab_get_payload_stats(int sizeclass, struct slab_stats *p_stats);
+void slab_report(Logger *log);
+
+#define SLAB_ALLOCATED \
+    static void* operator new(size_t size) \
+    { \
+        void *p = slab_alloc(size); \
+        if (p==NULL) throw std::bad_alloc(); \
+        return p; \
+    } \
+    static void operator delete(void *p) \
+    { \
+        slab_free(p); \
+    }
+
+#endif	/* SLAB_POOL_H */
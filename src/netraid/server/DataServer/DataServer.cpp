@@ -12,20 +12,22 @@
 
 //#define CONFFILE "../conf/main_ds.conf"
 
-pthread_mutex_t queue_0_trylockmutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t queue_cccin_trylockmutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t queue_spnin_trylockmutex = PTHREAD_MUTEX_INITIALIZER;
-//pthread_mutex_t queue0_trylockmutex = PTHREAD_MUTEX_INITIALIZER;
-
 void* ds_tasks_worker(void *obj);
 
-static ConcurrentQueue<void*>  *p_queue_spn_in = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_ccc_in = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_0 = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_1 = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_2 = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_3 = new ConcurrentQueue<void*>();
-static ConcurrentQueue<void*>  *p_queue_maintenance = new ConcurrentQueue<void*>();
+/* scheduling classes, highest priority first */
+enum ds_sched_classes
+{
+    ds_class_realtime,
+    ds_class_ccc_in,
+    ds_class_prim_recv,
+    ds_class_sec_recv,
+    ds_class_part_recv,
+    ds_class_spn_in,
+    ds_class_maintenance,
+    DS_SCHED_CLASSES
+};
+
+static TaskScheduler *p_scheduler = NULL;
 
 /** 
  * @brief worker thread of 
@@ -36,26 +38,15 @@ void* ds_storage_ops(void *obj)
     //printf("ds_storage_ops: startet.\n");
     struct OPHead *p_head;
     void *p;
-    float backoff = THREADING_TIMEOUT_BACKUOFF;
-    uint32_t sleeptime = THREADING_TIMEOUT_USLEEP;
-    uint8_t  i = 0;
     uint32_t rc=0;
+    p_scheduler->register_worker();
     while (1)
     {
         p = p_ds->popOperation();
         if (p==NULL)
         {
-            if (i<THREADING_TIMEOUT_MAXITER)
-            {
-                sleeptime = sleeptime*backoff;
-                i++;
-            }
-            else
-            {
-                sleeptime = THREADING_TIMEOUT_USLEEP;
-                i=0;
-            }            
-            if (i%5==0) usleep(sleeptime);
+            // scheduler stopped
+            break;
         }
         else
         {
@@ -95,10 +86,9 @@ void* ds_storage_ops(void *obj)
                 printf("Error occured:rc=%u\n",rc);
                 //exit(0);
             }
-            sleeptime = THREADING_TIMEOUT_USLEEP;
-            i=0;
         }
     }
+    return NULL;
 }
 
 static int global_gcinterval = 5;
@@ -108,7 +98,7 @@ static void pushtask_garbage_collector()
        struct dstask_maintenance_gc *p_task = new struct dstask_maintenance_gc;
        p_task->dshead.ophead.type = ds_task_type;    
        p_task->dshead.ophead.subtype = maintenance_garbagecollection;
-       p_queue_maintenance->push((void*) p_task);
+       p_scheduler->push(ds_class_maintenance, (void*) p_task);
 }
 
 void* maintenence_feeder(void *p)
@@ -171,6 +161,26 @@ DataServer::DataServer(
     p_cm->register_option("storage","Storage directory");
     p_cm->register_option("fsync", "Force fsync after write");
     p_cm->register_option("gcinterval", "Garbage collecter interval in seconds");
+    p_cm->register_option("layout", "Storage layout: files (one file per version) or segments");
+    p_cm->register_option("segmentsize", "Size of a storage segment in MB [default:64]");
+    p_cm->register_option("commitbatch", "Max. file handles flushed by one group commit [default:64]");
+    p_cm->register_option("commitdelay", "Max. microseconds a group commit waits for more writes [default:200]");
+    p_cm->register_option("aio", "Disk I/O backend: uring or threads [default:uring]");
+    p_cm->register_option("aiothreads", "Number of disk I/O threads [default:4]");
+    p_cm->register_option("cachesize", "Data object cache size in MB, 0 is unbounded [default:0]");
+    p_cm->register_option("cacheshards", "Number of data object cache shards [default:16]");
+    p_cm->register_option("readahead", "Stripes read ahead on sequential reads, 0 disables [default:4]");
+    p_cm->register_option("schedpolicy", "Worker scheduling: strict or weighted priorities [default:strict]");
+    p_cm->register_option("schedweights", "Comma separated pops per round of each priority class in weighted mode");
+    p_cm->register_option("schedaffinity", "Pin storage worker threads to cores [default:0]");
+    p_cm->register_option("opshards", "Inode partitions of the operation manager [default:64]");
+    p_cm->register_option("cccbatchwindow", "Microseconds a CCC message waits for more messages to the same server, 0 disables batching [default:100]");
+    p_cm->register_option("cccbatchsize", "Max. CCC messages per batch [default:32]");
+    p_cm->register_option("dsconnections", "Connections to each other data server [default:2]");
+    p_cm->register_option("rebuild", "Rebuild the units of this server from the other servers on start [default:0]");
+    p_cm->register_option("rebuildrate", "MB/s read and written by the rebuild, 0 is unthrottled [default:0]");
+    p_cm->register_option("rebuildbatch", "Stripes the rebuild reads in parallel [default:64]");
+    p_cm->register_option("slabdebug", "Check pooled structures for double frees and leaks [default:0]");
     p_cm->parse();
     bool dosync =  (p_cm->get_value("fsync").compare("1")==0) ? true : false;
     gcinterval = atoi(p_cm->get_value("gcinterval").c_str());
@@ -179,20 +189,77 @@ DataServer::DataServer(
     
     worker_threads_storage = BASE_THREADNUMBER*2;
     log->set_log_location(logfile);
+    slab_set_debug(p_cm->get_value("slabdebug").compare("1")==0);
+    p_scheduler = new TaskScheduler(log, DS_SCHED_CLASSES);
+    std::vector<uint32_t> weights;
+    std::string weightlist = p_cm->get_value("schedweights");
+    const char *w = weightlist.c_str();
+    char *end;
+    while (*w!='\0')
+    {
+        unsigned long weight = strtoul(w, &end, 10);
+        if (end==w) break;
+        weights.push_back(weight);
+        w = (*end==',') ? end+1 : end;
+    }
+    enum sched_policy policy = (p_cm->get_value("schedpolicy").compare("weighted")==0) ? sched_weighted : sched_strict;
+    p_scheduler->set_policy(policy, weights);
+    p_scheduler->set_affinity(p_cm->get_value("schedaffinity").compare("1")==0);
     
     this->id = id;
     std::string storagedir = p_cm->get_value("storage");
     log->debug_log("storage dir:%s.",storagedir.c_str());
-    p_fileio = new Filestorage(log,storagedir.c_str(), id,dosync);
-    p_docache = new doCache(log,p_fileio,id);
+    enum storage_layout layout = (p_cm->get_value("layout").compare("segments")==0) ? layout_segments : layout_files;
+    size_t segsize = atol(p_cm->get_value("segmentsize").c_str())*1024*1024;
+    p_fileio = new Filestorage(log,storagedir.c_str(), id,dosync,layout,segsize);
+    if (!p_cm->get_value("commitbatch").empty() || !p_cm->get_value("commitdelay").empty())
+    {
+        size_t commitbatch = atol(p_cm->get_value("commitbatch").c_str());
+        uint32_t commitdelay = p_cm->get_value("commitdelay").empty() ? GROUPCOMMIT_DEFAULT_DELAY : atol(p_cm->get_value("commitdelay").c_str());
+        p_fileio->set_commit_bounds(commitbatch, commitdelay);
+    }
+    bool uring = (p_cm->get_value("aio").compare("threads")==0) ? false : true;
+    rc = p_fileio->start_aio(uring, atoi(p_cm->get_value("aiothreads").c_str()));
+    if (rc)
+    {
+        log->error_log("disk I/O threads not started: rc=%d",rc);
+    }
+    p_rebuild = NULL;
+    if (p_cm->get_value("rebuild").compare("1")==0)
+    {
+        p_rebuild = new RebuildEngine(log, storagedir, id, p_fileio, layout, segsize);
+        p_rebuild->set_rate(atoi(p_cm->get_value("rebuildrate").c_str()));
+        if (!p_cm->get_value("rebuildbatch").empty())
+        {
+            p_rebuild->set_batch(atoi(p_cm->get_value("rebuildbatch").c_str()));
+        }
+    }
+    size_t cachesize = atol(p_cm->get_value("cachesize").c_str())*1024*1024;
+    uint32_t cacheshards = p_cm->get_value("cacheshards").empty() ? DOCACHE_DEFAULT_SHARDS : atoi(p_cm->get_value("cacheshards").c_str());
+    p_docache = new doCache(log,p_fileio,id,cachesize,cacheshards);
+    if (!p_cm->get_value("readahead").empty())
+    {
+        p_docache->set_readahead(atoi(p_cm->get_value("readahead").c_str()));
+    }
     mdsid = 0;
     
     p_brlman = new ByterangeLockManager(log);
     p_raid = new Libraid4(log);
-    p_opman = new OpManager(log,&pushOperation,id,p_docache, p_fileio);
+    uint32_t opshards = p_cm->get_value("opshards").empty() ? OPMANAGER_DEFAULT_SHARDS : atoi(p_cm->get_value("opshards").c_str());
+    p_opman = new OpManager(log,&pushOperation,id,p_docache, p_fileio, opshards);
     p_sm = new ServerManager(log,CCC_ASIO_BASEPORT);
     p_spnbc = new SPNBC_client(log);
     p_ccc = new CCCNetraid_client(log, p_sm, id,dosync);
+    if (!p_cm->get_value("cccbatchwindow").empty() || !p_cm->get_value("cccbatchsize").empty())
+    {
+        uint32_t batchwindow = p_cm->get_value("cccbatchwindow").empty() ? CCC_BATCH_DEFAULT_WINDOW : atoi(p_cm->get_value("cccbatchwindow").c_str());
+        uint32_t batchsize = p_cm->get_value("cccbatchsize").empty() ? CCC_BATCH_DEFAULT_SIZE : atoi(p_cm->get_value("cccbatchsize").c_str());
+        p_ccc->set_batching(batchwindow, batchsize);
+    }
+    if (!p_cm->get_value("dsconnections").empty())
+    {
+        p_ccc->set_connections(atoi(p_cm->get_value("dsconnections").c_str()));
+    }
     p_pnfs_cl   = new Pnfsdummy_client(log);    
 
     serverid_t a = 0;
@@ -212,6 +279,11 @@ DataServer::DataServer(
 DataServer::~DataServer()
 {
     log->debug_log(" Stopping metadata server" );
+    p_scheduler->stop();
+    if (p_rebuild!=NULL)
+    {
+        delete p_rebuild;
+    }
     delete log;
     delete p_cm;
     delete p_profiler;
@@ -270,7 +342,10 @@ int32_t DataServer::run()
             }
             pthread_t worker_thread;
             rc = pthread_create(&worker_thread, NULL, maintenence_feeder, NULL );
-            
+            if (p_rebuild!=NULL && p_rebuild->start())
+            {
+                log->error_log("rebuild not started.");
+            }
         }
     }
     catch (DataServerException e)
@@ -370,96 +445,58 @@ int32_t DataServer::register_lock_object(struct lock_exchange_struct *p_lock)
 int DataServer::pushOperation(queue_priorities priority, OPHead *op)
 {
     int rc = 0;
-    try
+    switch (priority)
     {
-        switch (priority)
+        case realtimetask:
         {
-            case realtimetask:
-            {
-                p_queue_0->push((void*)op);
-                break;
-            }
-            case prim_recv:
-            {
-                p_queue_1->push((void*)op);
-                break;
-            }
-            case sec_recv:
-            {
-                p_queue_2->push(op);
-                break;
-            }
-            case part_recv:
-            {
-                p_queue_3->push(op);
-                break;
-            }
-            case maintenance:
-            {
-                p_queue_maintenance->push(op);
-                break;
-            }
-            default:
-            {
-                rc = -2;
-            }            
+            rc = p_scheduler->push(ds_class_realtime, (void*)op);
+            break;
+        }
+        case prim_recv:
+        {
+            rc = p_scheduler->push(ds_class_prim_recv, (void*)op);
+            break;
+        }
+        case sec_recv:
+        {
+            rc = p_scheduler->push(ds_class_sec_recv, (void*)op);
+            break;
+        }
+        case part_recv:
+        {
+            rc = p_scheduler->push(ds_class_part_recv, (void*)op);
+            break;
+        }
+        case maintenance:
+        {
+            rc = p_scheduler->push(ds_class_maintenance, (void*)op);
+            break;
+        }
+        default:
+        {
+            rc = -2;
         }            
     }
-    catch (int)
-    {
-        rc=-3;
-    }
     return rc;
 }
 
 void DataServer::push_spn_in(void *op)
 {
-    p_queue_spn_in->push(op);
+    p_scheduler->push(ds_class_spn_in, op);
 }
 
 void DataServer::push_ccc_in(void *op)
 {
-    p_queue_ccc_in->push(op);
+    p_scheduler->push(ds_class_ccc_in, op);
 }
 
+/**
+ * @brief blocks until a task of any class is queued.
+ * @return task or NULL if the scheduler was stopped
+ */
 void* DataServer::popOperation()
 {
-    void *p = NULL;
-    if (pthread_mutex_trylock(&queue_0_trylockmutex)==0)
-    {
-        p_queue_0->wait_and_pop(p);
-        pthread_mutex_unlock(&queue_0_trylockmutex);
-        return p;        
-    }
-    if (pthread_mutex_trylock(&queue_cccin_trylockmutex)==0)
-    {
-        p_queue_ccc_in->wait_and_pop(p);
-        pthread_mutex_unlock(&queue_cccin_trylockmutex);
-        return p;
-    } 
-    if (p_queue_1->try_pop(p))
-    {
-        return p;
-    }
-    if (p_queue_2->try_pop(p))
-    {
-        return p;
-    }
-    if (p_queue_3->try_pop(p))
-    {
-        return p;
-    }
-    if (pthread_mutex_trylock(&queue_spnin_trylockmutex)==0)
-    {
-        p_queue_spn_in->wait_and_pop(p);
-        pthread_mutex_unlock(&queue_spnin_trylockmutex);
-        return p;
-    }    
-    if (p_queue_maintenance->try_pop(p))
-    {
-        return p;
-    }
-    return p;
+    return p_scheduler->pop();
 }
 
 /*int  DataServer::handle_primcoordinator_task(struct OPHead *p_head)
@@ -623,6 +660,27 @@ int DataServer::handle_CCC_prepare(struct dstask_ccc_recv_prepare *p_task)
     return rc;
 }
 
+/**
+ * @brief completion of the group commit, called by the flusher thread.
+ * Sending the committed message is left to the worker threads.
+ */
+static void docommit_flushed_cb(void *arg, int rc)
+{
+    struct dstask_docommit_flushed *p_task = (struct dstask_docommit_flushed *) arg;
+    p_task->rc = rc;
+    DataServer::pushOperation(realtimetask, (struct OPHead*) p_task);
+}
+
+/**
+ * @brief completion of the participant write, called by an I/O thread.
+ */
+static void docommit_written_cb(void *arg, int rc)
+{
+    struct dstask_docommit_flushed *p_task = (struct dstask_docommit_flushed *) arg;
+    p_task->rc = rc;
+    DataServer::pushOperation(realtimetask, (struct OPHead*) p_task);
+}
+
 int DataServer::handle_CCC_docommit(struct operation_dstask_docommit *p_task)
 {
     struct operation_participant *part_out=NULL;
@@ -630,32 +688,87 @@ int DataServer::handle_CCC_docommit(struct operation_dstask_docommit *p_task)
     if (!rc)
     {
         log->debug_log("write to disk");
-        rc = p_fileio->write_file(part_out);
+        part_out->ophead.status=opstatus_docommit;
+        // committed is acknowledged once the objects are written and flushed
+        struct dstask_docommit_flushed *p_flushed = new struct dstask_docommit_flushed;
+        p_flushed->dshead.ophead.type = ds_task_type;
+        p_flushed->dshead.ophead.subtype = docommit_written;
+        p_flushed->p_part = part_out;
+        p_flushed->rc = 0;
+        rc = p_fileio->write_file_async(part_out, &docommit_written_cb, p_flushed);
+        if (rc)
+        {
+            log->warning_log("Error occured while writing file.");
+            delete p_flushed;
+        }
+    }
+    else
+    {
+        log->debug_log("Operation manager reported error.");
+        return rc;
+    }
+    log->debug_log("STATUS:csid:%u,seq:%u,status:%u",part_out->ophead.cco_id.csid,part_out->ophead.cco_id.sequencenum, part_out->ophead.status);
+    return rc;
+}
+
+/**
+ * @brief the objects are written, hands their handles over to the group
+ * commit.
+ */
+int DataServer::handle_docommit_written(struct dstask_docommit_flushed *p_task)
+{
+    int rc = p_task->rc;
+    struct operation_participant *part_out = p_task->p_part;
+    p_task->dshead.ophead.subtype = docommit_flushed;
+    if (rc)
+    {
+        log->warning_log("Error occured while writing file.");
+        docommit_flushed_cb(p_task, rc);
+        return rc;
+    }
+    std::vector<int> fds;
+    std::map<StripeId,struct dataobject_collection*>::iterator it = part_out->datamap->begin();
+    for (it; it!=part_out->datamap->end(); it++)
+    {
+        if (it->second->fhvalid)
+        {
+            fds.push_back(it->second->filehandle);
+        }
+    }
+    if (fds.empty())
+    {
+        docommit_flushed_cb(p_task, 0);
+    }
+    else
+    {
+        rc = p_fileio->commit_async(&fds[0], fds.size(), &docommit_flushed_cb, p_task);
+    }
+    return rc;
+}
+
+int DataServer::handle_docommit_flushed(struct dstask_docommit_flushed *p_task)
+{
+    int rc = p_task->rc;
+    struct operation_participant *part_out = p_task->p_part;
+    if (!rc)
+    {
+        part_out->ophead.status = opstatus_committed;
+        rc = get_primcoordinator(&part_out->ophead, &part_out->primcoordinator);            
         if (!rc)
         {
-            log->debug_log("write ok");
-            part_out->ophead.status = opstatus_committed;
-            rc = get_primcoordinator(&part_out->ophead, &part_out->primcoordinator);            
-            if (!rc)
-            {
-                rc = p_ccc->handle_CCC_send_committed(part_out);
-            }
-            else
-            {
-                log->debug_log("Error occured while retriving primcoord.");
-            }
+            rc = p_ccc->handle_CCC_send_committed(part_out);
         }
         else
         {
-            log->warning_log("Error occured while writing file.");
+            log->debug_log("Error occured while retriving primcoord.");
         }
     }
     else
     {
-        log->debug_log("Operation manager reported error.");
+        log->warning_log("Error occured while flushing file.");
     }
-    part_out->ophead.status=opstatus_docommit;
     log->debug_log("STATUS:csid:%u,seq:%u,status:%u",part_out->ophead.cco_id.csid,part_out->ophead.cco_id.sequencenum, part_out->ophead.status);
+    delete p_task;
     return rc;
 }
 
@@ -695,6 +808,10 @@ int DataServer::handle_ds_task(struct dstask_head *p_taskhead)
 {
     int rc = -1;
     log->debug_log("Received ds task operation:%u:%p,",p_taskhead->ophead.subtype, p_taskhead);   
+    if (p_rebuild!=NULL && p_taskhead->ophead.subtype!=maintenance_garbagecollection)
+    {
+        p_rebuild->foreground_io();
+    }
     switch (p_taskhead->ophead.subtype)
     {
         case(received_received):
@@ -824,7 +941,7 @@ int DataServer::handle_ds_task(struct dstask_head *p_taskhead)
             log->debug_log("IP:%s",p_t->ip);
             p_spnbc->register_cl_address(p_t->dshead.ophead.cco_id.csid,p_t->ip);
             free(p_t->ip);
-            free(p_t);
+            delete p_t;
             rc=0;
             break;
         }
@@ -840,6 +957,28 @@ int DataServer::handle_ds_task(struct dstask_head *p_taskhead)
             rc = handle_ping_msg((struct dstask_pingpong *)p_taskhead);
             break;
         }
+        case (docommit_written):
+        {
+            rc = handle_docommit_written((struct dstask_docommit_flushed *) p_taskhead);
+            break;
+        }
+        case (docommit_flushed):
+        {
+            rc = handle_docommit_flushed((struct dstask_docommit_flushed *) p_taskhead);
+            break;
+        }
+        case (primco_written):
+        {
+            rc = p_opman->handle_primco_written((struct dstask_primco_written *) p_taskhead);
+            delete p_taskhead;
+            break;
+        }
+        case (read_loaded):
+        {
+            rc = handle_read_loaded((struct dstask_read_loaded *) p_taskhead);
+            delete p_taskhead;
+            break;
+        }
         case (maintenance_garbagecollection):
         {
             struct dstask_maintenance_gc *p_task = (struct dstask_maintenance_gc*) p_taskhead;
@@ -1027,17 +1166,55 @@ int DataServer::perform_primcoord_docommit(struct dstask_writetodisk *p_task)
 }**/
 
 
+/**
+ * @brief completion of a read that missed the cache, called by an I/O thread.
+ */
+static void read_loaded_cb(void *arg, int rc, struct data_object *p_do)
+{
+    struct dstask_read_loaded *p_task = (struct dstask_read_loaded *) arg;
+    p_task->rc = rc;
+    p_task->p_do = p_do;
+    DataServer::pushOperation(realtimetask, (struct OPHead*) p_task);
+}
+
 int DataServer::handle_read_req(struct dstask_spn_recv *p_task)
 {
     int rc=-1;
     log->debug_log("got read request for inum:%llu, stripe id:%u",p_task->dshead.ophead.inum, p_task->stripeid);
     StripeUnitId suid = p_raid->get_my_stripeunitid((filelayout_raid*)&p_task->dshead.ophead.filelayout[0], p_task->dshead.ophead.offset, this->id);
     struct data_object *p_obj;// = new struct data_object;
-    rc = this->p_docache->get_entry(p_task->dshead.ophead.inum, p_task->stripeid,  &p_obj);
+    // a miss is read on an I/O thread and answered by handle_read_loaded
+    struct dstask_read_loaded *p_loaded = new struct dstask_read_loaded;
+    memcpy(&p_loaded->dshead.ophead, &p_task->dshead.ophead, sizeof(struct OPHead));
+    p_loaded->dshead.ophead.type = ds_task_type;
+    p_loaded->dshead.ophead.subtype = read_loaded;
+    p_loaded->stripeid = p_task->stripeid;
+    p_loaded->suid = suid;
+    p_loaded->rc = 0;
+    p_loaded->p_do = NULL;
+    rc = this->p_docache->read_entry_async(p_task->dshead.ophead.inum, p_task->stripeid,  &p_obj, &read_loaded_cb, p_loaded);
     log->debug_log("cache read:rc:%d",rc);
+    if (rc==DOCACHE_PENDING)
+    {
+        return 0;
+    }
+    delete p_loaded;
     //log->debug_log("text:%s",(char*)p_obj->data);
     rc = p_spnbc->handle_read_response(p_task->dshead.ophead.inum, p_task->stripeid, suid, p_task->dshead.ophead.cco_id, p_obj);
-    
+    p_docache->release(p_obj);
+    log->debug_log("rc:%d",rc);
+    return rc;
+}
+
+/**
+ * @brief the stripe unit of a read that missed the cache is loaded, sends
+ * the response.
+ */
+int DataServer::handle_read_loaded(struct dstask_read_loaded *p_task)
+{
+    log->debug_log("loaded inum:%llu, stripe id:%u, rc:%d",p_task->dshead.ophead.inum, p_task->stripeid, p_task->rc);
+    int rc = p_spnbc->handle_read_response(p_task->dshead.ophead.inum, p_task->stripeid, p_task->suid, p_task->dshead.ophead.cco_id, p_task->p_do);
+    p_docache->release(p_task->p_do);
     log->debug_log("rc:%d",rc);
     return rc;
 }
@@ -1047,7 +1224,19 @@ int DataServer::maintenance_garbage_collection(struct dstask_maintenance_gc *p_t
     int rc=0;
     log->debug_log("start garbage collector");
     rc = p_docache->garbage_collection();
+    if (p_fileio->compact())
+    {
+        log->error_log("segment compaction failed.");
+    }
     delete p_task;
+    slab_report(log);
+    p_scheduler->report();
+    p_opman->report();
+    p_ccc->report();
+    if (p_rebuild!=NULL)
+    {
+        p_rebuild->report();
+    }
     log->debug_log("End garbage collector");
     return rc;
 }
@@ -0,0 +1,37 @@
+/*
+ * File:   crc32c.cpp
+ */
+
+#include <pthread.h>
+
+#include "tools/crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78U    // reversed Castagnoli polynomial
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init()
+{
+    for (uint32_t i=0; i<256; i++)
+    {
+        uint32_t c = i;
+        for (int k=0; k<8; k++)
+        {
+            c = (c & 1) ? (c>>1)^CRC32C_POLY : c>>1;
+        }
+        crc32c_table[i] = c;
+    }
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t length)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+    const uint8_t *p = (const uint8_t*) data;
+    crc = ~crc;
+    for (size_t i=0; i<length; i++)
+    {
+        crc = crc32c_table[(crc^p[i]) & 0xff] ^ (crc>>8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,119 @@
+/*
+ * File:   latency_histogram.cpp
+ */
+
+#include <string.h>
+#include <sstream>
+
+#include "tools/latency_histogram.h"
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset()
+{
+    memset(counts, 0, sizeof(counts));
+    count = 0;
+    min = UINT64_MAX;
+    max = 0;
+    sum = 0;
+}
+
+/**
+ * @brief the bucket of a value: its power of two range above the exact
+ * part and the LHIST_SUB_BITS leading bits inside it
+ */
+uint32_t LatencyHistogram::index_of(uint64_t value)
+{
+    const uint64_t limit = ((uint64_t)1<<LHIST_MAX_BITS)-1;
+    if (value>limit) value = limit;
+    int msb = 63-__builtin_clzll(value|1);
+    int shift = msb-(LHIST_SUB_BITS-1);
+    if (shift<0) shift = 0;
+    return shift*LHIST_HALF + (uint32_t)(value>>shift);
+}
+
+/**
+ * @brief the highest value counted in the bucket
+ */
+uint64_t LatencyHistogram::value_at(uint32_t index)
+{
+    uint32_t shift = (index<2*LHIST_HALF) ? 0 : index/LHIST_HALF-1;
+    uint64_t sub = index-shift*LHIST_HALF;
+    return ((sub+1)<<shift)-1;
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    counts[index_of(value)]++;
+    count++;
+    sum += value;
+    if (value<min) min = value;
+    if (value>max) max = value;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (uint32_t i=0; i<LHIST_BUCKETS; i++)
+    {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    if (other.min<min) min = other.min;
+    if (other.max>max) max = other.max;
+}
+
+/**
+ * @brief the smallest value that pct percent of the recorded values do not
+ * exceed, within the bucket precision. 0 without values.
+ */
+uint64_t LatencyHistogram::percentile(double pct) const
+{
+    if (count==0) return 0;
+    if (pct>100) pct = 100;
+    uint64_t rank = (uint64_t)(pct/100.0*count+0.5);
+    if (rank==0) rank = 1;
+    uint64_t seen = 0;
+    for (uint32_t i=0; i<LHIST_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (seen>=rank)
+        {
+            uint64_t v = value_at(i);
+            return (v>max) ? max : v;
+        }
+    }
+    return max;
+}
+
+uint64_t LatencyHistogram::get_count() const
+{
+    return count;
+}
+
+uint64_t LatencyHistogram::get_min() const
+{
+    return (count>0) ? min : 0;
+}
+
+uint64_t LatencyHistogram::get_max() const
+{
+    return max;
+}
+
+double LatencyHistogram::get_mean() const
+{
+    return (count>0) ? sum/count : 0;
+}
+
+std::string LatencyHistogram::to_json() const
+{
+    std::stringstream ss("");
+    ss << "{\"count\":" << count << ",\"min\":" << get_min() << ",\"mean\":" << get_mean()
+       << ",\"p50\":" << percentile(50) << ",\"p99\":" << percentile(99)
+       << ",\"p999\":" << percentile(99.9) << ",\"max\":" << max << "}";
+    return ss.str();
+}
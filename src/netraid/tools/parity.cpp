@@ -1,25 +1,280 @@
+
 #include "tools/parity.h"
 
-void calc_parity(void *ina, void *inb, void *out, size_t  len_x)
-{   
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define PARITY_SIMD_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*parity_xor_fn)(void **in, int n, void *out, size_t len);
+
+/**
+ * @brief xors the remaining bytes [pos,len) of all inputs into out.
+ */
+static inline void xor_tail(void **in, int n, void *out, size_t pos, size_t len)
+{
+    uint8_t *p = (uint8_t *) out;
+    for (pos; pos<len; pos++)
+    {
+        uint8_t v = ((uint8_t*)in[0])[pos];
+        for (int i=1; i<n; i++)
+        {
+            v ^= ((uint8_t*)in[i])[pos];
+        }
+        p[pos] = v;
+    }
+}
+
+static void xor_scalar(void **in, int n, void *out, size_t len)
+{
     uint64_t *p = (uint64_t *) out;
-    uint64_t *a = (uint64_t *) ina;
-    uint64_t *b = (uint64_t *) inb;
-    size_t len = len_x/8;
-    for (len; len>0; len--)
+    size_t words = len/8;
+    for (size_t w=0; w<words; w++)
     {
-        *p = ( *a ^ *b);
-        //printf("%llu,%llu,%llu.\n",*a,*b,*p);
-        p++;
-        a++;
-        b++;        
+        uint64_t v = ((uint64_t*)in[0])[w];
+        for (int i=1; i<n; i++)
+        {
+            v ^= ((uint64_t*)in[i])[w];
+        }
+        p[w] = v;
     }
+    xor_tail(in, n, out, words*8, len);
+}
+
+#ifdef PARITY_SIMD_X86
+/*
+ * Every kernel keeps four vector accumulators per iteration so a whole
+ * stripe is folded while each cache line of the inputs is touched once.
+ * Loads are unaligned since the buffers come straight from malloc and the
+ * network layer. out may alias one of the inputs.
+ */
+__attribute__((target("sse2")))
+static void xor_sse2(void **in, int n, void *out, size_t len)
+{
+    uint8_t *p = (uint8_t *) out;
+    size_t pos = 0;
+    for (pos; pos+64<=len; pos+=64)
+    {
+        const uint8_t *s = (const uint8_t*)in[0] + pos;
+        __m128i v0 = _mm_loadu_si128((const __m128i*)(s));
+        __m128i v1 = _mm_loadu_si128((const __m128i*)(s+16));
+        __m128i v2 = _mm_loadu_si128((const __m128i*)(s+32));
+        __m128i v3 = _mm_loadu_si128((const __m128i*)(s+48));
+        for (int i=1; i<n; i++)
+        {
+            s = (const uint8_t*)in[i] + pos;
+            v0 = _mm_xor_si128(v0, _mm_loadu_si128((const __m128i*)(s)));
+            v1 = _mm_xor_si128(v1, _mm_loadu_si128((const __m128i*)(s+16)));
+            v2 = _mm_xor_si128(v2, _mm_loadu_si128((const __m128i*)(s+32)));
+            v3 = _mm_xor_si128(v3, _mm_loadu_si128((const __m128i*)(s+48)));
+        }
+        _mm_storeu_si128((__m128i*)(p+pos), v0);
+        _mm_storeu_si128((__m128i*)(p+pos+16), v1);
+        _mm_storeu_si128((__m128i*)(p+pos+32), v2);
+        _mm_storeu_si128((__m128i*)(p+pos+48), v3);
+    }
+    for (pos; pos+16<=len; pos+=16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)((const uint8_t*)in[0] + pos));
+        for (int i=1; i<n; i++)
+        {
+            v = _mm_xor_si128(v, _mm_loadu_si128((const __m128i*)((const uint8_t*)in[i] + pos)));
+        }
+        _mm_storeu_si128((__m128i*)(p+pos), v);
+    }
+    xor_tail(in, n, out, pos, len);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(void **in, int n, void *out, size_t len)
+{
+    uint8_t *p = (uint8_t *) out;
+    size_t pos = 0;
+    for (pos; pos+128<=len; pos+=128)
+    {
+        const uint8_t *s = (const uint8_t*)in[0] + pos;
+        __m256i v0 = _mm256_loadu_si256((const __m256i*)(s));
+        __m256i v1 = _mm256_loadu_si256((const __m256i*)(s+32));
+        __m256i v2 = _mm256_loadu_si256((const __m256i*)(s+64));
+        __m256i v3 = _mm256_loadu_si256((const __m256i*)(s+96));
+        for (int i=1; i<n; i++)
+        {
+            s = (const uint8_t*)in[i] + pos;
+            v0 = _mm256_xor_si256(v0, _mm256_loadu_si256((const __m256i*)(s)));
+            v1 = _mm256_xor_si256(v1, _mm256_loadu_si256((const __m256i*)(s+32)));
+            v2 = _mm256_xor_si256(v2, _mm256_loadu_si256((const __m256i*)(s+64)));
+            v3 = _mm256_xor_si256(v3, _mm256_loadu_si256((const __m256i*)(s+96)));
+        }
+        _mm256_storeu_si256((__m256i*)(p+pos), v0);
+        _mm256_storeu_si256((__m256i*)(p+pos+32), v1);
+        _mm256_storeu_si256((__m256i*)(p+pos+64), v2);
+        _mm256_storeu_si256((__m256i*)(p+pos+96), v3);
+    }
+    for (pos; pos+32<=len; pos+=32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)((const uint8_t*)in[0] + pos));
+        for (int i=1; i<n; i++)
+        {
+            v = _mm256_xor_si256(v, _mm256_loadu_si256((const __m256i*)((const uint8_t*)in[i] + pos)));
+        }
+        _mm256_storeu_si256((__m256i*)(p+pos), v);
+    }
+    _mm256_zeroupper();
+    xor_tail(in, n, out, pos, len);
+}
+
+__attribute__((target("avx512f")))
+static void xor_avx512(void **in, int n, void *out, size_t len)
+{
+    uint8_t *p = (uint8_t *) out;
+    size_t pos = 0;
+    for (pos; pos+256<=len; pos+=256)
+    {
+        const uint8_t *s = (const uint8_t*)in[0] + pos;
+        __m512i v0 = _mm512_loadu_si512((const void*)(s));
+        __m512i v1 = _mm512_loadu_si512((const void*)(s+64));
+        __m512i v2 = _mm512_loadu_si512((const void*)(s+128));
+        __m512i v3 = _mm512_loadu_si512((const void*)(s+192));
+        for (int i=1; i<n; i++)
+        {
+            s = (const uint8_t*)in[i] + pos;
+            v0 = _mm512_xor_si512(v0, _mm512_loadu_si512((const void*)(s)));
+            v1 = _mm512_xor_si512(v1, _mm512_loadu_si512((const void*)(s+64)));
+            v2 = _mm512_xor_si512(v2, _mm512_loadu_si512((const void*)(s+128)));
+            v3 = _mm512_xor_si512(v3, _mm512_loadu_si512((const void*)(s+192)));
+        }
+        _mm512_storeu_si512((void*)(p+pos), v0);
+        _mm512_storeu_si512((void*)(p+pos+64), v1);
+        _mm512_storeu_si512((void*)(p+pos+128), v2);
+        _mm512_storeu_si512((void*)(p+pos+192), v3);
+    }
+    for (pos; pos+64<=len; pos+=64)
+    {
+        __m512i v = _mm512_loadu_si512((const void*)((const uint8_t*)in[0] + pos));
+        for (int i=1; i<n; i++)
+        {
+            v = _mm512_xor_si512(v, _mm512_loadu_si512((const void*)((const uint8_t*)in[i] + pos)));
+        }
+        _mm512_storeu_si512((void*)(p+pos), v);
+    }
+    _mm256_zeroupper();
+    xor_tail(in, n, out, pos, len);
+}
+#endif
+
+static parity_xor_fn get_kernel_fn(enum parity_kernel kernel)
+{
+    switch (kernel)
+    {
+        case parity_kernel_scalar: return &xor_scalar;
+#ifdef PARITY_SIMD_X86
+        case parity_kernel_sse2:   return &xor_sse2;
+        case parity_kernel_avx2:   return &xor_avx2;
+        case parity_kernel_avx512: return &xor_avx512;
+#endif
+        default: return NULL;
+    }
+}
+
+bool parity_kernel_supported(enum parity_kernel kernel)
+{
+    bool rc = false;
+    if (get_kernel_fn(kernel)==NULL)
+    {
+        return rc;
+    }
+#ifdef PARITY_SIMD_X86
+    __builtin_cpu_init();
+    switch (kernel)
+    {
+        case parity_kernel_scalar: rc = true; break;
+        case parity_kernel_sse2:   rc = __builtin_cpu_supports("sse2"); break;
+        case parity_kernel_avx2:   rc = __builtin_cpu_supports("avx2"); break;
+        case parity_kernel_avx512: rc = __builtin_cpu_supports("avx512f"); break;
+        default: break;
+    }
+#else
+    rc = (kernel==parity_kernel_scalar);
+#endif
+    return rc;
+}
+
+const char* parity_kernel_name(enum parity_kernel kernel)
+{
+    switch (kernel)
+    {
+        case parity_kernel_scalar: return "scalar";
+        case parity_kernel_sse2:   return "sse2";
+        case parity_kernel_avx2:   return "avx2";
+        case parity_kernel_avx512: return "avx512";
+        default: return "unknown";
+    }
+}
+
+static enum parity_kernel detect_kernel()
+{
+    int k = parity_kernel_count-1;
+    for (k; k>parity_kernel_scalar; k--)
+    {
+        if (parity_kernel_supported((enum parity_kernel)k))
+        {
+            break;
+        }
+    }
+    return (enum parity_kernel) k;
+}
+
+static enum parity_kernel selected_kernel = detect_kernel();
+static parity_xor_fn selected_fn = get_kernel_fn(selected_kernel);
+
+enum parity_kernel parity_get_kernel()
+{
+    return selected_kernel;
+}
+
+/**
+ * @brief xors n equally sized buffers into out in a single pass.
+ * @param[in] in input buffers
+ * @param[in] n number of input buffers
+ * @param[out] out result buffer, may be one of the inputs
+ * @param[in] len length of every buffer in bytes
+ */
+void calc_parity_n(void **in, int n, void *out, size_t len)
+{
+    if (n<=0) return;
+    if (selected_fn==NULL)
+    {
+        // called during static initialisation of another translation unit
+        selected_kernel = detect_kernel();
+        selected_fn = get_kernel_fn(selected_kernel);
+    }
+    selected_fn(in, n, out, len);
+}
+
+/**
+ * @brief same as calc_parity_n but with an explicitly chosen kernel
+ * @return 0 on success, -1 if the kernel is not supported on this cpu
+ */
+int calc_parity_n_kernel(enum parity_kernel kernel, void **in, int n, void *out, size_t len)
+{
+    if (n<=0 || !parity_kernel_supported(kernel))
+    {
+        return -1;
+    }
+    get_kernel_fn(kernel)(in, n, out, len);
+    return 0;
+}
+
+void calc_parity(void *ina, void *inb, void *out, size_t  len_x)
+{
+    void *in[2] = {ina, inb};
+    calc_parity_n(&in[0], 2, out, len_x);
 }
 
 void calc_parity (void *in, size_t length, void *out)
 {
     int i = length/sizeof(uint32_t);
-    
+
     uint32_t *tmp_in = (uint32_t*)in;
     uint32_t *tmp_out = (uint32_t*)out;
     *tmp_out=0;
@@ -28,4 +283,4 @@ void calc_parity (void *in, size_t length, void *out)
         *tmp_out = *tmp_in^*tmp_out;
         tmp_in++;
     }
-}
\ No newline at end of file
+}
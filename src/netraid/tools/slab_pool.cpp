@@ -0,0 +1,415 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "tools/slab_pool.h"
+
+#define SLAB_MAGIC      0x51ab51abU
+#define SLAB_LARGE      SLAB_CLASSES
+#define SLAB_STATE_LIVE 1
+#define SLAB_STATE_FREE 2
+#define SLAB_POISON     0xdb
+
+/* 16 bytes, keeps the user memory 16 byte aligned */
+struct slab_header
+{
+    uint32_t            magic;
+    uint16_t            sizeclass;
+    uint16_t            state;
+    struct slab_header  *next;
+};
+
+struct slab_depot
+{
+    pthread_mutex_t     mutex;
+    struct slab_header  *head;
+    uint32_t            count;
+    uint64_t            chunks;
+};
+
+struct slab_cache
+{
+    struct slab_header  *head[SLAB_CLASSES];
+    uint32_t            count[SLAB_CLASSES];
+    uint64_t            allocs[SLAB_CLASSES+1];
+    uint64_t            hits[SLAB_CLASSES+1];
+    uint64_t            frees[SLAB_CLASSES+1];
+    struct slab_cache   *next;
+};
+
+struct payload_depot
+{
+    pthread_mutex_t     mutex;
+    void                *bufs[SLAB_PAYLOAD_KEEP];
+    int                 count;
+    uint64_t            allocs;
+    uint64_t            hits;
+    uint64_t            frees;
+};
+
+static struct slab_depot depots[SLAB_CLASSES];
+static struct payload_depot payloads[SLAB_PAYLOAD_CLASSES];
+static pthread_mutex_t cachesmutex = PTHREAD_MUTEX_INITIALIZER;
+static struct slab_cache *caches = NULL;
+static __thread struct slab_cache *tl_cache = NULL;
+static pthread_key_t cachekey;
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static bool debugmode = false;
+static uint64_t doublefrees = 0;
+static uint64_t lastlive[SLAB_CLASSES+1];
+
+static void flush_cache(void *obj);
+
+static void slab_init()
+{
+    for (int i=0; i<SLAB_CLASSES; i++)
+    {
+        pthread_mutex_init(&depots[i].mutex, NULL);
+        depots[i].head = NULL;
+        depots[i].count = 0;
+        depots[i].chunks = 0;
+    }
+    for (int i=0; i<SLAB_PAYLOAD_CLASSES; i++)
+    {
+        pthread_mutex_init(&payloads[i].mutex, NULL);
+        payloads[i].count = 0;
+        payloads[i].allocs = 0;
+        payloads[i].hits = 0;
+        payloads[i].frees = 0;
+    }
+    pthread_key_create(&cachekey, &flush_cache);
+}
+
+static inline int size_class(size_t size)
+{
+    size_t s = SLAB_MIN_SIZE;
+    for (int i=0; i<SLAB_CLASSES; i++)
+    {
+        if (size<=s) return i;
+        s <<= 1;
+    }
+    return SLAB_LARGE;
+}
+
+static inline size_t class_size(int sizeclass)
+{
+    return (size_t)SLAB_MIN_SIZE << sizeclass;
+}
+
+/**
+ * @brief the calling threads cache, created on first use. Caches stay
+ * registered for the statistics after their thread exited.
+ */
+static struct slab_cache* get_cache()
+{
+    if (tl_cache==NULL)
+    {
+        pthread_once(&slab_once, &slab_init);
+        tl_cache = (struct slab_cache *) calloc(1, sizeof(struct slab_cache));
+        pthread_setspecific(cachekey, tl_cache);
+        pthread_mutex_lock(&cachesmutex);
+        tl_cache->next = caches;
+        caches = tl_cache;
+        pthread_mutex_unlock(&cachesmutex);
+    }
+    return tl_cache;
+}
+
+/**
+ * @brief moves up to n blocks of the cache into the depot.
+ */
+static void drain(struct slab_cache *p_cache, int sizeclass, uint32_t n)
+{
+    if (p_cache->head[sizeclass]==NULL) return;
+    struct slab_header *first = p_cache->head[sizeclass];
+    struct slab_header *last = first;
+    uint32_t cnt = 1;
+    while (cnt<n && last->next!=NULL)
+    {
+        last = last->next;
+        cnt++;
+    }
+    p_cache->head[sizeclass] = last->next;
+    p_cache->count[sizeclass] -= cnt;
+    struct slab_depot *p_depot = &depots[sizeclass];
+    pthread_mutex_lock(&p_depot->mutex);
+    last->next = p_depot->head;
+    p_depot->head = first;
+    p_depot->count += cnt;
+    pthread_mutex_unlock(&p_depot->mutex);
+}
+
+static void flush_cache(void *obj)
+{
+    struct slab_cache *p_cache = (struct slab_cache *) obj;
+    for (int i=0; i<SLAB_CLASSES; i++)
+    {
+        drain(p_cache, i, p_cache->count[i]);
+    }
+}
+
+/**
+ * @brief takes a batch from the depot, carves a new chunk if it is empty.
+ */
+static int refill(struct slab_cache *p_cache, int sizeclass)
+{
+    struct slab_depot *p_depot = &depots[sizeclass];
+    pthread_mutex_lock(&p_depot->mutex);
+    if (p_depot->head!=NULL)
+    {
+        struct slab_header *first = p_depot->head;
+        struct slab_header *last = first;
+        uint32_t cnt = 1;
+        while (cnt<SLAB_BATCH && last->next!=NULL)
+        {
+            last = last->next;
+            cnt++;
+        }
+        p_depot->head = last->next;
+        p_depot->count -= cnt;
+        pthread_mutex_unlock(&p_depot->mutex);
+        last->next = NULL;
+        p_cache->head[sizeclass] = first;
+        p_cache->count[sizeclass] = cnt;
+        return 0;
+    }
+    p_depot->chunks++;
+    pthread_mutex_unlock(&p_depot->mutex);
+
+    size_t blocksize = sizeof(struct slab_header)+class_size(sizeclass);
+    size_t n = SLAB_CHUNK_SIZE/blocksize;
+    char *chunk = (char *) malloc(n*blocksize);
+    if (chunk==NULL)
+    {
+        return -1;
+    }
+    for (size_t i=0; i<n; i++)
+    {
+        struct slab_header *p_hdr = (struct slab_header *) (chunk+i*blocksize);
+        p_hdr->magic = SLAB_MAGIC;
+        p_hdr->sizeclass = sizeclass;
+        p_hdr->state = SLAB_STATE_FREE;
+        p_hdr->next = (i+1<n) ? (struct slab_header *) (chunk+(i+1)*blocksize) : NULL;
+    }
+    p_cache->head[sizeclass] = (struct slab_header *) chunk;
+    if (n>SLAB_BATCH)
+    {
+        // keep a batch, the remainder goes to the depot
+        struct slab_header *last = (struct slab_header *) (chunk+(SLAB_BATCH-1)*blocksize);
+        struct slab_header *rest = last->next;
+        struct slab_header *tail = (struct slab_header *) (chunk+(n-1)*blocksize);
+        last->next = NULL;
+        pthread_mutex_lock(&p_depot->mutex);
+        tail->next = p_depot->head;
+        p_depot->head = rest;
+        p_depot->count += n-SLAB_BATCH;
+        pthread_mutex_unlock(&p_depot->mutex);
+        n = SLAB_BATCH;
+    }
+    p_cache->count[sizeclass] = n;
+    return 0;
+}
+
+void* slab_alloc(size_t size)
+{
+    struct slab_cache *p_cache = get_cache();
+    int sizeclass = size_class(size);
+    struct slab_header *p_hdr;
+    p_cache->allocs[sizeclass]++;
+    if (sizeclass==SLAB_LARGE)
+    {
+        p_hdr = (struct slab_header *) malloc(sizeof(struct slab_header)+size);
+        if (p_hdr==NULL) return NULL;
+        p_hdr->magic = SLAB_MAGIC;
+        p_hdr->sizeclass = SLAB_LARGE;
+    }
+    else
+    {
+        if (p_cache->head[sizeclass]!=NULL)
+        {
+            p_cache->hits[sizeclass]++;
+        }
+        else if (refill(p_cache, sizeclass))
+        {
+            return NULL;
+        }
+        p_hdr = p_cache->head[sizeclass];
+        p_cache->head[sizeclass] = p_hdr->next;
+        p_cache->count[sizeclass]--;
+    }
+    p_hdr->state = SLAB_STATE_LIVE;
+    p_hdr->next = NULL;
+    return p_hdr+1;
+}
+
+void slab_free(void *p)
+{
+    if (p==NULL) return;
+    struct slab_header *p_hdr = ((struct slab_header *) p)-1;
+    if (debugmode)
+    {
+        if (p_hdr->magic!=SLAB_MAGIC || p_hdr->state!=SLAB_STATE_LIVE)
+        {
+            // the block is kept out of the free lists
+            __sync_fetch_and_add(&doublefrees, 1);
+            return;
+        }
+        if (p_hdr->sizeclass!=SLAB_LARGE)
+        {
+            memset(p, SLAB_POISON, class_size(p_hdr->sizeclass));
+        }
+    }
+    struct slab_cache *p_cache = get_cache();
+    int sizeclass = p_hdr->sizeclass;
+    p_cache->frees[sizeclass]++;
+    p_hdr->state = SLAB_STATE_FREE;
+    if (sizeclass==SLAB_LARGE)
+    {
+        free(p_hdr);
+        return;
+    }
+    p_hdr->next = p_cache->head[sizeclass];
+    p_cache->head[sizeclass] = p_hdr;
+    p_cache->count[sizeclass]++;
+    if (p_cache->count[sizeclass]>2*SLAB_BATCH)
+    {
+        // blocks freed by a consumer thread flow back to the producers
+        drain(p_cache, sizeclass, SLAB_BATCH);
+    }
+}
+
+static inline int payload_class(size_t size)
+{
+    size_t s = SLAB_PAYLOAD_MIN;
+    for (int i=0; i<SLAB_PAYLOAD_CLASSES; i++)
+    {
+        if (size<=s) return i;
+        s <<= 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief aligned buffer of at least size bytes, rounded up to its class.
+ * Must be returned with slab_payload_free and the same size.
+ */
+void* slab_payload_alloc(size_t size)
+{
+    pthread_once(&slab_once, &slab_init);
+    int sizeclass = payload_class(size);
+    void *p = NULL;
+    if (sizeclass>=0)
+    {
+        struct payload_depot *p_depot = &payloads[sizeclass];
+        pthread_mutex_lock(&p_depot->mutex);
+        p_depot->allocs++;
+        if (p_depot->count>0)
+        {
+            p = p_depot->bufs[--p_depot->count];
+            p_depot->hits++;
+        }
+        pthread_mutex_unlock(&p_depot->mutex);
+        size = (size_t)SLAB_PAYLOAD_MIN << sizeclass;
+    }
+    if (p==NULL && posix_memalign(&p, SLAB_PAYLOAD_ALIGN, size))
+    {
+        return NULL;
+    }
+    return p;
+}
+
+void slab_payload_free(void *p, size_t size)
+{
+    if (p==NULL) return;
+    int sizeclass = payload_class(size);
+    if (sizeclass>=0)
+    {
+        struct payload_depot *p_depot = &payloads[sizeclass];
+        pthread_mutex_lock(&p_depot->mutex);
+        p_depot->frees++;
+        if (p_depot->count<SLAB_PAYLOAD_KEEP)
+        {
+            p_depot->bufs[p_depot->count++] = p;
+            p = NULL;
+        }
+        pthread_mutex_unlock(&p_depot->mutex);
+    }
+    free(p);
+}
+
+/**
+ * @brief enables the double free checks and poisons freed blocks.
+ */
+void slab_set_debug(bool enable)
+{
+    debugmode = enable;
+}
+
+/**
+ * @brief sums the thread caches, sizeclass SLAB_CLASSES are the large
+ * allocations passed to malloc.
+ */
+void slab_get_stats(int sizeclass, struct slab_stats *p_stats)
+{
+    memset(p_stats, 0, sizeof(struct slab_stats));
+    if (sizeclass<0 || sizeclass>SLAB_CLASSES) return;
+    pthread_mutex_lock(&cachesmutex);
+    struct slab_cache *p_cache = caches;
+    for (p_cache; p_cache!=NULL; p_cache=p_cache->next)
+    {
+        p_stats->allocs += p_cache->allocs[sizeclass];
+        p_stats->hits += p_cache->hits[sizeclass];
+        p_stats->frees += p_cache->frees[sizeclass];
+    }
+    pthread_mutex_unlock(&cachesmutex);
+    if (sizeclass<SLAB_CLASSES)
+    {
+        p_stats->chunks = depots[sizeclass].chunks;
+    }
+    p_stats->doublefrees = doublefrees;
+}
+
+void slab_get_payload_stats(int sizeclass, struct slab_stats *p_stats)
+{
+    memset(p_stats, 0, sizeof(struct slab_stats));
+    if (sizeclass<0 || sizeclass>=SLAB_PAYLOAD_CLASSES) return;
+    pthread_once(&slab_once, &slab_init);
+    pthread_mutex_lock(&payloads[sizeclass].mutex);
+    p_stats->allocs = payloads[sizeclass].allocs;
+    p_stats->hits = payloads[sizeclass].hits;
+    p_stats->frees = payloads[sizeclass].frees;
+    pthread_mutex_unlock(&payloads[sizeclass].mutex);
+}
+
+/**
+ * @brief logs the hit rates. In debug mode live blocks growing by more
+ * than a batch between two reports are reported as possible leaks.
+ */
+void slab_report(Logger *log)
+{
+    struct slab_stats stats;
+    for (int i=0; i<=SLAB_CLASSES; i++)
+    {
+        slab_get_stats(i, &stats);
+        if (stats.allocs==0) continue;
+        uint64_t live = stats.allocs-stats.frees;
+        log->debug_log("slab %u: allocs:%llu, hit rate:%.1f%%, live:%llu, chunks:%llu",
+                (uint32_t) ((i<SLAB_CLASSES) ? class_size(i) : 0), stats.allocs, 100.0*stats.hits/stats.allocs, live, stats.chunks);
+        if (debugmode && live>lastlive[i]+SLAB_BATCH)
+        {
+            log->warning_log("slab %u: live blocks grew from %llu to %llu, possible leak",
+                    (uint32_t) ((i<SLAB_CLASSES) ? class_size(i) : 0), lastlive[i], live);
+        }
+        lastlive[i] = live;
+    }
+    for (int i=0; i<SLAB_PAYLOAD_CLASSES; i++)
+    {
+        slab_get_payload_stats(i, &stats);
+        if (stats.allocs==0) continue;
+        log->debug_log("payload %u: allocs:%llu, hit rate:%.1f%%",
+                SLAB_PAYLOAD_MIN << i, stats.allocs, 100.0*stats.hits/stats.allocs);
+    }
+    if (doublefrees>0)
+    {
+        log->error_log("slab: %llu double or invalid frees detected",doublefrees);
+    }
+}
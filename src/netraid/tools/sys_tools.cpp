@@ -10,9 +10,8 @@ bool xsystools_fs_mkdir(std::string file)
     }
     else
     {
-        std::string cmd_mktmp = std::string("mkdir ");
-        cmd_mktmp += file;
-        system(cmd_mktmp.c_str());
+        // no shell, this is on the data server write path
+        mkdir(file.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
         ret = true;
     }
     return ret;
@@ -0,0 +1,56 @@
+#include "gtest/gtest.h"
+
+#include "tools/latency_histogram.h"
+
+
+namespace
+{
+
+TEST(LatencyHistogramTest, exact_small_values)
+{
+    LatencyHistogram h;
+    for (uint64_t v=1; v<=100; v++)
+    {
+        h.record(v);
+    }
+    ASSERT_EQ(h.get_count(), 100);
+    ASSERT_EQ(h.get_min(), 1);
+    ASSERT_EQ(h.get_max(), 100);
+    ASSERT_EQ(h.percentile(50), 50);
+    ASSERT_EQ(h.percentile(99), 99);
+    ASSERT_EQ(h.percentile(100), 100);
+    ASSERT_DOUBLE_EQ(h.get_mean(), 50.5);
+}
+
+TEST(LatencyHistogramTest, relative_precision)
+{
+    LatencyHistogram h;
+    for (uint64_t v=1000; v<=1000000; v+=1000)
+    {
+        h.record(v);
+    }
+    uint64_t p50 = h.percentile(50);
+    uint64_t p999 = h.percentile(99.9);
+    ASSERT_GE(p50, 500000);
+    ASSERT_LE(p50, 500000+500000/64);
+    ASSERT_GE(p999, 999000);
+    ASSERT_LE(p999, 1000000);
+}
+
+TEST(LatencyHistogramTest, merge_and_tail)
+{
+    LatencyHistogram a, b;
+    for (int i=0; i<990; i++) a.record(100);
+    for (int i=0; i<10; i++) b.record(50000);
+    a.merge(b);
+    ASSERT_EQ(a.get_count(), 1000);
+    ASSERT_EQ(a.percentile(50), 100);
+    ASSERT_EQ(a.percentile(99), 100);
+    ASSERT_GE(a.percentile(99.9), 50000-50000/64);
+    ASSERT_EQ(a.get_max(), 50000);
+    a.reset();
+    ASSERT_EQ(a.get_count(), 0);
+    ASSERT_EQ(a.percentile(99), 0);
+}
+
+}
@@ -0,0 +1,145 @@
+#include "gtest/gtest.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <vector>
+
+#include "tools/slab_pool.h"
+
+
+namespace
+{
+
+struct small_obj
+{
+    uint32_t    a;
+    uint64_t    b;
+    SLAB_ALLOCATED
+};
+
+struct mid_obj
+{
+    struct small_obj    head;
+    char                payload[700];
+    SLAB_ALLOCATED
+};
+
+static void* alloc_free_loop(void *arg)
+{
+    std::vector<struct mid_obj*> *p_vec = (std::vector<struct mid_obj*>*) arg;
+    for (int i=0; i<1000; i++)
+    {
+        struct mid_obj *p = new struct mid_obj;
+        p->head.a = i;
+        p_vec->push_back(p);
+    }
+    return NULL;
+}
+
+TEST(SlabPoolTest, reuse)
+{
+    struct slab_stats before, after;
+    slab_get_stats(0, &before);
+    struct small_obj *p = new struct small_obj;
+    p->a = 1;
+    delete p;
+    struct small_obj *p2 = new struct small_obj;
+    // LIFO thread cache hands the same block out again
+    ASSERT_EQ(p, p2);
+    delete p2;
+    slab_get_stats(0, &after);
+    ASSERT_EQ(after.allocs-before.allocs, 2);
+    ASSERT_EQ(after.frees-before.frees, 2);
+    ASSERT_GE(after.hits-before.hits, 1);
+}
+
+TEST(SlabPoolTest, delete_through_head)
+{
+    struct mid_obj *p = new struct mid_obj;
+    memset(p->payload, 1, sizeof(p->payload));
+    struct slab_stats before, after;
+    slab_get_stats(4, &before);
+    // the size class is taken from the block, not from the static type
+    delete &p->head;
+    slab_get_stats(4, &after);
+    ASSERT_EQ(after.frees-before.frees, 1);
+}
+
+TEST(SlabPoolTest, large_and_alignment)
+{
+    void *p = slab_alloc(100000);
+    ASSERT_TRUE(p!=NULL);
+    ASSERT_EQ(((uintptr_t)p)%16, 0);
+    memset(p, 0, 100000);
+    slab_free(p);
+    void *q = slab_alloc(33);
+    ASSERT_EQ(((uintptr_t)q)%16, 0);
+    slab_free(q);
+}
+
+TEST(SlabPoolTest, cross_thread_free)
+{
+    std::vector<struct mid_obj*> vec;
+    pthread_t thread;
+    pthread_create(&thread, NULL, &alloc_free_loop, &vec);
+    pthread_join(thread, NULL);
+    ASSERT_EQ(vec.size(), 1000);
+    std::vector<struct mid_obj*>::iterator it = vec.begin();
+    for (it; it!=vec.end(); it++)
+    {
+        delete *it;
+    }
+    // the freed blocks were drained to the depot and are reused
+    struct slab_stats before, after;
+    slab_get_stats(4, &before);
+    vec.clear();
+    alloc_free_loop(&vec);
+    slab_get_stats(4, &after);
+    ASSERT_EQ(after.chunks, before.chunks);
+    for (it=vec.begin(); it!=vec.end(); it++)
+    {
+        delete *it;
+    }
+}
+
+TEST(SlabPoolTest, double_free_detected)
+{
+    slab_set_debug(true);
+    struct slab_stats before, after;
+    slab_get_stats(0, &before);
+    struct small_obj *p = new struct small_obj;
+    delete p;
+    delete p;
+    slab_get_stats(0, &after);
+    ASSERT_EQ(after.doublefrees-before.doublefrees, 1);
+    // the block was not put on the free list twice
+    struct small_obj *p1 = new struct small_obj;
+    struct small_obj *p2 = new struct small_obj;
+    ASSERT_NE(p1, p2);
+    delete p1;
+    delete p2;
+    slab_set_debug(false);
+}
+
+TEST(SlabPoolTest, payload)
+{
+    struct slab_stats before, after;
+    slab_get_payload_stats(4, &before);
+    void *p = slab_payload_alloc(65536);
+    ASSERT_EQ(((uintptr_t)p)%SLAB_PAYLOAD_ALIGN, 0);
+    memset(p, 0, 65536);
+    slab_payload_free(p, 65536);
+    void *p2 = slab_payload_alloc(40000);
+    ASSERT_EQ(p, p2);
+    slab_payload_free(p2, 40000);
+    slab_get_payload_stats(4, &after);
+    ASSERT_EQ(after.allocs-before.allocs, 2);
+    ASSERT_EQ(after.hits-before.hits, 1);
+
+    // beyond the largest class
+    void *big = slab_payload_alloc(4*1024*1024);
+    ASSERT_TRUE(big!=NULL);
+    slab_payload_free(big, 4*1024*1024);
+}
+
+}//namespace